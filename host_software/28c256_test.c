@@ -12,21 +12,24 @@
 #include <stdlib.h>
 
 #include "busyboard.h"
-
-#define DELAY 100000
-
-void do_delay(void) {
-  #ifdef DELAY
-  usleep(DELAY);
-  #endif
-}
+#include "timing.h"
+
+/* Used to be a flat 100 ms after every step. The maxima are well over the
+   datasheet figures (tWC is 10 ms max); calibration finds what the chip
+   and board actually need. */
+enum { T_SETUP, T_WR_PULSE, T_WRITE_CYCLE, T_READ_ACCESS };
+struct timing_param params[] = {
+  { "setup", 0, 1000 },
+  { "wr_pulse", 0, 1000 },
+  { "write_cycle", 0, 20000 },
+  { "read_access", 0, 1000 }
+};
+struct timing timing = { "28c256", params, 4 };
 
 void eeprom_init(busyboard_t *bb) {
   bb->out_state[0] = 7; // CE, OE, and WR de-asserted
   bb->trimask = 0x3d;
   busyboard_out(bb);
-
-  do_delay();
 }
 
 void eeprom_write(busyboard_t *bb, unsigned addr, unsigned char data) {
@@ -37,17 +40,17 @@ void eeprom_write(busyboard_t *bb, unsigned addr, unsigned char data) {
   bb->out_state[4] = (addr >> 16) & 0xff;
   bb->trimask = 0x3f;
   busyboard_out(bb);
-  do_delay();
+  timing_wait(params[T_SETUP].us);
   
   bb->out_state[0] = 2; // CE and WR asserted, OE de-asserted
   busyboard_out(bb);
-  do_delay();
+  timing_wait(params[T_WR_PULSE].us);
 
   bb->out_state[0] = 6; // de-assert WR
   busyboard_out(bb);
-  do_delay();
   
   eeprom_init(bb);
+  timing_wait(params[T_WRITE_CYCLE].us);
 }
 
 unsigned char eeprom_read(busyboard_t *bb, unsigned addr)
@@ -58,18 +61,36 @@ unsigned char eeprom_read(busyboard_t *bb, unsigned addr)
   bb->out_state[3] = (addr >> 8) & 0xff;
   bb->out_state[4] = (addr >> 16) & 0xff;
   busyboard_out(bb);
-  do_delay();
+  timing_wait(params[T_READ_ACCESS].us);
   busyboard_in(bb);
-  do_delay();
 
   eeprom_init(bb);
   
   return bb->in_state[1];
 }
 
+/* Write a few fresh values back to back, each write starting as soon as
+   the last one's cycle should have finished, then read them back. */
+int verify(void *ctx) {
+  static unsigned seq;
+  busyboard_t *bb = ctx;
+  unsigned i, ok = 1;
+
+  seq++;
+  for (i = 0; i < 4; ++i)
+    eeprom_write(bb, 0x7ffc + i, (seq * 37 + i * 101) & 0xff);
+  for (i = 0; i < 4; ++i)
+    if (eeprom_read(bb, 0x7ffc + i) != ((seq * 37 + i * 101) & 0xff)) ok = 0;
+
+  return ok;
+}
+
 int main(int argc, char **argv) {
+  const char *parport = (argc >= 2) ? argv[1] : "/dev/parport0";
   busyboard_t bb;
-  init_busyboard(&bb, (argc >= 2) ? argv[1] : "/dev/parport0");
+  init_busyboard(&bb, parport);
+  eeprom_init(&bb);
+  timing_setup(&timing, parport, verify, &bb);
 
   unsigned int i, count;
   srand(0x1234);
@@ -0,0 +1,402 @@
+/* Bus cycle engine for the Z80 and 65C02 harnesses. */
+
+#include "buscyc.h"
+#include "timing.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Z80 status port, after inversion. */
+#define Z80_MREQ 0x01
+#define Z80_IORQ 0x02
+#define Z80_HALT 0x04
+#define Z80_RFSH 0x08
+#define Z80_RD   0x20
+#define Z80_WR   0x40
+#define Z80_M1   0x80
+
+static unsigned short z80_flags(unsigned char st) {
+  unsigned short f = 0;
+
+  if (st & Z80_MREQ) f |= BUS_MEM;
+  if (st & Z80_IORQ) f |= BUS_IO;
+  if ((st & Z80_RD) && (st & (Z80_MREQ | Z80_IORQ))) f |= BUS_RD;
+  if ((st & Z80_WR) && (st & (Z80_MREQ | Z80_IORQ))) f |= BUS_WR;
+  if ((st & Z80_M1) && (st & Z80_MREQ)) f |= BUS_FETCH;
+  /* Interrupt acknowledge: M1 with IORQ reads the vector. */
+  if ((st & Z80_M1) && (st & Z80_IORQ)) f |= BUS_RD | BUS_FETCH;
+  if (st & Z80_HALT) f |= BUS_HALT;
+  if (st & Z80_RFSH) f |= BUS_RFSH;
+
+  return f;
+}
+
+/* 65C02 status port, after the active-low bits are flipped. */
+#define M65_SYNC 0x02
+#define M65_WR   0x04
+#define M65_STP  0xdb
+
+static unsigned short m65_flags(unsigned char st) {
+  return BUS_MEM | ((st & M65_WR) ? BUS_WR : BUS_RD) |
+         ((st & M65_SYNC) ? BUS_FETCH : 0);
+}
+
+static inline void sample(struct buscyc *bc) {
+  busyboard_t *bb = bc->bb;
+  unsigned char st = bb->in_state[4] ^ bc->cpu->status_xor;
+
+  bc->cur.addr = bb->in_state[3] << 8 | bb->in_state[2];
+  bc->cur.status = st;
+  bc->cur.flags = bc->flag_tab[st];
+  bc->cur.data = bb->in_state[1];
+}
+
+/* Z80 signals move on both clock edges and a read or write is held for
+   several samples, so the handlers are only called when an access starts or
+   its address changes. The response goes out with the next edge. */
+static inline void z80_act(struct buscyc *bc) {
+  busyboard_t *bb = bc->bb;
+  struct bus_rec *r = &bc->cur;
+  int fresh = r->addr != bc->prev_addr;
+
+  if (r->flags & BUS_RD) {
+    if (fresh || !(bc->prev_flags & BUS_RD))
+      bc->resp = bc->read(bc, r->addr, r->flags);
+    r->data = bc->resp;
+    bb->out_state[1] = bc->resp;
+    bb->trimask |= 2;
+  } else {
+    bb->trimask &= ~2;
+    if ((r->flags & BUS_WR) && (fresh || !(bc->prev_flags & BUS_WR)))
+      bc->write(bc, r->addr, r->data, r->flags);
+  }
+
+  bc->prev_flags = r->flags;
+  bc->prev_addr = r->addr;
+}
+
+/* Rising edge, then falling edge. The record for the cycle is the sample
+   taken with the rising edge, i.e. the state the last falling edge left. */
+static void z80_cycle(struct buscyc *bc) {
+  busyboard_t *bb = bc->bb;
+
+  bb->out_state[0] |= bc->cpu->clk;
+  busyboard_xfer(bb);
+  timing_wait(bc->edge_us);
+  sample(bc);
+  z80_act(bc);
+  if (bc->check) bc->check(bc, &bc->cur);
+  if (bc->trace) bc->trace(bc, &bc->cur);
+  if (bc->cur.flags & BUS_HALT) bc->halted = 1;
+
+  bb->out_state[0] &= ~bc->cpu->clk;
+  busyboard_xfer(bb);
+  timing_wait(bc->edge_us);
+  sample(bc);
+  z80_act(bc);
+}
+
+/* Sequenced Z80. Every T-state still takes a frame per edge, but a sample
+   of the first T-state of an access says what the next ones hold: an M1
+   fetch stays up for another T-state and is followed by two of refresh
+   (MREQ, then just RFSH, at I:R counting up); a memory read, or I/O once
+   IORQ is down, stays up for one more and then lets go; a memory write
+   lets go on the T-state after WR. Those are made up, without a sample or
+   a handler call, and go through z80_act() like sampled ones, so the data
+   bus is let go on the same frame. Samples with nothing to go on (MREQ
+   waiting for WR, an idle or I/O T1, interrupt acknowledge) predict
+   nothing. A CPU held by WAIT or BUSREQ would be traced wrong. */
+static void z80_seq_next(struct buscyc *bc) {
+  struct bus_rec *r = &bc->cur;
+  unsigned char st = r->status & Z80_HALT;
+
+  if (r->flags & BUS_FETCH) {
+    if (++bc->seq_step == 1) return;
+    r->addr = bc->rfsh_ok ? bc->rfsh : 0;
+    bc->rfsh = (bc->rfsh & 0xff80) | ((bc->rfsh + 1) & 0x7f);
+    st |= Z80_MREQ | Z80_RFSH;
+  } else if (r->flags & BUS_RFSH) {
+    st |= Z80_RFSH;
+  } else if (++bc->seq_step < bc->seq_len) {
+    return;
+  }
+  r->status = st;
+  r->flags = bc->flag_tab[st];
+}
+
+/* Reset clears I and R, so the made-up refresh addresses start out right
+   and count up with each M1. LD I,A and LD R,A (ED 47, ED 4F) throw the
+   count off, and the addresses go out as zero from then until a refresh
+   T-state is sampled (after an interrupt acknowledge, say) and the count
+   is taken up from there. */
+static void z80_seq_sync(struct buscyc *bc) {
+  struct bus_rec *r = &bc->cur;
+
+  if (r->flags & BUS_RFSH) {
+    bc->rfsh = (r->addr & 0xff80) | ((r->addr + 1) & 0x7f);
+    bc->rfsh_ok = 1;
+  } else if ((r->flags & (BUS_FETCH | BUS_IO)) == BUS_FETCH) {
+    if (bc->last_op == 0xed && (r->data & 0xf7) == 0x47) bc->rfsh_ok = 0;
+    bc->last_op = r->data;
+  }
+}
+
+static void z80_seq_start(struct buscyc *bc) {
+  unsigned f = bc->cur.flags;
+
+  if (f & BUS_FETCH) bc->seq_left = (f & BUS_IO) ? 0 : 3; /* IORQ: int ack */
+  else if (f & BUS_IO) bc->seq_left = (f & (BUS_RD | BUS_WR)) ? 2 : 0;
+  else if (f & BUS_RD) bc->seq_left = 2;
+  else if (f & BUS_WR) bc->seq_left = 1;
+  else bc->seq_left = 0;
+  bc->seq_len = bc->seq_left;
+  bc->seq_step = 0;
+}
+
+static void z80_seq_cycle(struct buscyc *bc) {
+  busyboard_t *bb = bc->bb;
+  int sampled = 0;
+
+  bb->out_state[0] |= bc->cpu->clk;
+  if (bc->seq_left) {
+    busyboard_out(bb);
+    timing_wait(bc->edge_us);
+    bc->seq_left--;
+    z80_seq_next(bc);
+  } else {
+    busyboard_xfer(bb);
+    timing_wait(bc->edge_us);
+    sample(bc);
+    z80_seq_start(bc);
+    bc->sampled++;
+    sampled = 1;
+  }
+  z80_act(bc);
+  if (sampled) z80_seq_sync(bc);
+  if (bc->trace) bc->trace(bc, &bc->cur);
+  if (bc->cur.flags & BUS_HALT) bc->halted = 1;
+
+  bb->out_state[0] &= ~bc->cpu->clk;
+  busyboard_out(bb);
+  timing_wait(bc->edge_us);
+}
+
+/* The 65C02 puts out address and R/W after phi2 falls and latches read data
+   as it falls again, so each cycle is: the data bus is released, sampling
+   the address; phi2 rises with the read data for it; phi2 falls, sampling
+   write data while it was high.
+
+   When a predictor expects a read, its data goes out as phi2 rises, in the
+   same frame that samples the address, saving the first frame. If the
+   prediction was wrong there is still time to put the right data up (or let
+   go of the bus) before phi2 falls, at the cost of a frame. Predictions are
+   only made for plain memory, since the predicted address was read too; and
+   a wrong one is a divergence, so when the CPU was writing instead, the bus
+   was fought over for one frame as the run stops. */
+static void m65_cycle(struct buscyc *bc) {
+  busyboard_t *bb = bc->bb;
+  struct bus_rec *r = &bc->cur, next;
+
+  if (bc->predict && bc->predict(bc, &next) && (next.flags & BUS_RD) &&
+      bc->plain(bc, next.addr, next.flags)) {
+    bc->predicted++;
+    bb->out_state[1] = bc->read(bc, next.addr, next.flags);
+    bb->trimask |= 2;
+    bb->out_state[0] |= bc->cpu->clk;
+    busyboard_xfer(bb);
+    timing_wait(bc->edge_us);
+    sample(bc);
+    if ((r->flags & BUS_RD) && r->addr == next.addr) {
+      r->data = bb->out_state[1];
+    } else {
+      bc->mispredicted++;
+      if (r->flags & BUS_RD) {
+        r->data = bc->read(bc, r->addr, r->flags);
+        bb->out_state[1] = r->data;
+      } else {
+        bb->trimask &= ~2;
+      }
+      busyboard_xfer(bb);
+      timing_wait(bc->edge_us);
+    }
+  } else {
+    bb->trimask &= ~2;
+    busyboard_xfer(bb);
+    sample(bc);
+    if (r->flags & BUS_RD) {
+      r->data = bc->read(bc, r->addr, r->flags);
+      bb->out_state[1] = r->data;
+      bb->trimask |= 2;
+    }
+    bb->out_state[0] |= bc->cpu->clk;
+    busyboard_xfer(bb);
+    timing_wait(bc->edge_us);
+  }
+
+  bb->out_state[0] &= ~bc->cpu->clk;
+  busyboard_xfer(bb);
+  timing_wait(bc->edge_us);
+  if (r->flags & BUS_WR) {
+    r->data = bb->in_state[1];
+    bc->write(bc, r->addr, r->data, r->flags);
+  }
+  if (bc->check) bc->check(bc, r);
+  if (bc->trace) bc->trace(bc, r);
+  if ((r->flags & BUS_FETCH) && r->data == M65_STP) bc->halted = 1;
+}
+
+const struct bus_cpu bus_z80 = {
+  "Z80", 0xfe, 0x01, 0x08, 0xff,
+  { "mreq", "iorq", "halt", "rfrsh", "busack", "rd", "wr", "m1" },
+  z80_flags, z80_cycle, z80_seq_cycle
+};
+
+const struct bus_cpu bus_65c02 = {
+  "65C02", 0xfe, 0x01, 0x08, 0x0d,
+  { "ml", "sync", "wr", "vp" },
+  m65_flags, m65_cycle
+};
+
+static unsigned char default_read(struct buscyc *bc, unsigned addr,
+                                  unsigned flags)
+{
+  return (flags & BUS_IO) ? 0 : bc->mem[addr];
+}
+
+static void default_write(struct buscyc *bc, unsigned addr, unsigned char data,
+                          unsigned flags)
+{
+  if (flags & BUS_IO) printf("I/O write, port %02x, val %02x\n", addr & 0xff,
+                             data);
+  else bc->mem[addr] = data;
+}
+
+static int default_plain(struct buscyc *bc, unsigned addr, unsigned flags) {
+  return !(flags & BUS_IO);
+}
+
+void buscyc_init(struct buscyc *bc, busyboard_t *bb, const struct bus_cpu *cpu,
+                 unsigned char *mem)
+{
+  int i;
+
+  memset(bc, 0, sizeof(*bc));
+  bc->bb = bb;
+  bc->cpu = cpu;
+  bc->mem = mem;
+  bc->read = default_read;
+  bc->write = default_write;
+  bc->plain = default_plain;
+  for (i = 0; i < 256; ++i) bc->flag_tab[i] = cpu->flags(i);
+}
+
+void buscyc_reset(struct buscyc *bc) {
+  busyboard_t *bb = bc->bb;
+  void (*trace)(struct buscyc *, const struct bus_rec *) = bc->trace;
+  int i;
+
+  bb->out_state[0] = bc->cpu->ctl_idle & ~bc->cpu->reset;
+  bb->trimask = 1; // control bus output, everything else input
+  busyboard_out(bb);
+  memset(&bc->cur, 0, sizeof(bc->cur));
+  bc->prev_flags = 0;
+
+  // 10 clocks with reset asserted, and one more after releasing it so the
+  // first record is not a sample of the bus still in reset. A checker still
+  // sees these, to find the first fetch.
+  bc->trace = NULL;
+  for (i = 0; i < 10; ++i) bc->cpu->cycle(bc);
+  bb->out_state[0] |= bc->cpu->reset;
+  bc->cpu->cycle(bc);
+  bc->trace = trace;
+  bc->halted = 0;
+  bc->seq_left = 0;
+  bc->rfsh = 0;
+  bc->rfsh_ok = 1;
+  bc->last_op = 0;
+}
+
+/* Time a few of each kind of frame, for buscyc_report(). Neither changes
+   the outputs, so the CPU sees no edge. */
+static void frame_costs(struct buscyc *bc) {
+  double t;
+  int i;
+
+  t = now();
+  for (i = 0; i < 16; ++i) busyboard_xfer(bc->bb);
+  bc->xfer_s = (now() - t) / 16;
+  t = now();
+  for (i = 0; i < 16; ++i) busyboard_out(bc->bb);
+  bc->out_s = (now() - t) / 16;
+}
+
+unsigned long long buscyc_run(struct buscyc *bc, unsigned long long max) {
+  void (*cycle)(struct buscyc *) = bc->cpu->cycle;
+  unsigned long frames;
+  unsigned long long first = bc->cycles, n = 0;
+  double start;
+
+  if (bc->sequence && bc->cpu->seq_cycle && !bc->check) {
+    cycle = bc->cpu->seq_cycle;
+    if (!bc->xfer_s) frame_costs(bc);
+  }
+  frames = bc->bb->frames;
+  start = now();
+
+  while (!bc->halted && (!max || n < max)) {
+    cycle(bc);
+    n = ++bc->cycles - first;
+
+    if (bc->target_hz && !(n & 255)) {
+      double ahead = n / bc->target_hz - (now() - start);
+      if (ahead > 0) timing_wait(ahead * 1e6);
+    }
+  }
+
+  bc->elapsed += now() - start;
+  bc->frames += bc->bb->frames - frames;
+
+  return n;
+}
+
+void buscyc_print(struct buscyc *bc, const struct bus_rec *r) {
+  int i;
+
+  printf("addr: %04x %02x(%c)", r->addr, r->data,
+         (r->flags & BUS_RD) ? 'O' : 'I');
+  for (i = 0; i < 8; i++)
+    if (((r->status >> i) & 1) && bc->cpu->status_name[i])
+      printf(" %s", bc->cpu->status_name[i]);
+  putc('\n', stdout);
+}
+
+void buscyc_report(const struct buscyc *bc) {
+  printf("%s: %llu cycles in %.2f s: %.0f Hz", bc->cpu->name, bc->cycles,
+         bc->elapsed, bc->elapsed > 0 ? bc->cycles / bc->elapsed : 0);
+  if (bc->target_hz) printf(" (target %.0f Hz)", bc->target_hz);
+  printf(", %.2f frames/cycle%s.\n",
+         bc->cycles ? (double)bc->frames / bc->cycles : 0,
+         bc->halted ? ", halted" : "");
+
+  /* Without sequencing, every output-only frame would have sampled too. */
+  if (bc->sampled) {
+    double full = bc->elapsed + (bc->frames - bc->sampled) *
+                                (bc->xfer_s - bc->out_s);
+    printf("Sequencer: %.2f sampled frames/cycle (%.0f%% of cycles), "
+           "%.2fx the speed of sampling every edge.\n",
+           (double)bc->sampled / bc->cycles,
+           100.0 * bc->sampled / bc->cycles,
+           bc->elapsed > 0 ? full / bc->elapsed : 0);
+  }
+  if (bc->predicted)
+    printf("Predictor: %.0f%% of cycles read a frame early, %llu wrong.\n",
+           100.0 * (bc->predicted - bc->mispredicted) / bc->cycles,
+           bc->mispredicted);
+}
@@ -0,0 +1,129 @@
+#ifndef BUSCYC_H
+#define BUSCYC_H
+
+#include "busyboard.h"
+
+/* Bus cycle engine for the CPU harnesses. Every frame is one
+   busyboard_xfer(): it samples address, status and data as the last clock
+   edge left them and latches the next edge together with the data bus
+   response to the sample before; a frame that only latches (sequencing,
+   below) is cheaper. The Z80 takes two frames per clock, the
+   65C02 three (its data has to be up before phi2 rises, and the address is
+   only known after phi2 falls), or two when a predictor supplies the
+   address.
+
+   Ports (as in z80_test and 65c02_test):
+    A - CPU control inputs, clock on A0, reset on A3 (active low)
+    B - Data (I/O)
+    C - Address[7:0]
+    D - Address[15:8]
+    E - Status
+*/
+
+/* Decoded bus status. */
+#define BUS_RD    0x01 /* CPU is reading; the host drives the data bus. */
+#define BUS_WR    0x02
+#define BUS_IO    0x04 /* Z80 IORQ */
+#define BUS_FETCH 0x08 /* Opcode fetch: Z80 M1, 65C02 SYNC */
+#define BUS_HALT  0x10 /* Z80 HALT */
+#define BUS_RFSH  0x20 /* Z80 refresh */
+#define BUS_MEM   0x40 /* Z80 MREQ; always set on the 65C02 */
+
+/* One record per clock cycle. status is the CPU's status port, active
+   high; data is what the host drove for reads and what it sampled
+   otherwise. */
+struct bus_rec {
+  unsigned short addr, flags;
+  unsigned char data, status;
+};
+
+struct buscyc;
+
+struct bus_cpu {
+  const char *name;
+  unsigned char ctl_idle;   /* Port A: clock low, controls de-asserted. */
+  unsigned char clk, reset; /* Port A bits; reset is active low. */
+  unsigned char status_xor; /* Makes the status port active high. */
+  const char *status_name[8];
+  unsigned short (*flags)(unsigned char status);
+  void (*cycle)(struct buscyc *bc);
+  void (*seq_cycle)(struct buscyc *bc); /* For sequence, if the CPU has one */
+};
+
+extern const struct bus_cpu bus_z80, bus_65c02;
+
+struct buscyc {
+  busyboard_t *bb;
+  const struct bus_cpu *cpu;
+  unsigned char *mem; /* 64 KB, used by the default handlers. */
+
+  /* Memory and I/O. Called once per access, not once per sample. */
+  unsigned char (*read)(struct buscyc *bc, unsigned addr, unsigned flags);
+  void (*write)(struct buscyc *bc, unsigned addr, unsigned char data,
+                unsigned flags);
+  /* Nonzero if a read of addr is plain memory, with no side effects, so
+     that it may be made on a prediction that turns out wrong. Whatever
+     replaces read replaces this too; the defaults are all memory. */
+  int (*plain)(struct buscyc *bc, unsigned addr, unsigned flags);
+  void *bus_ctx;
+
+  /* Optional per-cycle hook, e.g. buscyc_print. */
+  void (*trace)(struct buscyc *bc, const struct bus_rec *r);
+  void *ctx;
+
+  /* Optional checker, e.g. a lockstep model: check sees every cycle before
+     trace does, including those during reset. On the 65C02, predict may
+     fill in the next cycle's address and flags; a predicted read has its
+     data driven a frame early. It returns 0 when it has no prediction, and
+     must not predict reads that plain() turns down. */
+  void (*check)(struct buscyc *bc, const struct bus_rec *r);
+  int (*predict)(struct buscyc *bc, struct bus_rec *next);
+  void *check_ctx;
+
+  unsigned edge_us;  /* Extra wait after each clock edge. */
+  double target_hz;  /* Pace the clock to this; 0 runs flat out. */
+
+  /* Z80: sample only the T-states that carry something new and clock
+     through the rest with output-only frames, making up their records from
+     the shape of the machine cycle (see z80_seq_cycle). Off while a checker
+     is attached, since the checker would only see what it predicts. */
+  int sequence;
+
+  /* Results. cycles is the number of the cycle in progress while the
+     trace hook runs. */
+  unsigned long long cycles;
+  int halted;
+  double elapsed;
+  unsigned long frames;
+  unsigned long long sampled; /* Cycles sampled, when sequencing */
+  unsigned long long predicted, mispredicted; /* 65C02 early reads */
+
+  /* Private. */
+  unsigned short flag_tab[256];
+  struct bus_rec cur;
+  unsigned short prev_flags, prev_addr;
+  unsigned char resp;
+  unsigned seq_left, seq_step, seq_len;
+  unsigned short rfsh;
+  unsigned char rfsh_ok, last_op;
+  double xfer_s, out_s;
+};
+
+void buscyc_init(struct buscyc *bc, busyboard_t *bb, const struct bus_cpu *cpu,
+                 unsigned char *mem);
+
+/* Hold reset for a few clocks and release it. */
+void buscyc_reset(struct buscyc *bc);
+
+/* Run until HALT (Z80), STP (65C02) or max cycles, if max is nonzero.
+   Returns the number of cycles run. */
+unsigned long long buscyc_run(struct buscyc *bc, unsigned long long max);
+
+/* Print a cycle in the old print_bus_status() format. */
+void buscyc_print(struct buscyc *bc, const struct bus_rec *r);
+
+/* Print cycles, time, clock rate and frames per cycle, and what sequencing
+   or prediction saved. */
+void buscyc_report(const struct buscyc *bc);
+
+#endif
@@ -33,6 +33,7 @@ void init_busyboard(struct busyboard *b, const char *devnode) {
   
   b->fd = open_parport(devnode);
   b->trimask = 0;
+  b->frames = 0;
 
   for (i = 0; i < BUSYBOARD_N_PORTS; ++i) b->out_state[i] = 0;
 
@@ -69,12 +70,14 @@ void close_parport(int fd) {
 }
 
 void busyboard_out(struct busyboard *b) {
-  int i, j;
+  int i, j, last = -1;
 
-  // Write out the tristate bits.
+  // Write out the tristate bits. The data line is only touched when the next
+  // bit differs from the one before it.
   for (i = 0; i < 8; ++i) {
     int oe = ((b->trimask >> (7 - i))&1);
-    set_bit(b->fd, BIT_DATA, oe);
+    if (oe != last) set_bit(b->fd, BIT_DATA, oe);
+    last = oe;
     set_bit(b->fd, BIT_STROBE, 1);
     set_bit(b->fd, BIT_STROBE, 0);
   }
@@ -83,7 +86,8 @@ void busyboard_out(struct busyboard *b) {
   for (i = 0; i < BUSYBOARD_N_PORTS; ++i) {
     for (j = 0; j < 8; ++j) {
       int bit = ((b->out_state[BUSYBOARD_N_PORTS - 1 - i] >> (7 - j))&1);
-      set_bit(b->fd, BIT_DATA, bit);
+      if (bit != last) set_bit(b->fd, BIT_DATA, bit);
+      last = bit;
       set_bit(b->fd, BIT_STROBE, 1);
       set_bit(b->fd, BIT_STROBE, 0);
     }
@@ -92,6 +96,8 @@ void busyboard_out(struct busyboard *b) {
   // Strobe out all the newly-written bits
   set_bit(b->fd, BIT_LATCH_OUT, 1);
   set_bit(b->fd, BIT_LATCH_OUT, 0);
+
+  b->frames++;
 }
 
 void busyboard_in(struct busyboard *b) {
@@ -118,10 +124,49 @@ void busyboard_in(struct busyboard *b) {
     }
   }
 
+  b->frames++;
+
   /* This has ruined our output state, so refresh it. */
   busyboard_out(b);
 }
 
+void busyboard_xfer(struct busyboard *b) {
+  int i, last = -1;
+
+  // Strobe in all of the inputs and transfer them to the shift register. The
+  // latch strobe is shared with the outputs, which still hold the last state
+  // shifted out, so nothing changes on the output pins here.
+  set_bit(b->fd, BIT_LATCH_IN, 1);
+  set_bit(b->fd, BIT_LATCH_IN, 0);
+  set_bit(b->fd, BIT_N_LD_IN, 0);
+  set_bit(b->fd, BIT_N_LD_IN, 1);
+
+  for (i = 0; i < BUSYBOARD_N_PORTS; ++i) b->in_state[i] = 0;
+
+  // Shift the tristate and data bits out. The 48 input bits come out of the
+  // input chain on the first 48 of the 56 clocks.
+  for (i = 0; i < 8 + 8*BUSYBOARD_N_PORTS; ++i) {
+    int bit;
+    if (i < 8)
+      bit = (b->trimask >> (7 - i))&1;
+    else
+      bit = (b->out_state[BUSYBOARD_N_PORTS - 1 - (i - 8)/8] >> (7 - i%8))&1;
+    if (bit != last) set_bit(b->fd, BIT_DATA, bit);
+    last = bit;
+
+    if (i < 8*BUSYBOARD_N_PORTS)
+      b->in_state[BUSYBOARD_N_PORTS - 1 - i/8] |= read_data(b->fd) << (7 - i%8);
+
+    set_bit(b->fd, BIT_STROBE, 1);
+    set_bit(b->fd, BIT_STROBE, 0);
+  }
+
+  set_bit(b->fd, BIT_LATCH_OUT, 1);
+  set_bit(b->fd, BIT_LATCH_OUT, 0);
+
+  b->frames++;
+}
+
 void set_bit(int fd, int bit, int val) {
   /* printf("Set bit %s to %d\n", ppbit_name[bit], val); */
 
@@ -13,6 +13,7 @@ struct busyboard {
   unsigned trimask; /* One bit per I/O byte tristate mask, 1=out 0=Hi-Z */
   unsigned char out_state[BUSYBOARD_N_PORTS],
                 in_state[BUSYBOARD_N_PORTS];
+  unsigned long frames; /* Shift chain passes since init, for rate reports. */
 };
 
 typedef struct busyboard busyboard_t;
@@ -26,4 +27,9 @@ void busyboard_out(struct busyboard *b);
 /* Read in_state from board. */
 void busyboard_in(struct busyboard *b);
 
+/* Sample in_state, then write out_state, trimask, in a single pass of the
+   shift chain. Inputs are captured with the previously written outputs still
+   applied, so the next outputs can be staged before the call. */
+void busyboard_xfer(struct busyboard *b);
+
 #endif
@@ -0,0 +1,166 @@
+/* Converts scope captures to VCD for waveform viewers. */
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "capfile.h"
+
+#define MAX_SIGNALS 48
+
+/* A signal is a pin, or a run of consecutive pins as a vector with the
+   first pin as bit 0. */
+struct signal {
+  char name[64];
+  int lo, width;
+  uint64_t mask;
+} sig[MAX_SIGNALS];
+int n_sig;
+
+/* "b3" is pin 11. */
+int parse_pin(const char *s, const char **end) {
+  int port = tolower((unsigned char)s[0]) - 'a';
+
+  if (port < 0 || port >= CAP_PORTS || s[1] < '0' || s[1] > '7') return -1;
+  *end = s + 2;
+  return port * 8 + s[1] - '0';
+}
+
+void add_signal(const char *name, int lo, int hi) {
+  struct signal *s = &sig[n_sig++];
+
+  snprintf(s->name, sizeof(s->name), "%s", name);
+  s->lo = lo;
+  s->width = hi - lo + 1;
+  s->mask = ((1ull << s->width) - 1) << lo;
+}
+
+/* Lines of "pin name" or "pin-pin name", e.g. "a0 clk" or "b0-b7 data";
+   # starts a comment. */
+int read_map(const char *filename) {
+  FILE *f = fopen(filename, "r");
+  char line[256], name[64], *hash;
+  const char *p;
+  int lo, hi, n = 0;
+
+  if (!f) {
+    perror(filename);
+    return -1;
+  }
+  while (fgets(line, sizeof(line), f)) {
+    n++;
+    if ((hash = strchr(line, '#'))) *hash = 0;
+    for (p = line; isspace((unsigned char)*p); ++p)
+      ;
+    if (!*p) continue;
+
+    hi = lo = parse_pin(p, &p);
+    if (lo >= 0 && *p == '-') hi = parse_pin(p + 1, &p);
+    if (lo < 0 || hi < 0 || sscanf(p, " %63s", name) != 1 ||
+        n_sig == MAX_SIGNALS) {
+      fprintf(stderr, "%s:%d: expected \"pin[-pin] name\".\n", filename, n);
+      fclose(f);
+      return -1;
+    }
+    if (hi < lo) {
+      int t = hi;
+      hi = lo;
+      lo = t;
+    }
+    add_signal(name, lo, hi);
+  }
+  fclose(f);
+  return 0;
+}
+
+void put_value(FILE *out, const struct signal *s, int i, uint64_t word) {
+  uint64_t v = (word & s->mask) >> s->lo;
+  int b;
+
+  if (s->width == 1) {
+    fprintf(out, "%d%c\n", (int)v, '!' + i);
+    return;
+  }
+  putc('b', out);
+  for (b = s->width - 1; b >= 0; --b) putc('0' + (int)(v >> b & 1), out);
+  fprintf(out, " %c\n", '!' + i);
+}
+
+int main(int argc, char **argv) {
+  const char *map = NULL, *in, *outname = NULL;
+  struct cap_reader r;
+  struct cap_change ch;
+  uint64_t prev = 0;
+  FILE *out = stdout;
+  time_t start;
+  int i, argi = 1, first = 1;
+
+  if (argi + 1 < argc && !strcmp(argv[argi], "-m")) {
+    map = argv[argi + 1];
+    argi += 2;
+  }
+  if (argi >= argc || argi + 2 < argc) {
+    fprintf(stderr,
+      "Usage: %s [-m pinmap] capture [out.vcd]\n"
+      "  pinmap has lines of \"pin name\" or \"pin-pin name\" (a0 clk,\n"
+      "  b0-b7 data); without one, all 48 pins are a0-f7.\n", argv[0]);
+    return 1;
+  }
+  in = argv[argi];
+  if (argi + 1 < argc) outname = argv[argi + 1];
+
+  if (map) {
+    if (read_map(map)) return 1;
+  } else {
+    for (i = 0; i < MAX_SIGNALS; ++i) {
+      char name[3] = { 'a' + i / 8, '0' + i % 8, 0 };
+      add_signal(name, i, i);
+    }
+  }
+
+  if (cap_open(&r, in)) return 1;
+  if (outname && !(out = fopen(outname, "w"))) {
+    perror(outname);
+    cap_done(&r);
+    return 1;
+  }
+
+  start = r.hdr.start_s;
+  fprintf(out, "$date %s$end\n$version busyboard scope, %llu samples "
+          "$end\n$timescale 1ns $end\n$scope module busyboard $end\n",
+          ctime(&start), (unsigned long long)r.hdr.samples);
+  for (i = 0; i < n_sig; ++i) {
+    fprintf(out, "$var wire %d %c %s", sig[i].width, '!' + i, sig[i].name);
+    if (sig[i].width > 1) fprintf(out, " [%d:0]", sig[i].width - 1);
+    fprintf(out, " $end\n");
+  }
+  /* Trigger windows: an event where each trigger fired. */
+  if (r.hdr.triggers) fprintf(out, "$var event 1 ~ trigger $end\n");
+  fprintf(out, "$upscope $end\n$enddefinitions $end\n");
+
+  while (cap_next(&r, &ch)) {
+    fprintf(out, "#%llu\n", (unsigned long long)ch.t);
+    if (ch.marks & CAP_WINDOW)
+      fprintf(out, "$comment window from sample %llu $end\n",
+              (unsigned long long)ch.index);
+    if (first) fprintf(out, "$dumpvars\n");
+    for (i = 0; i < n_sig; ++i)
+      if (first || ((ch.word ^ prev) & sig[i].mask))
+        put_value(out, &sig[i], i, ch.word);
+    if (first) fprintf(out, "$end\n");
+    if (ch.marks & CAP_TRIGGER) fprintf(out, "1~\n");
+    prev = ch.word;
+    first = 0;
+  }
+
+  cap_done(&r);
+  if (out != stdout && fclose(out)) {
+    perror(outname);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,256 @@
+/* Change-only logic capture files. */
+
+#include "capfile.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Changes between the sampler and the writer; a power of two. */
+#define QUEUE_LEN (1ul << 18)
+
+struct cap_entry {
+  uint64_t t, index, word;
+  unsigned marks;
+};
+
+struct capfile {
+  FILE *f;
+  const char *filename;
+  struct cap_hdr hdr;
+
+  /* Sampler side. */
+  uint64_t samples, last, last_t, triggers;
+  unsigned marks;
+
+  /* Single producer, single consumer: head is only written by
+     cap_sample(), tail only by the writer. */
+  struct cap_entry queue[QUEUE_LEN];
+  unsigned long head, tail, stalls;
+  int done, error;
+  pthread_t thread;
+
+  /* Writer side: the last record written. */
+  struct cap_entry prev;
+  uint64_t changes;
+};
+
+static int put_varint(unsigned char *p, uint64_t v) {
+  int n = 0;
+
+  while (v >= 0x80) {
+    p[n++] = v | 0x80;
+    v >>= 7;
+  }
+  p[n++] = v;
+  return n;
+}
+
+static void put_record(struct capfile *c, const struct cap_entry *e,
+                       unsigned ports)
+{
+  unsigned char rec[1 + 2 * 10 + CAP_PORTS];
+  int n = 0, i;
+
+  rec[n++] = ports | e->marks;
+  n += put_varint(rec + n, e->index - c->prev.index);
+  n += put_varint(rec + n, e->t - c->prev.t);
+  for (i = 0; i < CAP_PORTS; ++i)
+    if (ports >> i & 1) rec[n++] = e->word >> 8 * i;
+  if (fwrite(rec, 1, n, c->f) != (size_t)n) c->error = 1;
+  c->prev = *e;
+}
+
+static unsigned changed(uint64_t a, uint64_t b) {
+  unsigned ports = 0;
+  int i;
+
+  for (i = 0; i < CAP_PORTS; ++i)
+    if ((a ^ b) >> 8 * i & 0xff) ports |= 1 << i;
+  return ports;
+}
+
+static void *writer(void *arg) {
+  struct capfile *c = arg;
+
+  for (;;) {
+    /* done first: once it is seen, head is final. */
+    int done = __atomic_load_n(&c->done, __ATOMIC_ACQUIRE);
+    unsigned long head = __atomic_load_n(&c->head, __ATOMIC_ACQUIRE);
+
+    if (head == c->tail) {
+      if (done) break;
+      usleep(1000);
+      continue;
+    }
+
+    for (; c->tail != head; ++c->changes) {
+      const struct cap_entry *e = &c->queue[c->tail % QUEUE_LEN];
+
+      if (!c->changes) c->prev.t = e->t; /* Times count from here. */
+      put_record(c, e, (c->changes && !(e->marks & CAP_WINDOW))
+                       ? changed(c->prev.word, e->word)
+                       : (1 << CAP_PORTS) - 1);
+      __atomic_store_n(&c->tail, c->tail + 1, __ATOMIC_RELEASE);
+    }
+  }
+
+  return NULL;
+}
+
+struct capfile *cap_create(const char *filename) {
+  struct capfile *c = calloc(1, sizeof(*c));
+  struct timespec ts;
+
+  if (!c) {
+    perror("calloc");
+    return NULL;
+  }
+  c->filename = filename;
+  c->f = fopen(filename, "wb");
+  if (!c->f) {
+    perror(filename);
+    free(c);
+    return NULL;
+  }
+  setvbuf(c->f, NULL, _IOFBF, 1 << 20);
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  memcpy(c->hdr.magic, CAP_MAGIC, sizeof(CAP_MAGIC));
+  c->hdr.version = CAP_VERSION;
+  c->hdr.hdr_size = sizeof(c->hdr);
+  c->hdr.start_s = ts.tv_sec;
+  c->hdr.start_ns = ts.tv_nsec;
+  if (fwrite(&c->hdr, sizeof(c->hdr), 1, c->f) != 1 ||
+      pthread_create(&c->thread, NULL, writer, c)) {
+    fprintf(stderr, "%s: could not start the capture.\n", filename);
+    fclose(c->f);
+    free(c);
+    return NULL;
+  }
+
+  return c;
+}
+
+void cap_sample(struct capfile *c, uint64_t t, uint64_t word) {
+  unsigned long head = c->head;
+
+  c->last_t = t;
+  if (word == c->last && c->samples && !c->marks) {
+    c->samples++;
+    return;
+  }
+
+  /* The writer only encodes into a stdio buffer, so this only waits if the
+     disk can't keep up with the changes. */
+  if (head - __atomic_load_n(&c->tail, __ATOMIC_ACQUIRE) >= QUEUE_LEN) {
+    c->stalls++;
+    while (head - __atomic_load_n(&c->tail, __ATOMIC_ACQUIRE) >= QUEUE_LEN)
+      sched_yield();
+  }
+  c->queue[head % QUEUE_LEN].t = t;
+  c->queue[head % QUEUE_LEN].index = c->samples++;
+  c->queue[head % QUEUE_LEN].word = word;
+  c->queue[head % QUEUE_LEN].marks = c->marks;
+  __atomic_store_n(&c->head, head + 1, __ATOMIC_RELEASE);
+  c->last = word;
+  c->marks = 0;
+}
+
+void cap_mark(struct capfile *c, uint64_t index, unsigned marks) {
+  if (marks & CAP_WINDOW) c->samples = index;
+  if (marks & CAP_TRIGGER) c->triggers++;
+  c->marks |= marks;
+}
+
+uint64_t cap_close(struct capfile *c) {
+  struct cap_entry end;
+  uint64_t changes;
+
+  __atomic_store_n(&c->done, 1, __ATOMIC_RELEASE);
+  pthread_join(c->thread, NULL);
+
+  if (c->samples) {
+    end.t = c->last_t;
+    end.index = c->samples;
+    end.word = c->last;
+    end.marks = 0;
+    put_record(c, &end, 0);
+  }
+
+  c->hdr.samples = c->samples;
+  c->hdr.changes = changes = c->changes;
+  c->hdr.triggers = c->triggers;
+  if (!fseek(c->f, 0, SEEK_SET) &&
+      fwrite(&c->hdr, sizeof(c->hdr), 1, c->f) != 1)
+    c->error = 1;
+  if (fclose(c->f) || c->error) perror(c->filename);
+  if (c->stalls)
+    fprintf(stderr, "%s: the sampler waited for the writer %lu times.\n",
+            c->filename, c->stalls);
+  free(c);
+
+  return changes;
+}
+
+int cap_open(struct cap_reader *r, const char *filename) {
+  memset(r, 0, sizeof(*r));
+  r->f = fopen(filename, "rb");
+  if (!r->f) {
+    perror(filename);
+    return -1;
+  }
+  if (fread(&r->hdr, sizeof(r->hdr), 1, r->f) != 1 ||
+      memcmp(r->hdr.magic, CAP_MAGIC, sizeof(CAP_MAGIC)) ||
+      r->hdr.version != CAP_VERSION || r->hdr.hdr_size < sizeof(r->hdr) ||
+      fseek(r->f, r->hdr.hdr_size, SEEK_SET)) {
+    fprintf(stderr, "%s: not a version %d capture.\n", filename,
+            CAP_VERSION);
+    fclose(r->f);
+    return -1;
+  }
+  return 0;
+}
+
+static int get_varint(FILE *f, uint64_t *v) {
+  int c, shift = 0;
+
+  *v = 0;
+  do {
+    if ((c = getc(f)) == EOF || shift > 63) return -1;
+    *v |= (uint64_t)(c & 0x7f) << shift;
+    shift += 7;
+  } while (c & 0x80);
+  return 0;
+}
+
+int cap_next(struct cap_reader *r, struct cap_change *ch) {
+  uint64_t run, dt;
+  int ports, i, c;
+
+  if (r->ended || (c = getc(r->f)) == EOF ||
+      get_varint(r->f, &run) || get_varint(r->f, &dt))
+    return 0;
+  ports = c & ((1 << CAP_PORTS) - 1);
+  r->cur.marks = c & (CAP_WINDOW | CAP_TRIGGER);
+  for (i = 0; i < CAP_PORTS; ++i)
+    if (ports >> i & 1) {
+      if ((c = getc(r->f)) == EOF) return 0;
+      r->cur.word = (r->cur.word & ~(0xffull << 8 * i)) |
+                    (uint64_t)c << 8 * i;
+    }
+  r->cur.index += run;
+  r->cur.t += dt;
+  r->cur.ports = ports;
+  r->ended = r->started && !ports && !r->cur.marks;
+  r->started = 1;
+  *ch = r->cur;
+  return 1;
+}
+
+void cap_done(struct cap_reader *r) {
+  fclose(r->f);
+}
@@ -0,0 +1,87 @@
+#ifndef CAPFILE_H
+#define CAPFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Logic captures of the 48 busyboard pins. A sample is a 48-bit word with
+   port A in the low byte (pin A0 is bit 0, F7 bit 47). Only samples that
+   differ from the one before are kept, each with its time and the number
+   of samples since the last change. The sampler hands every sample to
+   cap_sample(), which only compares words unless there is a change to
+   queue; a writer thread encodes the changes and does the I/O.
+
+   File layout: struct cap_hdr, then a record per change:
+     ports  1 byte, bit n set if port n changed, and the marks below
+     run    varint, samples since the previous record
+     dt     varint, ns since the previous record
+     data   the new value of each changed port, port A first
+   Varints are 7 bits a byte, low first, with bit 7 set on all but the last.
+   The first record has all ports, dt 0, and its sample number (0 unless
+   it starts a trigger window) as the run. The last is a 0 byte: its run
+   and dt reach the end of the capture.
+
+   Captures of trigger windows mark where each window starts (after a gap,
+   so the samples before it weren't kept) and the sample that fired. Those
+   samples get records even if nothing changed; a window start has all
+   ports. */
+
+#define CAP_MAGIC "BBCAP"
+#define CAP_VERSION 1
+#define CAP_PORTS 6
+
+#define CAP_WINDOW  0x40
+#define CAP_TRIGGER 0x80
+
+struct cap_hdr {
+  char magic[8];
+  uint32_t version, hdr_size;
+  int64_t start_s, start_ns; /* Wall clock when the capture was created */
+  uint64_t samples, changes; /* Filled in at the end, if the file seeks */
+  uint64_t triggers;
+  uint64_t reserved[3];
+};
+
+/* One record as read back. */
+struct cap_change {
+  uint64_t t;     /* ns since the first sample */
+  uint64_t index; /* Sample number */
+  uint64_t word;
+  unsigned ports; /* Which ports changed; 0 at the end */
+  unsigned marks; /* CAP_WINDOW, CAP_TRIGGER */
+};
+
+struct capfile;
+
+/* Create filename and start the writer. Returns NULL (after printing why)
+   on error. */
+struct capfile *cap_create(const char *filename);
+
+/* Sample taken at t ns, on any monotonic clock. */
+void cap_sample(struct capfile *c, uint64_t t, uint64_t word);
+
+/* Record the next sample with marks. With CAP_WINDOW it is sample number
+   index; the ones since the last sample weren't kept. */
+void cap_mark(struct capfile *c, uint64_t index, unsigned marks);
+
+/* Drain the queue, write the end record and the header, and close.
+   Returns the number of changes written. */
+uint64_t cap_close(struct capfile *c);
+
+struct cap_reader {
+  FILE *f;
+  struct cap_hdr hdr;
+  struct cap_change cur;
+  int started, ended;
+};
+
+/* Open a capture for reading. Returns 0, or -1 after printing why. */
+int cap_open(struct cap_reader *r, const char *filename);
+
+/* The next record. Returns 1, or 0 after the end record (or at the end of
+   a capture that was cut short). */
+int cap_next(struct cap_reader *r, struct cap_change *ch);
+
+void cap_done(struct cap_reader *r);
+
+#endif
@@ -0,0 +1,294 @@
+/* Streaming player for 8-bit R-2R ladder DACs. */
+/* Pinout:
+     Port P+c, bits 0-7 - DAC for channel c, bit 0 on the LSB rung
+   P is port A unless -P says otherwise; up to six channels fit, one per
+   port, and every sample frame puts out all of them at once. */
+
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "busyboard.h"
+
+/* Sample frames between the reader and the player; a power of two. */
+#define RING_LEN 65536
+
+/* Sleep until this close to a deadline, then spin. */
+#define SPIN 100e-6
+
+struct stream {
+  FILE *f;
+  int channels, bits;
+  double rate;
+  long left; /* Bytes of sample data, or -1 to EOF */
+};
+
+/* Single producer, single consumer: head is only written by the reader,
+   tail only by the player. */
+unsigned char ring[RING_LEN][BUSYBOARD_N_PORTS];
+unsigned long head, tail;
+int done;
+
+int first_port;
+double out_rate;
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void wait_until(double t) {
+  struct timespec ts;
+
+  if (t - now() > SPIN) {
+    t -= SPIN;
+    ts.tv_sec = t;
+    ts.tv_nsec = (t - ts.tv_sec) * 1e9;
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    t += SPIN;
+  }
+  while (now() < t)
+    ;
+}
+
+unsigned le(const unsigned char *p, int n) {
+  unsigned v = 0;
+
+  while (n--) v = v << 8 | p[n];
+  return v;
+}
+
+/* Pipes can't seek. */
+int skip(FILE *f, unsigned long n) {
+  while (n--)
+    if (getc(f) == EOF) return -1;
+  return 0;
+}
+
+/* Find the fmt and data chunks; only integer PCM is taken. */
+int open_wav(struct stream *s, const char *name) {
+  unsigned char h[16];
+  unsigned long size;
+  int fmt = 0;
+
+  if (fread(h, 1, 12, s->f) != 12 || memcmp(h, "RIFF", 4) ||
+      memcmp(h + 8, "WAVE", 4)) {
+    fprintf(stderr, "%s: not a WAV file (use -R for raw PCM).\n", name);
+    return -1;
+  }
+  while (fread(h, 1, 8, s->f) == 8) {
+    size = le(h + 4, 4);
+    if (!memcmp(h, "fmt ", 4) && size >= 16) {
+      if (fread(h, 1, 16, s->f) != 16) break;
+      fmt = le(h, 2);
+      s->channels = le(h + 2, 2);
+      s->rate = le(h + 4, 4);
+      s->bits = le(h + 14, 2);
+      size -= 16;
+    } else if (!memcmp(h, "data", 4)) {
+      /* 1 is PCM; 0xfffe (extensible) is taken on trust to be PCM. */
+      if (fmt != 1 && fmt != 0xfffe) {
+        fprintf(stderr, "%s: not integer PCM (format %d).\n", name, fmt);
+        return -1;
+      }
+      s->left = size;
+      return 0;
+    }
+    if (skip(s->f, size + (size & 1))) break;
+  }
+  fprintf(stderr, "%s: no sample data.\n", name);
+  return -1;
+}
+
+/* One frame of samples, -1 to 1. Returns 0 at the end. */
+int read_frame(struct stream *s, float *v) {
+  unsigned char b[2 * BUSYBOARD_N_PORTS];
+  int c, n = s->channels * s->bits / 8;
+
+  if ((s->left >= 0 && s->left < n) || fread(b, 1, n, s->f) != (size_t)n)
+    return 0;
+  if (s->left >= 0) s->left -= n;
+  for (c = 0; c < s->channels; ++c)
+    v[c] = (s->bits == 8) ? (b[c] - 128) / 128.0
+                          : (short)le(b + 2 * c, 2) / 32768.0;
+  return 1;
+}
+
+unsigned char dac(float v) {
+  int x = lrintf(v * 128 + 128);
+  return x < 0 ? 0 : x > 255 ? 255 : x;
+}
+
+/* Resample to out_rate by linear interpolation into the ring. */
+void *reader(void *arg) {
+  struct stream *s = arg;
+  float prev[BUSYBOARD_N_PORTS], cur[BUSYBOARD_N_PORTS];
+  double pos = 1, step = s->rate / out_rate;
+  unsigned char *f;
+  int c, more = read_frame(s, cur);
+
+  while (more) {
+    for (; pos >= 1 && more; pos -= 1) {
+      memcpy(prev, cur, sizeof(cur));
+      more = read_frame(s, cur);
+    }
+    if (!more) break;
+
+    while (head - __atomic_load_n(&tail, __ATOMIC_ACQUIRE) >= RING_LEN)
+      usleep(1000);
+    f = ring[head % RING_LEN];
+    for (c = 0; c < s->channels; ++c)
+      f[first_port + c] = dac(prev[c] + (cur[c] - prev[c]) * pos);
+    __atomic_store_n(&head, head + 1, __ATOMIC_RELEASE);
+    pos += step;
+  }
+  __atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+
+  return NULL;
+}
+
+void usage(const char *argv0) {
+  fprintf(stderr,
+    "Usage: %s [-p parport] [-P port] [-r rate] [-R rate -C channels "
+    "[-b 8|16]]\n"
+    "       file|-\n"
+    "  Plays a WAV file, or raw PCM with -R (unsigned 8-bit or signed\n"
+    "  16-bit little endian samples, interleaved), on DACs on consecutive\n"
+    "  ports from -P (a-f, default a), one per channel. Samples are\n"
+    "  resampled to -r Hz, by default the source rate or as fast as the\n"
+    "  board can put out frames, whichever is lower.\n", argv0);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  const char *parport = "/dev/parport0";
+  struct stream s = { NULL, 1, 16, 0, -1 };
+  unsigned long n = 0, late = 0, underruns = 0, h;
+  double frame, start, t, err, sum = 0, sq = 0, worst = 0, lost = 0;
+  pthread_t thread;
+  int c, i;
+
+  while ((c = getopt(argc, argv, "p:P:r:R:C:b:")) != -1) {
+    switch (c) {
+    case 'p': parport = optarg; break;
+    case 'P': first_port = (optarg[0] | 0x20) - 'a'; break;
+    case 'r': out_rate = atof(optarg); break;
+    case 'R': s.rate = atof(optarg); break;
+    case 'C': s.channels = atoi(optarg); break;
+    case 'b': s.bits = atoi(optarg); break;
+    default: usage(argv[0]);
+    }
+  }
+  if (optind + 1 != argc || first_port < 0 ||
+      first_port >= BUSYBOARD_N_PORTS) usage(argv[0]);
+
+  s.f = strcmp(argv[optind], "-") ? fopen(argv[optind], "rb") : stdin;
+  if (!s.f) {
+    perror(argv[optind]);
+    return 1;
+  }
+  if (!s.rate && open_wav(&s, argv[optind])) return 1;
+  if ((s.bits != 8 && s.bits != 16) || s.channels < 1 || s.rate <= 0) {
+    fprintf(stderr, "%s: %d-bit, %d channel, %.0f Hz isn't playable.\n",
+            argv[optind], s.bits, s.channels, s.rate);
+    return 1;
+  }
+  if (first_port + s.channels > BUSYBOARD_N_PORTS) {
+    fprintf(stderr, "%d channels don't fit on ports %c-f.\n", s.channels,
+            'a' + first_port);
+    return 1;
+  }
+
+  busyboard_t bb;
+  init_busyboard(&bb, parport);
+  bb.trimask = ((1 << s.channels) - 1) << first_port;
+  for (i = 0; i < s.channels; ++i) bb.out_state[first_port + i] = 0x80;
+
+  /* What an output frame costs sets the fastest sample rate. */
+  t = now();
+  for (i = 0; i < 64; ++i) busyboard_out(&bb);
+  frame = (now() - t) / 64;
+  if (!out_rate) {
+    out_rate = s.rate;
+    if (out_rate * frame > 0.8) out_rate = floor(0.8 / frame);
+  } else if (out_rate * frame > 1) {
+    printf("Warning: frames take %.1f us; %.0f Hz can't be kept up.\n",
+           frame * 1e6, out_rate);
+  }
+  printf("%d channel%s, %d-bit, %.0f Hz, played at %.0f Hz on port%s %c",
+         s.channels, s.channels > 1 ? "s" : "", s.bits, s.rate, out_rate,
+         s.channels > 1 ? "s" : "", 'A' + first_port);
+  if (s.channels > 1) printf("-%c", 'A' + first_port + s.channels - 1);
+  printf(" (frames take %.1f us).\n", frame * 1e6);
+
+  if (pthread_create(&thread, NULL, reader, &s)) {
+    fprintf(stderr, "Could not start the reader thread.\n");
+    return 1;
+  }
+
+  /* Half fill the ring before starting the clock. */
+  while (__atomic_load_n(&head, __ATOMIC_ACQUIRE) < RING_LEN / 2 &&
+         !__atomic_load_n(&done, __ATOMIC_ACQUIRE))
+    usleep(1000);
+
+  start = now();
+  for (;;) {
+    /* done first: once it is seen, head is final. */
+    int fin = __atomic_load_n(&done, __ATOMIC_ACQUIRE);
+    h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+
+    if (h == tail) {
+      if (fin) break;
+
+      /* Hold the last sample until the reader catches up, and start the
+         clock over from there. */
+      underruns++;
+      t = now();
+      while (__atomic_load_n(&head, __ATOMIC_ACQUIRE) == tail &&
+             !__atomic_load_n(&done, __ATOMIC_ACQUIRE))
+        sched_yield();
+      lost += now() - t;
+      start += now() - t;
+      continue;
+    }
+
+    for (; tail != h; ++n) {
+      t = start + n / out_rate;
+      wait_until(t);
+      err = now() - t;
+      sum += err;
+      sq += err * err;
+      if (err > worst) worst = err;
+      if (err > 1 / out_rate) late++;
+
+      memcpy(bb.out_state, ring[tail % RING_LEN], BUSYBOARD_N_PORTS);
+      busyboard_out(&bb);
+      __atomic_store_n(&tail, tail + 1, __ATOMIC_RELEASE);
+    }
+  }
+  t = now() - start;
+  pthread_join(thread, NULL);
+  if (s.f != stdin) fclose(s.f);
+
+  printf("Played %lu frames in %.2f s: %.0f Hz.\n", n, t,
+         t > 0 ? n / t : 0);
+  if (n) {
+    double mean = sum / n, var = sq / n - mean * mean;
+    printf("Timing error %.1f us mean, %.1f us sd, %.1f us worst; %lu "
+           "frames over a period late.\n", mean * 1e6,
+           (var > 0 ? sqrt(var) : 0) * 1e6, worst * 1e6, late);
+  }
+  printf("%lu underruns, %.3f s held.\n", underruns, lost);
+
+  for (i = 0; i < s.channels; ++i) bb.out_state[first_port + i] = 0x80;
+  busyboard_out(&bb);
+  close_busyboard(&bb);
+
+  return 0;
+}
@@ -0,0 +1,511 @@
+/* Protocol decoders for scope captures. */
+
+#include "decode.h"
+
+#include <ctype.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Records per pass of the edge finder; a multiple of 4. */
+#define DEC_BLOCK 4096
+
+typedef uint64_t dec_v4 __attribute__((vector_size(32)));
+
+struct decoder {
+  const char *name;
+  uint64_t watch; /* Pins whose changes it needs to see */
+  void (*change)(struct decoder *d, const struct cap_change *ch,
+                 uint64_t prev);
+  void (*finish)(struct decoder *d, uint64_t t);
+  dec_emit_fn *emit;
+  void *ctx;
+
+  /* Settings; pins are -1 if not given. */
+  int clk, mosi, miso, cs, mode, bits;
+  int scl, sda;
+  int rx, baud;
+  int strobe, edge, data_lo, data_hi, addr_lo, addr_hi;
+
+  /* Transaction being decoded. */
+  int active, nbits, level, have_addr;
+  unsigned out, in, addr;
+  uint64_t start, last;
+  double next, bit_ns; /* UART: time of the next bit sample */
+  unsigned long errors;
+  char *text[2];
+  size_t len[2], size[2];
+};
+
+static int bit(uint64_t w, int pin) {
+  return w >> pin & 1;
+}
+
+static void put_text(struct decoder *d, int i, const char *s) {
+  size_t n = strlen(s);
+
+  if (d->len[i] + n + 1 > d->size[i]) {
+    size_t size = d->size[i] ? 2 * d->size[i] : 256;
+    char *p;
+
+    while (size < d->len[i] + n + 1) size *= 2;
+    if (!(p = realloc(d->text[i], size))) return;
+    d->text[i] = p;
+    d->size[i] = size;
+  }
+  memcpy(d->text[i] + d->len[i], s, n + 1);
+  d->len[i] += n;
+}
+
+static void put_byte(struct decoder *d, int i, unsigned v, int bits,
+                     int nak)
+{
+  char s[16];
+
+  snprintf(s, sizeof(s), "%s%0*x%s", d->len[i] ? " " : "", (bits + 3) / 4,
+           v, nak ? "!" : "");
+  put_text(d, i, s);
+}
+
+static void clear(struct decoder *d) {
+  d->len[0] = d->len[1] = 0;
+  put_text(d, 0, "");
+  put_text(d, 1, "");
+}
+
+static void emit(struct decoder *d, uint64_t end, const char *kind,
+                 const char *info)
+{
+  struct dec_txn txn = { d->name, d->start, end, kind, d->text[0], info };
+
+  d->emit(&txn, d->ctx);
+  clear(d);
+}
+
+/* SPI. Data is taken from just before the sampling edge: rising in modes
+   0 and 3, falling in 1 and 2. */
+static void spi_word(struct decoder *d) {
+  if (d->mosi >= 0) put_byte(d, 0, d->out, d->bits, 0);
+  if (d->miso >= 0) put_byte(d, 1, d->in, d->bits, 0);
+  d->nbits = d->out = d->in = 0;
+}
+
+static void spi_emit(struct decoder *d, uint64_t end) {
+  char *info = NULL, left[32];
+
+  if (d->mosi < 0) {
+    char *t = d->text[0];
+    d->text[0] = d->text[1];
+    d->text[1] = t;
+  } else if (d->miso >= 0 && d->len[1]) {
+    info = malloc(d->len[1] + 6);
+    if (info) sprintf(info, "miso %s", d->text[1]);
+  }
+  if (d->nbits) {
+    snprintf(left, sizeof(left), "%d bits left over", d->nbits);
+    emit(d, end, "xfer", left);
+  } else {
+    emit(d, end, "xfer", info ? info : "");
+  }
+  d->nbits = d->out = d->in = 0;
+  free(info);
+}
+
+static void spi_change(struct decoder *d, const struct cap_change *ch,
+                       uint64_t prev)
+{
+  uint64_t diff = ch->word ^ prev;
+  int rising;
+
+  if (ch->marks & CAP_WINDOW) {
+    d->active = d->cs < 0;
+    d->nbits = d->out = d->in = 0;
+    clear(d);
+  }
+
+  if (d->cs >= 0 && bit(diff, d->cs)) {
+    if (!bit(ch->word, d->cs)) {
+      d->active = 1;
+      d->start = ch->t;
+      d->nbits = d->out = d->in = 0;
+    } else if (d->active) {
+      d->active = 0;
+      if (d->len[0] || d->len[1] || d->nbits) spi_emit(d, ch->t);
+    }
+  }
+
+  if (!d->active || !bit(diff, d->clk)) return;
+  rising = bit(ch->word, d->clk);
+  if (rising != (d->mode == 0 || d->mode == 3)) return;
+
+  if (d->cs < 0 && !d->nbits) d->start = ch->t;
+  if (d->mosi >= 0) d->out = d->out << 1 | bit(prev, d->mosi);
+  if (d->miso >= 0) d->in = d->in << 1 | bit(prev, d->miso);
+  d->last = ch->t;
+  if (++d->nbits == d->bits) {
+    spi_word(d);
+    if (d->cs < 0) spi_emit(d, ch->t);
+  }
+}
+
+static void spi_finish(struct decoder *d, uint64_t t) {
+  if (d->cs >= 0 && d->active && (d->len[0] || d->len[1] || d->nbits))
+    spi_emit(d, t);
+}
+
+/* I2C: start and stop are SDA edges with SCL high; bits are sampled on
+   SCL rising, the ninth of each byte being the ack. */
+static void i2c_emit(struct decoder *d, uint64_t end) {
+  char info[32];
+
+  /* SCL rises once more before a stop or repeated start. */
+  if (!d->have_addr) return;
+  snprintf(info, sizeof(info), "addr 0x%02x%s%s", d->addr >> 1 & 0x7f,
+           (d->addr & 0x100) ? " nak" : "", d->nbits > 1 ? " cut short" : "");
+  emit(d, end, (d->addr & 1) ? "read" : "write", info);
+  d->have_addr = 0;
+}
+
+static void i2c_change(struct decoder *d, const struct cap_change *ch,
+                       uint64_t prev)
+{
+  uint64_t diff = ch->word ^ prev;
+
+  if (ch->marks & CAP_WINDOW) {
+    d->active = d->have_addr = 0;
+    clear(d);
+  }
+
+  if (bit(diff, d->sda) && bit(prev, d->scl) && bit(ch->word, d->scl)) {
+    if (!bit(ch->word, d->sda)) {        /* Start, or repeated start */
+      if (d->active) i2c_emit(d, ch->t);
+      d->active = 1;
+      d->start = ch->t;
+      d->nbits = d->out = 0;
+      d->have_addr = 0;
+      clear(d);
+    } else if (d->active) {               /* Stop */
+      i2c_emit(d, ch->t);
+      d->active = 0;
+    }
+    return;
+  }
+
+  if (!d->active || !bit(diff, d->scl) || !bit(ch->word, d->scl)) return;
+  if (d->nbits++ < 8) {
+    d->out = d->out << 1 | bit(ch->word, d->sda);
+    return;
+  }
+
+  /* The address byte, with a nak in bit 8, then data. */
+  if (!d->have_addr) {
+    d->addr = d->out | bit(ch->word, d->sda) << 8;
+    d->have_addr = 1;
+  } else {
+    put_byte(d, 0, d->out, 8, bit(ch->word, d->sda));
+  }
+  d->nbits = d->out = 0;
+}
+
+static void i2c_finish(struct decoder *d, uint64_t t) {
+  if (d->active) i2c_emit(d, t);
+}
+
+/* UART: the line only changes at records, so the bits of a character are
+   sampled, at their middles, from the level before the next change. */
+static void uart_flush(struct decoder *d) {
+  char info[40] = "";
+
+  if (!d->len[0]) return;
+  if (d->errors) snprintf(info, sizeof(info), "%lu framing errors",
+                          d->errors);
+  emit(d, d->last, "data", info);
+  d->errors = 0;
+}
+
+static void uart_sample(struct decoder *d, uint64_t t) {
+  while (d->active && d->next < t) {
+    if (d->nbits == 0 && d->level) {          /* Start bit gone: a glitch */
+      d->active = 0;
+      break;
+    }
+    if (d->nbits > 0 && d->nbits <= d->bits)
+      d->out |= d->level << (d->nbits - 1);   /* LSB first */
+    if (d->nbits == d->bits + 1) {
+      if (!d->level) d->errors++;
+      put_byte(d, 0, d->out, d->bits, 0);
+      d->last = d->next + d->bit_ns / 2;
+      d->active = 0;
+      break;
+    }
+    d->nbits++;
+    d->next += d->bit_ns;
+  }
+}
+
+static void uart_change(struct decoder *d, const struct cap_change *ch,
+                        uint64_t prev)
+{
+  if (ch->marks & CAP_WINDOW) {
+    d->active = 0;
+    uart_flush(d);
+  } else {
+    uart_sample(d, ch->t);
+  }
+  d->level = bit(ch->word, d->rx);
+
+  if (d->active || d->level || !bit(ch->word ^ prev, d->rx)) return;
+  if (d->len[0] && ch->t > d->last + 2 * (d->bits + 2) * d->bit_ns)
+    uart_flush(d);
+  if (!d->len[0]) d->start = ch->t;
+  d->active = 1;
+  d->nbits = d->out = 0;
+  d->next = ch->t + d->bit_ns / 2;
+}
+
+static void uart_finish(struct decoder *d, uint64_t t) {
+  uart_sample(d, t);
+  uart_flush(d);
+}
+
+/* Parallel bus: one transaction per strobe edge. */
+static unsigned field(uint64_t w, int lo, int hi) {
+  return (w >> lo) & ((1ull << (hi - lo + 1)) - 1);
+}
+
+static void par_change(struct decoder *d, const struct cap_change *ch,
+                       uint64_t prev)
+{
+  char info[32] = "";
+
+  if (!bit(ch->word ^ prev, d->strobe) ||
+      bit(ch->word, d->strobe) != (d->edge == '+'))
+    return;
+  d->start = ch->t;
+  put_byte(d, 0, field(prev, d->data_lo, d->data_hi),
+           d->data_hi - d->data_lo + 1, 0);
+  if (d->addr_lo >= 0)
+    snprintf(info, sizeof(info), "addr 0x%0*x",
+             (d->addr_hi - d->addr_lo + 4) / 4,
+             field(prev, d->addr_lo, d->addr_hi));
+  emit(d, ch->t, "strobe", info);
+}
+
+static void par_finish(struct decoder *d, uint64_t t) {
+  (void)d;
+  (void)t;
+}
+
+int dec_pin(const char *s) {
+  int port = tolower((unsigned char)s[0]) - 'a';
+
+  if (port < 0 || port >= CAP_PORTS || s[1] < '0' || s[1] > '7') return -1;
+  return port * 8 + s[1] - '0';
+}
+
+/* Settings by name: pins, pin ranges (lo-hi), and numbers. */
+enum { K_PIN, K_RANGE, K_NUM };
+
+struct key {
+  const char *name;
+  int type;
+  size_t off;
+};
+
+#define KEY(name, type, field) { name, type, offsetof(struct decoder, field) }
+
+static const struct key spi_keys[] = {
+  KEY("clk", K_PIN, clk), KEY("mosi", K_PIN, mosi), KEY("miso", K_PIN, miso),
+  KEY("cs", K_PIN, cs), KEY("mode", K_NUM, mode), KEY("bits", K_NUM, bits),
+  { NULL, 0, 0 }
+};
+static const struct key i2c_keys[] = {
+  KEY("scl", K_PIN, scl), KEY("sda", K_PIN, sda), { NULL, 0, 0 }
+};
+static const struct key uart_keys[] = {
+  KEY("rx", K_PIN, rx), KEY("baud", K_NUM, baud), KEY("bits", K_NUM, bits),
+  { NULL, 0, 0 }
+};
+static const struct key par_keys[] = {
+  KEY("strobe", K_PIN, strobe), KEY("edge", K_NUM, edge),
+  KEY("data", K_RANGE, data_lo), KEY("addr", K_RANGE, addr_lo),
+  { NULL, 0, 0 }
+};
+
+static int set_key(struct decoder *d, const struct key *keys, const char *k,
+                   size_t klen, const char *v)
+{
+  int *p, lo, hi;
+  char *end;
+
+  for (; keys->name; ++keys)
+    if (strlen(keys->name) == klen && !strncmp(keys->name, k, klen)) break;
+  if (!keys->name) return -1;
+  p = (int *)((char *)d + keys->off);
+
+  switch (keys->type) {
+  case K_PIN:
+    *p = dec_pin(v);
+    return (*p < 0 || (v[2] && v[2] != ',')) ? -1 : 0;
+  case K_RANGE:
+    lo = hi = dec_pin(v);
+    if (lo >= 0 && v[2] == '-') hi = dec_pin(v + 3);
+    if (lo < 0 || hi < 0) return -1;
+    p[0] = lo < hi ? lo : hi;
+    p[1] = lo < hi ? hi : lo;
+    return p[1] - p[0] < 32 ? 0 : -1;
+  default:
+    if (*v == '+' || *v == '-') {
+      *p = *v;
+      return 0;
+    }
+    *p = strtol(v, &end, 0);
+    return (end == v || (*end && *end != ',')) ? -1 : 0;
+  }
+}
+
+struct decoder *dec_create(const char *spec, dec_emit_fn *emit, void *ctx) {
+  struct decoder *d = calloc(1, sizeof(*d));
+  const struct key *keys;
+  const char *p, *eq;
+
+  if (!d) {
+    perror("calloc");
+    return NULL;
+  }
+  d->clk = d->mosi = d->miso = d->cs = d->scl = d->sda = d->rx = -1;
+  d->strobe = d->data_lo = d->addr_lo = -1;
+  d->bits = 8;
+  d->baud = 9600;
+  d->edge = '+';
+  d->emit = emit;
+  d->ctx = ctx;
+  clear(d);
+
+  if (!strncmp(spec, "spi:", 4)) {
+    d->name = "spi";
+    keys = spi_keys;
+    d->change = spi_change;
+    d->finish = spi_finish;
+  } else if (!strncmp(spec, "i2c:", 4)) {
+    d->name = "i2c";
+    keys = i2c_keys;
+    d->change = i2c_change;
+    d->finish = i2c_finish;
+  } else if (!strncmp(spec, "uart:", 5)) {
+    d->name = "uart";
+    keys = uart_keys;
+    d->change = uart_change;
+    d->finish = uart_finish;
+  } else if (!strncmp(spec, "par:", 4)) {
+    d->name = "par";
+    keys = par_keys;
+    d->change = par_change;
+    d->finish = par_finish;
+  } else {
+    fprintf(stderr, "%s: decoders are spi, i2c, uart and par.\n", spec);
+    dec_free(d);
+    return NULL;
+  }
+
+  for (p = strchr(spec, ':') + 1; *p; p += strcspn(p, ","), p += !!*p) {
+    eq = strchr(p, '=');
+    if (!eq || eq > p + strcspn(p, ",") ||
+        set_key(d, keys, p, eq - p, eq + 1)) {
+      fprintf(stderr, "%s: can't make sense of \"%.*s\".\n", spec,
+              (int)strcspn(p, ","), p);
+      dec_free(d);
+      return NULL;
+    }
+  }
+
+  if (d->change == spi_change) {
+    d->watch = 1ull << d->clk | (d->cs >= 0 ? 1ull << d->cs : 0);
+    d->active = d->cs < 0;
+    if (d->clk < 0 || (d->mosi < 0 && d->miso < 0)) goto missing;
+  } else if (d->change == i2c_change) {
+    d->watch = 1ull << d->scl | 1ull << d->sda;
+    if (d->scl < 0 || d->sda < 0) goto missing;
+  } else if (d->change == uart_change) {
+    d->watch = 1ull << d->rx;
+    d->level = 1;
+    d->bit_ns = 1e9 / (d->baud > 0 ? d->baud : 1);
+    if (d->rx < 0) goto missing;
+  } else {
+    d->watch = 1ull << d->strobe;
+    if (d->strobe < 0 || d->data_lo < 0) goto missing;
+  }
+  if (d->bits < 1 || d->bits > 16 || d->mode < 0 || d->mode > 3) {
+    fprintf(stderr, "%s: bits must be 1-16, and mode 0-3.\n", spec);
+    dec_free(d);
+    return NULL;
+  }
+  return d;
+
+ missing:
+  fprintf(stderr, "%s: pins are missing.\n", spec);
+  dec_free(d);
+  return NULL;
+}
+
+void dec_free(struct decoder *d) {
+  free(d->text[0]);
+  free(d->text[1]);
+  free(d);
+}
+
+/* diff[i] = w[i + 1] ^ w[i], a vector at a time. Returns the OR of
+   diff[i] & watch over groups of four, in any[i / 4]. */
+static void edges(const uint64_t *w, uint64_t *diff, uint64_t *any, int n,
+                  uint64_t watch)
+{
+  dec_v4 a, b, m = { watch, watch, watch, watch };
+  int i;
+
+  for (i = 0; i < n; i += 4) {
+    memcpy(&a, w + i + 1, sizeof(a));
+    memcpy(&b, w + i, sizeof(b));
+    a ^= b;
+    memcpy(diff + i, &a, sizeof(a));
+    a &= m;
+    any[i / 4] = a[0] | a[1] | a[2] | a[3];
+  }
+}
+
+uint64_t dec_run(struct decoder **d, int n, struct cap_reader *r) {
+  static struct cap_change blk[DEC_BLOCK];
+  static uint64_t w[DEC_BLOCK + 4], diff[DEC_BLOCK], any[DEC_BLOCK / 4];
+  uint64_t watch = 0, count = 0, t = 0;
+  int i, j, m, k, window;
+
+  for (j = 0; j < n; ++j) watch |= d[j]->watch;
+
+  do {
+    for (m = 0; m < DEC_BLOCK && cap_next(r, &blk[m]); ++m)
+      w[m + 1] = blk[m].word;
+    if (!count && m) w[0] = w[1]; /* No edges into the first sample */
+    for (i = m; i < ((m + 3) & ~3); ++i) w[i + 1] = w[m];
+    edges(w, diff, any, m, watch);
+
+    for (i = 0; i < m; i += 4) {
+      window = 0;
+      for (k = i; k < i + 4 && k < m; ++k) window |= blk[k].marks;
+      if (!any[i / 4] && !(window & CAP_WINDOW)) continue;
+
+      for (k = i; k < i + 4 && k < m; ++k)
+        for (j = 0; j < n; ++j)
+          if ((diff[k] & d[j]->watch) || (blk[k].marks & CAP_WINDOW))
+            d[j]->change(d[j], &blk[k], w[k]);
+    }
+
+    if (m) {
+      t = blk[m - 1].t;
+      w[0] = w[m];
+    }
+    count += m;
+  } while (m == DEC_BLOCK);
+
+  for (j = 0; j < n; ++j) d[j]->finish(d[j], t);
+  return count;
+}
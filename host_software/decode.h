@@ -0,0 +1,52 @@
+#ifndef DECODE_H
+#define DECODE_H
+
+#include <stdint.h>
+
+#include "capfile.h"
+
+/* Protocol decoders for scope captures. A capture is read in blocks of
+   records; one pass XORs each sample word with the one before it (four
+   words at a time as a vector where the compiler has them), and only
+   records where a decoder's pins changed are handed to it, with the mask
+   of changed pins. Decoders work on the words as they are, so testing a
+   pin or an edge is a shift and a mask.
+
+   Specs name a decoder and assign its pins, as pin=a0 or pins=b0-b7:
+     spi:clk=a0,mosi=a1,miso=b0,cs=a2,mode=0,bits=8
+         mosi, miso and cs are optional; mode is the SPI mode (0-3). A
+         transaction runs while cs is low, or is a word without one.
+     i2c:scl=b1,sda=b0
+         Start to stop (or repeated start): read or write, the address,
+         and the bytes, with ! after one that wasn't acked.
+     uart:rx=c0,baud=9600,bits=8
+         No parity, one stop bit. Bytes less than two characters apart
+         are one transaction.
+     par:strobe=a2,data=b0-b7,edge=+,addr=c0-c7
+         The data (and addr, if given) pins as they were just before
+         each strobe edge (+ rising, the default, or - falling). */
+
+/* One decoded transaction. */
+struct dec_txn {
+  const char *decoder; /* Spec name: spi, i2c, uart, par */
+  uint64_t start, end; /* ns since the first sample */
+  const char *kind;    /* e.g. "xfer", "write", "read", "data" */
+  const char *data;    /* Hex bytes */
+  const char *info;    /* Anything else; "" if nothing */
+};
+
+typedef void dec_emit_fn(const struct dec_txn *txn, void *ctx);
+
+struct decoder;
+
+/* Returns NULL after printing why if the spec doesn't parse. */
+struct decoder *dec_create(const char *spec, dec_emit_fn *emit, void *ctx);
+void dec_free(struct decoder *d);
+
+/* Run the decoders over a capture. Returns the number of records read. */
+uint64_t dec_run(struct decoder **d, int n, struct cap_reader *r);
+
+/* Pin number of "b3" (11), or -1. */
+int dec_pin(const char *s);
+
+#endif
@@ -0,0 +1,223 @@
+/* Memory map and I/O devices for the CPU harnesses. */
+
+#include "devmap.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static unsigned char ram_read(void *ctx, unsigned addr) {
+  return ((unsigned char *)ctx)[addr];
+}
+
+static void ram_write(void *ctx, unsigned addr, unsigned char data) {
+  ((unsigned char *)ctx)[addr] = data;
+}
+
+static void rom_write(void *ctx, unsigned addr, unsigned char data) {
+}
+
+static unsigned char open_read(void *ctx, unsigned addr) {
+  return 0xff;
+}
+
+static void port_print(void *ctx, unsigned addr, unsigned char data) {
+  printf("I/O write, port %02x, val %02x\n", addr, data);
+}
+
+static void set(struct devmap_entry *e, unsigned lo, unsigned hi,
+                dev_read_fn read, dev_write_fn write, void *ctx)
+{
+  unsigned i;
+
+  for (i = lo; i <= hi && i < 256; ++i) {
+    e[i].read = read;
+    e[i].write = write;
+    e[i].ctx = ctx;
+  }
+}
+
+void devmap_init(struct devmap *m, unsigned char *ram) {
+  m->ram = ram;
+  set(m->page, 0, 255, ram_read, ram_write, ram);
+  set(m->port, 0, 255, open_read, port_print, NULL);
+}
+
+void devmap_ram(struct devmap *m, unsigned lo, unsigned hi) {
+  set(m->page, lo >> 8, hi >> 8, ram_read, ram_write, m->ram);
+}
+
+void devmap_rom(struct devmap *m, unsigned lo, unsigned hi) {
+  set(m->page, lo >> 8, hi >> 8, ram_read, rom_write, m->ram);
+}
+
+void devmap_mem(struct devmap *m, unsigned lo, unsigned hi, dev_read_fn read,
+                dev_write_fn write, void *ctx)
+{
+  set(m->page, lo >> 8, hi >> 8, read, write, ctx);
+}
+
+void devmap_port(struct devmap *m, unsigned lo, unsigned hi, dev_read_fn read,
+                 dev_write_fn write, void *ctx)
+{
+  set(m->port, lo, hi, read, write, ctx);
+}
+
+unsigned char devmap_read(struct devmap *m, unsigned addr, unsigned flags) {
+  const struct devmap_entry *e = (flags & BUS_IO) ? &m->port[addr & 0xff]
+                                                  : &m->page[addr >> 8];
+  return e->read(e->ctx, (flags & BUS_IO) ? addr & 0xff : addr);
+}
+
+void devmap_write(struct devmap *m, unsigned addr, unsigned char data,
+                  unsigned flags)
+{
+  const struct devmap_entry *e = (flags & BUS_IO) ? &m->port[addr & 0xff]
+                                                  : &m->page[addr >> 8];
+  e->write(e->ctx, (flags & BUS_IO) ? addr & 0xff : addr, data);
+}
+
+static unsigned char map_read(struct buscyc *bc, unsigned addr,
+                              unsigned flags)
+{
+  return devmap_read(bc->bus_ctx, addr, flags);
+}
+
+static void map_write(struct buscyc *bc, unsigned addr, unsigned char data,
+                      unsigned flags)
+{
+  devmap_write(bc->bus_ctx, addr, data, flags);
+}
+
+/* RAM, ROM and unmapped pages; device handlers may count or consume. */
+static int map_plain(struct buscyc *bc, unsigned addr, unsigned flags) {
+  const struct devmap *m = bc->bus_ctx;
+  dev_read_fn read = m->page[addr >> 8 & 0xff].read;
+
+  return !(flags & BUS_IO) && (read == ram_read || read == open_read);
+}
+
+void devmap_attach(struct devmap *m, struct buscyc *bc) {
+  bc->read = map_read;
+  bc->write = map_write;
+  bc->plain = map_plain;
+  bc->bus_ctx = m;
+}
+
+/* Console UART */
+
+/* Polling stdin on every status read would cost a system call per loop of
+   the CPU's wait; once in this many reads is plenty for typing. */
+#define UART_POLL_EVERY 256
+
+void uart_init(struct uart *u) {
+  memset(u, 0, sizeof(*u));
+}
+
+void uart_flush(struct uart *u) {
+  if (!u->n_out) return;
+  fwrite(u->out, 1, u->n_out, stdout);
+  fflush(stdout);
+  u->n_out = 0;
+}
+
+static void uart_poll(struct uart *u) {
+  struct pollfd pfd = { 0, POLLIN, 0 };
+  unsigned char c;
+
+  if (u->rx_full || (u->polls++ % UART_POLL_EVERY)) return;
+  if (poll(&pfd, 1, 0) == 1 && read(0, &c, 1) == 1) {
+    u->rx = c;
+    u->rx_full = 1;
+  }
+}
+
+unsigned char uart_read(void *ctx, unsigned addr) {
+  struct uart *u = ctx;
+
+  if (addr & 1) {
+    uart_poll(u);
+    return UART_TX_READY | (u->rx_full ? UART_RX_READY : 0);
+  }
+  u->rx_full = 0;
+  return u->rx;
+}
+
+void uart_write(void *ctx, unsigned addr, unsigned char data) {
+  struct uart *u = ctx;
+
+  if (addr & 1) return;
+  u->out[u->n_out++] = data;
+  if (data == '\n' || u->n_out == sizeof(u->out)) uart_flush(u);
+}
+
+/* Cycle timer */
+
+unsigned char timer_read(void *ctx, unsigned addr) {
+  struct cycle_timer *t = ctx;
+
+  addr &= 3;
+  if (!addr) t->latch = t->bc->cycles;
+  return t->latch >> (8 * addr);
+}
+
+void timer_write(void *ctx, unsigned addr, unsigned char data) {
+}
+
+/* Sector device */
+
+int disk_open(struct disk *d, const char *filename) {
+  memset(d, 0, sizeof(*d));
+  d->fd = open(filename, O_RDWR);
+  if (d->fd < 0) {
+    perror(filename);
+    return -1;
+  }
+
+  return 0;
+}
+
+void disk_close(struct disk *d) {
+  close(d->fd);
+}
+
+static void disk_command(struct disk *d, unsigned char cmd) {
+  off_t off = (off_t)d->sector * DISK_SECTOR;
+  ssize_t n = -1;
+
+  if (cmd == DISK_READ) {
+    n = pread(d->fd, d->buf, DISK_SECTOR, off);
+    /* Past the end of the file reads as blank. */
+    if (n >= 0) memset(d->buf + n, 0xff, DISK_SECTOR - n);
+    n = n >= 0 ? DISK_SECTOR : -1;
+  } else if (cmd == DISK_WRITE) {
+    n = pwrite(d->fd, d->buf, DISK_SECTOR, off);
+  }
+  d->status = (n == DISK_SECTOR) ? 0 : DISK_ERROR;
+  d->pos = 0;
+}
+
+unsigned char disk_read(void *ctx, unsigned addr) {
+  struct disk *d = ctx;
+
+  switch (addr & 7) {
+  case 0: return d->sector;
+  case 1: return d->sector >> 8;
+  case 3: return d->status;
+  case 4: return d->buf[d->pos++ % DISK_SECTOR];
+  }
+  return 0xff;
+}
+
+void disk_write(void *ctx, unsigned addr, unsigned char data) {
+  struct disk *d = ctx;
+
+  switch (addr & 7) {
+  case 0: d->sector = (d->sector & 0xff00) | data; break;
+  case 1: d->sector = (d->sector & 0xff) | data << 8; break;
+  case 2: disk_command(d, data); break;
+  case 4: d->buf[d->pos++ % DISK_SECTOR] = data; break;
+  }
+}
@@ -0,0 +1,98 @@
+#ifndef DEVMAP_H
+#define DEVMAP_H
+
+#include "buscyc.h"
+
+/* Memory map and I/O devices for the CPU harnesses. Memory is mapped in
+   256-byte pages and Z80 I/O space port by port; every entry has a read and
+   a write handler, so an access costs one table lookup and one call
+   whatever is mapped there. Handlers get the full address (or port). */
+
+typedef unsigned char (*dev_read_fn)(void *ctx, unsigned addr);
+typedef void (*dev_write_fn)(void *ctx, unsigned addr, unsigned char data);
+
+struct devmap_entry {
+  dev_read_fn read;
+  dev_write_fn write;
+  void *ctx;
+};
+
+struct devmap {
+  struct devmap_entry page[256], port[256];
+  unsigned char *ram;
+};
+
+/* All memory RAM backed by ram (64 KB), no ports. Unmapped pages and ports
+   read 0xff; writes to unmapped ports are printed. */
+void devmap_init(struct devmap *m, unsigned char *ram);
+
+/* Map pages covering addresses lo to hi. */
+void devmap_ram(struct devmap *m, unsigned lo, unsigned hi);
+void devmap_rom(struct devmap *m, unsigned lo, unsigned hi);
+void devmap_mem(struct devmap *m, unsigned lo, unsigned hi, dev_read_fn read,
+                dev_write_fn write, void *ctx);
+
+/* Map Z80 ports lo to hi. */
+void devmap_port(struct devmap *m, unsigned lo, unsigned hi, dev_read_fn read,
+                 dev_write_fn write, void *ctx);
+
+/* Serve bc's reads and writes from the map. */
+void devmap_attach(struct devmap *m, struct buscyc *bc);
+
+/* An access through the map, for handlers layered on top of it. flags are
+   the bus_rec flags; BUS_IO selects a port. */
+unsigned char devmap_read(struct devmap *m, unsigned addr, unsigned flags);
+void devmap_write(struct devmap *m, unsigned addr, unsigned char data,
+                  unsigned flags);
+
+/* Console UART. Registers: 0 data, 1 status (bit 0: a byte has been
+   received, bit 1: ready to send, always set). Output is buffered and
+   written a line at a time; input comes from stdin, polled now and then
+   while the CPU polls the status register. */
+#define UART_RX_READY 0x01
+#define UART_TX_READY 0x02
+
+struct uart {
+  char out[4096];
+  unsigned n_out;
+  int rx, rx_full;
+  unsigned polls;
+};
+
+void uart_init(struct uart *u);
+void uart_flush(struct uart *u);
+unsigned char uart_read(void *ctx, unsigned addr);
+void uart_write(void *ctx, unsigned addr, unsigned char data);
+
+/* Cycle timer. Reading register 0 latches the cycle count; registers 0-3
+   return it, least significant byte first. */
+struct cycle_timer {
+  const struct buscyc *bc;
+  unsigned long latch;
+};
+
+unsigned char timer_read(void *ctx, unsigned addr);
+void timer_write(void *ctx, unsigned addr, unsigned char data);
+
+/* Sector device backed by an image file. Registers: 0-1 sector number (low
+   byte first), 2 command (write DISK_READ or DISK_WRITE), 3 status (0 or
+   DISK_ERROR), 4 data: each access moves on to the next byte of the sector
+   buffer, starting from 0 after a command. */
+#define DISK_SECTOR 512
+#define DISK_READ   1
+#define DISK_WRITE  2
+#define DISK_ERROR  1
+
+struct disk {
+  int fd;
+  unsigned sector, pos;
+  unsigned char status;
+  unsigned char buf[DISK_SECTOR];
+};
+
+int disk_open(struct disk *d, const char *filename);
+void disk_close(struct disk *d);
+unsigned char disk_read(void *ctx, unsigned addr);
+void disk_write(void *ctx, unsigned addr, unsigned char data);
+
+#endif
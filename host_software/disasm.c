@@ -0,0 +1,422 @@
+/* Z80 and 65C02 disassemblers for the bus trace decoder. */
+
+#include "disasm.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+struct dis {
+  const unsigned char *mem;
+  unsigned pc, len;
+  int ix;           /* Z80 index prefix: 0 none, 1 ix, 2 iy */
+  int have_disp;
+  signed char disp;
+  char *buf;
+  size_t n, pos;
+  char tmp[2][16];
+};
+
+static unsigned char next(struct dis *d) {
+  return d->mem[(d->pc + d->len++) & 0xffff];
+}
+
+static unsigned next16(struct dis *d) {
+  unsigned lo = next(d);
+  return lo | next(d) << 8;
+}
+
+static void emit(struct dis *d, const char *fmt, ...) {
+  va_list ap;
+  int k;
+
+  if (d->pos >= d->n) return;
+  va_start(ap, fmt);
+  k = vsnprintf(d->buf + d->pos, d->n - d->pos, fmt, ap);
+  va_end(ap);
+  if (k > 0) d->pos += k;
+}
+
+static void dis_init(struct dis *d, const unsigned char *mem, unsigned pc,
+                     char *buf, size_t n)
+{
+  d->mem = mem;
+  d->pc = pc;
+  d->len = 0;
+  d->ix = d->have_disp = 0;
+  d->buf = buf;
+  d->n = n;
+  d->pos = 0;
+  if (n) buf[0] = 0;
+}
+
+/* Z80, decoded by the x/y/z fields of the opcode. */
+
+static const char *reg8[] = { "b", "c", "d", "e", "h", "l", "(hl)", "a" };
+static const char *cc[] = { "nz", "z", "nc", "c", "po", "pe", "p", "m" };
+static const char *alu[] = {
+  "add a,", "adc a,", "sub ", "sbc a,", "and ", "xor ", "or ", "cp "
+};
+
+static const char *hl(struct dis *d) {
+  return d->ix == 1 ? "ix" : d->ix == 2 ? "iy" : "hl";
+}
+
+static const char *rp(struct dis *d, int p) {
+  static const char *name[] = { "bc", "de", NULL, "sp" };
+  return p == 2 ? hl(d) : name[p];
+}
+
+static const char *rp2(struct dis *d, int p) {
+  static const char *name[] = { "bc", "de", NULL, "af" };
+  return p == 2 ? hl(d) : name[p];
+}
+
+/* Register r. Under an index prefix (hl) becomes (ix+d) and, unless the
+   instruction also uses (ix+d), h and l become ixh and ixl. */
+static const char *r8(struct dis *d, int r, int mem_too, int slot) {
+  char *s = d->tmp[slot];
+
+  if (!d->ix) return reg8[r];
+  if (r == 6) {
+    if (!d->have_disp) {
+      d->disp = next(d);
+      d->have_disp = 1;
+    }
+    snprintf(s, sizeof(d->tmp[slot]), "(%s%+d)", hl(d), d->disp);
+    return s;
+  }
+  if ((r == 4 || r == 5) && !mem_too) {
+    snprintf(s, sizeof(d->tmp[slot]), "%s%c", hl(d), r == 4 ? 'h' : 'l');
+    return s;
+  }
+  return reg8[r];
+}
+
+static void z80_cb(struct dis *d) {
+  static const char *rot[] = {
+    "rlc", "rrc", "rl", "rr", "sla", "sra", "sll", "srl"
+  };
+  static const char *bitop[] = { NULL, "bit", "res", "set" };
+  const char *m;
+  unsigned char op;
+  int x, y, z;
+
+  /* dd cb d op: the displacement comes before the opcode. */
+  if (d->ix) {
+    d->disp = next(d);
+    d->have_disp = 1;
+  }
+  op = next(d);
+  x = op >> 6;
+  y = (op >> 3) & 7;
+  z = op & 7;
+
+  m = r8(d, d->ix ? 6 : z, 1, 0);
+  if (!x) emit(d, "%s %s", rot[y], m);
+  else emit(d, "%s %d,%s", bitop[x], y, m);
+  if (d->ix && z != 6 && x != 1) emit(d, ",%s", reg8[z]);
+}
+
+static void z80_ed(struct dis *d) {
+  static const char *im[] = { "0", "0/1", "1", "2", "0", "0/1", "1", "2" };
+  static const char *misc[] = {
+    "ld i,a", "ld r,a", "ld a,i", "ld a,r", "rrd", "rld", "nop", "nop"
+  };
+  static const char *block[4][4] = {
+    { "ldi", "cpi", "ini", "outi" }, { "ldd", "cpd", "ind", "outd" },
+    { "ldir", "cpir", "inir", "otir" }, { "lddr", "cpdr", "indr", "otdr" }
+  };
+  unsigned char op = next(d);
+  int x = op >> 6, y = (op >> 3) & 7, z = op & 7, p = y >> 1, q = y & 1;
+  unsigned nn;
+
+  if (x == 1) {
+    switch (z) {
+    case 0:
+      if (y == 6) emit(d, "in (c)");
+      else emit(d, "in %s,(c)", reg8[y]);
+      return;
+    case 1:
+      if (y == 6) emit(d, "out (c),0");
+      else emit(d, "out (c),%s", reg8[y]);
+      return;
+    case 2: emit(d, "%s hl,%s", q ? "adc" : "sbc", rp(d, p)); return;
+    case 3:
+      nn = next16(d);
+      if (q) emit(d, "ld %s,(0x%04x)", rp(d, p), nn);
+      else emit(d, "ld (0x%04x),%s", nn, rp(d, p));
+      return;
+    case 4: emit(d, "neg"); return;
+    case 5: emit(d, y == 1 ? "reti" : "retn"); return;
+    case 6: emit(d, "im %s", im[y]); return;
+    case 7: emit(d, "%s", misc[y]); return;
+    }
+  }
+  if (x == 2 && z <= 3 && y >= 4) {
+    emit(d, "%s", block[y - 4][z]);
+    return;
+  }
+  emit(d, "db 0xed,0x%02x", op);
+}
+
+unsigned disasm_z80(const unsigned char *mem, unsigned pc, char *buf,
+                    size_t n)
+{
+  static const char *misc[] = {
+    "rlca", "rrca", "rla", "rra", "daa", "cpl", "scf", "ccf"
+  };
+  struct dis dd, *d = &dd;
+  unsigned char op;
+  int x, y, z, p, q;
+  unsigned nn;
+  const char *a, *b;
+
+  dis_init(d, mem, pc, buf, n);
+  op = next(d);
+  if (op == 0xdd || op == 0xfd) {
+    d->ix = (op == 0xdd) ? 1 : 2;
+    op = next(d);
+    /* A prefix followed by another prefix acts alone. */
+    if (op == 0xdd || op == 0xfd || op == 0xed) {
+      emit(d, "db 0x%02x", mem[pc & 0xffff]);
+      return 1;
+    }
+  }
+  if (op == 0xcb) {
+    z80_cb(d);
+    return d->len;
+  }
+  if (op == 0xed) {
+    z80_ed(d);
+    return d->len;
+  }
+
+  x = op >> 6;
+  y = (op >> 3) & 7;
+  z = op & 7;
+  p = y >> 1;
+  q = y & 1;
+
+  switch (x) {
+  case 0:
+    switch (z) {
+    case 0:
+      if (y == 0) emit(d, "nop");
+      else if (y == 1) emit(d, "ex af,af'");
+      else {
+        signed char e = next(d);
+        unsigned t = (pc + d->len + e) & 0xffff;
+        if (y == 2) emit(d, "djnz 0x%04x", t);
+        else if (y == 3) emit(d, "jr 0x%04x", t);
+        else emit(d, "jr %s,0x%04x", cc[y - 4], t);
+      }
+      break;
+    case 1:
+      if (q) emit(d, "add %s,%s", hl(d), rp(d, p));
+      else {
+        nn = next16(d);
+        emit(d, "ld %s,0x%04x", rp(d, p), nn);
+      }
+      break;
+    case 2:
+      if (p < 2) {
+        a = p ? "(de)" : "(bc)";
+        if (q) emit(d, "ld a,%s", a);
+        else emit(d, "ld %s,a", a);
+        break;
+      }
+      nn = next16(d);
+      a = (p == 2) ? hl(d) : "a";
+      if (q) emit(d, "ld %s,(0x%04x)", a, nn);
+      else emit(d, "ld (0x%04x),%s", nn, a);
+      break;
+    case 3: emit(d, "%s %s", q ? "dec" : "inc", rp(d, p)); break;
+    case 4: emit(d, "inc %s", r8(d, y, 0, 0)); break;
+    case 5: emit(d, "dec %s", r8(d, y, 0, 0)); break;
+    case 6:
+      a = r8(d, y, 0, 0);
+      emit(d, "ld %s,0x%02x", a, next(d));
+      break;
+    case 7: emit(d, "%s", misc[y]); break;
+    }
+    break;
+
+  case 1:
+    if (op == 0x76) {
+      emit(d, "halt");
+      break;
+    }
+    a = r8(d, y, z == 6, 0);
+    b = r8(d, z, y == 6, 1);
+    emit(d, "ld %s,%s", a, b);
+    break;
+
+  case 2:
+    emit(d, "%s%s", alu[y], r8(d, z, 0, 0));
+    break;
+
+  case 3:
+    switch (z) {
+    case 0: emit(d, "ret %s", cc[y]); break;
+    case 1:
+      if (!q) emit(d, "pop %s", rp2(d, p));
+      else if (p == 0) emit(d, "ret");
+      else if (p == 1) emit(d, "exx");
+      else if (p == 2) emit(d, "jp (%s)", hl(d));
+      else emit(d, "ld sp,%s", hl(d));
+      break;
+    case 2:
+      nn = next16(d);
+      emit(d, "jp %s,0x%04x", cc[y], nn);
+      break;
+    case 3:
+      switch (y) {
+      case 0: nn = next16(d); emit(d, "jp 0x%04x", nn); break;
+      case 2: emit(d, "out (0x%02x),a", next(d)); break;
+      case 3: emit(d, "in a,(0x%02x)", next(d)); break;
+      case 4: emit(d, "ex (sp),%s", hl(d)); break;
+      case 5: emit(d, "ex de,hl"); break;
+      case 6: emit(d, "di"); break;
+      case 7: emit(d, "ei"); break;
+      }
+      break;
+    case 4:
+      nn = next16(d);
+      emit(d, "call %s,0x%04x", cc[y], nn);
+      break;
+    case 5:
+      if (!q) emit(d, "push %s", rp2(d, p));
+      else {
+        nn = next16(d);
+        emit(d, "call 0x%04x", nn);
+      }
+      break;
+    case 6: emit(d, "%s0x%02x", alu[y], next(d)); break;
+    case 7: emit(d, "rst 0x%02x", y * 8); break;
+    }
+    break;
+  }
+
+  return d->len;
+}
+
+/* 65C02 (WDC), table driven. Unused opcodes are the NOPs they execute as. */
+
+enum { IMP, ACC, IMM, ZP, ZPX, ZPY, ABS, ABX, ABY, IND, IZX, IZY, IZP, IAX,
+       REL, ZPR };
+
+static const unsigned char mode_len[] = {
+  1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 2, 2, 2, 3, 2, 3
+};
+
+static const struct {
+  char name[5];
+  unsigned char mode;
+} op65[256] = {
+  /* 0 */ { "brk", IMP }, { "ora", IZX }, { "nop", IMM }, { "nop", IMP },
+          { "tsb", ZP }, { "ora", ZP }, { "asl", ZP }, { "rmb0", ZP },
+          { "php", IMP }, { "ora", IMM }, { "asl", ACC }, { "nop", IMP },
+          { "tsb", ABS }, { "ora", ABS }, { "asl", ABS }, { "bbr0", ZPR },
+  /* 1 */ { "bpl", REL }, { "ora", IZY }, { "ora", IZP }, { "nop", IMP },
+          { "trb", ZP }, { "ora", ZPX }, { "asl", ZPX }, { "rmb1", ZP },
+          { "clc", IMP }, { "ora", ABY }, { "inc", ACC }, { "nop", IMP },
+          { "trb", ABS }, { "ora", ABX }, { "asl", ABX }, { "bbr1", ZPR },
+  /* 2 */ { "jsr", ABS }, { "and", IZX }, { "nop", IMM }, { "nop", IMP },
+          { "bit", ZP }, { "and", ZP }, { "rol", ZP }, { "rmb2", ZP },
+          { "plp", IMP }, { "and", IMM }, { "rol", ACC }, { "nop", IMP },
+          { "bit", ABS }, { "and", ABS }, { "rol", ABS }, { "bbr2", ZPR },
+  /* 3 */ { "bmi", REL }, { "and", IZY }, { "and", IZP }, { "nop", IMP },
+          { "bit", ZPX }, { "and", ZPX }, { "rol", ZPX }, { "rmb3", ZP },
+          { "sec", IMP }, { "and", ABY }, { "dec", ACC }, { "nop", IMP },
+          { "bit", ABX }, { "and", ABX }, { "rol", ABX }, { "bbr3", ZPR },
+  /* 4 */ { "rti", IMP }, { "eor", IZX }, { "nop", IMM }, { "nop", IMP },
+          { "nop", ZP }, { "eor", ZP }, { "lsr", ZP }, { "rmb4", ZP },
+          { "pha", IMP }, { "eor", IMM }, { "lsr", ACC }, { "nop", IMP },
+          { "jmp", ABS }, { "eor", ABS }, { "lsr", ABS }, { "bbr4", ZPR },
+  /* 5 */ { "bvc", REL }, { "eor", IZY }, { "eor", IZP }, { "nop", IMP },
+          { "nop", ZPX }, { "eor", ZPX }, { "lsr", ZPX }, { "rmb5", ZP },
+          { "cli", IMP }, { "eor", ABY }, { "phy", IMP }, { "nop", IMP },
+          { "nop", ABS }, { "eor", ABX }, { "lsr", ABX }, { "bbr5", ZPR },
+  /* 6 */ { "rts", IMP }, { "adc", IZX }, { "nop", IMM }, { "nop", IMP },
+          { "stz", ZP }, { "adc", ZP }, { "ror", ZP }, { "rmb6", ZP },
+          { "pla", IMP }, { "adc", IMM }, { "ror", ACC }, { "nop", IMP },
+          { "jmp", IND }, { "adc", ABS }, { "ror", ABS }, { "bbr6", ZPR },
+  /* 7 */ { "bvs", REL }, { "adc", IZY }, { "adc", IZP }, { "nop", IMP },
+          { "stz", ZPX }, { "adc", ZPX }, { "ror", ZPX }, { "rmb7", ZP },
+          { "sei", IMP }, { "adc", ABY }, { "ply", IMP }, { "nop", IMP },
+          { "jmp", IAX }, { "adc", ABX }, { "ror", ABX }, { "bbr7", ZPR },
+  /* 8 */ { "bra", REL }, { "sta", IZX }, { "nop", IMM }, { "nop", IMP },
+          { "sty", ZP }, { "sta", ZP }, { "stx", ZP }, { "smb0", ZP },
+          { "dey", IMP }, { "bit", IMM }, { "txa", IMP }, { "nop", IMP },
+          { "sty", ABS }, { "sta", ABS }, { "stx", ABS }, { "bbs0", ZPR },
+  /* 9 */ { "bcc", REL }, { "sta", IZY }, { "sta", IZP }, { "nop", IMP },
+          { "sty", ZPX }, { "sta", ZPX }, { "stx", ZPY }, { "smb1", ZP },
+          { "tya", IMP }, { "sta", ABY }, { "txs", IMP }, { "nop", IMP },
+          { "stz", ABS }, { "sta", ABX }, { "stz", ABX }, { "bbs1", ZPR },
+  /* a */ { "ldy", IMM }, { "lda", IZX }, { "ldx", IMM }, { "nop", IMP },
+          { "ldy", ZP }, { "lda", ZP }, { "ldx", ZP }, { "smb2", ZP },
+          { "tay", IMP }, { "lda", IMM }, { "tax", IMP }, { "nop", IMP },
+          { "ldy", ABS }, { "lda", ABS }, { "ldx", ABS }, { "bbs2", ZPR },
+  /* b */ { "bcs", REL }, { "lda", IZY }, { "lda", IZP }, { "nop", IMP },
+          { "ldy", ZPX }, { "lda", ZPX }, { "ldx", ZPY }, { "smb3", ZP },
+          { "clv", IMP }, { "lda", ABY }, { "tsx", IMP }, { "nop", IMP },
+          { "ldy", ABX }, { "lda", ABX }, { "ldx", ABY }, { "bbs3", ZPR },
+  /* c */ { "cpy", IMM }, { "cmp", IZX }, { "nop", IMM }, { "nop", IMP },
+          { "cpy", ZP }, { "cmp", ZP }, { "dec", ZP }, { "smb4", ZP },
+          { "iny", IMP }, { "cmp", IMM }, { "dex", IMP }, { "wai", IMP },
+          { "cpy", ABS }, { "cmp", ABS }, { "dec", ABS }, { "bbs4", ZPR },
+  /* d */ { "bne", REL }, { "cmp", IZY }, { "cmp", IZP }, { "nop", IMP },
+          { "nop", ZPX }, { "cmp", ZPX }, { "dec", ZPX }, { "smb5", ZP },
+          { "cld", IMP }, { "cmp", ABY }, { "phx", IMP }, { "stp", IMP },
+          { "nop", ABS }, { "cmp", ABX }, { "dec", ABX }, { "bbs5", ZPR },
+  /* e */ { "cpx", IMM }, { "sbc", IZX }, { "nop", IMM }, { "nop", IMP },
+          { "cpx", ZP }, { "sbc", ZP }, { "inc", ZP }, { "smb6", ZP },
+          { "inx", IMP }, { "sbc", IMM }, { "nop", IMP }, { "nop", IMP },
+          { "cpx", ABS }, { "sbc", ABS }, { "inc", ABS }, { "bbs6", ZPR },
+  /* f */ { "beq", REL }, { "sbc", IZY }, { "sbc", IZP }, { "nop", IMP },
+          { "nop", ZPX }, { "sbc", ZPX }, { "inc", ZPX }, { "smb7", ZP },
+          { "sed", IMP }, { "sbc", ABY }, { "plx", IMP }, { "nop", IMP },
+          { "nop", ABS }, { "sbc", ABX }, { "inc", ABX }, { "bbs7", ZPR },
+};
+
+unsigned disasm_65c02(const unsigned char *mem, unsigned pc, char *buf,
+                      size_t n)
+{
+  struct dis dd, *d = &dd;
+  unsigned char op;
+  unsigned arg = 0, len;
+  const char *name;
+
+  dis_init(d, mem, pc, buf, n);
+  op = next(d);
+  name = op65[op].name;
+  len = mode_len[op65[op].mode];
+  if (len == 2) arg = next(d);
+  else if (len == 3) arg = next16(d);
+
+  switch (op65[op].mode) {
+  case IMP: emit(d, "%s", name); break;
+  case ACC: emit(d, "%s a", name); break;
+  case IMM: emit(d, "%s #$%02x", name, arg); break;
+  case ZP:  emit(d, "%s $%02x", name, arg); break;
+  case ZPX: emit(d, "%s $%02x,x", name, arg); break;
+  case ZPY: emit(d, "%s $%02x,y", name, arg); break;
+  case ABS: emit(d, "%s $%04x", name, arg); break;
+  case ABX: emit(d, "%s $%04x,x", name, arg); break;
+  case ABY: emit(d, "%s $%04x,y", name, arg); break;
+  case IND: emit(d, "%s ($%04x)", name, arg); break;
+  case IZX: emit(d, "%s ($%02x,x)", name, arg); break;
+  case IZY: emit(d, "%s ($%02x),y", name, arg); break;
+  case IZP: emit(d, "%s ($%02x)", name, arg); break;
+  case IAX: emit(d, "%s ($%04x,x)", name, arg); break;
+  case REL:
+    emit(d, "%s $%04x", name, (pc + 2 + (signed char)arg) & 0xffff);
+    break;
+  case ZPR:
+    emit(d, "%s $%02x,$%04x", name, arg & 0xff,
+         (pc + 3 + (signed char)(arg >> 8)) & 0xffff);
+    break;
+  }
+
+  return len;
+}
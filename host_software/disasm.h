@@ -0,0 +1,13 @@
+#ifndef DISASM_H
+#define DISASM_H
+
+#include <stddef.h>
+
+/* Disassemble the instruction at pc in a 64 KB memory image into buf.
+   Returns its length in bytes. */
+unsigned disasm_z80(const unsigned char *mem, unsigned pc, char *buf,
+                    size_t n);
+unsigned disasm_65c02(const unsigned char *mem, unsigned pc, char *buf,
+                      size_t n);
+
+#endif
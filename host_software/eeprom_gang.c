@@ -0,0 +1,347 @@
+/* Gang programmer for up to three 28C256 EEPROMs sharing address and
+   control lines. */
+/* Ports:
+    A0: #ce0 A1: #oe A2: #wr A3: #ce1 A4: #ce2
+    B - Data, chip 0
+    C - Address[7:0]
+    D - Address[14:8]
+    E - Data, chip 1
+    F - Data, chip 2
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "busyboard.h"
+#include "image.h"
+
+#define EEPROM_SIZE 0x8000
+#define PAGE_SIZE   64
+#define MAX_CHIPS   3
+
+#define CTL_OE   0x02
+#define CTL_WR   0x04
+#define CTL_IDLE 0x1f /* All chip enables, OE, and WR de-asserted */
+
+/* Tristate mask with and without the data ports driven. */
+#define TRI_READ  0x0d
+#define TRI_WRITE 0x3f
+
+/* A page write takes 10 ms max; anything past this has failed. */
+#define WRITE_TIMEOUT 0.05
+
+/* Attempts per page before a chip is dropped from the run. */
+#define MAX_TRIES 4
+
+/* The parts start their write cycle if #WR stays high longer than this
+   between bytes of a page load. */
+#define T_BLC 150e-6
+
+static const unsigned char ce_bit[MAX_CHIPS] = { 0x01, 0x08, 0x10 };
+static const int data_port[MAX_CHIPS] = { 1, 4, 5 };
+
+struct chip {
+  const char *filename;
+  struct image img;
+  const struct image *im; /* img, or another chip's when shared. */
+  unsigned len;
+
+  unsigned char want[EEPROM_SIZE], cur[EEPROM_SIZE];
+  int failed;
+  unsigned pages, retries, bad;
+  double lat_max, lat_sum;
+  unsigned n_lat;
+};
+
+struct gang {
+  busyboard_t *bb;
+  struct chip chip[MAX_CHIPS];
+  int n;
+  int byte_mode; /* Frames outlast T_BLC: one byte per write cycle. */
+};
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void set_addr(busyboard_t *bb, unsigned addr) {
+  bb->out_state[2] = addr & 0xff;
+  bb->out_state[3] = (addr >> 8) & 0x7f;
+}
+
+void gang_idle(busyboard_t *bb) {
+  bb->out_state[0] = CTL_IDLE;
+  bb->trimask = TRI_READ;
+  busyboard_out(bb);
+}
+
+/* Control port value with the chips in mask selected. */
+unsigned char select_chips(unsigned mask) {
+  unsigned char ctl = CTL_IDLE;
+  int i;
+
+  for (i = 0; i < MAX_CHIPS; ++i)
+    if (mask & (1 << i)) ctl &= ~ce_bit[i];
+
+  return ctl;
+}
+
+/* Read len bytes from every chip at once, one frame per byte. */
+void gang_read(struct gang *g, unsigned addr, unsigned len) {
+  busyboard_t *bb = g->bb;
+  unsigned i;
+  int c;
+
+  bb->trimask = TRI_READ;
+  bb->out_state[0] = select_chips((1 << g->n) - 1) & ~CTL_OE;
+  set_addr(bb, addr);
+  busyboard_out(bb);
+
+  for (i = 0; i < len; ++i) {
+    set_addr(bb, addr + i + 1);
+    busyboard_xfer(bb);
+    for (c = 0; c < g->n; ++c)
+      g->chip[c].cur[addr + i] = bb->in_state[data_port[c]];
+  }
+
+  gang_idle(bb);
+}
+
+/* Load bytes [lo, hi) of want[] into the chips in mask, each from its own
+   image, and DATA#-poll each of them on the last byte. Returns the mask of
+   chips that finished in time. Timing as in eeprom_prog: #WR falls with the
+   data and rises with the next address. */
+unsigned gang_load_page(struct gang *g, unsigned mask, unsigned lo,
+                        unsigned hi)
+{
+  busyboard_t *bb = g->bb;
+  unsigned char sel = select_chips(mask);
+  unsigned a, done = 0, seen = 0;
+  double start;
+  int c;
+
+  bb->trimask = TRI_WRITE;
+  bb->out_state[0] = sel;
+  set_addr(bb, lo);
+  busyboard_out(bb);
+
+  for (a = lo; a < hi; ++a) {
+    for (c = 0; c < g->n; ++c)
+      bb->out_state[data_port[c]] = g->chip[c].want[a];
+    bb->out_state[0] = sel & ~CTL_WR;
+    busyboard_out(bb);
+
+    bb->out_state[0] = sel;
+    set_addr(bb, a + 1 < hi ? a + 1 : a);
+    busyboard_out(bb);
+  }
+  start = now();
+
+  /* Poll all the chips with the same samples. */
+  bb->trimask = TRI_READ;
+  bb->out_state[0] = sel & ~CTL_OE;
+  busyboard_out(bb);
+
+  while (done != mask && now() - start < WRITE_TIMEOUT) {
+    busyboard_xfer(bb);
+    for (c = 0; c < g->n; ++c) {
+      struct chip *ch = &g->chip[c];
+      unsigned char data = ch->want[hi - 1];
+      if (!(mask & ~done & (1 << c))) continue;
+      if ((bb->in_state[data_port[c]] ^ data) & 0x80) continue;
+
+      /* I/O7 settles first; take another sample for the rest of the byte. */
+      if (!(seen & (1 << c))) {
+        seen |= 1 << c;
+        continue;
+      }
+
+      double t = now() - start;
+      done |= 1 << c;
+      ch->lat_sum += t;
+      ch->n_lat++;
+      if (t > ch->lat_max) ch->lat_max = t;
+    }
+  }
+
+  gang_idle(bb);
+  return done;
+}
+
+/* As eeprom_prog's: time a few frames, and return 1 if they're too slow
+   to hold a page load open, so pages have to go a byte at a time. */
+int check_frame_time(busyboard_t *bb) {
+  double start = now();
+  int i;
+
+  for (i = 0; i < 32; ++i) busyboard_out(bb);
+  double t = (now() - start)/32;
+  if (t <= T_BLC) return 0;
+  fprintf(stderr, "Warning: %.0f us frames exceed the %.0f us byte load "
+          "window; pages will be written a byte at a time.\n",
+          t * 1e6, T_BLC * 1e6);
+  return 1;
+}
+
+/* Write one page to every live chip whose contents differ from its image,
+   re-reading and retrying the chips that come back wrong. In byte mode
+   every byte gets a write cycle of its own. */
+void gang_write_page(struct gang *g, unsigned page) {
+  unsigned base = page * PAGE_SIZE, lo = base + PAGE_SIZE, hi = base, mask = 0;
+  unsigned ok, a;
+  int c, tries;
+
+  for (c = 0; c < g->n; ++c) {
+    struct chip *ch = &g->chip[c];
+    unsigned l = base, h = base + PAGE_SIZE;
+    if (ch->failed) continue;
+    while (l < h && ch->want[l] == ch->cur[l]) l++;
+    while (h > l && ch->want[h - 1] == ch->cur[h - 1]) h--;
+    if (l >= h) continue;
+
+    mask |= 1 << c;
+    if (l < lo) lo = l;
+    if (h > hi) hi = h;
+  }
+
+  /* Outside its image a chip is loaded with what it already holds, so the
+     span can be shared. */
+  for (tries = 0; mask && tries < MAX_TRIES; ++tries) {
+    if (g->byte_mode)
+      for (a = lo, ok = mask; a < hi; ++a)
+        ok &= gang_load_page(g, mask, a, a + 1);
+    else
+      ok = gang_load_page(g, mask, lo, hi);
+    gang_read(g, lo, hi - lo);
+
+    for (c = 0; c < g->n; ++c) {
+      struct chip *ch = &g->chip[c];
+      if (!(mask & (1 << c))) continue;
+      if (tries) ch->retries++;
+      if ((ok & (1 << c)) && !memcmp(ch->cur + lo, ch->want + lo, hi - lo)) {
+        ch->pages++;
+        mask &= ~(1 << c);
+      }
+    }
+  }
+
+  /* Whoever is still left failed; stop selecting them. */
+  for (c = 0; c < g->n; ++c) {
+    if (!(mask & (1 << c))) continue;
+    g->chip[c].failed = 1;
+    fprintf(stderr, "\nChip %d (%s): write of page %04x failed; dropping it.\n",
+            c, g->chip[c].filename, base);
+  }
+}
+
+void usage(const char *argv0) {
+  fprintf(stderr,
+    "Usage: %s [-p parport] [-N chips] [-n] [-b] [-F format] image0 [image1\n"
+    "       [image2]]\n"
+    "  Programs up to three chips at once, each from its own image. With one\n"
+    "  image and -N, every chip gets the same image. Pages already holding\n"
+    "  the right data are skipped, as are addresses an image doesn't cover\n"
+    "  (Intel HEX and S-record images may be sparse). -b also leaves pages\n"
+    "  that are blank (all 0xff) in an image alone. -n skips the final\n"
+    "  verify pass. Images are read as -F says (ihex, srec, bytes or bin),\n"
+    "  or by extension: .hex, .ihx, .s19, .srec and .mot are text, anything\n"
+    "  else binary.\n", argv0);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  const char *parport = "/dev/parport0", *format = NULL;
+  static struct gang g;
+  unsigned len = 0, p, a;
+  int c, i, n_chips = 0, do_verify = 1, skip_blank = 0, ret = 0;
+  double start, t;
+
+  while ((c = getopt(argc, argv, "p:N:nbF:")) != -1) {
+    switch (c) {
+    case 'p': parport = optarg; break;
+    case 'N': n_chips = atoi(optarg); break;
+    case 'n': do_verify = 0; break;
+    case 'b': skip_blank = 1; break;
+    case 'F': format = optarg; break;
+    default: usage(argv[0]);
+    }
+  }
+
+  g.n = argc - optind;
+  if (g.n < 1 || g.n > MAX_CHIPS) usage(argv[0]);
+  if (n_chips) {
+    if (g.n != 1 || n_chips < 1 || n_chips > MAX_CHIPS) usage(argv[0]);
+    g.n = n_chips;
+  }
+
+  for (i = 0; i < g.n; ++i) {
+    struct chip *ch = &g.chip[i];
+    ch->filename = argv[optind + (n_chips ? 0 : i)];
+    if (i && n_chips) {
+      ch->im = g.chip[0].im;
+    } else {
+      if (image_load(&ch->img, ch->filename, 0, format)) return 1;
+      if (skip_blank && image_strip_blank(&ch->img, PAGE_SIZE)) return 1;
+      ch->im = &ch->img;
+    }
+    ch->len = ch->im->hi;
+    if (!ch->im->n_seg || ch->len > EEPROM_SIZE) {
+      fprintf(stderr, "%s: image must have data below %x.\n", ch->filename,
+              EEPROM_SIZE);
+      return 1;
+    }
+    if (ch->len > len) len = ch->len;
+  }
+
+  busyboard_t bb;
+  init_busyboard(&bb, parport);
+  g.bb = &bb;
+  gang_idle(&bb);
+  g.byte_mode = check_frame_time(&bb);
+
+  start = now();
+  gang_read(&g, 0, len);
+  for (i = 0; i < g.n; ++i) {
+    memcpy(g.chip[i].want, g.chip[i].cur, len);
+    image_copy(g.chip[i].im, g.chip[i].want, 0, len);
+  }
+
+  for (p = 0; p < (len + PAGE_SIZE - 1)/PAGE_SIZE; ++p) {
+    gang_write_page(&g, p);
+    fprintf(stderr, "\r%04x", (p + 1) * PAGE_SIZE);
+  }
+  fputc('\n', stderr);
+  t = now() - start;
+  printf("Programmed %d chips in %.2f s.\n", g.n, t);
+
+  if (do_verify) gang_read(&g, 0, len);
+
+  for (i = 0; i < g.n; ++i) {
+    struct chip *ch = &g.chip[i];
+
+    if (do_verify && !ch->failed)
+      for (a = 0; a < ch->len; ++a)
+        if (ch->cur[a] != ch->want[a]) ch->bad++;
+
+    printf("Chip %d (%s): %s, %u pages written, %u retries", i, ch->filename,
+           ch->failed ? "FAILED" : ch->bad ? "VERIFY FAILED" : "ok",
+           ch->pages, ch->retries);
+    if (ch->n_lat)
+      printf(", write latency mean %.2f ms max %.2f ms",
+             ch->lat_sum/ch->n_lat * 1e3, ch->lat_max * 1e3);
+    if (ch->bad) printf(", %u bytes mismatched", ch->bad);
+    printf(".\n");
+
+    if (ch->failed || ch->bad) ret = 1;
+  }
+
+  for (i = 0; i < g.n; ++i) image_free(&g.chip[i].img);
+  close_busyboard(&bb);
+
+  return ret;
+}
@@ -0,0 +1,633 @@
+/* 28C256 EEPROM programmer: page writes with DATA#/toggle-bit polling. */
+/* Ports (as in 28c256_test):
+    A0: #ce A1: #oe A2: #wr
+    B - Data
+    C - Address[7:0]
+    D - Address[15:8]
+    E - Address[23:16]
+    F
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "busyboard.h"
+#include "image.h"
+
+#define EEPROM_SIZE 0x8000
+#define PAGE_SIZE   64
+#define N_PAGES     (EEPROM_SIZE/PAGE_SIZE)
+
+/* Control port values. */
+#define CTL_IDLE  7 /* CE, OE, and WR de-asserted */
+#define CTL_SEL   6 /* CE asserted */
+#define CTL_WRITE 2 /* CE and WR asserted */
+#define CTL_READ  4 /* CE and OE asserted */
+
+/* A page write takes 10 ms max; anything past this has failed. */
+#define WRITE_TIMEOUT 0.05
+
+/* Attempts per page before giving up on it. */
+#define MAX_TRIES 4
+
+/* The part starts its write cycle if #WE stays high longer than this between
+   bytes of a page load. */
+#define T_BLC 150e-6
+
+enum poll_mode { POLL_DATA, POLL_TOGGLE };
+
+struct eeprom {
+  busyboard_t *bb;
+  enum poll_mode mode;
+  int sdp; /* Prefix each page with the software data protection sequence. */
+  int byte_mode; /* Frames outlast T_BLC: one byte per write cycle. */
+
+  /* Observed page write latencies, seconds. */
+  double *lat;
+  unsigned n_lat;
+  unsigned long polls, retries;
+};
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void set_addr(busyboard_t *bb, unsigned addr) {
+  bb->out_state[2] = addr & 0xff;
+  bb->out_state[3] = (addr >> 8) & 0xff;
+  bb->out_state[4] = (addr >> 16) & 0xff;
+}
+
+void eeprom_init(busyboard_t *bb) {
+  bb->out_state[0] = CTL_IDLE;
+  bb->trimask = 0x3d;
+  busyboard_out(bb);
+}
+
+/* Load one byte of a page write. The caller has already put addr on the bus
+   with #WR high; #WR falls here together with the data, latching the address,
+   then rises together with the next byte's address, latching the data. */
+void load_byte(busyboard_t *bb, unsigned char data, unsigned next_addr) {
+  bb->out_state[0] = CTL_WRITE;
+  bb->out_state[1] = data;
+  busyboard_out(bb);
+
+  bb->out_state[0] = CTL_SEL;
+  set_addr(bb, next_addr);
+  busyboard_out(bb);
+}
+
+/* Wait for the internal write cycle to finish, reading back addr, which must
+   have been the last byte loaded with value data. Returns 0 on success, -1 on
+   timeout, or -2 if the part finished but holds the wrong value, which means
+   the page load was cut short. */
+int eeprom_poll(struct eeprom *e, unsigned addr, unsigned char data) {
+  busyboard_t *bb = e->bb;
+  double start = now();
+  unsigned char prev = 0;
+  int first = 1, ret;
+
+  bb->trimask = 0x3d;
+  bb->out_state[0] = CTL_READ;
+  set_addr(bb, addr);
+  busyboard_out(bb);
+
+  for (;;) {
+    unsigned char x;
+
+    /* Sample with #OE low. Toggle polling needs a fresh read cycle for every
+       sample, so bounce #OE between samples. */
+    if (e->mode == POLL_TOGGLE) bb->out_state[0] = CTL_SEL;
+    busyboard_xfer(bb);
+    x = bb->in_state[1];
+    e->polls++;
+
+    /* I/O6 toggles, and I/O7 reads back inverted, until the write is done. */
+    if (e->mode == POLL_TOGGLE) {
+      if (!first && !((x ^ prev) & 0x40)) {
+        ret = (x == data) ? 0 : -2;
+        break;
+      }
+      prev = x;
+      first = 0;
+      bb->out_state[0] = CTL_READ;
+      busyboard_out(bb);
+    } else if (!((x ^ data) & 0x80)) {
+      /* I/O7 settles first; take another sample for the rest of the byte. */
+      if (!first) {
+        ret = (x == data) ? 0 : -2;
+        break;
+      }
+      first = 0;
+    }
+
+    if (now() - start > WRITE_TIMEOUT) {
+      ret = -1;
+      break;
+    }
+  }
+
+  eeprom_init(bb);
+  return ret;
+}
+
+/* Load n bytes within one page and wait for the write cycle. */
+int eeprom_load_page(struct eeprom *e, unsigned addr,
+                     const unsigned char *buf, int n)
+{
+  static const unsigned sdp_addr[] = { 0x5555, 0x2aaa, 0x5555 };
+  static const unsigned char sdp_data[] = { 0xaa, 0x55, 0xa0 };
+  busyboard_t *bb = e->bb;
+  double start;
+  int i, ret;
+
+  bb->trimask = 0x3f;
+  bb->out_state[0] = CTL_SEL;
+  set_addr(bb, e->sdp ? sdp_addr[0] : addr);
+  busyboard_out(bb);
+
+  if (e->sdp)
+    for (i = 0; i < 3; ++i)
+      load_byte(bb, sdp_data[i], i < 2 ? sdp_addr[i + 1] : addr);
+
+  for (i = 0; i < n; ++i)
+    load_byte(bb, buf[i], addr + i + (i < n - 1));
+  start = now();
+
+  ret = eeprom_poll(e, addr + n - 1, buf[n - 1]);
+  if (!ret) e->lat[e->n_lat++] = now() - start;
+
+  return ret;
+}
+
+/* Read len bytes. The address of each byte is shifted out in the same frame
+   that samples the previous one, so a read costs one frame per byte. */
+void eeprom_read(busyboard_t *bb, unsigned addr, unsigned char *buf,
+                 unsigned len)
+{
+  unsigned i;
+
+  bb->trimask = 0x3d;
+  bb->out_state[0] = CTL_READ;
+  set_addr(bb, addr);
+  busyboard_out(bb);
+
+  for (i = 0; i < len; ++i) {
+    set_addr(bb, addr + i + 1);
+    busyboard_xfer(bb);
+    buf[i] = bb->in_state[1];
+  }
+
+  eeprom_init(bb);
+}
+
+/* Write n bytes within one page, reading them back afterwards. A page load
+   that stalls past the byte load window (the host got preempted, say) starts
+   the write early and drops the remaining bytes, so retry a few times. In
+   byte mode every byte gets a write cycle of its own instead. */
+int eeprom_write_page(struct eeprom *e, unsigned addr,
+                      const unsigned char *buf, int n)
+{
+  unsigned char check[PAGE_SIZE];
+  int tries, i;
+
+  for (tries = 0; tries < MAX_TRIES; ++tries) {
+    if (tries) e->retries++;
+    if (e->byte_mode) {
+      for (i = 0; i < n; ++i)
+        if (eeprom_load_page(e, addr + i, buf + i, 1) == -1) break;
+      if (i < n) continue;
+    } else if (eeprom_load_page(e, addr, buf, n) == -1) {
+      continue;
+    }
+    eeprom_read(e->bb, addr, check, n);
+    if (!memcmp(check, buf, n)) return 0;
+  }
+
+  return -1;
+}
+
+int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+void print_latencies(struct eeprom *e) {
+  double sum = 0;
+  unsigned i, hist[12] = { 0 };
+
+  if (!e->n_lat) return;
+
+  for (i = 0; i < e->n_lat; ++i) {
+    unsigned ms = e->lat[i] * 1000;
+    sum += e->lat[i];
+    hist[ms < 11 ? ms : 11]++;
+  }
+  qsort(e->lat, e->n_lat, sizeof(double), cmp_double);
+
+  printf("Write cycle latency over %u %s: min %.2f ms, median %.2f ms, "
+         "mean %.2f ms, max %.2f ms, %lu polls, %lu retries.\n", e->n_lat,
+         e->byte_mode ? "bytes" : "pages",
+         e->lat[0] * 1e3, e->lat[e->n_lat/2] * 1e3, sum/e->n_lat * 1e3,
+         e->lat[e->n_lat - 1] * 1e3, e->polls, e->retries);
+  for (i = 0; i < 12; ++i)
+    if (hist[i]) printf("  %2u%s ms: %u\n", i, i == 11 ? "+" : "", hist[i]);
+}
+
+/* Time a few frames; slower links can't hold a page load open. Returns 1
+   if pages have to be written a byte at a time. */
+int check_frame_time(busyboard_t *bb) {
+  double start = now();
+  int i;
+
+  for (i = 0; i < 32; ++i) busyboard_out(bb);
+  double t = (now() - start)/32;
+  if (t <= T_BLC) return 0;
+  fprintf(stderr, "Warning: %.0f us frames exceed the %.0f us byte load "
+          "window; pages will be written a byte at a time.\n",
+          t * 1e6, T_BLC * 1e6);
+  return 1;
+}
+
+unsigned crc32(unsigned crc, const unsigned char *buf, unsigned len) {
+  static unsigned table[256];
+  unsigned i, j;
+
+  if (!table[1]) {
+    for (i = 0; i < 256; ++i) {
+      unsigned c = i;
+      for (j = 0; j < 8; ++j) c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+      table[i] = c;
+    }
+  }
+
+  crc = ~crc;
+  for (i = 0; i < len; ++i) crc = table[(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
+/* Read whole pages first to last, filling chip[] and computing each page's
+   CRC as its bytes arrive. */
+void read_pages(busyboard_t *bb, unsigned first, unsigned last,
+                unsigned char *chip, unsigned *crc)
+{
+  unsigned i, addr = first * PAGE_SIZE, len = (last - first + 1) * PAGE_SIZE;
+
+  bb->trimask = 0x3d;
+  bb->out_state[0] = CTL_READ;
+  set_addr(bb, addr);
+  busyboard_out(bb);
+
+  for (i = 0; i < len; ++i) {
+    set_addr(bb, addr + i + 1);
+    busyboard_xfer(bb);
+    chip[addr + i] = bb->in_state[1];
+    if ((addr + i) % PAGE_SIZE == PAGE_SIZE - 1)
+      crc[(addr + i)/PAGE_SIZE] = crc32(0, chip + addr + i + 1 - PAGE_SIZE,
+                                        PAGE_SIZE);
+  }
+
+  eeprom_init(bb);
+}
+
+/* Manifest: CRC of every page of a particular chip's contents, one
+   "page crc" line per page, so unchanged pages need not even be read. */
+int load_manifest(const char *filename, unsigned *crc, unsigned char *valid) {
+  FILE *fp = fopen(filename, "r");
+  unsigned page, c;
+
+  if (!fp) return -1;
+  while (fscanf(fp, "%x %x\n", &page, &c) == 2)
+    if (page < N_PAGES) { crc[page] = c; valid[page] = 1; }
+  fclose(fp);
+
+  return 0;
+}
+
+void save_manifest(const char *filename, const unsigned *crc,
+                   const unsigned char *valid)
+{
+  FILE *fp = fopen(filename, "w");
+  unsigned i;
+
+  if (!fp) {
+    perror(filename);
+    return;
+  }
+  for (i = 0; i < N_PAGES; ++i)
+    if (valid[i]) fprintf(fp, "%03x %08x\n", i, crc[i]);
+  fclose(fp);
+}
+
+/* Journal: which pages of a particular image are already done, so that an
+   interrupted write picks up where it stopped. */
+struct journal {
+  char magic[8];
+  unsigned image_hash, offset, len;
+  unsigned char done[N_PAGES/8];
+};
+
+static const char journal_magic[8] = "BBEEJRN";
+
+void load_journal(const char *filename, struct journal *j) {
+  struct journal old;
+  FILE *fp = fopen(filename, "rb");
+
+  if (!fp) return;
+  if (fread(&old, sizeof(old), 1, fp) == 1 &&
+      !memcmp(old.magic, journal_magic, sizeof(old.magic)) &&
+      old.image_hash == j->image_hash && old.offset == j->offset &&
+      old.len == j->len)
+  {
+    memcpy(j->done, old.done, sizeof(j->done));
+  }
+  fclose(fp);
+}
+
+void save_journal(const char *filename, const struct journal *j) {
+  FILE *fp = fopen(filename, "wb");
+  if (!fp || fwrite(j, sizeof(*j), 1, fp) != 1) perror(filename);
+  if (fp) fclose(fp);
+}
+
+/* Copy the image bytes that fall in the page at chip address lo into want,
+   returning how many there were. The page is clipped to where the image
+   starts on the chip first, since below that lo - offset has no image
+   address. */
+unsigned copy_page(const struct image *img, unsigned char *want,
+                   unsigned lo, unsigned offset)
+{
+  unsigned from = offset + img->lo;
+
+  if (from < lo) from = lo;
+  if (from >= lo + PAGE_SIZE) return 0;
+  return image_copy(img, want + from, from - offset, lo + PAGE_SIZE - from);
+}
+
+/* Program an image, writing only pages whose contents differ. Current page
+   contents come from the manifest when it has them and the image covers the
+   whole page, and are read from the chip otherwise. Pages the image doesn't
+   touch are left alone. */
+int write_image(struct eeprom *e, const struct image *img, unsigned offset,
+                const char *manifest, const char *journal, int do_verify)
+{
+  static unsigned char chip[EEPROM_SIZE], want[EEPROM_SIZE], need[N_PAGES],
+                       valid[N_PAGES];
+  static unsigned crc[N_PAGES], cov[N_PAGES];
+  unsigned first = (offset + img->lo) / PAGE_SIZE,
+           last = (offset + img->hi - 1) / PAGE_SIZE, p, q, written = 0,
+           resumed = 0, bytes = 0, bad = 0, checked = 0;
+  struct journal j;
+  double start = now(), t;
+  int ret = 0;
+
+  if (manifest) load_manifest(manifest, crc, valid);
+
+  memset(&j, 0, sizeof(j));
+  memcpy(j.magic, journal_magic, sizeof(j.magic));
+  j.image_hash = image_hash(img);
+  j.offset = offset;
+  j.len = img->hi - img->lo;
+  if (journal) load_journal(journal, &j);
+
+  /* Image bytes per page; a page is only diffed from its manifest CRC when
+     the image fills it. */
+  for (p = first; p <= last; ++p) {
+    unsigned lo = p * PAGE_SIZE;
+    cov[p] = copy_page(img, want, lo, offset);
+  }
+
+  /* Work out which pages have to be read to be diffed. */
+  for (p = first; p <= last; ++p) {
+    unsigned lo = p * PAGE_SIZE;
+
+    if (!cov[p]) continue;
+    if (j.done[p/8] & (1 << p%8)) {
+      resumed++;
+      continue;
+    }
+
+    need[p] = !valid[p] || cov[p] < PAGE_SIZE ||
+              crc32(0, want + lo, PAGE_SIZE) != crc[p];
+  }
+
+  /* Read runs of needed pages in one go each. */
+  for (p = first; p <= last; p = q + 1) {
+    for (q = p; q <= last && need[q]; ++q);
+    if (q > p) read_pages(e->bb, p, q - 1, chip, crc);
+    for (; p < q; ++p) valid[p] = 1;
+  }
+
+  for (p = first; p <= last; ++p) {
+    unsigned lo = p * PAGE_SIZE, hi = lo + PAGE_SIZE;
+
+    if (!need[p]) continue;
+
+    /* Partly covered pages keep the rest of what the chip holds. */
+    if (cov[p] < PAGE_SIZE) {
+      memcpy(want + lo, chip + lo, PAGE_SIZE);
+      copy_page(img, want, lo, offset);
+    }
+
+    while (lo < hi && want[lo] == chip[lo]) lo++;
+    while (hi > lo && want[hi - 1] == chip[hi - 1]) hi--;
+    if (lo < hi) {
+      if (eeprom_write_page(e, lo, want + lo, hi - lo)) {
+        fprintf(stderr, "\nWrite of page %04x failed.\n", p * PAGE_SIZE);
+        valid[p] = 0;
+        ret = 1;
+        continue;
+      }
+      written++;
+      bytes += hi - lo;
+    }
+
+    crc[p] = crc32(0, want + p * PAGE_SIZE, PAGE_SIZE);
+    j.done[p/8] |= 1 << p%8;
+    if (journal && lo < hi) save_journal(journal, &j);
+    fprintf(stderr, "\r%04x", (p + 1) * PAGE_SIZE);
+  }
+  fputc('\n', stderr);
+
+  t = now() - start;
+  for (p = first; p <= last; ++p) if (cov[p]) checked++;
+  printf("Wrote %u bytes in %u of %u pages (%u resumed) in %.2f s.\n",
+         bytes, written, checked, resumed, t);
+  print_latencies(e);
+
+  if (do_verify) {
+    static unsigned got[N_PAGES];
+    start = now();
+    for (p = first; p <= last; p = q + 1) {
+      for (q = p; q <= last && cov[q]; ++q);
+      if (q > p) read_pages(e->bb, p, q - 1, chip, got);
+    }
+    for (p = first; p <= last; ++p) {
+      unsigned lo = p * PAGE_SIZE;
+
+      if (!cov[p]) continue;
+
+      /* Compare only the bytes the image asked for. */
+      valid[p] = 1;
+      crc[p] = got[p];
+      memcpy(want + lo, chip + lo, PAGE_SIZE);
+      copy_page(img, want, lo, offset);
+      if (got[p] == crc32(0, want + lo, PAGE_SIZE)) continue;
+      printf("Page %04x CRC mismatch: read %08x.\n", lo, got[p]);
+      bad++;
+    }
+    t = now() - start;
+    printf("Verify: %u bad pages of %u, %.2f s.\n", bad, checked, t);
+    if (bad) ret = 1;
+  }
+
+  if (manifest) save_manifest(manifest, crc, valid);
+  if (journal && !ret) remove(journal);
+
+  return ret;
+}
+
+/* Read back every segment of the image and count mismatching bytes. */
+unsigned verify(busyboard_t *bb, unsigned offset, const struct image *img) {
+  static unsigned char buf[EEPROM_SIZE];
+  unsigned i, k, bad = 0;
+
+  for (k = 0; k < img->n_seg; ++k) {
+    const struct image_seg *s = &img->seg[k];
+    unsigned base = offset + s->addr;
+
+    eeprom_read(bb, base, buf, s->len);
+    for (i = 0; i < s->len; ++i) {
+      if (buf[i] == s->data[i]) continue;
+      if (bad++ < 16)
+        printf("Mismatch at %04x: read %02x, expected %02x.\n",
+               base + i, buf[i], s->data[i]);
+    }
+  }
+
+  return bad;
+}
+
+void usage(const char *argv0) {
+  fprintf(stderr,
+    "Usage: %s [-p parport] [-o offset] [-t] [-s] [-n] [-b] [-m manifest]\n"
+    "          [-j journal] [-F format] command file\n"
+    "  write file    Program the pages of file that differ from the chip.\n"
+    "  verify file   Compare EEPROM at offset against file.\n"
+    "  read file     Dump the whole EEPROM to file.\n"
+    "  -t polls the toggle bit instead of DATA#, -s sends the software data\n"
+    "  protection sequence with every page, -n skips the verify pass.\n"
+    "  -m keeps per-page CRCs of this chip's contents between runs, so that\n"
+    "  unchanged pages are skipped without reading them. -j records finished\n"
+    "  pages so an interrupted write resumes where it stopped.\n"
+    "  Files are Intel HEX, S-records or raw binary; only the pages a file\n"
+    "  covers are written. -b also leaves pages that are blank (all 0xff) in\n"
+    "  the file alone. -F gives the format (ihex, srec, bytes or bin);\n"
+    "  without it .hex, .ihx, .s19, .srec and .mot are text and anything\n"
+    "  else is binary.\n",
+    argv0);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  const char *parport = "/dev/parport0", *manifest = NULL, *journal = NULL,
+             *format = NULL;
+  struct eeprom e;
+  unsigned offset = 0, len, bad, i;
+  static unsigned char buf[EEPROM_SIZE];
+  struct image img;
+  int c, do_verify = 1, skip_blank = 0, ret = 0;
+  double start, t;
+
+  memset(&e, 0, sizeof(e));
+  while ((c = getopt(argc, argv, "p:o:tsnbm:j:F:")) != -1) {
+    switch (c) {
+    case 'p': parport = optarg; break;
+    case 'o': offset = strtoul(optarg, NULL, 0); break;
+    case 't': e.mode = POLL_TOGGLE; break;
+    case 's': e.sdp = 1; break;
+    case 'n': do_verify = 0; break;
+    case 'b': skip_blank = 1; break;
+    case 'm': manifest = optarg; break;
+    case 'j': journal = optarg; break;
+    case 'F': format = optarg; break;
+    default: usage(argv[0]);
+    }
+  }
+  if (optind + 2 != argc) usage(argv[0]);
+
+  busyboard_t bb;
+  init_busyboard(&bb, parport);
+  e.bb = &bb;
+  eeprom_init(&bb);
+
+  start = now();
+  if (!strcmp(argv[optind], "read")) {
+    eeprom_read(&bb, 0, buf, EEPROM_SIZE);
+    FILE *fp = fopen(argv[optind + 1], "wb");
+    if (!fp || fwrite(buf, 1, EEPROM_SIZE, fp) != EEPROM_SIZE) {
+      perror(argv[optind + 1]);
+      ret = 1;
+    }
+    if (fp) fclose(fp);
+    t = now() - start;
+    printf("Read %u bytes in %.2f s (%.0f B/s).\n", EEPROM_SIZE, t,
+           EEPROM_SIZE/t);
+  } else if (!strcmp(argv[optind], "write") ||
+             !strcmp(argv[optind], "verify")) {
+    if (image_load(&img, argv[optind + 1], 0, format)) {
+      close_busyboard(&bb);
+      return 1;
+    }
+    if (skip_blank && image_strip_blank(&img, PAGE_SIZE)) {
+      close_busyboard(&bb);
+      return 1;
+    }
+    for (i = len = 0; i < img.n_seg; ++i) len += img.seg[i].len;
+    printf("%s: %s, %u bytes in %u segments.\n", argv[optind + 1],
+           img.format, len, img.n_seg);
+    if (!len) {
+      printf("Nothing to do.\n");
+      close_busyboard(&bb);
+      return 0;
+    }
+    if (img.hi > EEPROM_SIZE || offset > EEPROM_SIZE - img.hi) {
+      fprintf(stderr, "Image does not fit: %x-%x at %u.\n", img.lo, img.hi,
+              offset);
+      close_busyboard(&bb);
+      return 1;
+    }
+
+    if (!strcmp(argv[optind], "write")) {
+      e.byte_mode = check_frame_time(&bb);
+      e.lat = malloc(sizeof(double) * MAX_TRIES *
+                     (e.byte_mode ? EEPROM_SIZE : N_PAGES));
+      if (!e.lat) {
+        perror("malloc");
+        image_free(&img);
+        close_busyboard(&bb);
+        return 1;
+      }
+      ret = write_image(&e, &img, offset, manifest, journal, do_verify);
+      printf("Total %.2f s.\n", now() - start);
+    } else {
+      bad = verify(&bb, offset, &img);
+      t = now() - start;
+      printf("Verify: %u mismatches in %u bytes, %.2f s (%.0f B/s).\n",
+             bad, len, t, len/t);
+      if (bad) ret = 1;
+    }
+    image_free(&img);
+  } else {
+    usage(argv[0]);
+  }
+
+  close_busyboard(&bb);
+
+  return ret;
+}
@@ -0,0 +1,206 @@
+/* Frequency, duty cycle and pulse width of all 48 inputs at once. */
+/* Pinout: every pin is an input; nothing is driven. */
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "busyboard.h"
+
+#define PINS (8 * BUSYBOARD_N_PORTS)
+
+/* Bit-sliced counters: bit p of plane k is bit k of pin p's count, so
+   adding a sample word to all 48 counts is a ripple of ANDs and XORs.
+   They are emptied into the per-pin totals before they can overflow. */
+#define PLANES 16
+
+volatile sig_atomic_t stop;
+
+uint64_t plane[PLANES];
+unsigned long plane_n;
+
+/* Per pin, over a gate. Times are ns. */
+struct pin {
+  unsigned long high;  /* Samples high */
+  unsigned long rises, falls;
+  uint64_t first_rise, last_rise, last_edge;
+  uint64_t min_hi, max_hi, min_lo, max_lo;
+} pin[PINS];
+
+void on_signal(int sig) {
+  (void)sig;
+  stop = 1;
+}
+
+uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+uint64_t sample(struct busyboard *bb) {
+  uint64_t w = 0;
+  int i;
+
+  busyboard_xfer(bb);
+  for (i = 0; i < BUSYBOARD_N_PORTS; i++)
+    w |= (uint64_t)bb->in_state[i] << 8 * i;
+  return w;
+}
+
+void count(uint64_t w) {
+  int k;
+
+  for (k = 0; k < PLANES && w; ++k) {
+    uint64_t carry = plane[k] & w;
+    plane[k] ^= w;
+    w = carry;
+  }
+}
+
+void empty_planes(void) {
+  int k, p;
+
+  for (k = 0; k < PLANES; ++k) {
+    for (p = 0; p < PINS; ++p)
+      if (plane[k] >> p & 1) pin[p].high += 1ul << k;
+    plane[k] = 0;
+  }
+  plane_n = 0;
+}
+
+/* A pulse that ended at t; hi says it was high. The first edge of a gate
+   ends a pulse whose start wasn't seen, so it isn't measured. */
+void pulse(struct pin *p, uint64_t t, int hi) {
+  uint64_t w = t - p->last_edge;
+
+  if (p->last_edge) {
+    if (hi) {
+      if (!p->min_hi || w < p->min_hi) p->min_hi = w;
+      if (w > p->max_hi) p->max_hi = w;
+    } else {
+      if (!p->min_lo || w < p->min_lo) p->min_lo = w;
+      if (w > p->max_lo) p->max_lo = w;
+    }
+  }
+  p->last_edge = t;
+}
+
+void edges(uint64_t diff, uint64_t w, uint64_t t) {
+  while (diff) {
+    int b = __builtin_ctzll(diff);
+    struct pin *p = &pin[b];
+
+    diff &= diff - 1;
+    if (w >> b & 1) {
+      if (!p->rises++) p->first_rise = t;
+      p->last_rise = t;
+      pulse(p, t, 0);
+    } else {
+      p->falls++;
+      pulse(p, t, 1);
+    }
+  }
+}
+
+void print_us(uint64_t lo, uint64_t hi) {
+  if (!lo) printf(" %21s", "-");
+  else printf(" %10.1f-%-10.1f", lo * 1e-3, hi * 1e-3);
+}
+
+void report(unsigned long n, uint64_t elapsed, uint64_t w, int all) {
+  double rate = n * 1e9 / elapsed, f;
+  char steady[2][PINS * 3 + 1];
+  int p, len[2] = { 0, 0 };
+
+  printf("%lu samples in %.3f s: %.0f samples/s, so up to %.0f Hz, and "
+         "widths to +-%.1f us.\n", n, elapsed * 1e-9, rate, rate / 2,
+         1e6 / rate);
+  printf("pin %12s %7s %21s %21s %8s\n", "Hz", "duty", "high us",
+         "low us", "edges");
+  steady[0][0] = steady[1][0] = 0;
+  for (p = 0; p < PINS; ++p) {
+    struct pin *q = &pin[p];
+
+    if (!all && !q->rises && !q->falls) {
+      int hi = w >> p & 1;
+      len[hi] += sprintf(steady[hi] + len[hi], " %c%d", 'a' + p / 8, p % 8);
+      continue;
+    }
+    /* Between the first and last rising edges if there are two; else
+       over the gate. */
+    f = (q->rises > 1) ? (q->rises - 1) * 1e9 / (q->last_rise -
+                                                 q->first_rise)
+                       : q->rises * 1e9 / elapsed;
+    printf(" %c%d %12.2f %6.2f%%", 'a' + p / 8, p % 8, f,
+           100.0 * q->high / n);
+    print_us(q->min_hi, q->max_hi);
+    print_us(q->min_lo, q->max_lo);
+    printf(" %8lu\n", q->rises + q->falls);
+  }
+  if (len[1]) printf("Steady high:%s\n", steady[1]);
+  if (len[0]) printf("Steady low:%s\n", steady[0]);
+}
+
+void usage(const char *argv0) {
+  fprintf(stderr,
+    "Usage: %s [-g seconds] [-n gates] [-a] [parport]\n"
+    "  Samples all 48 inputs as fast as the board goes and reports each\n"
+    "  pin's frequency, duty cycle and shortest and longest high and low\n"
+    "  pulses over every gate (default 1 s; -n 0 runs until ^C). Only pins\n"
+    "  that changed are listed unless -a is given.\n", argv0);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  double gate = 1;
+  unsigned long gates = 1, g, n;
+  uint64_t w, prev, start, t, end;
+  int c, all = 0;
+
+  while ((c = getopt(argc, argv, "g:n:a")) != -1) {
+    switch (c) {
+    case 'g': gate = atof(optarg); break;
+    case 'n': gates = strtoul(optarg, NULL, 0); break;
+    case 'a': all = 1; break;
+    default: usage(argv[0]);
+    }
+  }
+  if (optind + 1 < argc || gate <= 0) usage(argv[0]);
+
+  struct busyboard bb;
+  init_busyboard(&bb, (optind < argc) ? argv[optind] : "/dev/parport0");
+  bb.trimask = 0;
+  busyboard_out(&bb);
+
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+  prev = sample(&bb);
+  for (g = 0; !stop && (!gates || g < gates); ++g) {
+    memset(pin, 0, sizeof(pin));
+    n = 0;
+    t = start = now_ns();
+    end = start + gate * 1e9;
+
+    while (!stop && t < end) {
+      w = sample(&bb);
+      t = now_ns();
+      count(w);
+      if (++plane_n == (1ul << PLANES) - 1) empty_planes();
+      if (w != prev) edges(w ^ prev, w, t);
+      prev = w;
+      n++;
+    }
+    empty_planes();
+
+    if (n) report(n, t - start, prev, all);
+  }
+
+  close_busyboard(&bb);
+
+  return 0;
+}
@@ -0,0 +1,674 @@
+/* GDB remote serial protocol server for the CPU harnesses. */
+
+#include "gdbstub.h"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define GDB_POINTS 64
+#define GDB_PACKET 4096
+
+#define BIT(map, addr) ((map)[(addr) >> 3] & (1 << ((addr) & 7)))
+
+enum { Z80_AF, Z80_BC, Z80_DE, Z80_HL, Z80_SP, Z80_PC, Z80_IX, Z80_IY,
+       Z80_AF2, Z80_BC2, Z80_DE2, Z80_HL2, Z80_IR, Z80_REGS };
+enum { M65_A, M65_X, M65_Y, M65_P, M65_S, M65_PC, M65_REGS };
+
+/* Whether the last fetches are known to belong to one instruction; only
+   matters on the Z80, whose prefixes are fetched like opcodes. */
+enum { TRACK_UNKNOWN, TRACK_START, TRACK_INSN };
+
+/* What the injected stub is for: reading the registers, loading them back
+   before holding the CPU, or loading changed ones before resuming. */
+enum { STUB_NONE, STUB_DUMP, STUB_PARK, STUB_RESUME };
+
+struct gdb_point {
+  unsigned char type; /* Z packet type: 0/1 break, 2 write, 3 read, 4 any */
+  unsigned short addr;
+  unsigned len;
+};
+
+struct gdb {
+  struct buscyc *bc;
+  struct devmap *map;
+  int z80;
+  int listen_fd, fd;
+  char *path;
+
+  /* Breakpoints on fetches, watchpoints on reads and writes. */
+  unsigned char bp[8192], rw[8192], ww[8192];
+  struct gdb_point point[GDB_POINTS];
+  int n_points;
+
+  /* Set while a stop is due at the next instruction start. */
+  int pending, step, interrupt, watch_type;
+  unsigned watch_addr;
+  int track;
+  unsigned insn_pc, insn_fetches;
+  unsigned char last_op;
+
+  /* Injection. Reads are answered from stub in order, whatever their
+     address; writes are captured. */
+  int phase;
+  unsigned char stub[64];
+  unsigned stub_len, stub_pos, fetches;
+  unsigned char cap[32];
+  unsigned short cap_addr[32];
+  unsigned cap_fetches[32], n_cap;
+  void (*trace)(struct buscyc *bc, const struct bus_rec *r);
+
+  unsigned short reg[Z80_REGS];
+  int iff, dirty, running, killed;
+  char reply[32];
+
+  char in[GDB_PACKET];
+  unsigned in_pos, in_len;
+};
+
+/* Register read: ld (0),sp, then push everything, with ld a,i and ld a,r
+   to get at I, IFF2 and R. */
+static const unsigned char z80_pushed[] = {
+  Z80_AF, Z80_BC, Z80_DE, Z80_HL, Z80_IX, Z80_IY, Z80_BC2, Z80_DE2, Z80_HL2,
+  Z80_AF2
+};
+static const unsigned char z80_dump[] = {
+  0xed, 0x73, 0x00, 0x00,
+  0xf5, 0xc5, 0xd5, 0xe5, 0xdd, 0xe5, 0xfd, 0xe5,
+  0xd9, 0xc5, 0xd5, 0xe5, 0xd9,
+  0x08, 0xf5, 0x08,
+  0xed, 0x57, 0xf5,
+  0xed, 0x5f, 0xf5
+};
+
+/* sta/stx/sty $0000, php (whose write gives S away). Implied instructions
+   make a dummy read, which takes a byte of the stub too. */
+static const unsigned char m65_dump[] = {
+  0x8d, 0x00, 0x00, 0x8e, 0x00, 0x00, 0x8c, 0x00, 0x00, 0x08, 0x00
+};
+
+static void put16(unsigned char *s, unsigned *n, unsigned v) {
+  s[(*n)++] = v;
+  s[(*n)++] = v >> 8;
+}
+
+static void decode_regs(struct gdb *g) {
+  const unsigned char *c = g->cap;
+  unsigned short *r = g->reg;
+  unsigned i, rr;
+
+  if (!g->z80) {
+    r[M65_A] = c[0];
+    r[M65_X] = c[1];
+    r[M65_Y] = c[2];
+    r[M65_P] = c[3];
+    r[M65_S] = g->cap_addr[3] & 0xff;
+    return;
+  }
+
+  /* Pushes write the high byte first. */
+  r[Z80_SP] = c[0] | c[1] << 8;
+  for (i = 0; i < 10; ++i) r[z80_pushed[i]] = c[2 + 2 * i] << 8 | c[3 + 2 * i];
+  g->iff = c[23] & 0x04;
+  /* ld a,r saw R after the stub's own fetches up to it. */
+  rr = c[24] - (g->cap_fetches[24] - 1);
+  r[Z80_IR] = c[22] << 8 | (c[24] & 0x80) | (rr & 0x7f);
+}
+
+/* Pops are answered from the stub like any read, so they load whatever it
+   says. R is set to come out right after the 4 fetches that follow. */
+static void load_regs(struct gdb *g) {
+  const unsigned short *r = g->reg;
+  unsigned char *s = g->stub;
+  unsigned n = 0, rr;
+
+  if (!g->z80) {
+    s[n++] = 0xa2; s[n++] = r[M65_S] - 1; /* ldx #s-1; txs */
+    s[n++] = 0x9a; s[n++] = 0x00;
+    s[n++] = 0xa9; s[n++] = r[M65_A];     /* lda, ldx, ldy */
+    s[n++] = 0xa2; s[n++] = r[M65_X];
+    s[n++] = 0xa0; s[n++] = r[M65_Y];
+    s[n++] = 0x28; s[n++] = 0x00;         /* plp */
+    s[n++] = 0x00; s[n++] = r[M65_P];
+    s[n++] = 0x4c; put16(s, &n, r[M65_PC]);
+    g->stub_len = n;
+    return;
+  }
+
+  s[n++] = 0x08; s[n++] = 0xf1; put16(s, &n, r[Z80_AF2]); s[n++] = 0x08;
+  s[n++] = 0xd9;
+  s[n++] = 0xc1; put16(s, &n, r[Z80_BC2]);
+  s[n++] = 0xd1; put16(s, &n, r[Z80_DE2]);
+  s[n++] = 0xe1; put16(s, &n, r[Z80_HL2]);
+  s[n++] = 0xd9;
+  s[n++] = 0xc1; put16(s, &n, r[Z80_BC]);
+  s[n++] = 0xd1; put16(s, &n, r[Z80_DE]);
+  s[n++] = 0xe1; put16(s, &n, r[Z80_HL]);
+  s[n++] = 0xdd; s[n++] = 0xe1; put16(s, &n, r[Z80_IX]);
+  s[n++] = 0xfd; s[n++] = 0xe1; put16(s, &n, r[Z80_IY]);
+  s[n++] = 0x3e; s[n++] = r[Z80_IR] >> 8; s[n++] = 0xed; s[n++] = 0x47;
+  rr = r[Z80_IR] - 4;
+  s[n++] = 0x3e; s[n++] = (r[Z80_IR] & 0x80) | (rr & 0x7f);
+  s[n++] = 0xed; s[n++] = 0x4f;
+  s[n++] = 0xf1; put16(s, &n, r[Z80_AF]);
+  s[n++] = 0x31; put16(s, &n, r[Z80_SP]);
+  s[n++] = g->iff ? 0xfb : 0xf3;
+  s[n++] = 0xc3; put16(s, &n, r[Z80_PC]);
+  g->stub_len = n;
+}
+
+static void start_stub(struct gdb *g, int phase) {
+  if (phase == STUB_DUMP) {
+    if (g->z80) memcpy(g->stub, z80_dump, g->stub_len = sizeof(z80_dump));
+    else memcpy(g->stub, m65_dump, g->stub_len = sizeof(m65_dump));
+    g->n_cap = 0;
+  } else {
+    load_regs(g);
+  }
+  g->phase = phase;
+  g->stub_pos = g->fetches = 0;
+  if (g->bc->trace) {
+    g->trace = g->bc->trace;
+    g->bc->trace = NULL;
+  }
+}
+
+static void end_stub(struct gdb *g) {
+  g->phase = STUB_NONE;
+  if (g->trace) g->bc->trace = g->trace;
+  g->trace = NULL;
+}
+
+/* Let the CPU go on with the fetch it is held at. */
+static unsigned char resume(struct gdb *g, unsigned addr, unsigned flags) {
+  unsigned char op = devmap_read(g->map, addr, flags);
+
+  if (g->step) {
+    g->pending = 1;
+    g->track = TRACK_INSN;
+    g->insn_pc = addr;
+    g->insn_fetches = 1;
+    g->last_op = op;
+  }
+  return op;
+}
+
+static void serve(struct gdb *g);
+static void put_packet(struct gdb *g, const char *s);
+
+static unsigned char stub_read(struct gdb *g, unsigned addr, unsigned flags) {
+  if (g->stub_pos < g->stub_len) {
+    if (flags & BUS_FETCH) g->fetches++;
+    return g->stub[g->stub_pos++];
+  }
+
+  /* Out of stub: this is the fetch at PC again. */
+  switch (g->phase) {
+  case STUB_DUMP:
+    decode_regs(g);
+    start_stub(g, STUB_PARK);
+    return stub_read(g, addr, flags);
+  case STUB_PARK:
+    end_stub(g);
+    if (g->running) put_packet(g, g->reply);
+    g->running = 0;
+    serve(g);
+    if (g->dirty && !g->killed) {
+      g->dirty = 0;
+      start_stub(g, STUB_RESUME);
+      return stub_read(g, addr, flags);
+    }
+    return resume(g, addr, flags);
+  default:
+    end_stub(g);
+    return resume(g, addr, flags);
+  }
+}
+
+static unsigned char stop(struct gdb *g, unsigned addr, unsigned flags) {
+  static const char *watch[] = { "", "", "watch", "rwatch", "awatch" };
+
+  if (g->watch_type)
+    sprintf(g->reply, "T05%s:%x;", watch[g->watch_type], g->watch_addr);
+  else
+    strcpy(g->reply, g->interrupt && !g->step ? "S02" : "S05");
+  g->pending = g->step = g->interrupt = g->watch_type = 0;
+  g->track = TRACK_UNKNOWN;
+  g->reg[g->z80 ? Z80_PC : M65_PC] = addr;
+
+  start_stub(g, STUB_DUMP);
+  return stub_read(g, addr, flags);
+}
+
+/* Whether a fetch at addr belongs to the instruction fetched last: after a
+   DD or FD prefix, or the first byte after CB or ED. */
+static int continues(const struct gdb *g, unsigned addr) {
+  if (!g->z80 || g->track == TRACK_START) return 0;
+  if (g->track == TRACK_UNKNOWN) return 1;
+  if (addr != ((g->insn_pc + g->insn_fetches) & 0xffff)) return 0;
+  if (g->last_op == 0xdd || g->last_op == 0xfd) return 1;
+  return (g->last_op == 0xcb || g->last_op == 0xed) && g->insn_fetches == 1;
+}
+
+static unsigned char fetch(struct gdb *g, unsigned addr, unsigned flags) {
+  unsigned char op;
+
+  if (!g->pending || !continues(g, addr)) return stop(g, addr, flags);
+
+  op = devmap_read(g->map, addr, flags);
+  if (g->track == TRACK_INSN) {
+    g->insn_fetches++;
+  } else {
+    g->track = TRACK_INSN;
+    g->insn_pc = addr;
+    g->insn_fetches = 1;
+  }
+  g->last_op = op;
+  return op;
+}
+
+/* Stop after the instruction making the access. */
+static void watch(struct gdb *g, unsigned addr, int type) {
+  int i;
+
+  for (i = 0; i < g->n_points; ++i) {
+    const struct gdb_point *p = &g->point[i];
+    if ((p->type == type || p->type == 4) && addr - p->addr < p->len) {
+      g->watch_type = p->type;
+      g->watch_addr = addr;
+      break;
+    }
+  }
+  g->pending = 1;
+  g->track = TRACK_START;
+}
+
+static unsigned char gdb_read(struct buscyc *bc, unsigned addr,
+                              unsigned flags)
+{
+  struct gdb *g = bc->bus_ctx;
+
+  if (g->phase) return stub_read(g, addr, flags);
+  if (flags & BUS_FETCH) {
+    if (g->pending || BIT(g->bp, addr)) return fetch(g, addr, flags);
+  } else if (BIT(g->rw, addr) && !(flags & BUS_IO)) {
+    watch(g, addr, 3);
+  }
+  return devmap_read(g->map, addr, flags);
+}
+
+static void gdb_write(struct buscyc *bc, unsigned addr, unsigned char data,
+                      unsigned flags)
+{
+  struct gdb *g = bc->bus_ctx;
+
+  if (g->phase) {
+    if (g->n_cap < sizeof(g->cap)) {
+      g->cap[g->n_cap] = data;
+      g->cap_addr[g->n_cap] = addr;
+      g->cap_fetches[g->n_cap++] = g->fetches;
+    }
+    return;
+  }
+  if (BIT(g->ww, addr) && !(flags & BUS_IO)) watch(g, addr, 2);
+  devmap_write(g->map, addr, data, flags);
+}
+
+static void rebuild_points(struct gdb *g) {
+  int i;
+  unsigned a;
+
+  memset(g->bp, 0, sizeof(g->bp));
+  memset(g->rw, 0, sizeof(g->rw));
+  memset(g->ww, 0, sizeof(g->ww));
+  for (i = 0; i < g->n_points; ++i) {
+    const struct gdb_point *p = &g->point[i];
+    for (a = p->addr; a < p->addr + p->len && a < 0x10000; ++a) {
+      if (p->type < 2) g->bp[a >> 3] |= 1 << (a & 7);
+      if (p->type == 3 || p->type == 4) g->rw[a >> 3] |= 1 << (a & 7);
+      if (p->type == 2 || p->type == 4) g->ww[a >> 3] |= 1 << (a & 7);
+    }
+  }
+}
+
+/* The CPU runs on without breakpoints once the debugger has gone. */
+static void hang_up(struct gdb *g, const char *why) {
+  printf("%s", why);
+  close(g->fd);
+  g->fd = -1;
+  g->n_points = 0;
+  rebuild_points(g);
+}
+
+/* Packets. */
+
+static int get_byte(struct gdb *g) {
+  ssize_t n;
+
+  if (g->in_pos == g->in_len) {
+    g->in_pos = g->in_len = 0;
+    n = read(g->fd, g->in, sizeof(g->in));
+    if (n <= 0) return -1;
+    g->in_len = n;
+  }
+  return (unsigned char)g->in[g->in_pos++];
+}
+
+static int hex_digit(int c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+/* Returns the length of the packet in buf, or -1 if the debugger went
+   away. */
+static int get_packet(struct gdb *g, char *buf, int size) {
+  int c, n, sum, hi, lo;
+
+  for (;;) {
+    while ((c = get_byte(g)) != '$')
+      if (c < 0) return -1;
+    for (n = sum = 0; (c = get_byte(g)) != '#'; sum += c) {
+      if (c < 0) return -1;
+      if (n < size - 1) buf[n++] = c;
+    }
+    hi = hex_digit(get_byte(g));
+    lo = hex_digit(get_byte(g));
+    if (hi >= 0 && lo >= 0 && (hi << 4 | lo) == (sum & 0xff)) break;
+    if (write(g->fd, "-", 1) != 1) return -1;
+  }
+  buf[n] = 0;
+  return write(g->fd, "+", 1) == 1 ? n : -1;
+}
+
+static void put_packet(struct gdb *g, const char *s) {
+  static char buf[2 * GDB_PACKET];
+  unsigned sum = 0;
+  int n, c;
+
+  if (g->fd < 0) return;
+  for (n = 0; s[n]; ++n) sum += (unsigned char)s[n];
+  n = snprintf(buf, sizeof(buf), "$%s#%02x", s, sum & 0xff);
+  do {
+    if (write(g->fd, buf, n) != n) return;
+    while ((c = get_byte(g)) != '+' && c != '-' && c >= 0)
+      ;
+  } while (c == '-');
+}
+
+static int reg_size(const struct gdb *g, int i) {
+  return g->z80 || i == M65_PC ? 2 : 1;
+}
+
+static char *put_hex(char *p, unsigned v, int bytes) {
+  while (bytes--) {
+    p += sprintf(p, "%02x", v & 0xff);
+    v >>= 8;
+  }
+  return p;
+}
+
+/* Little-endian hex of bytes bytes; returns NULL if short. */
+static const char *get_hex(const char *p, unsigned *v, int bytes) {
+  int i, hi, lo;
+
+  *v = 0;
+  for (i = 0; i < bytes; ++i) {
+    if ((hi = hex_digit(p[0])) < 0 || (lo = hex_digit(p[1])) < 0)
+      return NULL;
+    *v |= (hi << 4 | lo) << (8 * i);
+    p += 2;
+  }
+  return p;
+}
+
+static int set_point(struct gdb *g, const char *args, int insert) {
+  unsigned type, addr, len;
+  int i;
+
+  if (sscanf(args, "%x,%x,%x", &type, &addr, &len) != 3 || type > 4 ||
+      addr > 0xffff)
+    return 0;
+  if (type < 2) len = 1;
+  for (i = 0; i < g->n_points; ++i)
+    if (g->point[i].type == type && g->point[i].addr == addr &&
+        g->point[i].len == len)
+      break;
+  if (insert && i == g->n_points) {
+    if (g->n_points == GDB_POINTS) return 0;
+    g->point[g->n_points].type = type;
+    g->point[g->n_points].addr = addr;
+    g->point[g->n_points++].len = len;
+  } else if (!insert && i < g->n_points) {
+    g->point[i] = g->point[--g->n_points];
+  }
+  rebuild_points(g);
+  return 1;
+}
+
+/* Answer the debugger while the CPU is held, until it resumes it. */
+static void serve(struct gdb *g) {
+  static char pkt[GDB_PACKET], out[GDB_PACKET];
+  int n_regs = g->z80 ? Z80_REGS : M65_REGS, i;
+  unsigned addr, len, v;
+  unsigned long r;
+  const char *p;
+  char *o;
+
+  while (g->fd >= 0) {
+    if (get_packet(g, pkt, sizeof(pkt)) < 0) {
+      hang_up(g, "GDB went away; running on.\n");
+      return;
+    }
+    out[0] = 0;
+    switch (pkt[0]) {
+    case '?':
+      strcpy(out, g->reply);
+      break;
+    case 'g':
+      for (o = out, i = 0; i < n_regs; ++i)
+        o = put_hex(o, g->reg[i], reg_size(g, i));
+      break;
+    case 'G':
+      for (p = pkt + 1, i = 0; i < n_regs && p; ++i)
+        if ((p = get_hex(p, &v, reg_size(g, i)))) g->reg[i] = v;
+      g->dirty = 1;
+      strcpy(out, p ? "OK" : "E01");
+      break;
+    case 'p':
+      r = strtoul(pkt + 1, NULL, 16);
+      if (r < (unsigned)n_regs) put_hex(out, g->reg[r], reg_size(g, r));
+      else strcpy(out, "E01");
+      break;
+    case 'P':
+      r = strtoul(pkt + 1, (char **)&p, 16);
+      if (r < (unsigned)n_regs && *p == '=' &&
+          get_hex(p + 1, &v, reg_size(g, r))) {
+        g->reg[r] = v;
+        g->dirty = 1;
+        strcpy(out, "OK");
+      } else {
+        strcpy(out, "E01");
+      }
+      break;
+    case 'm':
+      if (sscanf(pkt + 1, "%x,%x", &addr, &len) != 2 || addr > 0xffff ||
+          len > sizeof(out) / 2 - 1) {
+        strcpy(out, "E01");
+        break;
+      }
+      for (o = out; len-- && addr <= 0xffff; ++addr)
+        o = put_hex(o, g->map->ram[addr], 1);
+      break;
+    case 'M':
+      if (sscanf(pkt + 1, "%x,%x", &addr, &len) != 2 ||
+          addr > 0xffff || len > 0x10000 - addr ||
+          !(p = strchr(pkt, ':'))) {
+        strcpy(out, "E01");
+        break;
+      }
+      for (++p; len-- && (p = get_hex(p, &v, 1)); ++addr)
+        g->map->ram[addr] = v;
+      strcpy(out, p ? "OK" : "E01");
+      break;
+    case 'c':
+    case 's':
+      if (pkt[1]) {
+        g->reg[g->z80 ? Z80_PC : M65_PC] = strtoul(pkt + 1, NULL, 16);
+        g->dirty = 1;
+      }
+      g->step = pkt[0] == 's';
+      g->running = 1;
+      return;
+    case 'Z':
+    case 'z':
+      strcpy(out, set_point(g, pkt + 1, pkt[0] == 'Z') ? "OK" : "E01");
+      break;
+    case 'k':
+      g->killed = 1;
+      g->bc->halted = 1;
+      return;
+    case 'D':
+      put_packet(g, "OK");
+      hang_up(g, "GDB detached; running on.\n");
+      return;
+    case 'H':
+      strcpy(out, "OK");
+      break;
+    case 'q':
+      if (!strncmp(pkt, "qSupported", 10))
+        sprintf(out, "PacketSize=%x", GDB_PACKET);
+      else if (!strcmp(pkt, "qAttached"))
+        strcpy(out, "1");
+      break;
+    }
+    put_packet(g, out);
+  }
+}
+
+/* Between runs of GDB_POLL_CYCLES, look for an interrupt. Nothing else
+   comes while the CPU runs; anything that does is kept for serve(). */
+static void poll_input(struct gdb *g) {
+  struct pollfd pfd = { g->fd, POLLIN, 0 };
+  ssize_t n;
+  unsigned i;
+
+  if (poll(&pfd, 1, 0) <= 0) return;
+  if (g->in_pos == g->in_len) g->in_pos = g->in_len = 0;
+  if (g->in_len == sizeof(g->in)) return;
+  n = read(g->fd, g->in + g->in_len, sizeof(g->in) - g->in_len);
+  if (n <= 0) {
+    hang_up(g, "GDB went away; running on.\n");
+    return;
+  }
+  for (i = g->in_len; i < g->in_len + n; ++i)
+    if (g->in[i] == 0x03) {
+      g->interrupt = g->pending = 1;
+      if (g->track == TRACK_INSN) g->track = TRACK_UNKNOWN;
+    }
+  g->in_len += n;
+}
+
+void gdb_run(struct gdb *g) {
+  struct buscyc *bc = g->bc;
+
+  g->step = g->pending = 1;
+  g->track = TRACK_START;
+  while (!bc->halted) {
+    buscyc_run(bc, g->fd >= 0 ? GDB_POLL_CYCLES : 0);
+    if (g->fd >= 0 && !bc->halted) poll_input(g);
+  }
+  if (g->fd >= 0 && !g->killed) put_packet(g, "W00");
+}
+
+static int listen_on(struct gdb *g, const char *where) {
+  const char *p;
+  int fd, one = 1;
+
+  for (p = where; *p >= '0' && *p <= '9'; ++p)
+    ;
+  if (!*p) {
+    struct sockaddr_in sin;
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(atoi(where));
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) || listen(fd, 1)) {
+      close(fd);
+      return -1;
+    }
+  } else {
+    struct sockaddr_un sun;
+
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strncpy(sun.sun_path, where, sizeof(sun.sun_path) - 1);
+    unlink(where);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) || listen(fd, 1)) {
+      close(fd);
+      return -1;
+    }
+    g->path = strdup(where);
+  }
+  return fd;
+}
+
+struct gdb *gdb_open(const char *where, struct buscyc *bc, struct devmap *map)
+{
+  struct gdb *g = calloc(1, sizeof(*g));
+  int one = 1;
+
+  if (!g) {
+    perror("gdb");
+    return NULL;
+  }
+  g->bc = bc;
+  g->map = map;
+  g->z80 = bc->cpu == &bus_z80;
+  g->fd = -1;
+  if ((g->listen_fd = listen_on(g, where)) < 0) {
+    perror(where);
+    free(g);
+    return NULL;
+  }
+
+  printf("Waiting for GDB on %s...\n", where);
+  fflush(stdout);
+  g->fd = accept(g->listen_fd, NULL, NULL);
+  if (g->fd < 0) {
+    perror("accept");
+    gdb_close(g);
+    return NULL;
+  }
+  setsockopt(g->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  printf("GDB connected.\n");
+
+  bc->read = gdb_read;
+  bc->write = gdb_write;
+  bc->bus_ctx = g;
+  return g;
+}
+
+void gdb_close(struct gdb *g) {
+  if (g->bc->bus_ctx == g) devmap_attach(g->map, g->bc);
+  if (g->fd >= 0) close(g->fd);
+  close(g->listen_fd);
+  if (g->path) {
+    unlink(g->path);
+    free(g->path);
+  }
+  free(g);
+}
@@ -0,0 +1,44 @@
+#ifndef GDBSTUB_H
+#define GDBSTUB_H
+
+#include "buscyc.h"
+#include "devmap.h"
+
+/* GDB remote serial protocol server for the CPU harnesses, e.g.
+
+     z80_test -g 2159 /dev/parport0 sieve.hex
+     (gdb) target remote :2159
+
+   The stub sits between the engine and the memory map. Breakpoints and
+   watchpoints are bitmaps with a bit per address, so a free-running CPU
+   costs one bit test per access on top of the map lookup; the socket is
+   only polled (for an interrupt) every GDB_POLL_CYCLES cycles.
+
+   The CPU stops with an opcode fetch on the bus. Its registers are read by
+   answering that fetch with a stub that writes them all out, loads them
+   back and jumps to the fetch address again, where the CPU is held until
+   the debugger resumes it; registers the debugger changes are loaded the
+   same way. Stub writes never reach memory, and the stub's cycles are not
+   traced. Memory is read and written in the host's copy.
+
+   Registers ('g' packet order), 16 bits each on the Z80 as GDB's z80
+   target has them: af bc de hl sp pc ix iy af' bc' de' hl' ir. On the
+   65C02, a x y p s of 8 bits and pc of 16; p is as PHP pushes it. The
+   Z80's R is kept across a stop, its interrupt mode is not. */
+
+#define GDB_POLL_CYCLES 4096
+
+struct gdb;
+
+/* Wait for the debugger on where, a TCP port on localhost or a Unix socket
+   path, and take over bc's reads and writes from map. Call after
+   devmap_attach(). Returns NULL (after printing why) on error. */
+struct gdb *gdb_open(const char *where, struct buscyc *bc, struct devmap *map);
+
+/* Run from reset, stopped at the first instruction, until the CPU halts or
+   the debugger kills it. After a detach the CPU runs on freely. */
+void gdb_run(struct gdb *g);
+
+void gdb_close(struct gdb *g);
+
+#endif
@@ -0,0 +1,255 @@
+/* CPU test harness shared by z80_test and 65c02_test. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "harness.h"
+#include "busyboard.h"
+#include "devmap.h"
+#include "gdbstub.h"
+#include "image.h"
+#include "lockstep.h"
+#include "profile.h"
+#include "timing.h"
+#include "trace.h"
+
+/* Wait after each clock edge; was a commented-out 1 ms DELAY. */
+enum { T_CLK };
+static struct timing_param params[] = { { "clk", 0, 1000 } };
+static struct timing timing = { NULL, params, 1 };
+
+static unsigned char mem[0x10000], mem0[0x10000];
+static const char *image_format;
+
+/* Returns the start address: the file's own, or else base. */
+static unsigned load_image(unsigned base, const char *filename) {
+  struct image img;
+  unsigned entry;
+
+  if (image_load(&img, filename, base, image_format)) exit(1);
+  printf("Initialized memory from %s (%s) with %u bytes.\n", filename,
+         img.format, image_copy(&img, mem, 0, sizeof(mem)));
+  entry = img.has_entry ? img.entry : base;
+  image_free(&img);
+
+  return entry;
+}
+
+static void dump_hex(void) {
+  int i, j;
+  for (i = 0; i < 0x10000; i += 16) {
+    printf("%04x: ", i);
+    for (j = 0; j < 16; j++) {
+      printf("%02x", (unsigned int)mem[i + j]);
+      if (j != 15) {
+        putc(' ', stdout);
+        if (j % 4 == 3) putc(' ', stdout);
+      }
+    }
+    putc('\n', stdout);
+  }
+}
+
+/* Run from reset out of a fresh copy of memory and compare the bus trace
+   against the first run's, made at the slowest clock. */
+#define VERIFY_CYCLES 256
+struct verify_trace {
+  unsigned rec[VERIFY_CYCLES];
+  int n;
+};
+
+static void verify_rec(struct buscyc *bc, const struct bus_rec *r) {
+  struct verify_trace *t = bc->ctx;
+  if (t->n < VERIFY_CYCLES) t->rec[t->n++] = r->addr << 8 | r->status;
+}
+
+static int verify(void *ctx) {
+  static unsigned ref[VERIFY_CYCLES];
+  static int have_ref;
+  struct verify_trace t = { { 0 }, 0 };
+  struct buscyc *bc = ctx;
+
+  memcpy(mem, mem0, sizeof(mem));
+  bc->edge_us = params[T_CLK].us;
+  bc->trace = verify_rec;
+  bc->ctx = &t;
+  buscyc_reset(bc);
+  buscyc_run(bc, VERIFY_CYCLES);
+  bc->trace = NULL;
+  bc->cycles = bc->frames = 0;
+  bc->elapsed = 0;
+
+  if (!have_ref) {
+    memcpy(ref, t.rec, sizeof(ref));
+    have_ref = 1;
+  }
+
+  return !memcmp(t.rec, ref, sizeof(ref));
+}
+
+/* With -p, every cycle goes to the profile and then on to the trace. */
+static struct profile *prof;
+static void (*traced)(struct buscyc *bc, const struct bus_rec *r);
+
+static void profile_rec(struct buscyc *bc, const struct bus_rec *r) {
+  profile_cycle(prof, r);
+  if (traced) traced(bc, r);
+}
+
+static void usage(const struct harness *h, const char *argv0) {
+  int seq = h->cpu->seq_cycle != NULL;
+
+  fprintf(stderr, "Usage: %s [-v] [-d] [-o trace] [-R records] [-n cycles] "
+          "[-f hz]\n"
+          "       [-r lo-hi] [-D disk] [-L] [-g port|socket]%s\n"
+          "       [-p folded] [-F format] [parport [image]]\n"
+          "  -o  trace file for tracedump, - for none (default %s.trace)\n"
+          "  -R  cycles the trace keeps (default %lu)\n"
+          "  -v  print every bus cycle instead of tracing\n"
+          "  -d  dump memory at exit\n"
+          "  -n  cycles to run, 0 to run until %s (default %llu)\n"
+          "  -f  pace the clock to this frequency\n"
+          "  -r  make addresses lo to hi ROM\n"
+          "  -D  attach a disk image to the sector device\n"
+          "  -L  check every bus cycle against a model of the CPU\n"
+          "  -g  wait for GDB on a TCP port or Unix socket, and run until "
+          "%s\n"
+          "%s"
+          "  -p  profile, writing call stacks for flamegraph.pl to folded\n"
+          "  -F  image format: ihex, srec, bytes or bin (default by "
+          "extension)\n",
+          argv0, seq ? " [-S]" : "", h->name, TRACE_DEFAULT_RECORDS,
+          h->stop, h->cycles, h->stop,
+          seq ? "  -S  only sample the T-states that carry something new\n"
+              : "");
+  exit(1);
+}
+
+/* Devices go on I/O ports, n of them, or on a memory page. */
+static void map_device(const struct harness *h, struct devmap *map,
+                       unsigned base, unsigned n, dev_read_fn read,
+                       dev_write_fn write, void *ctx)
+{
+  if (h->ports) devmap_port(map, base, base + n - 1, read, write, ctx);
+  else devmap_mem(map, base, base + 0xff, read, write, ctx);
+}
+
+int harness_main(const struct harness *h, int argc, char **argv) {
+  const char *parport = "/dev/parport0", *diskfile = NULL, *image = h->image,
+             *tracefile = NULL, *gdbsock = NULL, *proffile = NULL;
+  char default_trace[64];
+  unsigned long long cycles = h->cycles;
+  unsigned long records = TRACE_DEFAULT_RECORDS;
+  unsigned rom_lo = 1, rom_hi = 0, start;
+  char *end;
+  int c, verbose = 0, dump = 0, check = 0, sequence = 0;
+  double hz = 0;
+  busyboard_t bb;
+  struct buscyc bc;
+  struct trace *tr = NULL;
+  struct lockstep *ls = NULL;
+  struct gdb *gdb = NULL;
+  struct devmap map;
+  struct uart uart;
+  struct cycle_timer timer;
+  struct disk disk;
+
+  snprintf(default_trace, sizeof(default_trace), "%s.trace", h->name);
+  tracefile = default_trace;
+  timing.device = h->name;
+
+  while ((c = getopt(argc, argv, "vdo:R:n:f:r:D:Lg:Sp:F:")) != -1) {
+    switch (c) {
+    case 'v': verbose = 1; break;
+    case 'd': dump = 1; break;
+    case 'o': tracefile = optarg; break;
+    case 'R': records = strtoul(optarg, NULL, 0); break;
+    case 'n': cycles = strtoull(optarg, NULL, 0); break;
+    case 'f': hz = atof(optarg); break;
+    case 'r':
+      rom_lo = strtoul(optarg, &end, 0);
+      rom_hi = (*end == '-') ? strtoul(end + 1, &end, 0) : rom_lo;
+      if (*end || rom_hi < rom_lo || rom_hi > 0xffff) usage(h, argv[0]);
+      break;
+    case 'D': diskfile = optarg; break;
+    case 'L': check = 1; break;
+    case 'g': gdbsock = optarg; break;
+    case 'p': proffile = optarg; break;
+    case 'F': image_format = optarg; break;
+    case 'S':
+      if (!h->cpu->seq_cycle) usage(h, argv[0]);
+      sequence = 1;
+      break;
+    default: usage(h, argv[0]);
+    }
+  }
+  if (argc - optind > 2 || !records || (check && gdbsock)) usage(h, argv[0]);
+  if (optind < argc) parport = argv[optind++];
+  if (optind < argc) image = argv[optind++];
+
+  start = load_image(h->load_base, image);
+  if (h->setup) h->setup(mem, start);
+  memcpy(mem0, mem, sizeof(mem));
+  init_busyboard(&bb, parport);
+  buscyc_init(&bc, &bb, h->cpu, mem);
+  timing_setup(&timing, parport, verify, &bc);
+  memcpy(mem, mem0, sizeof(mem));
+
+  devmap_init(&map, mem);
+  if (rom_lo <= rom_hi) devmap_rom(&map, rom_lo, rom_hi);
+  uart_init(&uart);
+  map_device(h, &map, h->uart_base, 2, uart_read, uart_write, &uart);
+  timer.bc = &bc;
+  map_device(h, &map, h->timer_base, 4, timer_read, timer_write, &timer);
+  if (diskfile) {
+    if (disk_open(&disk, diskfile)) exit(1);
+    map_device(h, &map, h->disk_base, 8, disk_read, disk_write, &disk);
+  }
+  devmap_attach(&map, &bc);
+
+  bc.edge_us = params[T_CLK].us;
+  bc.target_hz = hz;
+  bc.sequence = sequence;
+  if (verbose) {
+    bc.trace = buscyc_print;
+  } else if (strcmp(tracefile, "-")) {
+    tr = trace_open(tracefile, bc.cpu->name, records);
+    if (!tr) exit(1);
+    bc.trace = trace_hook;
+    bc.ctx = tr;
+  }
+  if (proffile) {
+    if (!(prof = profile_open(bc.cpu))) exit(1);
+    traced = bc.trace;
+    bc.trace = profile_rec;
+  }
+  if (check && !(ls = lockstep_attach(&bc))) exit(1);
+  if (gdbsock && !(gdb = gdb_open(gdbsock, &bc, &map))) exit(1);
+  buscyc_reset(&bc);
+  if (gdb) gdb_run(gdb);
+  else buscyc_run(&bc, cycles);
+  uart_flush(&uart);
+  buscyc_report(&bc);
+  if (ls) {
+    lockstep_report(ls);
+    lockstep_close(ls);
+  }
+  if (gdb) gdb_close(gdb);
+  if (prof) {
+    profile_print_hot(prof, mem, 20);
+    if (!profile_write_folded(prof, proffile))
+      printf("Wrote call stacks to %s.\n", proffile);
+    profile_close(prof);
+  }
+  if (tr)
+    printf("Traced %llu cycles to %s.\n", trace_close(tr), tracefile);
+
+  if (diskfile) disk_close(&disk);
+  if (dump) dump_hex();
+
+  close_busyboard(&bb);
+
+  return 0;
+}
@@ -0,0 +1,32 @@
+#ifndef HARNESS_H
+#define HARNESS_H
+
+#include "buscyc.h"
+
+/* The CPU test harness shared by z80_test and 65c02_test: options, image
+   loading, the device map, clock timing, and the trace, lockstep, GDB and
+   profile hooks around buscyc. Each test only says what differs between
+   the CPUs. */
+
+struct harness {
+  const struct bus_cpu *cpu;
+  const char *name;        /* Timing profile name, and the trace file's */
+  const char *image;       /* Default image */
+  unsigned load_base;      /* Where address-less images go */
+  unsigned long long cycles; /* Default -n */
+  const char *stop;        /* What ends a run: "HALT", "STP" */
+
+  /* Devices: console UART, cycle timer and (with -D) sector device, as I/O
+     ports, or a memory page each if ports is zero. See devmap.h. */
+  int ports;
+  unsigned uart_base, timer_base, disk_base;
+
+  /* Optional: called with the image loaded and its start address (its
+     own, or load_base), before memory is saved for the timing runs. */
+  void (*setup)(unsigned char *mem, unsigned start);
+};
+
+/* Parse the options and run; returns the exit status. */
+int harness_main(const struct harness *h, int argc, char **argv);
+
+#endif
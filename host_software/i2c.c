@@ -0,0 +1,189 @@
+/* I2C master with open-drain lines emulated by port tristate control. */
+
+#include "i2c.h"
+
+/* Frames to wait for a stretched clock; the sensors that do it take
+   milliseconds at most. */
+#define I2C_MAX_STRETCH 10000
+
+/* Put out SDA and SCL (1 released) and sample the bus as it was. */
+static void lines(struct i2c *c, int sda, int scl) {
+  busyboard_t *bb = c->bb;
+
+  bb->trimask &= ~(c->sda_mask | c->scl_mask);
+  if (!sda) bb->trimask |= c->sda_mask;
+  if (!scl) bb->trimask |= c->scl_mask;
+  busyboard_xfer(bb);
+  c->sda = sda;
+  c->scl = scl;
+  c->frames++;
+}
+
+static int sda_in(const struct i2c *c) {
+  return c->bb->in_state[c->sda_port] & 1;
+}
+
+static int scl_in(const struct i2c *c) {
+  return c->bb->in_state[c->scl_port] & 1;
+}
+
+/* Release SCL until a slave stretching it lets go. Returns the frames it
+   was held low for, or -1. */
+static int wait_scl(struct i2c *c) {
+  int n;
+
+  lines(c, c->sda, 1);
+  for (n = 0; n < I2C_MAX_STRETCH; ++n) {
+    lines(c, c->sda, 1);
+    if (scl_in(c)) return n;
+  }
+  c->timeouts++;
+  return -1;
+}
+
+/* Clock out b (1 released) with SCL low on entry and exit; next is what
+   SDA will be for the following bit, or -1 if unknown. Returns SDA as
+   sampled with SCL high, or -1 on a timeout.
+
+   Slaves stretch the clock after an ack, so the first bit of a byte
+   (first set) holds SCL released until it reads high, which takes a frame
+   more. The rest go high for one frame and are pulled low by the frame
+   that finds out whether they did: one let go of between the sample and
+   the latch would be a short clock the slave counts and we don't. */
+static int clock_bit(struct i2c *c, int b, int next, int first) {
+  int after = (next == 1) ? 1 : b, n;
+
+  if (c->sda != b) lines(c, b, 0);
+  if (first) {
+    if ((n = wait_scl(c)) < 0) return -1;
+    if (n) c->stretches++;
+  } else {
+    lines(c, b, 1);
+  }
+  c->bits++;
+  for (;;) {
+    lines(c, after, 0);
+    if (scl_in(c)) return sda_in(c);
+
+    /* A slave held SCL low, so it hasn't risen yet: it does now. */
+    c->stretches++;
+    if (c->sda != b) lines(c, b, 0);
+    if (wait_scl(c) < 0) return -1;
+  }
+}
+
+int i2c_init(struct i2c *c, busyboard_t *bb, int sda_port, int scl_port) {
+  int i;
+
+  c->bb = bb;
+  c->sda_port = sda_port;
+  c->scl_port = scl_port;
+  c->sda_mask = 1 << sda_port;
+  c->scl_mask = 1 << scl_port;
+  c->frames = c->bits = c->stretches = c->naks = c->timeouts = 0;
+  bb->out_state[sda_port] = bb->out_state[scl_port] = 0;
+
+  lines(c, 1, 1);
+  lines(c, 1, 1);
+  for (i = 0; i < 9 && !sda_in(c); ++i) {
+    clock_bit(c, 1, 1, 1);
+    lines(c, 1, 1);
+  }
+  if (scl_in(c) && sda_in(c)) {
+    i2c_start(c);
+    i2c_stop(c);
+    return 0;
+  }
+  return -1;
+}
+
+void i2c_start(struct i2c *c) {
+  if (!c->scl) {
+    if (!c->sda) lines(c, 1, 0);
+    wait_scl(c);
+  }
+  lines(c, 0, 1);
+  lines(c, 0, 0);
+}
+
+void i2c_stop(struct i2c *c) {
+  if (c->sda) lines(c, 0, c->scl);
+  if (!c->scl) wait_scl(c);
+  lines(c, 1, 1);
+}
+
+int i2c_write_byte(struct i2c *c, unsigned char b) {
+  int i, ack;
+
+  for (i = 7; i >= 0; --i)
+    if (clock_bit(c, b >> i & 1, i ? b >> (i - 1) & 1 : 1, i == 7) < 0)
+      return -1;
+  if ((ack = clock_bit(c, 1, -1, 0)) > 0) c->naks++;
+  return ack;
+}
+
+unsigned char i2c_read_byte(struct i2c *c, int ack) {
+  unsigned char b = 0;
+  int i;
+
+  for (i = 0; i < 8; ++i)
+    b = b << 1 | (clock_bit(c, 1, i < 7 || !ack, i == 0) > 0);
+  clock_bit(c, !ack, 1, 0);
+  return b;
+}
+
+int i2c_probe(struct i2c *c, unsigned addr) {
+  int ack;
+
+  i2c_start(c);
+  ack = i2c_write_byte(c, addr << 1);
+  i2c_stop(c);
+  return ack ? -1 : 0;
+}
+
+static int send(struct i2c *c, unsigned addr, int rd, const unsigned char *buf,
+                unsigned len)
+{
+  unsigned i;
+
+  i2c_start(c);
+  if (i2c_write_byte(c, addr << 1 | rd)) return -1;
+  for (i = 0; i < len; ++i)
+    if (i2c_write_byte(c, buf[i])) return -1;
+  return 0;
+}
+
+static void recv(struct i2c *c, unsigned char *buf, unsigned len) {
+  unsigned i;
+
+  for (i = 0; i < len; ++i) buf[i] = i2c_read_byte(c, i + 1 < len);
+}
+
+int i2c_write(struct i2c *c, unsigned addr, const unsigned char *buf,
+              unsigned len)
+{
+  int ret = send(c, addr, 0, buf, len);
+
+  i2c_stop(c);
+  return ret;
+}
+
+int i2c_read(struct i2c *c, unsigned addr, unsigned char *buf, unsigned len)
+{
+  int ret = send(c, addr, 1, NULL, 0);
+
+  if (!ret) recv(c, buf, len);
+  i2c_stop(c);
+  return ret;
+}
+
+int i2c_write_read(struct i2c *c, unsigned addr, const unsigned char *wbuf,
+                   unsigned wlen, unsigned char *rbuf, unsigned rlen)
+{
+  int ret = send(c, addr, 0, wbuf, wlen);
+
+  if (!ret) ret = send(c, addr, 1, NULL, 0);
+  if (!ret) recv(c, rbuf, rlen);
+  i2c_stop(c);
+  return ret;
+}
@@ -0,0 +1,56 @@
+#ifndef I2C_H
+#define I2C_H
+
+#include "busyboard.h"
+
+/* I2C master. trimask switches whole ports, so SDA and SCL each get a port
+   of their own (by default SDA on port A, SCL on port B; the line is bit 0
+   and the rest of the port goes with it). A port's outputs stay 0: a line
+   is pulled low by enabling its port's drivers, and released, to be pulled
+   up by the bus, by tristating them. That is open drain, so slaves can
+   stretch the clock and drive SDA.
+
+   Every frame both puts out the next line states and samples the bus as
+   it was under the last ones, so reading SDA and checking SCL for a
+   stretched clock ride on the frame that pulls SCL low again. A bit takes
+   two frames, SCL high and SCL low; SDA changes with SCL going low when
+   it rises (released, so it lags SCL), and gets a frame of its own, with
+   SCL low, only when it falls. The first bit of each byte, where slaves
+   stretch, takes one more, to see SCL high before pulling it low. */
+
+struct i2c {
+  busyboard_t *bb;
+  unsigned sda_mask, scl_mask; /* trimask bits */
+  int sda_port, scl_port;
+  int sda, scl;                /* As put out; 1 released */
+
+  /* Statistics */
+  unsigned long frames, bits, stretches, naks, timeouts;
+};
+
+/* Release the bus, and clock a slave stuck in a read off SDA. Returns 0,
+   or -1 if SCL or SDA stays low. */
+int i2c_init(struct i2c *c, busyboard_t *bb, int sda_port, int scl_port);
+
+/* Start, or repeated start with the bus busy. */
+void i2c_start(struct i2c *c);
+void i2c_stop(struct i2c *c);
+
+/* Returns 0 if acked, 1 if not, -1 if the clock stayed stretched. */
+int i2c_write_byte(struct i2c *c, unsigned char b);
+
+/* Ack unless it's the last byte to read. */
+unsigned char i2c_read_byte(struct i2c *c, int ack);
+
+/* Whole transactions, 7-bit addresses. Each returns 0, or -1 on a nak or
+   timeout (after a stop). i2c_write_read writes, then reads after a
+   repeated start: a register read, or a 24Cxx random read when wbuf holds
+   the memory address. */
+int i2c_probe(struct i2c *c, unsigned addr);
+int i2c_write(struct i2c *c, unsigned addr, const unsigned char *buf,
+              unsigned len);
+int i2c_read(struct i2c *c, unsigned addr, unsigned char *buf, unsigned len);
+int i2c_write_read(struct i2c *c, unsigned addr, const unsigned char *wbuf,
+                   unsigned wlen, unsigned char *rbuf, unsigned rlen);
+
+#endif
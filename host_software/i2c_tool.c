@@ -0,0 +1,242 @@
+/* I2C bus tool: scan, register access, sensor polling, and 24Cxx EEPROM
+   dump and load. */
+/* Pinout (open drain; pull-ups on the bus side):
+     A0 - SDA (the rest of port A follows it)
+     B0 - SCL (the rest of port B follows it)
+   -s and -c move them to other ports. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "busyboard.h"
+#include "i2c.h"
+
+/* Give up ack polling a 24Cxx write cycle after this long (they take
+   5-10 ms). */
+#define WRITE_TIMEOUT 0.05
+
+struct i2c i2c;
+int reg_width = 1, page_size = 32;
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void hexdump(unsigned base, const unsigned char *buf, unsigned len) {
+  unsigned i;
+
+  for (i = 0; i < len; ++i)
+    printf("%s%02x%s", (i % 16) ? "" : (printf("%04x:", base + i), " "),
+           buf[i], (i % 16 == 15 || i + 1 == len) ? "\n" : " ");
+}
+
+/* Register or memory address bytes, high first. */
+unsigned reg_bytes(unsigned reg, unsigned char *b) {
+  if (reg_width == 2) {
+    b[0] = reg >> 8;
+    b[1] = reg;
+  } else {
+    b[0] = reg;
+  }
+  return reg_width;
+}
+
+/* 24C04-24C16 take address bits 8-10 in the device address. */
+unsigned dev_for(unsigned addr, unsigned mem) {
+  return reg_width == 1 ? addr | (mem >> 8 & 7) : addr;
+}
+
+int mem_read(unsigned addr, unsigned mem, unsigned char *buf, unsigned len) {
+  unsigned char b[2];
+  unsigned n;
+
+  /* One random read, then sequential; with 1-byte addresses, one per 256
+     byte block. */
+  while (len) {
+    n = (reg_width == 1) ? 256 - (mem & 0xff) : len;
+    if (n > len) n = len;
+    if (i2c_write_read(&i2c, dev_for(addr, mem), b, reg_bytes(mem, b), buf,
+                       n))
+      return -1;
+    mem += n;
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+int mem_write(unsigned addr, unsigned mem, const unsigned char *buf,
+              unsigned len)
+{
+  unsigned char b[2 + 256];
+  unsigned n, k;
+  double start;
+
+  while (len) {
+    n = page_size - mem % page_size;
+    if (n > len) n = len;
+    k = reg_bytes(mem, b);
+    memcpy(b + k, buf, n);
+    if (i2c_write(&i2c, dev_for(addr, mem), b, k + n)) return -1;
+
+    /* The part naks its address until the write cycle is done. */
+    start = now();
+    while (i2c_probe(&i2c, dev_for(addr, mem)))
+      if (now() - start > WRITE_TIMEOUT) return -1;
+    mem += n;
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/* Gives up, letting go of the bus, if there's no memory. */
+unsigned char *get_buf(busyboard_t *bb, unsigned len) {
+  unsigned char *buf = malloc(len ? len : 1);
+
+  if (!buf) {
+    perror("malloc");
+    close_busyboard(bb);
+    exit(1);
+  }
+  return buf;
+}
+
+void report(double t) {
+  printf("%lu bits in %lu frames (%.2f frames/bit) in %.3f s: %.0f bits/s",
+         i2c.bits, i2c.frames, i2c.bits ? (double)i2c.frames / i2c.bits : 0,
+         t, t > 0 ? i2c.bits / t : 0);
+  if (i2c.stretches) printf(", %lu stretched clocks", i2c.stretches);
+  if (i2c.naks) printf(", %lu naks", i2c.naks);
+  if (i2c.timeouts) printf(", %lu clock timeouts", i2c.timeouts);
+  printf(".\n");
+}
+
+void usage(const char *argv0) {
+  fprintf(stderr,
+    "Usage: %s [-p parport] [-s sda_port] [-c scl_port] [-w 1|2] "
+    "[-P page]\n"
+    "       command...\n"
+    "  scan                      List the addresses that ack.\n"
+    "  get addr reg [len]        Read registers (or memory).\n"
+    "  set addr reg byte...      Write registers.\n"
+    "  poll addr reg len count   Read registers count times, as fast as\n"
+    "                            the bus goes.\n"
+    "  dump addr size file       Read a 24Cxx EEPROM to file.\n"
+    "  load addr file            Write file to a 24Cxx, page by page, and\n"
+    "                            verify it.\n"
+    "  Register and memory addresses are -w bytes (default 1; 24C32 and\n"
+    "  up take 2); -P is the EEPROM page size (default 32). Ports are a-f.\n",
+    argv0);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  const char *parport = "/dev/parport0";
+  int c, sda_port = 0, scl_port = 1, ret = 0;
+  unsigned addr = 0, reg = 0, len, i, n;
+  unsigned char *buf = NULL;
+  const char *cmd;
+  double start;
+  FILE *f;
+
+  while ((c = getopt(argc, argv, "p:s:c:w:P:")) != -1) {
+    switch (c) {
+    case 'p': parport = optarg; break;
+    case 's': sda_port = (optarg[0] | 0x20) - 'a'; break;
+    case 'c': scl_port = (optarg[0] | 0x20) - 'a'; break;
+    case 'w': reg_width = atoi(optarg); break;
+    case 'P': page_size = atoi(optarg); break;
+    default: usage(argv[0]);
+    }
+  }
+  if (optind >= argc || sda_port < 0 || sda_port >= BUSYBOARD_N_PORTS ||
+      scl_port < 0 || scl_port >= BUSYBOARD_N_PORTS ||
+      sda_port == scl_port || (reg_width != 1 && reg_width != 2) ||
+      page_size < 1 || page_size > 256)
+    usage(argv[0]);
+  cmd = argv[optind];
+  if (optind + 1 < argc) addr = strtoul(argv[optind + 1], NULL, 0);
+  if (optind + 2 < argc) reg = strtoul(argv[optind + 2], NULL, 0);
+
+  busyboard_t bb;
+  init_busyboard(&bb, parport);
+  bb.trimask = 0;
+  if (i2c_init(&i2c, &bb, sda_port, scl_port)) {
+    fprintf(stderr, "The bus is stuck: SCL or SDA stays low.\n");
+    close_busyboard(&bb);
+    return 1;
+  }
+
+  start = now();
+  if (!strcmp(cmd, "scan")) {
+    for (i = 0x08, n = 0; i < 0x78; ++i)
+      if (!i2c_probe(&i2c, i)) printf("%s0x%02x", n++ ? " " : "", i);
+    printf(n ? "\n" : "No devices.\n");
+  } else if (!strcmp(cmd, "get") && optind + 2 < argc) {
+    len = (optind + 3 < argc) ? strtoul(argv[optind + 3], NULL, 0) : 1;
+    buf = get_buf(&bb, len);
+    if (!(ret = mem_read(addr, reg, buf, len))) hexdump(reg, buf, len);
+  } else if (!strcmp(cmd, "set") && optind + 3 < argc) {
+    len = argc - optind - 3;
+    buf = get_buf(&bb, len);
+    for (i = 0; i < len; ++i)
+      buf[i] = strtoul(argv[optind + 3 + i], NULL, 0);
+    ret = mem_write(addr, reg, buf, len);
+  } else if (!strcmp(cmd, "poll") && optind + 4 < argc) {
+    len = strtoul(argv[optind + 3], NULL, 0);
+    n = strtoul(argv[optind + 4], NULL, 0);
+    buf = get_buf(&bb, len);
+    for (i = 0; i < n && !ret; ++i) ret = mem_read(addr, reg, buf, len);
+    if (!ret) {
+      printf("%u reads, %.0f/s; the last:\n", n, n / (now() - start));
+      hexdump(reg, buf, len);
+    }
+  } else if (!strcmp(cmd, "dump") && optind + 3 < argc) {
+    len = reg;
+    buf = get_buf(&bb, len);
+    if (!(ret = mem_read(addr, 0, buf, len))) {
+      f = fopen(argv[optind + 3], "wb");
+      if (!f || fwrite(buf, 1, len, f) != len) {
+        perror(argv[optind + 3]);
+        ret = -1;
+      }
+      if (f) fclose(f);
+    }
+  } else if (!strcmp(cmd, "load") && optind + 2 < argc) {
+    f = fopen(argv[optind + 2], "rb");
+    if (!f) {
+      perror(argv[optind + 2]);
+      close_busyboard(&bb);
+      return 1;
+    }
+    buf = get_buf(&bb, 0x10000 * 2);
+    len = fread(buf, 1, 0x10000, f);
+    fclose(f);
+    ret = mem_write(addr, 0, buf, len);
+    if (!ret && !(ret = mem_read(addr, 0, buf + 0x10000, len)) &&
+        memcmp(buf, buf + 0x10000, len)) {
+      for (i = 0; buf[i] == buf[0x10000 + i]; ++i)
+        ;
+      printf("Verify failed at 0x%04x: wrote %02x, read %02x.\n", i, buf[i],
+             buf[0x10000 + i]);
+      ret = -1;
+    }
+    if (!ret) printf("Wrote and verified %u bytes.\n", len);
+  } else {
+    close_busyboard(&bb);
+    usage(argv[0]);
+  }
+
+  if (ret) printf("Failed: no ack.\n");
+  report(now() - start);
+  free(buf);
+  close_busyboard(&bb);
+
+  return ret ? 1 : 0;
+}
@@ -0,0 +1,418 @@
+/* Program image loader: Intel HEX, S-records, hex bytes, raw binary. */
+
+#include "image.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static signed char hexval[256];
+
+static void init_hexval(void) {
+  int i;
+
+  if (hexval['1']) return;
+  memset(hexval, -1, sizeof(hexval));
+  for (i = 0; i < 10; ++i) hexval['0' + i] = i;
+  for (i = 0; i < 6; ++i) hexval['a' + i] = hexval['A' + i] = 10 + i;
+}
+
+static int error(const struct image *img, unsigned line, const char *msg) {
+  if (line) fprintf(stderr, "%s:%u: %s\n", img->filename, line, msg);
+  else fprintf(stderr, "%s: %s\n", img->filename, msg);
+  return -1;
+}
+
+/* Append n bytes already decoded at the end of buf, at address addr. Runs
+   that continue the previous record extend its segment. */
+static int add_data(struct image *img, unsigned line, unsigned addr,
+                    unsigned n)
+{
+  struct image_seg *s = img->n_seg ? &img->seg[img->n_seg - 1] : NULL, *seg;
+  unsigned max;
+
+  if (addr + n < addr) return error(img, line, "address overflow");
+
+  if (s && s->addr + s->len == addr &&
+      s->data + s->len == img->buf + img->buf_len) {
+    s->len += n;
+  } else {
+    if (img->n_seg == img->max_seg) {
+      max = img->max_seg ? img->max_seg * 2 : 16;
+      seg = realloc(img->seg, max * sizeof(*seg));
+      if (!seg) return error(img, line, "out of memory");
+      img->seg = seg;
+      img->max_seg = max;
+    }
+    s = &img->seg[img->n_seg++];
+    s->addr = addr;
+    s->len = n;
+    s->data = img->buf + img->buf_len;
+  }
+  img->buf_len += n;
+
+  return 0;
+}
+
+/* Decode the hex digits of one record into rec. Returns the byte count, or
+   -1 on a bad digit or odd length. */
+static int decode(const char *p, const char *e, unsigned char *rec, int max) {
+  int n = 0;
+
+  if ((e - p) & 1) return -1;
+  for (; p < e; p += 2) {
+    int hi = hexval[(unsigned char)p[0]], lo = hexval[(unsigned char)p[1]];
+    if (hi < 0 || lo < 0 || n == max) return -1;
+    rec[n++] = hi << 4 | lo;
+  }
+
+  return n;
+}
+
+/* Split the mapping into lines, trimmed of surrounding white space. */
+static const char *next_line(const char **p, const char *end, const char **e) {
+  const char *s = *p, *t;
+
+  while (s < end && (*s == ' ' || *s == '\t' || *s == '\r')) s++;
+  t = (s < end) ? memchr(s, '\n', end - s) : NULL;
+  if (!t) t = end;
+  *p = t < end ? t + 1 : end;
+  while (t > s && (t[-1] == ' ' || t[-1] == '\t' || t[-1] == '\r')) t--;
+  *e = t;
+
+  return s;
+}
+
+static int load_ihex(struct image *img, const char *p, const char *end) {
+  unsigned char rec[260];
+  unsigned line = 0, ext = 0, sum;
+  int n, i;
+
+  while (p < end) {
+    const char *e, *s = next_line(&p, end, &e);
+    line++;
+    if (s == e) continue;
+
+    if (*s != ':' || (n = decode(s + 1, e, rec, sizeof(rec))) < 5 ||
+        n != rec[0] + 5)
+      return error(img, line, "malformed record");
+    for (i = sum = 0; i < n; ++i) sum += rec[i];
+    if (sum & 0xff) return error(img, line, "bad checksum");
+
+    unsigned addr = rec[1] << 8 | rec[2],
+             val = (rec[0] >= 2) ? rec[4] << 8 | rec[5] : 0;
+    switch (rec[3]) {
+    case 0:
+      memcpy(img->buf + img->buf_len, rec + 4, rec[0]);
+      if (add_data(img, line, ext + addr, rec[0])) return -1;
+      break;
+    case 1:
+      return 0;
+    case 2:
+      ext = val << 4;
+      break;
+    case 3:
+      if (rec[0] != 4) return error(img, line, "malformed record");
+      img->entry = (val << 4) + (rec[6] << 8 | rec[7]);
+      img->has_entry = 1;
+      break;
+    case 4:
+      ext = val << 16;
+      break;
+    case 5:
+      if (rec[0] != 4) return error(img, line, "malformed record");
+      img->entry = val << 16 | rec[6] << 8 | rec[7];
+      img->has_entry = 1;
+      break;
+    default:
+      return error(img, line, "unknown record type");
+    }
+  }
+
+  return 0;
+}
+
+static int load_srec(struct image *img, const char *p, const char *end) {
+  static const int addr_len[10] = { 2, 2, 3, 4, 0, 2, 3, 4, 3, 2 };
+  unsigned char rec[260];
+  unsigned line = 0, sum, addr;
+  int n, i, type, al;
+
+  while (p < end) {
+    const char *e, *s = next_line(&p, end, &e);
+    line++;
+    if (s == e) continue;
+
+    if (e - s < 4 || s[0] != 'S' || s[1] < '0' || s[1] > '9' ||
+        !(al = addr_len[type = s[1] - '0']) ||
+        (n = decode(s + 2, e, rec, sizeof(rec))) < al + 2 || n != rec[0] + 1)
+      return error(img, line, "malformed record");
+    for (i = sum = 0; i < n - 1; ++i) sum += rec[i];
+    if ((~sum & 0xff) != rec[n - 1]) return error(img, line, "bad checksum");
+
+    for (i = addr = 0; i < al; ++i) addr = addr << 8 | rec[1 + i];
+    if (type >= 1 && type <= 3) {
+      memcpy(img->buf + img->buf_len, rec + 1 + al, n - 2 - al);
+      if (add_data(img, line, addr, n - 2 - al)) return -1;
+    } else if (type >= 7) {
+      img->entry = addr;
+      img->has_entry = 1;
+    }
+  }
+
+  return 0;
+}
+
+/* The original format: one hex byte per line (or any white space). */
+static int load_bytes(struct image *img, const char *p, const char *end,
+                      unsigned base)
+{
+  unsigned line = 1;
+
+  while (p < end) {
+    unsigned val = 0;
+    int digits = 0;
+
+    for (; p < end && hexval[(unsigned char)*p] < 0; ++p)
+      if (*p == '\n') line++;
+    for (; p < end && hexval[(unsigned char)*p] >= 0; ++p, ++digits)
+      val = val << 4 | hexval[(unsigned char)*p];
+    if (!digits) break;
+    if (digits > 2) return error(img, line, "value wider than a byte");
+
+    img->buf[img->buf_len] = val;
+    if (add_data(img, line, base + img->buf_len, 1)) return -1;
+  }
+
+  return 0;
+}
+
+static int seg_cmp(const void *a, const void *b) {
+  const struct image_seg *x = a, *y = b;
+  return (x->addr > y->addr) - (x->addr < y->addr);
+}
+
+/* Sort the segments, reject overlaps, and work out the extent. */
+static int finish(struct image *img) {
+  unsigned i;
+
+  qsort(img->seg, img->n_seg, sizeof(*img->seg), seg_cmp);
+  for (i = 1; i < img->n_seg; ++i) {
+    if (img->seg[i].addr < img->seg[i - 1].addr + img->seg[i - 1].len) {
+      fprintf(stderr, "%s: overlapping data at %x\n", img->filename,
+              img->seg[i].addr);
+      return -1;
+    }
+  }
+
+  img->lo = img->n_seg ? img->seg[0].addr : 0;
+  img->hi = img->n_seg ? img->seg[img->n_seg - 1].addr +
+                         img->seg[img->n_seg - 1].len : 0;
+
+  return 0;
+}
+
+/* Nonzero if filename ends in one of the extensions, in any case. */
+static int has_ext(const char *filename, const char *const *ext) {
+  size_t n = strlen(filename), m;
+
+  for (; *ext; ++ext) {
+    m = strlen(*ext);
+    if (n > m && !strcasecmp(filename + n - m, *ext)) return 1;
+  }
+  return 0;
+}
+
+int image_load(struct image *img, const char *filename, unsigned base,
+               const char *format)
+{
+  static const char *const hex_ext[] = { ".hex", NULL };
+  static const char *const ihx_ext[] = { ".ihx", NULL };
+  static const char *const srec_ext[] = { ".s19", ".s28", ".s37", ".srec",
+                                          ".mot", NULL };
+  struct stat st;
+  const char *p, *end, *s;
+  int fd, ret;
+
+  init_hexval();
+  memset(img, 0, sizeof(*img));
+  img->filename = filename;
+
+  fd = open(filename, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st)) {
+    perror(filename);
+    if (fd >= 0) close(fd);
+    return -1;
+  }
+  img->map_len = st.st_size;
+  if (img->map_len) {
+    img->map = mmap(NULL, img->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (img->map == MAP_FAILED) {
+      perror(filename);
+      close(fd);
+      img->map = NULL;
+      return -1;
+    }
+    madvise(img->map, img->map_len, MADV_SEQUENTIAL);
+  }
+  close(fd);
+
+  p = img->map;
+  end = p + img->map_len;
+  for (s = p; s < end && (*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n');
+       ++s);
+
+  /* Text formats go by the name; anything else is binary, since a raw
+     image can start with ':' or "S1" as well as a text file can. .hex is
+     Intel HEX or, without the colons, the old one byte per line files. */
+  if (!format) {
+    if (has_ext(filename, ihx_ext))
+      format = "ihex";
+    else if (has_ext(filename, hex_ext))
+      format = (s < end && *s == ':') ? "ihex" : "bytes";
+    else if (has_ext(filename, srec_ext))
+      format = "srec";
+    else
+      format = "bin";
+  }
+  if (!strcmp(format, "ihex")) img->format = "Intel HEX";
+  else if (!strcmp(format, "srec")) img->format = "S-record";
+  else if (!strcmp(format, "bytes")) img->format = "hex bytes";
+  else if (strcmp(format, "bin")) {
+    error(img, 0, "format isn't ihex, srec, bytes or bin");
+    image_free(img);
+    return -1;
+  }
+
+  if (!img->format) {
+    img->format = "binary";
+    if (img->map_len > 0xffffffffu - base) {
+      error(img, 0, "too large");
+      image_free(img);
+      return -1;
+    }
+    if (img->map_len) {
+      if (!(img->seg = malloc(sizeof(*img->seg)))) {
+        error(img, 0, "out of memory");
+        image_free(img);
+        return -1;
+      }
+      img->max_seg = img->n_seg = 1;
+      img->seg[0].addr = base;
+      img->seg[0].len = img->map_len;
+      img->seg[0].data = img->map;
+    }
+    return finish(img);
+  }
+
+  /* Decoded data never takes more than half the text. */
+  img->buf = malloc(img->map_len/2 + 1);
+  if (!img->buf) ret = error(img, 0, "out of memory");
+  else if (!strcmp(img->format, "Intel HEX")) ret = load_ihex(img, p, end);
+  else if (!strcmp(img->format, "S-record")) ret = load_srec(img, p, end);
+  else ret = load_bytes(img, p, end, base);
+
+  if (!ret) ret = finish(img);
+  if (ret) image_free(img);
+
+  return ret;
+}
+
+void image_free(struct image *img) {
+  if (img->map) munmap(img->map, img->map_len);
+  free(img->buf);
+  free(img->seg);
+  img->map = NULL;
+  img->buf = NULL;
+  img->seg = NULL;
+  img->n_seg = 0;
+}
+
+unsigned image_copy(const struct image *img, unsigned char *buf, unsigned base,
+                    unsigned len)
+{
+  unsigned i, copied = 0;
+
+  for (i = 0; i < img->n_seg; ++i) {
+    const struct image_seg *s = &img->seg[i];
+    unsigned lo = s->addr > base ? s->addr : base,
+             hi = s->addr + s->len < base + len ? s->addr + s->len : base + len;
+    if (lo >= hi) continue;
+    memcpy(buf + (lo - base), s->data + (lo - s->addr), hi - lo);
+    copied += hi - lo;
+  }
+
+  return copied;
+}
+
+int image_blank(const unsigned char *buf, unsigned len) {
+  return !len || (buf[0] == 0xff && !memcmp(buf, buf + 1, len - 1));
+}
+
+int image_strip_blank(struct image *img, unsigned size) {
+  struct image_seg *out = NULL, *grown;
+  unsigned i, n = 0, max = 0;
+
+  for (i = 0; i < img->n_seg; ++i) {
+    const struct image_seg *s = &img->seg[i];
+    unsigned a = s->addr, end = s->addr + s->len;
+
+    while (a < end) {
+      unsigned b = (a | (size - 1)) + 1;
+      if (b > end || b == 0) b = end;
+
+      if (!image_blank(s->data + (a - s->addr), b - a)) {
+        if (n && out[n - 1].addr + out[n - 1].len == a &&
+            out[n - 1].data + out[n - 1].len == s->data + (a - s->addr)) {
+          out[n - 1].len += b - a;
+        } else {
+          if (n == max) {
+            max = max ? max * 2 : 16;
+            if (!(grown = realloc(out, max * sizeof(*out)))) {
+              error(img, 0, "out of memory");
+              free(out);
+              image_free(img);
+              return -1;
+            }
+            out = grown;
+          }
+          out[n].addr = a;
+          out[n].len = b - a;
+          out[n].data = s->data + (a - s->addr);
+          n++;
+        }
+      }
+      a = b;
+    }
+  }
+
+  free(img->seg);
+  img->seg = out;
+  img->n_seg = n;
+  img->max_seg = max;
+  return finish(img);
+}
+
+unsigned long long image_hash(const struct image *img) {
+  unsigned long long h = 0xcbf29ce484222325ull;
+  unsigned i, j;
+
+  for (i = 0; i < img->n_seg; ++i) {
+    const struct image_seg *s = &img->seg[i];
+    for (j = 0; j < 4; ++j) {
+      h ^= (s->addr >> (8 * j)) & 0xff;
+      h *= 0x100000001b3ull;
+    }
+    for (j = 0; j < s->len; ++j) {
+      h ^= s->data[j];
+      h *= 0x100000001b3ull;
+    }
+  }
+
+  return h;
+}
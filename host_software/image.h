@@ -0,0 +1,55 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+/* Program image loader. Reads Intel HEX, Motorola S-records, the old one hex
+   byte per line format, or raw binary into a list of segments sorted by
+   address. Files are mmapped; raw binaries are used in place. */
+
+struct image_seg {
+  unsigned addr, len;
+  const unsigned char *data;
+};
+
+struct image {
+  const char *filename, *format;
+  struct image_seg *seg;
+  unsigned n_seg;
+  unsigned lo, hi; /* Lowest address, and one past the highest. */
+  unsigned entry; /* Start address from the file, if has_entry. */
+  int has_entry;
+
+  /* Private. */
+  unsigned max_seg;
+  unsigned char *buf;
+  unsigned buf_len, buf_max;
+  void *map;
+  unsigned long map_len;
+};
+
+/* Load filename. format is "ihex", "srec", "bytes" (one hex byte per line)
+   or "bin", or NULL to go by the extension: .hex and .ihx are Intel HEX
+   (.hex without colons is bytes), .s19, .s28, .s37, .srec and .mot are
+   S-records, and everything else is binary. base is the load address for
+   formats that don't carry addresses (raw binary and bytes). Returns 0,
+   or -1 after printing an error. */
+int image_load(struct image *img, const char *filename, unsigned base,
+               const char *format);
+void image_free(struct image *img);
+
+/* Copy the bytes of the image that fall in [base, base + len) to buf, leaving
+   the gaps between segments alone. Returns the number of bytes copied. */
+unsigned image_copy(const struct image *img, unsigned char *buf, unsigned base,
+                    unsigned len);
+
+/* Drop aligned blocks of size bytes (a power of two) that are all 0xff, so
+   that programmers leave erased or blank regions alone. Returns 0, or -1
+   after printing an error and freeing the image. */
+int image_strip_blank(struct image *img, unsigned size);
+
+/* Nonzero if len bytes at buf are all 0xff. */
+int image_blank(const unsigned char *buf, unsigned len);
+
+/* FNV-1a hash over every segment's address and data. */
+unsigned long long image_hash(const struct image *img);
+
+#endif
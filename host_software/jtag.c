@@ -0,0 +1,158 @@
+/* JTAG master: TAP state tracking and scans. */
+
+#include <string.h>
+
+#include "jtag.h"
+
+static const char *const names[TAP_N_STATES] = {
+  "RESET", "IDLE",
+  "DRSELECT", "DRCAPTURE", "DRSHIFT", "DREXIT1", "DRPAUSE", "DREXIT2",
+  "DRUPDATE",
+  "IRSELECT", "IRCAPTURE", "IRSHIFT", "IREXIT1", "IRPAUSE", "IREXIT2",
+  "IRUPDATE",
+};
+
+/* The state after a clock with TMS low, and high. */
+static const unsigned char next[TAP_N_STATES][2] = {
+  [TAP_RESET]     = { TAP_IDLE,      TAP_RESET },
+  [TAP_IDLE]      = { TAP_IDLE,      TAP_DRSELECT },
+  [TAP_DRSELECT]  = { TAP_DRCAPTURE, TAP_IRSELECT },
+  [TAP_DRCAPTURE] = { TAP_DRSHIFT,   TAP_DREXIT1 },
+  [TAP_DRSHIFT]   = { TAP_DRSHIFT,   TAP_DREXIT1 },
+  [TAP_DREXIT1]   = { TAP_DRPAUSE,   TAP_DRUPDATE },
+  [TAP_DRPAUSE]   = { TAP_DRPAUSE,   TAP_DREXIT2 },
+  [TAP_DREXIT2]   = { TAP_DRSHIFT,   TAP_DRUPDATE },
+  [TAP_DRUPDATE]  = { TAP_IDLE,      TAP_DRSELECT },
+  [TAP_IRSELECT]  = { TAP_IRCAPTURE, TAP_RESET },
+  [TAP_IRCAPTURE] = { TAP_IRSHIFT,   TAP_IREXIT1 },
+  [TAP_IRSHIFT]   = { TAP_IRSHIFT,   TAP_IREXIT1 },
+  [TAP_IREXIT1]   = { TAP_IRPAUSE,   TAP_IRUPDATE },
+  [TAP_IRPAUSE]   = { TAP_IRPAUSE,   TAP_IREXIT2 },
+  [TAP_IREXIT2]   = { TAP_IRSHIFT,   TAP_IRUPDATE },
+  [TAP_IRUPDATE]  = { TAP_IDLE,      TAP_DRSELECT },
+};
+
+/* Shortest TMS sequences, bit 0 first, and their lengths: path[from][to].
+   Filled in by a breadth-first search from each state on the first
+   jtag_init. No path is longer than 7. */
+static unsigned char path[TAP_N_STATES][TAP_N_STATES];
+static unsigned char path_len[TAP_N_STATES][TAP_N_STATES];
+
+static void find_paths(void) {
+  int from, head, tail, s, t, tms;
+  unsigned char queue[TAP_N_STATES], seen[TAP_N_STATES];
+
+  for (from = 0; from < TAP_N_STATES; ++from) {
+    memset(seen, 0, sizeof(seen));
+    queue[0] = from;
+    seen[from] = 1;
+    path[from][from] = path_len[from][from] = 0;
+    for (head = 0, tail = 1; head < tail; ++head) {
+      s = queue[head];
+      for (tms = 0; tms < 2; ++tms) {
+        t = next[s][tms];
+        if (seen[t]) continue;
+        seen[t] = 1;
+        path[from][t] = path[from][s] | tms << path_len[from][s];
+        path_len[from][t] = path_len[from][s] + 1;
+        queue[tail++] = t;
+      }
+    }
+  }
+}
+
+static void pin(busyboard_t *bb, int p, int v) {
+  if (v) bb->out_state[p / 8] |= 1 << p % 8;
+  else bb->out_state[p / 8] &= ~(1 << p % 8);
+}
+
+/* One TCK cycle; returns TDO as it was before the rising edge if sample
+   is set. */
+static int cycle(struct jtag *j, int tms, int tdi, int sample) {
+  busyboard_t *bb = j->bb;
+  int tdo = 0;
+
+  pin(bb, j->tck, 0);
+  pin(bb, j->tms, tms);
+  pin(bb, j->tdi, tdi);
+  busyboard_out(bb);
+  pin(bb, j->tck, 1);
+  if (sample) {
+    busyboard_xfer(bb);
+    tdo = bb->in_state[j->tdo / 8] >> j->tdo % 8 & 1;
+  } else {
+    busyboard_out(bb);
+  }
+  j->state = next[j->state][tms];
+  j->tcks++;
+  return tdo;
+}
+
+int jtag_init(struct jtag *j, busyboard_t *bb, int tck, int tms, int tdi,
+              int tdo)
+{
+  if (!path_len[TAP_RESET][TAP_IDLE]) find_paths();
+
+  if (tdo / 8 == tck / 8 || tdo / 8 == tms / 8 || tdo / 8 == tdi / 8)
+    return -1;
+  j->bb = bb;
+  j->tck = tck;
+  j->tms = tms;
+  j->tdi = tdi;
+  j->tdo = tdo;
+  j->tcks = 0;
+  bb->trimask |= 1 << tck / 8 | 1 << tms / 8 | 1 << tdi / 8;
+  bb->trimask &= ~(1 << tdo / 8);
+  jtag_reset(j);
+  return 0;
+}
+
+void jtag_reset(struct jtag *j) {
+  int i;
+
+  for (i = 0; i < 5; ++i) cycle(j, 1, 0, 0);
+  j->state = TAP_RESET;
+}
+
+void jtag_goto(struct jtag *j, enum tap_state s) {
+  unsigned tms = path[j->state][s];
+  int i, n = path_len[j->state][s];
+
+  for (i = 0; i < n; ++i) cycle(j, tms >> i & 1, 0, 0);
+}
+
+void jtag_idle(struct jtag *j, unsigned long n) {
+  int tms = (j->state == TAP_RESET);
+
+  while (n--) cycle(j, tms, 0, 0);
+}
+
+void jtag_scan(struct jtag *j, int ir, unsigned long n,
+               const unsigned char *tdi, unsigned char *tdo,
+               enum tap_state end)
+{
+  enum tap_state shift = ir ? TAP_IRSHIFT : TAP_DRSHIFT;
+  unsigned long i;
+  int b;
+
+  jtag_goto(j, shift);
+  if (tdo) memset(tdo, 0, (n + 7) / 8);
+  for (i = 0; i < n; ++i) {
+    b = cycle(j, i + 1 == n && end != shift,
+              tdi ? tdi[i / 8] >> i % 8 & 1 : 0, tdo != NULL);
+    if (tdo) tdo[i / 8] |= b << i % 8;
+  }
+  jtag_goto(j, end);
+}
+
+const char *tap_name(enum tap_state s) {
+  return names[s];
+}
+
+int tap_by_name(const char *name) {
+  int s;
+
+  for (s = 0; s < TAP_N_STATES; ++s)
+    if (!strcmp(name, names[s])) return s;
+  return -1;
+}
@@ -0,0 +1,60 @@
+#ifndef JTAG_H
+#define JTAG_H
+
+#include "busyboard.h"
+
+/* JTAG master. Pins are numbered a0 = 0 to f7 = 47. TCK, TMS and TDI are
+   outputs and may share a port; TDO is an input, so its port is left
+   tristated and can't hold any of them.
+
+   A TCK cycle is two frames, as in spi_byte: the first puts out TCK low
+   with the cycle's TMS and TDI, which the target takes on the rising edge
+   put out by the second; its TDO moves on the falling edge. When TDO is
+   wanted the second frame is a transfer, and samples it as it was under
+   the first, so a scan that reads costs no more frames than one that
+   doesn't. The state is tracked, and moves take the shortest TMS path on
+   the same frames: the last bit of a scan leaves the shift state with TMS
+   high, and the path to the end state carries on from Exit1. */
+
+enum tap_state {
+  TAP_RESET, TAP_IDLE,
+  TAP_DRSELECT, TAP_DRCAPTURE, TAP_DRSHIFT, TAP_DREXIT1, TAP_DRPAUSE,
+  TAP_DREXIT2, TAP_DRUPDATE,
+  TAP_IRSELECT, TAP_IRCAPTURE, TAP_IRSHIFT, TAP_IREXIT1, TAP_IRPAUSE,
+  TAP_IREXIT2, TAP_IRUPDATE,
+  TAP_N_STATES
+};
+
+struct jtag {
+  busyboard_t *bb;
+  int tck, tms, tdi, tdo;
+  enum tap_state state;
+
+  /* Statistics */
+  unsigned long long tcks;
+};
+
+/* Set up the pins and reset the TAP. Returns 0, or -1 if TDO shares a port
+   with an output. */
+int jtag_init(struct jtag *j, busyboard_t *bb, int tck, int tms, int tdi,
+              int tdo);
+
+/* Five clocks with TMS high: Test-Logic-Reset from anywhere. */
+void jtag_reset(struct jtag *j);
+
+void jtag_goto(struct jtag *j, enum tap_state s);
+
+/* n clocks staying in a stable state (TMS high in Reset, else low). */
+void jtag_idle(struct jtag *j, unsigned long n);
+
+/* Shift n bits through IR (ir set) or DR, bit 0 of tdi[0] first, then go
+   to end. tdi NULL shifts zeros; tdo, if not NULL, gets what came out. */
+void jtag_scan(struct jtag *j, int ir, unsigned long n,
+               const unsigned char *tdi, unsigned char *tdo,
+               enum tap_state end);
+
+/* SVF names: RESET, IDLE, DRSHIFT, ... */
+const char *tap_name(enum tap_state s);
+int tap_by_name(const char *name); /* -1 if none */
+
+#endif
@@ -0,0 +1,141 @@
+/* HD44780 character LCD driver. */
+
+#include "lcd.h"
+#include "timing.h"
+
+#include <string.h>
+
+#define LCD_RS 0x01
+#define LCD_RW 0x02
+#define LCD_E  0x04
+
+#define LCD_BUSY 0x80
+
+/* Polls before giving up on the busy flag; clear takes 1.52 ms. */
+#define LCD_MAX_POLLS 1000
+
+/* One E pulse. RS, R/#W and the direction of port B go out with E low
+   first when they change. Returns port B as sampled while E was high. */
+static unsigned char pulse(struct lcd *l, unsigned char mode,
+                           unsigned char data)
+{
+  busyboard_t *bb = l->bb;
+
+  bb->out_state[1] = data;
+  if (mode != l->mode) {
+    bb->out_state[0] = mode;
+    bb->trimask = (mode & LCD_RW) ? 0x01 : 0x3f;
+    busyboard_out(bb);
+    l->mode = mode;
+  }
+  bb->out_state[0] = mode | LCD_E;
+  busyboard_out(bb);
+  timing_wait(l->e_us);
+  bb->out_state[0] = mode;
+  busyboard_xfer(bb);
+
+  return bb->in_state[1];
+}
+
+int lcd_wait(struct lcd *l) {
+  unsigned char st;
+  int i;
+
+  for (i = 0; i < LCD_MAX_POLLS; ++i) {
+    st = pulse(l, LCD_RW, 0);
+    l->polls++;
+    if (!(st & LCD_BUSY)) return l->addr = st & 0x7f;
+  }
+  l->timeouts++;
+  return l->addr = -1;
+}
+
+static void show(struct lcd *l, unsigned char c) {
+  int col = l->addr & 0x3f;
+
+  if (col < LCD_COLS) l->shown[l->addr >> 6][col] = c;
+}
+
+void lcd_command(struct lcd *l, unsigned char cmd) {
+  lcd_wait(l);
+  pulse(l, 0, cmd);
+  l->ops++;
+
+  if (cmd & 0x80) {
+    l->addr = cmd & 0x7f;
+  } else if (cmd == 0x01) {
+    memset(l->shown, ' ', sizeof(l->shown));
+    l->addr = 0;
+  } else if ((cmd & 0xfe) == 0x02) {
+    l->addr = 0;
+  }
+}
+
+/* The address counter moves on after a data write or read; the next poll
+   would say so, but lcd_flush() wants to know before it. */
+static void advance(struct lcd *l) {
+  if (l->addr >= 0) l->addr = (l->addr + 1) & 0x7f;
+}
+
+void lcd_data(struct lcd *l, unsigned char c) {
+  if (lcd_wait(l) >= 0) show(l, c);
+  pulse(l, LCD_RS, c);
+  advance(l);
+  l->ops++;
+}
+
+void lcd_read(struct lcd *l, unsigned addr, unsigned char *buf, int len) {
+  int i;
+
+  lcd_command(l, 0x80 | addr);
+  for (i = 0; i < len; ++i) {
+    lcd_wait(l);
+    buf[i] = pulse(l, LCD_RS | LCD_RW, 0);
+    advance(l);
+    l->ops++;
+  }
+}
+
+void lcd_init(struct lcd *l, busyboard_t *bb, unsigned e_us) {
+  memset(l, 0, sizeof(*l));
+  l->bb = bb;
+  l->e_us = e_us;
+  l->mode = 0xff;
+  l->addr = -1;
+
+  /* The busy flag can't be read before the third function set; these are
+     the datasheet's waits. */
+  pulse(l, 0, 0x30);
+  timing_wait(4100);
+  pulse(l, 0, 0x30);
+  timing_wait(100);
+  pulse(l, 0, 0x30);
+
+  lcd_command(l, 0x38); /* 8 bits, 2 lines, 5x8 */
+  lcd_command(l, 0x0c); /* Display on, no cursor */
+  lcd_command(l, 0x06); /* Increment, no shift */
+  lcd_command(l, 0x01); /* Clear */
+  lcd_clear(l);
+}
+
+void lcd_print(struct lcd *l, int row, int col, const char *s) {
+  for (; *s && col < LCD_COLS; ++s, ++col) l->fb[row][col] = *s;
+}
+
+void lcd_clear(struct lcd *l) {
+  memset(l->fb, ' ', sizeof(l->fb));
+}
+
+unsigned long lcd_flush(struct lcd *l) {
+  unsigned long ops = l->ops;
+  int row, col;
+
+  for (row = 0; row < LCD_ROWS; ++row)
+    for (col = 0; col < LCD_COLS; ++col) {
+      if (l->fb[row][col] == l->shown[row][col]) continue;
+      if (l->addr != (row << 6 | col)) lcd_command(l, 0x80 | row << 6 | col);
+      lcd_data(l, l->fb[row][col]);
+    }
+
+  return l->ops - ops;
+}
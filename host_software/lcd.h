@@ -0,0 +1,59 @@
+#ifndef LCD_H
+#define LCD_H
+
+#include "busyboard.h"
+
+/* HD44780 character LCD, 16x2, on the busyboard:
+    A0: RS - Register/data select
+    A1: R/#W - Read/#write
+    A2: E -- Operation strobe, falling edge triggered
+    B0-B7: Parallel data
+
+   E idles low. Every operation first polls the busy flag, with port B
+   switched to input, instead of waiting out the worst-case execution time;
+   the poll also gives the address counter, so the driver always knows
+   where the cursor is. RS and R/#W change a frame ahead of E rising.
+
+   The driver keeps what the display shows and what it should show.
+   lcd_flush() sends only the cells that differ. A cursor jump costs as much
+   as writing a character, so the cursor only jumps to skip cells that are
+   already right, or to change rows (row 1 starts at DDRAM 0x40). */
+
+#define LCD_ROWS 2
+#define LCD_COLS 16
+
+struct lcd {
+  busyboard_t *bb;
+  unsigned e_us; /* Wait with E high */
+
+  unsigned char shown[LCD_ROWS][LCD_COLS], fb[LCD_ROWS][LCD_COLS];
+  int addr;           /* Address counter, -1 if unknown */
+  unsigned char mode; /* RS and R/#W as last put out */
+
+  /* Operations sent, busy flag reads, and polls that gave up. */
+  unsigned long ops, polls, timeouts;
+};
+
+/* Reset the controller by instruction, set 8 bits and 2 lines, and clear
+   it. */
+void lcd_init(struct lcd *l, busyboard_t *bb, unsigned e_us);
+
+/* Wait until the controller is ready. Returns the address counter, or -1
+   if it stayed busy (no display?). */
+int lcd_wait(struct lcd *l);
+
+void lcd_command(struct lcd *l, unsigned char cmd);
+void lcd_data(struct lcd *l, unsigned char c);
+
+/* Read len bytes of display RAM from addr. */
+void lcd_read(struct lcd *l, unsigned addr, unsigned char *buf, int len);
+
+/* Put s in the framebuffer at row, col, clipped to the row; blank it. */
+void lcd_print(struct lcd *l, int row, int col, const char *s);
+void lcd_clear(struct lcd *l);
+
+/* Bring the display up to date with the framebuffer. Returns the number of
+   operations it took. */
+unsigned long lcd_flush(struct lcd *l);
+
+#endif
@@ -5,87 +5,84 @@
  * B0-B7: Parallel data
  */
 
-#include "busyboard.h"
-
-#define DELAY 10000
-
-void delay() {
-  usleep(DELAY);
-}
-
-void lcd_write_command(struct busyboard *bb, unsigned char cmd) {
-  bb->out_state[0] = 4;
-  bb->out_state[1] = cmd;
-  busyboard_out(bb);
-  delay();
-
-  bb->out_state[0] = 0;
-  busyboard_out(bb);
-  delay();
-
-  bb->out_state[0] = 4;
-  busyboard_out(bb);
-  delay();
-}
-
-void lcd_write_data(struct busyboard *bb, unsigned char data) {
-  bb->out_state[0] = 5; /* E high, write mode, data mode */
-  bb->out_state[1] = data;
-  busyboard_out(bb);
-  delay();
-
-  bb->out_state[0] = 1;
-  busyboard_out(bb);
-  delay();
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
 
-  bb->out_state[0] = 5;
-  busyboard_out(bb);
-}
-
-void lcd_init(struct busyboard *bb) {
-  bb->trimask = 0x3f;
-  bb->out_state[0] = 4; /* E high, write mode, command mode */
-  busyboard_out(bb);
-
-  lcd_write_command(bb, 0x30); /* Wake up!!! */
-  lcd_write_command(bb, 0x30);
-  lcd_write_command(bb, 0x30);
-
-  lcd_write_command(bb, 0x38); /* Recommended start-up sequence */
-  lcd_write_command(bb, 0x10);
-  lcd_write_command(bb, 0x0c);
-  lcd_write_command(bb, 0x06);
+#include "busyboard.h"
+#include "lcd.h"
+#include "timing.h"
 
-  lcd_write_command(bb, 0x02); /* Clear display */
-}
+/* The busy flag says when the controller is done; only E's high time is
+   still a wait. */
+enum { T_E_PULSE };
+struct timing_param params[] = { { "e_pulse", 0, 1000 } };
+struct timing timing = { "lcd", params, 1 };
 
-void lcd_set_pos(struct busyboard *bb, int row, int col) {
-  int addr = (row * 40 + col)&0x3f;
-  lcd_write_command(bb, 0x80 | addr);
-}
+struct lcd lcd;
 
-void lcd_write_str(struct busyboard *bb, const char *s) {
-  lcd_set_pos(bb, 0, 0);
-  for (unsigned i = 0; i < 128 && *s; i++, s++) {
-    if (i == 16) lcd_set_pos(bb, 1, 0);
-    lcd_write_data(bb, *s);
-  }
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
 }
 
-void lcd_clear_screen(struct busyboard *bb) {
-  lcd_write_str(bb, "                                ");
+/* Initialize, write a fresh pattern to display RAM past the visible
+   columns, and read it back. */
+int verify(void *ctx) {
+  static unsigned seq;
+  struct busyboard *bb = ctx;
+  unsigned char buf[8];
+  int i, ok = 1;
+
+  seq++;
+  lcd_init(&lcd, bb, params[T_E_PULSE].us);
+  lcd_command(&lcd, 0x80 | 0x20);
+  for (i = 0; i < 8; ++i) lcd_data(&lcd, 'A' + (seq + i) % 26);
+  lcd_read(&lcd, 0x20, buf, 8);
+  for (i = 0; i < 8; ++i) if (buf[i] != 'A' + (seq + i) % 26) ok = 0;
+
+  return ok && !lcd.timeouts;
 }
 
 int main(int argc, char **argv) {
+  const char *parport = (argc >= 2) ? argv[1] : "/dev/parport0";
+  int updates = (argc >= 3) ? atoi(argv[2]) : 100, i;
+  unsigned long ops, polls, frames;
   struct busyboard bb;
-  init_busyboard(&bb, (argc >= 2) ? argv[1] : "/dev/parport0");  
-
-  lcd_init(&bb);
+  char line[LCD_COLS + 1];
+  double t;
+
+  init_busyboard(&bb, parport);
+
+  timing_setup(&timing, parport, verify, &bb);
+  lcd_init(&lcd, &bb, params[T_E_PULSE].us);
+
+  lcd_print(&lcd, 0, 0, "Busyboard Ver. 0");
+  lcd_print(&lcd, 1, 0, "CHDL & LibPCB");
+  lcd_flush(&lcd);
+
+  /* A live counter on the second row, as a status display would be. */
+  ops = lcd.ops;
+  polls = lcd.polls;
+  frames = bb.frames;
+  t = now();
+  for (i = 1; i <= updates; ++i) {
+    snprintf(line, sizeof(line), "Count %10d", i);
+    lcd_print(&lcd, 1, 0, line);
+    lcd_flush(&lcd);
+  }
+  t = now() - t;
+  if (updates > 0)
+    printf("%d updates in %.2f s: %.1f Hz, %.1f operations, %.1f busy polls "
+           "and %.1f frames each.\n", updates, t, t > 0 ? updates / t : 0,
+           (double)(lcd.ops - ops) / updates,
+           (double)(lcd.polls - polls) / updates,
+           (double)(bb.frames - frames) / updates);
+  if (lcd.timeouts)
+    printf("The busy flag stayed set %lu times; is the display there?\n",
+           lcd.timeouts);
 
-  lcd_clear_screen(&bb);
-  /*                  012345678901234*0123456789012345 */
-  lcd_write_str(&bb, "Busyboard Ver. 0CHDL & LibPCB");
-  
   close_busyboard(&bb);
 
   return 0;
@@ -0,0 +1,214 @@
+/* Lockstep co-simulation of the Z80 and 65C02 harnesses. */
+
+#include "lockstep.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STACK_SIZE (64 * 1024)
+
+/* makecontext() only passes ints. */
+static struct lockstep *starting;
+
+static void model_main(void) {
+  struct lockstep *ls = starting;
+
+  ls->model->run(ls, ls->insn_pc);
+}
+
+unsigned char ls_bus(struct lockstep *ls, const struct ls_access *a) {
+  ls->acc = *a;
+  ls->step = 0;
+  swapcontext(&ls->model_ctx, &ls->main_ctx);
+  return ls->data;
+}
+
+void ls_insn(struct lockstep *ls, unsigned pc) {
+  int i;
+
+  /* A register the last instruction changed is known from now on. */
+  for (i = 0; i < LS_REGS; ++i) {
+    if (ls->reg[i] != ls->snap[i]) ls->known[i] = 1;
+    ls->snap[i] = ls->reg[i];
+  }
+  ls->insn_pc = pc;
+  ls->insns++;
+}
+
+static void start(struct lockstep *ls, unsigned pc) {
+  ls->model->reset(ls);
+  memcpy(ls->snap, ls->reg, sizeof(ls->snap));
+  ls->insn_pc = pc;
+  ls->insns = 0;
+
+  getcontext(&ls->model_ctx);
+  ls->model_ctx.uc_stack.ss_sp = ls->stack;
+  ls->model_ctx.uc_stack.ss_size = STACK_SIZE;
+  ls->model_ctx.uc_link = NULL;
+  makecontext(&ls->model_ctx, model_main, 0);
+  starting = ls;
+  swapcontext(&ls->main_ctx, &ls->model_ctx);
+  ls->state = LS_RUN;
+}
+
+static void print_flags(unsigned flags) {
+  static const char *name[] = { "RD", "WR", "IO", "FETCH", "HALT", "RFSH",
+                                "MEM" };
+  int i, n = 0;
+
+  for (i = 0; i < 7; ++i)
+    if (flags & (1 << i)) n += printf(" %s", name[i]);
+  printf("%*s", n < 16 ? 16 - n : 0, "");
+}
+
+static void print_expect(const struct ls_access *a, const struct ls_expect *e)
+{
+  if (!e->care) {
+    printf("(any)");
+    return;
+  }
+  if (e->addr) printf("%04x", a->addr);
+  else printf("----");
+  if (e->cmp) printf(" %02x  ", a->data);
+  else printf("     ");
+  print_flags(e->flags);
+}
+
+static void print_hist(const struct ls_hist *h) {
+  printf("%10llu  %04x %02x ", h->cycle, h->rec.addr, h->rec.data);
+  print_flags(h->rec.flags);
+  printf("  ");
+  print_expect(&h->acc, &h->exp);
+  putc('\n', stdout);
+}
+
+static void diverge(struct lockstep *ls, const struct bus_rec *r,
+                    const struct ls_expect *e, const char *why)
+{
+  unsigned i, n = ls->n_hist < LS_HISTORY ? ls->n_hist : LS_HISTORY;
+
+  printf("%s diverged from the model at cycle %llu (%s), in the "
+         "instruction at %04x.\n", ls->bc->cpu->name, ls->bc->cycles, why,
+         ls->insn_pc);
+  printf("%10s  addr data status%12s  expected\n", "cycle", "");
+  for (i = ls->n_hist - n; i < ls->n_hist; ++i)
+    print_hist(&ls->hist[i % LS_HISTORY]);
+
+  ls->state = LS_DIVERGED;
+  ls->bc->predict = NULL;
+  ls->bc->halted = 1;
+}
+
+static void check(struct buscyc *bc, const struct bus_rec *r) {
+  struct lockstep *ls = bc->check_ctx;
+  struct ls_access *a = &ls->acc;
+  struct ls_hist *h;
+  struct ls_expect e;
+  int predicted = ls->predicted;
+
+  ls->predicted = 0;
+  if (ls->state == LS_SYNC) {
+    /* Both CPUs start with an opcode fetch from wherever reset sent them. */
+    if ((r->flags & BUS_FETCH) && !(ls->prev_flags & BUS_FETCH))
+      start(ls, r->addr);
+    ls->prev_flags = r->flags;
+  }
+  if (ls->state != LS_RUN) return;
+
+  ls->model->expect(a, ls->step, &e);
+  h = &ls->hist[ls->n_hist++ % LS_HISTORY];
+  h->cycle = bc->cycles;
+  h->rec = *r;
+  h->acc = *a;
+  h->exp = e;
+
+  if (e.addr && r->addr != a->addr && a->sp_off >= 0 &&
+      ls->model->learn_sp(ls, a, r->addr)) {
+    a->addr = h->acc.addr = r->addr;
+    ls->learnt++;
+  }
+  if ((r->flags & e.care) != e.flags) {
+    diverge(ls, r, &e, "status");
+    return;
+  }
+  if (e.addr && r->addr != a->addr) {
+    diverge(ls, r, &e, "address");
+    return;
+  }
+  if (e.cmp && ((r->data ^ a->data) & a->mask)) {
+    if (a->src < 0 || ls->known[a->src]) {
+      diverge(ls, r, &e, "data");
+      return;
+    }
+    ls->reg[a->src] = ls->snap[a->src] = r->data;
+    ls->known[a->src] = 1;
+    ls->learnt++;
+  }
+
+  ls->checked++;
+  if (predicted) ls->staged++;
+  if (e.take) ls->data = r->data;
+  if (e.last) swapcontext(&ls->main_ctx, &ls->model_ctx);
+  else ls->step++;
+}
+
+static int predict(struct buscyc *bc, struct bus_rec *next) {
+  struct lockstep *ls = bc->check_ctx;
+
+  if (ls->state != LS_RUN || ls->step) return 0;
+  if (ls->acc.kind == LS_FETCH) next->flags = BUS_RD | BUS_MEM | BUS_FETCH;
+  else if (ls->acc.kind == LS_READ) next->flags = BUS_RD | BUS_MEM;
+  else return 0;
+  if (!bc->plain(bc, ls->acc.addr, next->flags)) return 0;
+  next->addr = ls->acc.addr;
+  ls->predicted = 1;
+  return 1;
+}
+
+struct lockstep *lockstep_attach(struct buscyc *bc) {
+  const struct ls_model *model;
+  struct lockstep *ls;
+
+  if (bc->cpu == &bus_z80) model = &ls_z80;
+  else if (bc->cpu == &bus_65c02) model = &ls_65c02;
+  else {
+    fprintf(stderr, "No lockstep model for %s.\n", bc->cpu->name);
+    return NULL;
+  }
+
+  ls = calloc(1, sizeof(*ls));
+  if (ls) ls->stack = malloc(STACK_SIZE);
+  if (!ls || !ls->stack) {
+    perror("lockstep");
+    free(ls);
+    return NULL;
+  }
+  ls->bc = bc;
+  ls->model = model;
+  bc->check = check;
+  bc->predict = predict;
+  bc->check_ctx = ls;
+
+  return ls;
+}
+
+void lockstep_report(const struct lockstep *ls) {
+  printf("Lockstep: %llu cycles checked, %llu instructions",
+         ls->checked, ls->insns);
+  if (ls->bc->cpu == &bus_65c02) printf(", %llu reads staged", ls->staged);
+  if (ls->learnt) printf(", %llu unknown registers learnt", ls->learnt);
+  if (ls->state == LS_SYNC) printf(", never saw the first fetch");
+  else if (ls->state == LS_DIVERGED) printf(", diverged");
+  printf(".\n");
+}
+
+void lockstep_close(struct lockstep *ls) {
+  if (ls->bc->check_ctx == ls) {
+    ls->bc->check = NULL;
+    ls->bc->predict = NULL;
+    ls->bc->check_ctx = NULL;
+  }
+  free(ls->stack);
+  free(ls);
+}
@@ -0,0 +1,129 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <ucontext.h>
+
+#include "buscyc.h"
+
+/* Lockstep co-simulation. A bus-level model of the CPU runs alongside the
+   hardware as a buscyc checker: from the first opcode fetch after reset it
+   predicts the address and status of every cycle and stops the run at the
+   first one the CPU gets different, printing the cycles leading up to it.
+   Read data comes from the bus, so the model needs no memory of its own and
+   follows whatever the devices return.
+
+   On the 65C02, the engine uses the prediction to put read data up in the
+   frame that samples the address (see buscyc.h). The Z80 engine already
+   answers a read in the frame that samples it, so there the model only
+   checks.
+
+   Registers the CPU has not set since reset are unknown to the model. Until
+   an instruction changes one, a write of it (or, for the stack pointer, an
+   access relative to it) that disagrees with the model is taken as its
+   value rather than as a divergence. */
+
+struct lockstep;
+
+/* Attach a model for bc's CPU, before buscyc_reset(). Returns NULL (after
+   printing why) on error. */
+struct lockstep *lockstep_attach(struct buscyc *bc);
+
+/* Cycles checked and instructions run, and the divergence if there was
+   one. */
+void lockstep_report(const struct lockstep *ls);
+
+void lockstep_close(struct lockstep *ls);
+
+/* Interface for the CPU models. A model is a plain instruction-level
+   emulator running as a coroutine: it hands every bus access to ls_bus(),
+   which returns once the hardware has made it, with the data read. */
+
+enum {
+  LS_FETCH,   /* Opcode fetch: Z80 M1, 65C02 SYNC */
+  LS_READ,
+  LS_WRITE,
+  LS_IN,      /* Z80 I/O */
+  LS_OUT,
+  LS_IDLE,    /* Z80 internal T-states, len of them */
+  LS_DUMMY,   /* 65C02 read whose address is not checked */
+  LS_ANY      /* Anything, from here on: HALT, STP, WAI */
+};
+
+struct ls_access {
+  unsigned char kind;
+  unsigned short addr;
+  unsigned char data;  /* Write data, and the bits of it that are checked */
+  unsigned char mask;
+  signed char src;     /* Register the write data came from, or -1 */
+  signed char sp_off;  /* Stack access at SP + sp_off, or -1 */
+  unsigned char len;
+};
+
+/* What the model expects of one record of an access. */
+struct ls_expect {
+  unsigned short flags, care; /* (r->flags & care) == flags */
+  unsigned char addr;         /* Check the address */
+  unsigned char take;         /* Read data is on the bus */
+  unsigned char cmp;          /* Write data is on the bus */
+  unsigned char last;         /* Last record of the access */
+};
+
+#define LS_REGS    32
+#define LS_HISTORY 16
+
+struct ls_model {
+  const struct bus_cpu *cpu;
+  /* Registers as they are after reset, and whether they are known. */
+  void (*reset)(struct lockstep *ls);
+  /* Run from pc; never returns. */
+  void (*run)(struct lockstep *ls, unsigned pc);
+  /* Record step of access a. */
+  void (*expect)(const struct ls_access *a, unsigned step,
+                 struct ls_expect *e);
+  /* Take the stack pointer from a stack access to addr, if it is unknown.
+     Returns 1 if it did. */
+  int (*learn_sp)(struct lockstep *ls, const struct ls_access *a,
+                  unsigned addr);
+};
+
+extern const struct ls_model ls_z80, ls_65c02;
+
+struct ls_hist {
+  unsigned long long cycle;
+  struct bus_rec rec;
+  struct ls_access acc;
+  struct ls_expect exp;
+};
+
+struct lockstep {
+  struct buscyc *bc;
+  const struct ls_model *model;
+  enum { LS_SYNC, LS_RUN, LS_DIVERGED } state;
+
+  /* Model registers, kept as bytes so that the unknown ones can be told
+     apart; snap is their value when the instruction started. */
+  unsigned char reg[LS_REGS], known[LS_REGS], snap[LS_REGS];
+  unsigned insn_pc;
+
+  struct ls_access acc; /* Access in progress */
+  unsigned step;        /* Records of it so far */
+  unsigned char data;   /* Data it read */
+  int predicted;
+
+  struct ls_hist hist[LS_HISTORY];
+  unsigned n_hist;
+  unsigned short prev_flags;
+
+  unsigned long long checked, staged, insns, learnt;
+
+  ucontext_t main_ctx, model_ctx;
+  char *stack;
+};
+
+/* Make an access; returns the data read. */
+unsigned char ls_bus(struct lockstep *ls, const struct ls_access *a);
+
+/* Start of the instruction at pc. */
+void ls_insn(struct lockstep *ls, unsigned pc);
+
+#endif
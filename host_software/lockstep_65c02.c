@@ -0,0 +1,490 @@
+/* 65C02 (WDC) model for the lockstep checker: one access per clock, as the
+   datasheet lists them. The reads a 65C02 makes while it works something
+   out internally are only counted, as the address they go to is not
+   documented. */
+
+#include "lockstep.h"
+
+#include <string.h>
+
+enum { RA, RX, RY, RS, RP };
+
+#define FC 0x01
+#define FZ 0x02
+#define FI 0x04
+#define FD 0x08
+#define FB 0x10
+#define FV 0x40
+#define FN 0x80
+
+enum { IMP, ACC, IMM, ZP, ZPX, ZPY, ABS, ABX, ABY, IND, IZX, IZY, IZP, IAX,
+       REL, ZPR, NOP1 };
+
+enum { ADC, AND, ASL, BBR, BBS, BIT, BRA, BRK, CMP, CPX, CPY, DEC, DEX, DEY,
+       EOR, FLG, INC, INX, INY, JMP, JSR, LDA, LDX, LDY, LSR, NOP, ORA, PHA,
+       PHP, PHX, PHY, PLA, PLP, PLX, PLY, RMB, ROL, ROR, RTI, RTS, SBC, SMB,
+       STA, STP, STX, STY, STZ, TAX, TAY, TRB, TSB, TSX, TXA, TXS, TYA, WAI };
+
+/* FLG is clc sec cli sei clv cld sed, by opcode; BRA covers the conditional
+   branches too. NOP1 is a one-cycle NOP. */
+static const struct {
+  unsigned char op, mode;
+} op65[256] = {
+  /* 0 */ { BRK, IMP }, { ORA, IZX }, { NOP, IMM }, { NOP, NOP1 },
+          { TSB, ZP }, { ORA, ZP }, { ASL, ZP }, { RMB, ZP },
+          { PHP, IMP }, { ORA, IMM }, { ASL, ACC }, { NOP, NOP1 },
+          { TSB, ABS }, { ORA, ABS }, { ASL, ABS }, { BBR, ZPR },
+  /* 1 */ { BRA, REL }, { ORA, IZY }, { ORA, IZP }, { NOP, NOP1 },
+          { TRB, ZP }, { ORA, ZPX }, { ASL, ZPX }, { RMB, ZP },
+          { FLG, IMP }, { ORA, ABY }, { INC, ACC }, { NOP, NOP1 },
+          { TRB, ABS }, { ORA, ABX }, { ASL, ABX }, { BBR, ZPR },
+  /* 2 */ { JSR, ABS }, { AND, IZX }, { NOP, IMM }, { NOP, NOP1 },
+          { BIT, ZP }, { AND, ZP }, { ROL, ZP }, { RMB, ZP },
+          { PLP, IMP }, { AND, IMM }, { ROL, ACC }, { NOP, NOP1 },
+          { BIT, ABS }, { AND, ABS }, { ROL, ABS }, { BBR, ZPR },
+  /* 3 */ { BRA, REL }, { AND, IZY }, { AND, IZP }, { NOP, NOP1 },
+          { BIT, ZPX }, { AND, ZPX }, { ROL, ZPX }, { RMB, ZP },
+          { FLG, IMP }, { AND, ABY }, { DEC, ACC }, { NOP, NOP1 },
+          { BIT, ABX }, { AND, ABX }, { ROL, ABX }, { BBR, ZPR },
+  /* 4 */ { RTI, IMP }, { EOR, IZX }, { NOP, IMM }, { NOP, NOP1 },
+          { NOP, ZP }, { EOR, ZP }, { LSR, ZP }, { RMB, ZP },
+          { PHA, IMP }, { EOR, IMM }, { LSR, ACC }, { NOP, NOP1 },
+          { JMP, ABS }, { EOR, ABS }, { LSR, ABS }, { BBR, ZPR },
+  /* 5 */ { BRA, REL }, { EOR, IZY }, { EOR, IZP }, { NOP, NOP1 },
+          { NOP, ZPX }, { EOR, ZPX }, { LSR, ZPX }, { RMB, ZP },
+          { FLG, IMP }, { EOR, ABY }, { PHY, IMP }, { NOP, NOP1 },
+          { NOP, IND }, { EOR, ABX }, { LSR, ABX }, { BBR, ZPR },
+  /* 6 */ { RTS, IMP }, { ADC, IZX }, { NOP, IMM }, { NOP, NOP1 },
+          { STZ, ZP }, { ADC, ZP }, { ROR, ZP }, { RMB, ZP },
+          { PLA, IMP }, { ADC, IMM }, { ROR, ACC }, { NOP, NOP1 },
+          { JMP, IND }, { ADC, ABS }, { ROR, ABS }, { BBR, ZPR },
+  /* 7 */ { BRA, REL }, { ADC, IZY }, { ADC, IZP }, { NOP, NOP1 },
+          { STZ, ZPX }, { ADC, ZPX }, { ROR, ZPX }, { RMB, ZP },
+          { FLG, IMP }, { ADC, ABY }, { PLY, IMP }, { NOP, NOP1 },
+          { JMP, IAX }, { ADC, ABX }, { ROR, ABX }, { BBR, ZPR },
+  /* 8 */ { BRA, REL }, { STA, IZX }, { NOP, IMM }, { NOP, NOP1 },
+          { STY, ZP }, { STA, ZP }, { STX, ZP }, { SMB, ZP },
+          { DEY, IMP }, { BIT, IMM }, { TXA, IMP }, { NOP, NOP1 },
+          { STY, ABS }, { STA, ABS }, { STX, ABS }, { BBS, ZPR },
+  /* 9 */ { BRA, REL }, { STA, IZY }, { STA, IZP }, { NOP, NOP1 },
+          { STY, ZPX }, { STA, ZPX }, { STX, ZPY }, { SMB, ZP },
+          { TYA, IMP }, { STA, ABY }, { TXS, IMP }, { NOP, NOP1 },
+          { STZ, ABS }, { STA, ABX }, { STZ, ABX }, { BBS, ZPR },
+  /* a */ { LDY, IMM }, { LDA, IZX }, { LDX, IMM }, { NOP, NOP1 },
+          { LDY, ZP }, { LDA, ZP }, { LDX, ZP }, { SMB, ZP },
+          { TAY, IMP }, { LDA, IMM }, { TAX, IMP }, { NOP, NOP1 },
+          { LDY, ABS }, { LDA, ABS }, { LDX, ABS }, { BBS, ZPR },
+  /* b */ { BRA, REL }, { LDA, IZY }, { LDA, IZP }, { NOP, NOP1 },
+          { LDY, ZPX }, { LDA, ZPX }, { LDX, ZPY }, { SMB, ZP },
+          { FLG, IMP }, { LDA, ABY }, { TSX, IMP }, { NOP, NOP1 },
+          { LDY, ABX }, { LDA, ABX }, { LDX, ABY }, { BBS, ZPR },
+  /* c */ { CPY, IMM }, { CMP, IZX }, { NOP, IMM }, { NOP, NOP1 },
+          { CPY, ZP }, { CMP, ZP }, { DEC, ZP }, { SMB, ZP },
+          { INY, IMP }, { CMP, IMM }, { DEX, IMP }, { WAI, IMP },
+          { CPY, ABS }, { CMP, ABS }, { DEC, ABS }, { BBS, ZPR },
+  /* d */ { BRA, REL }, { CMP, IZY }, { CMP, IZP }, { NOP, NOP1 },
+          { NOP, ZPX }, { CMP, ZPX }, { DEC, ZPX }, { SMB, ZP },
+          { FLG, IMP }, { CMP, ABY }, { PHX, IMP }, { STP, IMP },
+          { NOP, ABS }, { CMP, ABX }, { DEC, ABX }, { BBS, ZPR },
+  /* e */ { CPX, IMM }, { SBC, IZX }, { NOP, IMM }, { NOP, NOP1 },
+          { CPX, ZP }, { SBC, ZP }, { INC, ZP }, { SMB, ZP },
+          { INX, IMP }, { SBC, IMM }, { NOP, IMP }, { NOP, NOP1 },
+          { CPX, ABS }, { SBC, ABS }, { INC, ABS }, { BBS, ZPR },
+  /* f */ { BRA, REL }, { SBC, IZY }, { SBC, IZP }, { NOP, NOP1 },
+          { NOP, ZPX }, { SBC, ZPX }, { INC, ZPX }, { SMB, ZP },
+          { FLG, IMP }, { SBC, ABY }, { PLX, IMP }, { NOP, NOP1 },
+          { NOP, ABS }, { SBC, ABX }, { INC, ABX }, { BBS, ZPR },
+};
+
+struct m65 {
+  struct lockstep *ls;
+  unsigned char *r;
+  unsigned pc;
+};
+
+/* Bus cycles. */
+
+static unsigned char bus(struct m65 *m, int kind, unsigned addr,
+                         unsigned char data, int src, int sp_off)
+{
+  struct ls_access a = { 0 };
+
+  a.kind = kind;
+  a.addr = addr & 0xffff;
+  a.data = data;
+  /* Bits 4 and 5 of P do not exist; they read as 1. */
+  a.mask = src == RP ? 0xcf : 0xff;
+  a.src = src;
+  a.sp_off = sp_off;
+  return ls_bus(m->ls, &a);
+}
+
+static unsigned char rd(struct m65 *m, unsigned addr) {
+  return bus(m, LS_READ, addr, 0, -1, -1);
+}
+
+static void dummy(struct m65 *m) {
+  bus(m, LS_DUMMY, 0, 0, -1, -1);
+}
+
+static void wr(struct m65 *m, unsigned addr, unsigned char v, int src) {
+  bus(m, LS_WRITE, addr, v, src, -1);
+}
+
+static unsigned char imm8(struct m65 *m) {
+  unsigned char v = rd(m, m->pc);
+
+  m->pc = (m->pc + 1) & 0xffff;
+  return v;
+}
+
+static unsigned imm16(struct m65 *m) {
+  unsigned lo = imm8(m);
+  return lo | imm8(m) << 8;
+}
+
+static void push(struct m65 *m, unsigned char v, int src) {
+  bus(m, LS_WRITE, 0x100 | m->r[RS], v, src, 0);
+  m->r[RS]--;
+}
+
+static unsigned char pull(struct m65 *m) {
+  m->r[RS]++;
+  return bus(m, LS_READ, 0x100 | m->r[RS], 0, -1, 0);
+}
+
+/* Flags. */
+
+static unsigned char nz(struct m65 *m, unsigned char v) {
+  m->r[RP] = (m->r[RP] & ~(FN | FZ)) | (v & FN) | (v ? 0 : FZ);
+  return v;
+}
+
+static void adc(struct m65 *m, unsigned char v) {
+  unsigned a = m->r[RA], c = m->r[RP] & FC, res = a + v + c;
+  unsigned char p = m->r[RP] & ~(FC | FV);
+
+  if (((a ^ res) & (v ^ res)) & 0x80) p |= FV;
+  if (p & FD) {
+    unsigned lo = (a & 0x0f) + (v & 0x0f) + c;
+    if (lo > 9) lo += 6;
+    res = (a & 0xf0) + (v & 0xf0) + (lo > 0x0f ? 0x10 : 0) + (lo & 0x0f);
+    if (res > 0x9f) res += 0x60;
+  }
+  m->r[RP] = p | (res > 0xff ? FC : 0);
+  m->r[RA] = nz(m, res);
+}
+
+static void sbc(struct m65 *m, unsigned char v) {
+  unsigned a = m->r[RA], b = !(m->r[RP] & FC);
+  int res = a - v - b;
+  unsigned char p = m->r[RP] & ~(FC | FV);
+
+  if (((a ^ v) & (a ^ res)) & 0x80) p |= FV;
+  if (res >= 0) p |= FC;
+  if (p & FD) {
+    int lo = (int)(a & 0x0f) - (v & 0x0f) - b;
+    if (res < 0) res -= 0x60;
+    if (lo < 0) res -= 0x06;
+  }
+  m->r[RP] = p;
+  m->r[RA] = nz(m, res);
+}
+
+static void cmp(struct m65 *m, unsigned char r, unsigned char v) {
+  m->r[RP] = (m->r[RP] & ~FC) | (r >= v ? FC : 0);
+  nz(m, r - v);
+}
+
+/* Read-modify-write operations. */
+static unsigned char modify(struct m65 *m, int op, unsigned char v,
+                            unsigned char bit)
+{
+  unsigned c = m->r[RP] & FC;
+
+  switch (op) {
+  case ASL: m->r[RP] = (m->r[RP] & ~FC) | v >> 7; return nz(m, v << 1);
+  case LSR: m->r[RP] = (m->r[RP] & ~FC) | (v & 1); return nz(m, v >> 1);
+  case ROL:
+    m->r[RP] = (m->r[RP] & ~FC) | v >> 7;
+    return nz(m, v << 1 | c);
+  case ROR:
+    m->r[RP] = (m->r[RP] & ~FC) | (v & 1);
+    return nz(m, v >> 1 | c << 7);
+  case INC: return nz(m, v + 1);
+  case DEC: return nz(m, v - 1);
+  case TSB:
+  case TRB:
+    m->r[RP] = (m->r[RP] & ~FZ) | ((v & m->r[RA]) ? 0 : FZ);
+    return op == TSB ? v | m->r[RA] : v & ~m->r[RA];
+  case RMB: return v & ~bit;
+  default: return v | bit; /* SMB */
+  }
+}
+
+/* Effective address of a memory operand, with the internal cycles of the
+   mode. Indexing across a page costs a cycle; stores and INC/DEC always
+   take it. */
+enum { READ, WRITE, RMW };
+
+static unsigned ea(struct m65 *m, int mode, int kind, int always) {
+  unsigned base, addr, zp;
+
+  switch (mode) {
+  case ZP:
+    return imm8(m);
+  case ZPX:
+  case ZPY:
+    zp = imm8(m);
+    dummy(m);
+    return (zp + m->r[mode == ZPX ? RX : RY]) & 0xff;
+  case ABS:
+    return imm16(m);
+  case IZX:
+    zp = (imm8(m) + m->r[RX]) & 0xff;
+    dummy(m);
+    base = rd(m, zp);
+    return base | rd(m, (zp + 1) & 0xff) << 8;
+  case IZP:
+    zp = imm8(m);
+    base = rd(m, zp);
+    return base | rd(m, (zp + 1) & 0xff) << 8;
+  case IZY:
+    zp = imm8(m);
+    base = rd(m, zp);
+    base |= rd(m, (zp + 1) & 0xff) << 8;
+    addr = (base + m->r[RY]) & 0xffff;
+    break;
+  default: /* ABX, ABY */
+    base = imm16(m);
+    addr = (base + m->r[mode == ABX ? RX : RY]) & 0xffff;
+    break;
+  }
+  if (kind == WRITE || always || (addr ^ base) & 0xff00) dummy(m);
+  return addr;
+}
+
+static void branch(struct m65 *m, int take) {
+  signed char d = imm8(m);
+  unsigned to = (m->pc + d) & 0xffff;
+
+  if (!take) return;
+  dummy(m);
+  if ((to ^ m->pc) & 0xff00) dummy(m);
+  m->pc = to;
+}
+
+static void run(struct lockstep *ls, unsigned pc) {
+  static const unsigned char flg_bit[] = { FC, FC, FI, FI, FV, FV, FD, FD };
+  static const unsigned char cond_bit[] = { FN, FV, FC, FZ };
+  struct m65 mm, *m = &mm;
+  unsigned char opc, v, *r = ls->reg;
+  unsigned addr;
+  int op, mode, kind;
+
+  m->ls = ls;
+  m->r = r;
+  m->pc = pc;
+  for (;;) {
+    ls_insn(ls, m->pc);
+    opc = bus(m, LS_FETCH, m->pc, 0, -1, -1);
+    m->pc = (m->pc + 1) & 0xffff;
+    op = op65[opc].op;
+    mode = op65[opc].mode;
+
+    switch (op) {
+    case BRK:
+      imm8(m);
+      push(m, m->pc >> 8, -1);
+      push(m, m->pc, -1);
+      push(m, r[RP] | FB | 0x20, RP);
+      r[RP] = (r[RP] | FI) & ~FD;
+      m->pc = rd(m, 0xfffe);
+      m->pc |= rd(m, 0xffff) << 8;
+      continue;
+    case JSR:
+      addr = imm8(m);
+      dummy(m);
+      push(m, m->pc >> 8, -1);
+      push(m, m->pc, -1);
+      m->pc = addr | rd(m, m->pc) << 8;
+      continue;
+    case RTS:
+    case RTI:
+      dummy(m);
+      dummy(m);
+      if (op == RTI) r[RP] = pull(m) | FB | 0x20;
+      m->pc = pull(m);
+      m->pc |= pull(m) << 8;
+      if (op == RTS) {
+        dummy(m);
+        m->pc = (m->pc + 1) & 0xffff;
+      }
+      continue;
+    case JMP:
+      addr = imm16(m);
+      if (mode == ABS) {
+        m->pc = addr;
+        continue;
+      }
+      dummy(m);
+      if (mode == IAX) addr = (addr + r[RX]) & 0xffff;
+      m->pc = rd(m, addr);
+      m->pc |= rd(m, (addr + 1) & 0xffff) << 8;
+      continue;
+    case PHA: case PHP: case PHX: case PHY:
+      dummy(m);
+      if (op == PHP) push(m, r[RP] | FB | 0x20, RP);
+      else push(m, r[op == PHA ? RA : op == PHX ? RX : RY],
+                op == PHA ? RA : op == PHX ? RX : RY);
+      continue;
+    case PLA: case PLP: case PLX: case PLY:
+      dummy(m);
+      dummy(m);
+      v = pull(m);
+      if (op == PLP) r[RP] = v | FB | 0x20;
+      else r[op == PLA ? RA : op == PLX ? RX : RY] = nz(m, v);
+      continue;
+    case BRA:
+      if (opc == 0x80) branch(m, 1);
+      else branch(m, !(r[RP] & cond_bit[opc >> 6]) == !(opc & 0x20));
+      continue;
+    case BBR:
+    case BBS:
+      addr = imm8(m);
+      v = rd(m, addr);
+      dummy(m);
+      branch(m, !(v & 1 << ((opc >> 4) & 7)) == (op == BBR));
+      continue;
+    case WAI:
+    case STP: {
+      struct ls_access a = { LS_ANY, 0, 0, 0, -1, -1, 0 };
+      dummy(m);
+      dummy(m);
+      ls_bus(ls, &a);
+      continue;
+    }
+    }
+
+    switch (mode) {
+    case NOP1:
+      continue;
+    case IMP:
+    case ACC:
+      dummy(m);
+      switch (op) {
+      case FLG:
+        if ((opc & 0x20) && opc != 0xb8) r[RP] |= flg_bit[opc >> 5];
+        else r[RP] &= ~flg_bit[opc >> 5];
+        break;
+      case DEX: nz(m, --r[RX]); break;
+      case DEY: nz(m, --r[RY]); break;
+      case INX: nz(m, ++r[RX]); break;
+      case INY: nz(m, ++r[RY]); break;
+      case TAX: r[RX] = nz(m, r[RA]); break;
+      case TAY: r[RY] = nz(m, r[RA]); break;
+      case TSX: r[RX] = nz(m, r[RS]); break;
+      case TXA: r[RA] = nz(m, r[RX]); break;
+      case TXS: r[RS] = r[RX]; break;
+      case TYA: r[RA] = nz(m, r[RY]); break;
+      case NOP: break;
+      default: r[RA] = modify(m, op, r[RA], 0); break;
+      }
+      continue;
+    case IMM:
+      v = imm8(m);
+      addr = 0;
+      break;
+    case IND: /* The eight cycle NOP, 5c */
+      imm16(m);
+      for (v = 0; v < 5; ++v) dummy(m);
+      continue;
+    default:
+      kind = READ;
+      if (op == STA || op == STX || op == STY || op == STZ) kind = WRITE;
+      else if (op == ASL || op == LSR || op == ROL || op == ROR ||
+               op == INC || op == DEC || op == TSB || op == TRB ||
+               op == RMB || op == SMB) kind = RMW;
+      addr = ea(m, mode, kind, op == INC || op == DEC);
+      if (kind == WRITE) {
+        int src = op == STA ? RA : op == STX ? RX : op == STY ? RY : -1;
+        wr(m, addr, src < 0 ? 0 : r[src], src);
+        continue;
+      }
+      /* The operands of the multi-byte NOPs are read but not used. */
+      v = op == NOP ? bus(m, LS_DUMMY, 0, 0, -1, -1) : rd(m, addr);
+      if (kind == RMW) {
+        dummy(m);
+        wr(m, addr, modify(m, op, v, 1 << ((opc >> 4) & 7)), -1);
+        continue;
+      }
+      break;
+    }
+
+    /* Reads. Decimal ADC and SBC take a cycle more. */
+    switch (op) {
+    case ADC: adc(m, v); break;
+    case SBC: sbc(m, v); break;
+    case AND: r[RA] = nz(m, r[RA] & v); break;
+    case EOR: r[RA] = nz(m, r[RA] ^ v); break;
+    case ORA: r[RA] = nz(m, r[RA] | v); break;
+    case LDA: r[RA] = nz(m, v); break;
+    case LDX: r[RX] = nz(m, v); break;
+    case LDY: r[RY] = nz(m, v); break;
+    case CMP: cmp(m, r[RA], v); break;
+    case CPX: cmp(m, r[RX], v); break;
+    case CPY: cmp(m, r[RY], v); break;
+    case BIT:
+      if (mode != IMM) r[RP] = (r[RP] & ~(FN | FV)) | (v & (FN | FV));
+      r[RP] = (r[RP] & ~FZ) | ((r[RA] & v) ? 0 : FZ);
+      break;
+    }
+    if ((op == ADC || op == SBC) && (r[RP] & FD)) dummy(m);
+  }
+}
+
+static void reset(struct lockstep *ls) {
+  memset(ls->reg, 0xff, sizeof(ls->reg));
+  memset(ls->known, 0, sizeof(ls->known));
+  /* Reset sets I and clears D; the rest of P is unknown. */
+  ls->reg[RP] = 0x34;
+}
+
+static void expect(const struct ls_access *a, unsigned step,
+                   struct ls_expect *e)
+{
+  memset(e, 0, sizeof(*e));
+  if (a->kind == LS_ANY) return;
+  e->care = BUS_RD | BUS_WR | BUS_FETCH;
+  e->last = 1;
+  switch (a->kind) {
+  case LS_FETCH:
+    e->flags = BUS_RD | BUS_FETCH;
+    e->addr = e->take = 1;
+    break;
+  case LS_READ:
+    e->flags = BUS_RD;
+    e->addr = e->take = 1;
+    break;
+  case LS_WRITE:
+    e->flags = BUS_WR;
+    e->addr = e->cmp = 1;
+    break;
+  default:
+    e->flags = BUS_RD;
+    e->take = 1;
+    break;
+  }
+}
+
+static int learn_sp(struct lockstep *ls, const struct ls_access *a,
+                    unsigned addr)
+{
+  if (ls->known[RS] || (addr >> 8) != 1) return 0;
+  ls->reg[RS] = ls->snap[RS] = addr - a->sp_off;
+  ls->known[RS] = 1;
+  return 1;
+}
+
+const struct ls_model ls_65c02 = { &bus_65c02, reset, run, expect,
+                                   learn_sp };
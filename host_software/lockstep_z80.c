@@ -0,0 +1,769 @@
+/* Z80 model for the lockstep checker: makes the same machine cycles as the
+   CPU, T-state for T-state. Interrupts are never raised by the harness and
+   are not modelled. */
+
+#include "lockstep.h"
+
+#include <string.h>
+
+/* Registers; pairs are high byte first. */
+enum { B, C, D, E, H, L, A, F, IXH, IXL, IYH, IYL, SPH, SPL, I, R,
+       B2, C2, D2, E2, H2, L2, A2, F2, IFF, IM };
+
+#define FC 0x01
+#define FN 0x02
+#define FP 0x04
+#define F3 0x08
+#define FH 0x10
+#define F5 0x20
+#define FZ 0x40
+#define FS 0x80
+
+/* Bits 3 and 5 of F are not modelled, so they are left out of the checks
+   when F is pushed. */
+#define F_MASK 0xd7
+
+struct z80 {
+  struct lockstep *ls;
+  unsigned char *r;
+  unsigned pc;
+  int hl;      /* H, or IXH or IYH under a prefix */
+};
+
+static const signed char reg8[] = { B, C, D, E, H, L, -1, A };
+
+/* Bus cycles. */
+
+static unsigned char bus(struct z80 *z, int kind, unsigned addr,
+                         unsigned char data, int src, int sp_off)
+{
+  struct ls_access a = { 0 };
+
+  a.kind = kind;
+  a.addr = addr & 0xffff;
+  a.data = data;
+  a.mask = src == F ? F_MASK : 0xff;
+  a.src = src;
+  a.sp_off = sp_off;
+  return ls_bus(z->ls, &a);
+}
+
+static unsigned char fetch(struct z80 *z) {
+  unsigned char op = bus(z, LS_FETCH, z->pc, 0, -1, -1);
+
+  z->pc = (z->pc + 1) & 0xffff;
+  z->r[R] = (z->r[R] & 0x80) | ((z->r[R] + 1) & 0x7f);
+  return op;
+}
+
+static unsigned char rd(struct z80 *z, unsigned addr) {
+  return bus(z, LS_READ, addr, 0, -1, -1);
+}
+
+static void wr(struct z80 *z, unsigned addr, unsigned char v, int src) {
+  bus(z, LS_WRITE, addr, v, src, -1);
+}
+
+static void idle(struct z80 *z, unsigned n) {
+  struct ls_access a = { LS_IDLE, 0, 0, 0, -1, -1, n };
+
+  ls_bus(z->ls, &a);
+}
+
+static unsigned char imm8(struct z80 *z) {
+  unsigned char v = rd(z, z->pc);
+
+  z->pc = (z->pc + 1) & 0xffff;
+  return v;
+}
+
+static unsigned imm16(struct z80 *z) {
+  unsigned lo = imm8(z);
+  return lo | imm8(z) << 8;
+}
+
+static unsigned pair(struct z80 *z, int hi) {
+  return z->r[hi] << 8 | z->r[hi + 1];
+}
+
+static void set_pair(struct z80 *z, int hi, unsigned v) {
+  z->r[hi] = v >> 8;
+  z->r[hi + 1] = v;
+}
+
+static unsigned sp(struct z80 *z) {
+  return pair(z, SPH);
+}
+
+static void push(struct z80 *z, unsigned v, int hi) {
+  set_pair(z, SPH, sp(z) - 1);
+  bus(z, LS_WRITE, sp(z), v >> 8, hi, 0);
+  set_pair(z, SPH, sp(z) - 1);
+  bus(z, LS_WRITE, sp(z), v, hi < 0 ? -1 : hi + 1, 0);
+}
+
+static unsigned pop(struct z80 *z) {
+  unsigned v = bus(z, LS_READ, sp(z), 0, -1, 0);
+
+  set_pair(z, SPH, sp(z) + 1);
+  v |= bus(z, LS_READ, sp(z), 0, -1, 0) << 8;
+  set_pair(z, SPH, sp(z) + 1);
+  return v;
+}
+
+/* Register r of an opcode, with H and L replaced under a prefix. */
+static int reg(struct z80 *z, int r) {
+  if (r == 4) return z->hl;
+  if (r == 5) return z->hl + 1;
+  return reg8[r];
+}
+
+/* The (hl) operand: (ix+d) under a prefix. */
+static unsigned mem_hl(struct z80 *z) {
+  signed char d;
+
+  if (z->hl == H) return pair(z, H);
+  d = imm8(z);
+  idle(z, 5);
+  return (pair(z, z->hl) + d) & 0xffff;
+}
+
+/* Flags. */
+
+static unsigned char sz(unsigned char v) {
+  return (v & (FS | F5 | F3)) | (v ? 0 : FZ);
+}
+
+static unsigned char szp(unsigned char v) {
+  unsigned p = v;
+
+  p ^= p >> 4;
+  p ^= p >> 2;
+  p ^= p >> 1;
+  return sz(v) | ((p & 1) ? 0 : FP);
+}
+
+static int cond(struct z80 *z, int y) {
+  static const unsigned char flag[] = { FZ, FC, FP, FS };
+
+  return ((z->r[F] & flag[y >> 1]) != 0) == (y & 1);
+}
+
+static void alu(struct z80 *z, int op, unsigned char v) {
+  unsigned a = z->r[A], c = z->r[F] & FC, res;
+  unsigned char f;
+
+  switch (op) {
+  case 0: /* add */
+  case 1: /* adc */
+    if (op == 0) c = 0;
+    res = a + v + c;
+    f = sz(res) | ((res >> 8) & FC) | ((a ^ v ^ res) & FH) |
+        (((~(a ^ v) & (a ^ res)) & 0x80) ? FP : 0);
+    z->r[A] = res;
+    break;
+  case 2: /* sub */
+  case 3: /* sbc */
+  case 7: /* cp */
+    if (op != 3) c = 0;
+    res = a - v - c;
+    f = (sz(res) & ~(F3 | F5)) | FN | ((res >> 8) & FC) |
+        ((a ^ v ^ res) & FH) | ((((a ^ v) & (a ^ res)) & 0x80) ? FP : 0);
+    f |= (op == 7 ? v : res) & (F3 | F5);
+    if (op != 7) z->r[A] = res;
+    break;
+  case 4:
+    z->r[A] &= v;
+    f = szp(z->r[A]) | FH;
+    break;
+  case 5:
+    z->r[A] ^= v;
+    f = szp(z->r[A]);
+    break;
+  default:
+    z->r[A] |= v;
+    f = szp(z->r[A]);
+    break;
+  }
+  z->r[F] = f;
+}
+
+static unsigned char inc8(struct z80 *z, unsigned char v) {
+  v++;
+  z->r[F] = (z->r[F] & FC) | sz(v) | ((v & 0x0f) ? 0 : FH) |
+            (v == 0x80 ? FP : 0);
+  return v;
+}
+
+static unsigned char dec8(struct z80 *z, unsigned char v) {
+  v--;
+  z->r[F] = (z->r[F] & FC) | FN | sz(v) | ((v & 0x0f) == 0x0f ? FH : 0) |
+            (v == 0x7f ? FP : 0);
+  return v;
+}
+
+static void add16(struct z80 *z, int dst, unsigned v) {
+  unsigned a = pair(z, dst), res = a + v;
+
+  z->r[F] = (z->r[F] & (FS | FZ | FP)) | ((res >> 16) & FC) |
+            (((a ^ v ^ res) >> 8) & FH) | ((res >> 8) & (F3 | F5));
+  set_pair(z, dst, res);
+}
+
+static void adc16(struct z80 *z, unsigned v, int sub) {
+  unsigned a = pair(z, H), c = z->r[F] & FC, res;
+  unsigned char f;
+
+  res = sub ? a - v - c : a + v + c;
+  f = ((res >> 8) & (FS | F3 | F5)) | ((res & 0xffff) ? 0 : FZ) |
+      ((res >> 16) & FC) | (((a ^ v ^ res) >> 8) & FH) | (sub ? FN : 0);
+  if (sub) f |= (((a ^ v) & (a ^ res)) & 0x8000) ? FP : 0;
+  else f |= ((~(a ^ v) & (a ^ res)) & 0x8000) ? FP : 0;
+  z->r[F] = f;
+  set_pair(z, H, res);
+}
+
+/* CB rotates and shifts: rlc rrc rl rr sla sra sll srl. */
+static unsigned char rot(struct z80 *z, int op, unsigned char v) {
+  unsigned c = z->r[F] & FC, out;
+
+  switch (op) {
+  case 0: out = v >> 7; v = v << 1 | out; break;
+  case 1: out = v & 1; v = v >> 1 | out << 7; break;
+  case 2: out = v >> 7; v = v << 1 | c; break;
+  case 3: out = v & 1; v = v >> 1 | c << 7; break;
+  case 4: out = v >> 7; v <<= 1; break;
+  case 5: out = v & 1; v = (v >> 1) | (v & 0x80); break;
+  case 6: out = v >> 7; v = v << 1 | 1; break;
+  default: out = v & 1; v >>= 1; break;
+  }
+  z->r[F] = szp(v) | out;
+  return v;
+}
+
+static void bit(struct z80 *z, int b, unsigned char v) {
+  unsigned char f = (z->r[F] & FC) | FH | (v & (F3 | F5));
+
+  v &= 1 << b;
+  z->r[F] = f | (v ? (v & FS) : FZ | FP);
+}
+
+/* Unprefixed rotates of A: rlca rrca rla rra. */
+static void rot_a(struct z80 *z, int op) {
+  unsigned char a = z->r[A], out;
+  unsigned c = z->r[F] & FC;
+
+  switch (op) {
+  case 0: out = a >> 7; a = a << 1 | out; break;
+  case 1: out = a & 1; a = a >> 1 | out << 7; break;
+  case 2: out = a >> 7; a = a << 1 | c; break;
+  default: out = a & 1; a = a >> 1 | c << 7; break;
+  }
+  z->r[A] = a;
+  z->r[F] = (z->r[F] & (FS | FZ | FP)) | (a & (F3 | F5)) | out;
+}
+
+static void daa(struct z80 *z) {
+  unsigned char a = z->r[A], f = z->r[F], diff = 0, c = 0, h;
+
+  if ((f & FH) || (a & 0x0f) > 9) diff = 0x06;
+  if ((f & FC) || a > 0x99) {
+    diff |= 0x60;
+    c = FC;
+  }
+  if (f & FN) {
+    h = (f & FH) && (a & 0x0f) < 6;
+    a -= diff;
+  } else {
+    h = (a & 0x0f) > 9;
+    a += diff;
+  }
+  z->r[A] = a;
+  z->r[F] = szp(a) | c | (f & FN) | (h ? FH : 0);
+}
+
+/* Instructions. */
+
+static void ex(struct z80 *z, int a, int b) {
+  unsigned char t = z->r[a];
+
+  z->r[a] = z->r[b];
+  z->r[b] = t;
+}
+
+static void jr(struct z80 *z, int take) {
+  signed char d = imm8(z);
+
+  if (!take) return;
+  idle(z, 5);
+  z->pc = (z->pc + d) & 0xffff;
+}
+
+static void call(struct z80 *z, int take) {
+  unsigned nn = imm8(z);
+
+  nn |= rd(z, z->pc) << 8;
+  z->pc = (z->pc + 1) & 0xffff;
+  if (!take) return;
+  idle(z, 1);
+  push(z, z->pc, -1);
+  z->pc = nn;
+}
+
+static void op_cb(struct z80 *z) {
+  unsigned addr = 0;
+  unsigned char op, v;
+  int x, y, r;
+
+  if (z->hl == H) {
+    op = fetch(z);
+  } else {
+    /* DD CB d op: neither d nor op is an opcode fetch. */
+    signed char d = imm8(z);
+    op = imm8(z);
+    idle(z, 2);
+    addr = (pair(z, z->hl) + d) & 0xffff;
+  }
+  x = op >> 6;
+  y = (op >> 3) & 7;
+  r = reg8[op & 7];
+
+  if (z->hl == H && r >= 0) {
+    v = z->r[r];
+  } else {
+    if (z->hl == H) addr = pair(z, H);
+    v = rd(z, addr);
+    idle(z, 1);
+  }
+
+  switch (x) {
+  case 0: v = rot(z, y, v); break;
+  case 1: bit(z, y, v); return;
+  case 2: v &= ~(1 << y); break;
+  case 3: v |= 1 << y; break;
+  }
+
+  if (z->hl == H && r >= 0) {
+    z->r[r] = v;
+    return;
+  }
+  wr(z, addr, v, -1);
+  if (r >= 0) z->r[r] = v;
+}
+
+static void block(struct z80 *z, int y, int op) {
+  int dir = (y & 1) ? -1 : 1, rep = y >= 6;
+  unsigned hl = pair(z, H), bc = pair(z, B), k;
+  unsigned char v, f;
+
+  switch (op) {
+  case 0: /* ldi ldd ldir lddr */
+    v = rd(z, hl);
+    wr(z, pair(z, D), v, -1);
+    idle(z, 2);
+    set_pair(z, H, hl + dir);
+    set_pair(z, D, pair(z, D) + dir);
+    set_pair(z, B, --bc);
+    z->r[F] = (z->r[F] & (FS | FZ | FC)) | (bc & 0xffff ? FP : 0);
+    if (rep && (bc & 0xffff)) {
+      idle(z, 5);
+      z->pc = (z->pc - 2) & 0xffff;
+    }
+    break;
+  case 1: /* cpi cpd cpir cpdr */
+    v = rd(z, hl);
+    idle(z, 5);
+    k = (z->r[A] - v) & 0xff;
+    set_pair(z, H, hl + dir);
+    set_pair(z, B, --bc);
+    z->r[F] = (z->r[F] & FC) | FN | (sz(k) & (FS | FZ)) |
+              ((z->r[A] ^ v ^ k) & FH) | (bc & 0xffff ? FP : 0);
+    if (rep && (bc & 0xffff) && k) {
+      idle(z, 5);
+      z->pc = (z->pc - 2) & 0xffff;
+    }
+    break;
+  case 2: /* ini ind inir indr */
+    idle(z, 1);
+    v = bus(z, LS_IN, bc, 0, -1, -1);
+    wr(z, hl, v, -1);
+    set_pair(z, H, hl + dir);
+    z->r[B]--;
+    k = v + ((z->r[C] + dir) & 0xff);
+    goto io_flags;
+  default: /* outi outd otir otdr */
+    idle(z, 1);
+    v = rd(z, hl);
+    z->r[B]--;
+    bus(z, LS_OUT, pair(z, B), v, -1, -1);
+    set_pair(z, H, hl + dir);
+    k = v + z->r[L];
+  io_flags:
+    f = sz(z->r[B]) | ((v & 0x80) ? FN : 0) | (k > 0xff ? FH | FC : 0);
+    z->r[F] = f | (szp((k & 7) ^ z->r[B]) & FP);
+    if (rep && z->r[B]) {
+      idle(z, 5);
+      z->pc = (z->pc - 2) & 0xffff;
+    }
+    break;
+  }
+}
+
+static void op_ed(struct z80 *z) {
+  static const signed char rp[] = { B, D, H, SPH };
+  unsigned char op = fetch(z), v;
+  int x = op >> 6, y = (op >> 3) & 7, p = y >> 1, q = y & 1;
+  unsigned nn;
+
+  if (x == 2 && (op & 7) < 4 && y >= 4) {
+    block(z, y, op & 7);
+    return;
+  }
+  if (x != 1) return; /* The rest are 8 T-state NOPs. */
+
+  switch (op & 7) {
+  case 0: /* in r,(c) */
+    v = bus(z, LS_IN, pair(z, B), 0, -1, -1);
+    if (y != 6) z->r[reg8[y]] = v;
+    z->r[F] = (z->r[F] & FC) | szp(v);
+    break;
+  case 1: /* out (c),r */
+    bus(z, LS_OUT, pair(z, B), y == 6 ? 0 : z->r[reg8[y]],
+        y == 6 ? -1 : reg8[y], -1);
+    break;
+  case 2: /* sbc hl,rr / adc hl,rr */
+    idle(z, 7);
+    adc16(z, pair(z, rp[p]), !q);
+    break;
+  case 3: /* ld (nn),rr / ld rr,(nn) */
+    nn = imm16(z);
+    if (!q) {
+      wr(z, nn, z->r[rp[p] + 1], rp[p] + 1);
+      wr(z, nn + 1, z->r[rp[p]], rp[p]);
+    } else {
+      z->r[rp[p] + 1] = rd(z, nn);
+      z->r[rp[p]] = rd(z, nn + 1);
+    }
+    break;
+  case 4: /* neg */
+    v = z->r[A];
+    z->r[A] = 0;
+    alu(z, 2, v);
+    break;
+  case 5: /* retn / reti */
+    z->pc = pop(z);
+    z->r[IFF] = (z->r[IFF] & 2) | (z->r[IFF] >> 1);
+    break;
+  case 6: /* im */
+    z->r[IM] = (y & 3) ? (y & 3) - 1 : 0;
+    break;
+  case 7:
+    switch (y) {
+    case 0: idle(z, 1); z->r[I] = z->r[A]; break;
+    case 1: idle(z, 1); z->r[R] = z->r[A]; break;
+    case 2:
+    case 3:
+      idle(z, 1);
+      z->r[A] = z->r[y == 2 ? I : R];
+      z->r[F] = (z->r[F] & FC) | sz(z->r[A]) |
+                ((z->r[IFF] & 2) ? FP : 0);
+      break;
+    case 4: /* rrd */
+    case 5: /* rld */
+      nn = pair(z, H);
+      v = rd(z, nn);
+      idle(z, 4);
+      if (y == 4) {
+        wr(z, nn, (z->r[A] << 4) | (v >> 4), -1);
+        z->r[A] = (z->r[A] & 0xf0) | (v & 0x0f);
+      } else {
+        wr(z, nn, (v << 4) | (z->r[A] & 0x0f), -1);
+        z->r[A] = (z->r[A] & 0xf0) | (v >> 4);
+      }
+      z->r[F] = (z->r[F] & FC) | szp(z->r[A]);
+      break;
+    }
+    break;
+  }
+}
+
+static void op_main(struct z80 *z, unsigned char op) {
+  const signed char rp[] = { B, D, z->hl, SPH };
+  const signed char rp2[] = { B, D, z->hl, A };
+  int x = op >> 6, y = (op >> 3) & 7, p = y >> 1, q = y & 1;
+  unsigned nn;
+  unsigned char v;
+
+  switch (x) {
+  case 0:
+    switch (op & 7) {
+    case 0:
+      if (y == 0) break;
+      if (y == 1) {
+        ex(z, A, A2);
+        ex(z, F, F2);
+      } else if (y == 2) {
+        idle(z, 1);
+        jr(z, --z->r[B] != 0);
+      } else {
+        jr(z, y == 3 || cond(z, y - 4));
+      }
+      break;
+    case 1:
+      if (!q) {
+        nn = imm16(z);
+        set_pair(z, rp[p], nn);
+      } else {
+        idle(z, 7);
+        add16(z, z->hl, pair(z, rp[p]));
+      }
+      break;
+    case 2:
+      if (p < 2) {
+        nn = pair(z, p ? D : B);
+        if (!q) wr(z, nn, z->r[A], A);
+        else z->r[A] = rd(z, nn);
+      } else {
+        nn = imm16(z);
+        if (p == 3) {
+          if (!q) wr(z, nn, z->r[A], A);
+          else z->r[A] = rd(z, nn);
+        } else if (!q) {
+          wr(z, nn, z->r[z->hl + 1], z->hl + 1);
+          wr(z, nn + 1, z->r[z->hl], z->hl);
+        } else {
+          z->r[z->hl + 1] = rd(z, nn);
+          z->r[z->hl] = rd(z, nn + 1);
+        }
+      }
+      break;
+    case 3:
+      idle(z, 2);
+      set_pair(z, rp[p], pair(z, rp[p]) + (q ? -1 : 1));
+      break;
+    case 4:
+    case 5:
+      if (y == 6) {
+        nn = mem_hl(z);
+        v = rd(z, nn);
+        idle(z, 1);
+        wr(z, nn, (op & 1) ? dec8(z, v) : inc8(z, v), -1);
+      } else if (op & 1) {
+        z->r[reg(z, y)] = dec8(z, z->r[reg(z, y)]);
+      } else {
+        z->r[reg(z, y)] = inc8(z, z->r[reg(z, y)]);
+      }
+      break;
+    case 6:
+      if (y != 6) {
+        z->r[reg(z, y)] = imm8(z);
+      } else if (z->hl == H) {
+        v = imm8(z);
+        wr(z, pair(z, H), v, -1);
+      } else {
+        signed char d = imm8(z);
+        v = imm8(z);
+        idle(z, 2);
+        wr(z, pair(z, z->hl) + d, v, -1);
+      }
+      break;
+    case 7:
+      if (y < 4) {
+        rot_a(z, y);
+      } else if (y == 4) {
+        daa(z);
+      } else if (y == 5) {
+        z->r[A] = ~z->r[A];
+        z->r[F] = (z->r[F] & (FS | FZ | FP | FC)) | FH | FN |
+                  (z->r[A] & (F3 | F5));
+      } else if (y == 6) {
+        z->r[F] = (z->r[F] & (FS | FZ | FP)) | FC | (z->r[A] & (F3 | F5));
+      } else {
+        v = z->r[F];
+        z->r[F] = (v & (FS | FZ | FP)) | ((v & FC) ? FH : FC) |
+                  (z->r[A] & (F3 | F5));
+      }
+      break;
+    }
+    break;
+
+  case 1:
+    if (op == 0x76) {
+      /* HALT: the CPU runs NOPs until an interrupt. */
+      struct ls_access a = { LS_ANY, 0, 0, 0, -1, -1, 0 };
+      ls_bus(z->ls, &a);
+    } else if (y == 6) {
+      nn = mem_hl(z);
+      wr(z, nn, z->r[reg8[op & 7]], reg8[op & 7]);
+    } else if ((op & 7) == 6) {
+      nn = mem_hl(z);
+      z->r[reg8[y]] = rd(z, nn);
+    } else {
+      z->r[reg(z, y)] = z->r[reg(z, op & 7)];
+    }
+    break;
+
+  case 2:
+    if ((op & 7) == 6) alu(z, y, rd(z, mem_hl(z)));
+    else alu(z, y, z->r[reg(z, op & 7)]);
+    break;
+
+  case 3:
+    switch (op & 7) {
+    case 0: /* ret cc */
+      idle(z, 1);
+      if (cond(z, y)) z->pc = pop(z);
+      break;
+    case 1:
+      if (!q) {
+        set_pair(z, rp2[p], pop(z));
+      } else if (p == 0) {
+        z->pc = pop(z);
+      } else if (p == 1) {
+        for (v = B; v <= L; ++v) ex(z, v, v + B2);
+      } else if (p == 2) {
+        z->pc = pair(z, z->hl);
+      } else {
+        idle(z, 2);
+        set_pair(z, SPH, pair(z, z->hl));
+      }
+      break;
+    case 2: /* jp cc,nn */
+      nn = imm16(z);
+      if (cond(z, y)) z->pc = nn;
+      break;
+    case 3:
+      switch (y) {
+      case 0:
+        z->pc = imm16(z);
+        break;
+      case 2: /* out (n),a */
+        v = imm8(z);
+        bus(z, LS_OUT, z->r[A] << 8 | v, z->r[A], A, -1);
+        break;
+      case 3: /* in a,(n) */
+        v = imm8(z);
+        z->r[A] = bus(z, LS_IN, z->r[A] << 8 | v, 0, -1, -1);
+        break;
+      case 4: /* ex (sp),hl */
+        nn = bus(z, LS_READ, sp(z), 0, -1, 0);
+        nn |= bus(z, LS_READ, sp(z) + 1, 0, -1, 1) << 8;
+        idle(z, 1);
+        bus(z, LS_WRITE, sp(z) + 1, z->r[z->hl], z->hl, 1);
+        bus(z, LS_WRITE, sp(z), z->r[z->hl + 1], z->hl + 1, 0);
+        idle(z, 2);
+        set_pair(z, z->hl, nn);
+        break;
+      case 5:
+        ex(z, D, H);
+        ex(z, E, L);
+        break;
+      case 6: z->r[IFF] = 0; break;
+      case 7: z->r[IFF] = 3; break;
+      }
+      break;
+    case 4:
+      call(z, cond(z, y));
+      break;
+    case 5:
+      if (!q) {
+        idle(z, 1);
+        push(z, pair(z, rp2[p]), rp2[p]);
+      } else {
+        call(z, 1);
+      }
+      break;
+    case 6:
+      alu(z, y, imm8(z));
+      break;
+    case 7:
+      idle(z, 1);
+      push(z, z->pc, -1);
+      z->pc = y * 8;
+      break;
+    }
+    break;
+  }
+}
+
+static void run(struct lockstep *ls, unsigned pc) {
+  struct z80 zz, *z = &zz;
+  unsigned char op;
+
+  z->ls = ls;
+  z->r = ls->reg;
+  z->pc = pc;
+  for (;;) {
+    ls_insn(ls, z->pc);
+    z->hl = H;
+    op = fetch(z);
+    while (op == 0xdd || op == 0xfd) {
+      z->hl = op == 0xdd ? IXH : IYH;
+      op = fetch(z);
+    }
+    if (op == 0xcb) op_cb(z);
+    else if (op == 0xed) op_ed(z);
+    else op_main(z, op);
+  }
+}
+
+static void reset(struct lockstep *ls) {
+  memset(ls->reg, 0xff, sizeof(ls->reg));
+  memset(ls->known, 0, sizeof(ls->known));
+  ls->reg[I] = ls->reg[R] = ls->reg[IFF] = ls->reg[IM] = 0;
+  ls->known[I] = ls->known[R] = ls->known[IFF] = ls->known[IM] = 1;
+}
+
+/* Records of each machine cycle: the state after the falling edge of each
+   of its T-states (see buscyc.c). */
+static void expect(const struct ls_access *a, unsigned step,
+                   struct ls_expect *e)
+{
+  static const struct ls_expect tab[][4] = {
+    [LS_FETCH] = {
+      { BUS_RD | BUS_MEM | BUS_FETCH, 0, 1 },
+      { BUS_RD | BUS_MEM | BUS_FETCH, 0, 1, 1 },
+      { BUS_MEM | BUS_RFSH },
+      { BUS_RFSH, 0, 0, 0, 0, 1 } },
+    [LS_READ] = {
+      { BUS_RD | BUS_MEM, 0, 1 },
+      { BUS_RD | BUS_MEM, 0, 1, 1 },
+      { 0, 0, 1, 0, 0, 1 } },
+    [LS_WRITE] = {
+      { BUS_MEM, 0, 1 },
+      { BUS_MEM | BUS_WR, 0, 1, 0, 1 },
+      { 0, 0, 1, 0, 0, 1 } },
+    [LS_IN] = {
+      { 0, 0, 1 },
+      { BUS_IO | BUS_RD, 0, 1 },
+      { BUS_IO | BUS_RD, 0, 1, 1 },
+      { 0, 0, 1, 0, 0, 1 } },
+    [LS_OUT] = {
+      { 0, 0, 1 },
+      { BUS_IO | BUS_WR, 0, 1, 0, 1 },
+      { BUS_IO | BUS_WR, 0, 1 },
+      { 0, 0, 1, 0, 0, 1 } },
+  };
+
+  memset(e, 0, sizeof(*e));
+  if (a->kind == LS_ANY) return;
+  if (a->kind == LS_IDLE) {
+    e->last = step + 1 >= a->len;
+  } else {
+    *e = tab[a->kind][step];
+  }
+  e->care = BUS_RD | BUS_WR | BUS_IO | BUS_FETCH | BUS_MEM | BUS_RFSH;
+}
+
+static int learn_sp(struct lockstep *ls, const struct ls_access *a,
+                    unsigned addr)
+{
+  if (ls->known[SPH] && ls->known[SPL]) return 0;
+  addr = (addr - a->sp_off) & 0xffff;
+  ls->reg[SPH] = ls->snap[SPH] = addr >> 8;
+  ls->reg[SPL] = ls->snap[SPL] = addr;
+  ls->known[SPH] = ls->known[SPL] = 1;
+  return 1;
+}
+
+const struct ls_model ls_z80 = { &bus_z80, reset, run, expect, learn_sp };
@@ -9,78 +9,64 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
 
 #include "busyboard.h"
+#include "sram.h"
 
-#define DELAY 0
-
-void do_delay(void) {
-  #ifdef DELAY
-  usleep(DELAY);
-  #endif
-}
-
-void sram_init(busyboard_t *bb) {
-  bb->out_state[0] = 7; // CE, OE, and WR de-asserted
-  bb->trimask = 0x3d;
-  busyboard_out(bb);
-
-  do_delay();
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
 }
 
-void sram_write(busyboard_t *bb, unsigned addr, unsigned char data) {
-  bb->out_state[0] = 2; // CE and WR asserted, OE de-asserted
-  bb->out_state[1] = data;
-  bb->out_state[2] = addr & 0xff;
-  bb->out_state[3] = (addr >> 8) & 0xff;
-  bb->out_state[4] = (addr >> 16) & 0xff;
-  bb->trimask = 0x3f;
-  busyboard_out(bb);
-  do_delay();
-  
-  sram_init(bb);
-}
-
-unsigned char sram_read(busyboard_t *bb, unsigned addr)
-{
-  bb->out_state[0] = 4; // CE and OE asserted, WR clear.
-  bb->trimask = 0x3d;
-  bb->out_state[2] = addr & 0xff;
-  bb->out_state[3] = (addr >> 8) & 0xff;
-  bb->out_state[4] = (addr >> 16) & 0xff;
-  busyboard_out(bb);
-  do_delay();
-  busyboard_in(bb);
-  do_delay();
+int main(int argc, char **argv) {
+  const char *parport = (argc >= 2) ? argv[1] : "/dev/parport0";
+  unsigned int i, len = (argc >= 3) ? strtoul(argv[2], NULL, 0) : SRAM_SIZE,
+               bad, first;
+  unsigned long frames;
+  unsigned char *buf;
+  double start, t;
 
-  sram_init(bb);
-  
-  return bb->in_state[1];
-}
+  /* Past SRAM_SIZE the addresses wrap onto bytes already written. */
+  if (!len || len > SRAM_SIZE) {
+    fprintf(stderr, "Usage: %s [parport [len]]: len is 1 to 0x%x.\n",
+            argv[0], SRAM_SIZE);
+    return 1;
+  }
+  if (!(buf = malloc(len))) {
+    perror("malloc");
+    return 1;
+  }
 
-int main(int argc, char **argv) {
   busyboard_t bb;
-  init_busyboard(&bb, (argc >= 2) ? argv[1] : "/dev/parport0");
+  init_busyboard(&bb, parport);
+  sram_init(&bb);
+  timing_setup(&sram_timing, parport, sram_verify, &bb);
 
-  unsigned int i, count;
   srand(0x1234);
-  for (i = 0; i < (1<<10); ++i) {
-    unsigned val = rand() & 0xff;
-    sram_write(&bb, i, val);
-    printf("Wrote %x to address %x.\n", val, i);
-  }
+  for (i = 0; i < len; ++i) buf[i] = rand() & 0xff;
 
-  srand(0x1234);
-  for (i = 0, count = 0; i < (1<<10); ++i) {
-    unsigned val = sram_read(&bb, i);
-    printf("Read %x from address %x.\n", val, i);
-    if (val == (rand() & 0xff)) count++;
-    else puts("Warning: value mismatch.");
-  }
+  start = now();
+  frames = bb.frames;
+  sram_write_block(&bb, 0, buf, len);
+  t = now() - start;
+  printf("Wrote %u bytes in %.2f s: %.0f B/s, %.2f frames/byte.\n",
+         len, t, len/t, (double)(bb.frames - frames)/len);
+
+  start = now();
+  frames = bb.frames;
+  bad = sram_compare_block(&bb, 0, buf, len, &first);
+  t = now() - start;
+  printf("Read %u bytes in %.2f s: %.0f B/s, %.2f frames/byte.\n",
+         len, t, len/t, (double)(bb.frames - frames)/len);
 
-  printf("%d values matched.\n", count);
+  if (bad) printf("%u values mismatched, first at %x.\n", bad, first);
+  else printf("%u values matched.\n", len);
 
+  free(buf);
   close_busyboard(&bb);
 
-  return 0;
+  return bad ? 1 : 0;
 }
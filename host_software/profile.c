@@ -0,0 +1,262 @@
+/* Target-code profiler for the CPU harnesses. */
+
+#include "profile.h"
+#include "disasm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROFILE_DEPTH 256
+
+enum { OP_OTHER, OP_CALL, OP_RET };
+
+struct profile_node {
+  unsigned short func;
+  struct profile_node *parent, *child, *next;
+  unsigned long long cycles;
+};
+
+struct profile_frame {
+  struct profile_node *node; /* Stack from the call on */
+  unsigned short ret;        /* Where the call returns to */
+};
+
+struct profile {
+  int z80;
+  unsigned long long exec[0x10000], cycles[0x10000];
+  unsigned long long reads[0x10000], writes[0x10000];
+  unsigned long long total, insns, lost;
+
+  /* Instruction in progress, and what it may do at its end. */
+  unsigned insn, n_fetches;
+  unsigned char last_op;
+  int kind, started;
+  unsigned short ret;
+  unsigned short prev_flags, prev_addr;
+
+  struct profile_node root, *node;
+  struct profile_frame stack[PROFILE_DEPTH];
+  unsigned depth;
+};
+
+/* Whether the Z80 fetch at addr continues the instruction: after a DD or
+   FD prefix, or the first byte after CB or ED. */
+static int continues(const struct profile *p, unsigned addr) {
+  if (addr != ((p->insn + p->n_fetches) & 0xffff)) return 0;
+  if (p->last_op == 0xdd || p->last_op == 0xfd) return 1;
+  return (p->last_op == 0xcb || p->last_op == 0xed) && p->n_fetches == 1;
+}
+
+static void classify(struct profile *p, unsigned addr, unsigned char op) {
+  unsigned char prefix = p->n_fetches > 1 ? p->last_op : 0;
+
+  p->kind = OP_OTHER;
+  if (!p->z80) {
+    if (op == 0x20) p->kind = OP_CALL, p->ret = addr + 3;      /* JSR */
+    else if (op == 0x00) p->kind = OP_CALL, p->ret = addr + 2; /* BRK */
+    else if (op == 0x60 || op == 0x40) p->kind = OP_RET;      /* RTS RTI */
+  } else if (prefix == 0xed) {
+    if ((op & 0xc7) == 0x45) p->kind = OP_RET;                /* RETI RETN */
+  } else if (prefix != 0xcb) {
+    if (op == 0xcd || (op & 0xc7) == 0xc4)                     /* CALL */
+      p->kind = OP_CALL, p->ret = addr + 3;
+    else if ((op & 0xc7) == 0xc7)                              /* RST */
+      p->kind = OP_CALL, p->ret = addr + 1;
+    else if (op == 0xc9 || (op & 0xc7) == 0xc0)                /* RET */
+      p->kind = OP_RET;
+  }
+}
+
+static void call(struct profile *p, unsigned func) {
+  struct profile_node *n;
+
+  if (p->depth == PROFILE_DEPTH) {
+    p->lost++;
+    return;
+  }
+  for (n = p->node->child; n && n->func != func; n = n->next)
+    ;
+  if (!n) {
+    n = calloc(1, sizeof(*n));
+    if (!n) {
+      p->lost++;
+      return;
+    }
+    n->func = func;
+    n->parent = p->node;
+    n->next = p->node->child;
+    p->node->child = n;
+  }
+  p->stack[p->depth].node = n;
+  p->stack[p->depth++].ret = p->ret;
+  p->node = n;
+}
+
+static void ret(struct profile *p, unsigned addr) {
+  unsigned i;
+
+  for (i = p->depth; i-- > 0; )
+    if (p->stack[i].ret == addr) {
+      p->depth = i;
+      p->node = i ? p->stack[i - 1].node : &p->root;
+      return;
+    }
+}
+
+static void fetch(struct profile *p, unsigned addr, unsigned char op) {
+  if (p->z80 && p->started && continues(p, addr)) {
+    p->n_fetches++;
+    classify(p, addr, op);
+    p->last_op = op;
+    return;
+  }
+
+  /* Where the last instruction went says whether its call or return was
+     taken. */
+  if (!p->started) {
+    p->root.func = addr;
+    p->started = 1;
+  } else if (p->kind == OP_CALL && addr != p->ret) {
+    call(p, addr);
+  } else if (p->kind == OP_RET) {
+    ret(p, addr);
+  }
+
+  p->insn = addr;
+  p->n_fetches = 1;
+  p->exec[addr]++;
+  p->insns++;
+  classify(p, addr, op);
+  p->last_op = op;
+}
+
+void profile_cycle(struct profile *p, const struct bus_rec *r) {
+  unsigned f = r->flags;
+
+  /* A Z80 M1 fetch shows for two cycles; a 65C02 one for one. */
+  if ((f & BUS_FETCH) && !(f & BUS_IO) &&
+      (!p->z80 || !(p->prev_flags & BUS_FETCH) || r->addr != p->prev_addr))
+    fetch(p, r->addr, r->data);
+  else if ((f & BUS_MEM) && (f & (BUS_RD | BUS_WR)) &&
+           (r->addr != p->prev_addr || !(p->prev_flags & (BUS_RD | BUS_WR))))
+    ((f & BUS_WR) ? p->writes : p->reads)[r->addr]++;
+
+  p->cycles[p->insn]++;
+  p->node->cycles++;
+  p->total++;
+  p->prev_flags = f;
+  p->prev_addr = r->addr;
+}
+
+struct profile *profile_open(const struct bus_cpu *cpu) {
+  struct profile *p = calloc(1, sizeof(*p));
+
+  if (!p) {
+    perror("profile");
+    return NULL;
+  }
+  p->z80 = cpu == &bus_z80;
+  p->node = &p->root;
+  return p;
+}
+
+static void write_stack(FILE *f, const struct profile_node *n) {
+  if (n->parent) {
+    write_stack(f, n->parent);
+    putc(';', f);
+  }
+  fprintf(f, "%04x", n->func);
+}
+
+static void write_node(FILE *f, const struct profile_node *n) {
+  const struct profile_node *c;
+
+  if (n->cycles) {
+    write_stack(f, n);
+    fprintf(f, " %llu\n", n->cycles);
+  }
+  for (c = n->child; c; c = c->next) write_node(f, c);
+}
+
+int profile_write_folded(const struct profile *p, const char *filename) {
+  FILE *f = fopen(filename, "w");
+
+  if (!f) {
+    perror(filename);
+    return -1;
+  }
+  write_node(f, &p->root);
+  if (fclose(f)) {
+    perror(filename);
+    return -1;
+  }
+  return 0;
+}
+
+/* The n largest of count[], in order. Returns how many there are. */
+static unsigned top(const unsigned long long *count, unsigned *addr,
+                    unsigned n)
+{
+  unsigned a, i, m = 0;
+
+  for (a = 0; a < 0x10000; ++a) {
+    if (!count[a] || (m == n && count[a] <= count[addr[m - 1]])) continue;
+    for (i = m < n ? m++ : m - 1; i > 0 && count[addr[i - 1]] < count[a]; --i)
+      addr[i] = addr[i - 1];
+    addr[i] = a;
+  }
+  return m;
+}
+
+void profile_print_hot(const struct profile *p, const unsigned char *mem,
+                       unsigned n)
+{
+  unsigned long long *acc = malloc(0x10000 * sizeof(*acc));
+  unsigned *addr = malloc(n * sizeof(*addr)), i, m, a;
+  char text[32];
+
+  if (!acc || !addr) {
+    free(acc);
+    free(addr);
+    return;
+  }
+
+  printf("Profile: %llu cycles, %llu instructions", p->total, p->insns);
+  if (p->lost) printf(", %llu calls too deep to follow", p->lost);
+  printf(".\n%6s %12s %6s %10s %6s  %s\n", "addr", "cycles", "%", "runs",
+         "cyc/run", "instruction");
+  m = top(p->cycles, addr, n);
+  for (i = 0; i < m; ++i) {
+    a = addr[i];
+    if (!p->exec[a]) continue; /* Before the first fetch */
+    (p->z80 ? disasm_z80 : disasm_65c02)(mem, a, text, sizeof(text));
+    printf("  %04x %12llu %5.1f%% %10llu %7.2f  %s\n", a, p->cycles[a],
+           100.0 * p->cycles[a] / p->total, p->exec[a],
+           (double)p->cycles[a] / p->exec[a], text);
+  }
+
+  for (a = 0; a < 0x10000; ++a) acc[a] = p->reads[a] + p->writes[a];
+  printf("%6s %12s %12s\n", "data", "reads", "writes");
+  m = top(acc, addr, n);
+  for (i = 0; i < m; ++i)
+    printf("  %04x %12llu %12llu\n", addr[i], p->reads[addr[i]],
+           p->writes[addr[i]]);
+  free(acc);
+  free(addr);
+}
+
+static void free_nodes(struct profile_node *n) {
+  struct profile_node *c, *next;
+
+  for (c = n->child; c; c = next) {
+    next = c->next;
+    free_nodes(c);
+    free(c);
+  }
+}
+
+void profile_close(struct profile *p) {
+  free_nodes(&p->root);
+  free(p);
+}
@@ -0,0 +1,37 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "buscyc.h"
+
+/* Target-code profiler for the CPU harnesses. Fed every bus cycle, it
+   counts, by address, the instructions started there (SYNC or the first M1
+   of an instruction), the cycles spent in them, and data reads and writes;
+   each is a flat 64K array. Calls and returns (JSR, BRK, RTS, RTI; CALL,
+   RST, RET, RETI, RETN, taken or not) move through a trie of call stacks,
+   and every cycle is also counted against the stack it ran on.
+
+   A call is taken if the next instruction is not the one after it, and
+   pushes that address as the callee. A return pops back to the call it
+   returned to; one that matches no call on the stack (an RTS used as a
+   jump, say) leaves it alone. Interrupts are not followed. */
+
+struct profile;
+
+struct profile *profile_open(const struct bus_cpu *cpu);
+
+/* One bus cycle; a few increments unless it starts an instruction. */
+void profile_cycle(struct profile *p, const struct bus_rec *r);
+
+/* Write the stacks in the folded format of flamegraph.pl, one line per
+   stack: function start addresses from the first instruction down, and its
+   cycles. Returns 0, or -1 after printing why. */
+int profile_write_folded(const struct profile *p, const char *filename);
+
+/* Print the n instructions with the most cycles, disassembled from mem, and
+   the n most accessed data addresses. */
+void profile_print_hot(const struct profile *p, const unsigned char *mem,
+                       unsigned n);
+
+void profile_close(struct profile *p);
+
+#endif
@@ -0,0 +1,155 @@
+/* Binary code modulation PWM on all 48 busyboard pins. */
+
+#include "pwm.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/* Sleep until this close to a deadline, then spin. */
+#define PWM_SPIN 100e-6
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void wait_until(double t) {
+  struct timespec ts;
+  double left = t - now();
+
+  if (left > PWM_SPIN) {
+    t -= PWM_SPIN;
+    ts.tv_sec = t;
+    ts.tv_nsec = (t - ts.tv_sec) * 1e9;
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    t += PWM_SPIN;
+  }
+  while (now() < t)
+    ;
+}
+
+void pwm_init(struct pwm *p, busyboard_t *bb, int bits, unsigned period_us) {
+  int i;
+
+  memset(p, 0, sizeof(*p));
+  p->bb = bb;
+  p->bits = bits < 1 ? 1 : bits > PWM_MAX_BITS ? PWM_MAX_BITS : bits;
+  p->slot = period_us * 1e-6 / ((1 << p->bits) - 1);
+  pwm_gamma(p, 1);
+
+  bb->trimask = 0x3f;
+  for (i = 0; i < BUSYBOARD_N_PORTS; ++i) bb->out_state[i] = 0;
+  busyboard_out(bb);
+}
+
+void pwm_gamma(struct pwm *p, double g) {
+  int i;
+
+  for (i = 0; i < 256; ++i)
+    p->gamma[i] = pow(i / 255.0, g) * ((1 << p->bits) - 1) + 0.5;
+}
+
+void pwm_set(struct pwm *p, int ch, double level) {
+  p->level[ch] = level < 0 ? 0 : level > 255 ? 255 : level;
+  p->span[ch] = 0;
+  p->staged[ch] = 1;
+}
+
+void pwm_fade(struct pwm *p, int ch, double level, unsigned periods) {
+  pwm_set(p, ch, level);
+  p->span[ch] = periods;
+}
+
+void pwm_commit(struct pwm *p) {
+  int ch;
+
+  for (ch = 0; ch < PWM_CHANNELS; ++ch) {
+    if (!p->staged[ch]) continue;
+    if (p->span[ch]) {
+      p->step[ch] = (p->level[ch] - p->shown[ch]) / p->span[ch];
+    } else {
+      p->shown[ch] = p->level[ch];
+    }
+    p->fade[ch] = p->span[ch];
+    p->staged[ch] = 0;
+    p->pending = 1;
+  }
+}
+
+int pwm_fading(const struct pwm *p) {
+  int ch;
+
+  for (ch = 0; ch < PWM_CHANNELS; ++ch)
+    if (p->fade[ch]) return 1;
+  return 0;
+}
+
+/* Step the fades and split the committed levels into bit planes. */
+static void update(struct pwm *p) {
+  unsigned duty;
+  int ch, k;
+
+  for (ch = 0; ch < PWM_CHANNELS; ++ch)
+    if (p->fade[ch]) {
+      p->shown[ch] += p->step[ch];
+      p->fade[ch]--;
+      p->pending = 1;
+    }
+  if (!p->pending) return;
+
+  memset(p->plane, 0, sizeof(p->plane));
+  for (ch = 0; ch < PWM_CHANNELS; ++ch) {
+    duty = p->gamma[(int)(p->shown[ch] + 0.5)];
+    for (k = 0; k < p->bits; ++k)
+      if (duty >> k & 1) p->plane[k][ch >> 3] |= 1 << (ch & 7);
+  }
+  p->pending = 0;
+}
+
+void pwm_period(struct pwm *p) {
+  busyboard_t *bb = p->bb;
+  double late;
+  int k;
+
+  update(p);
+
+  /* Start the clock, or start it over if a whole period was missed. */
+  if (!p->periods || now() - p->next > p->slot * ((1 << p->bits) - 1)) {
+    if (p->periods) p->slips++;
+    p->next = now();
+    if (!p->periods) p->start = p->next;
+  }
+
+  /* Longest plane first; each one is out until the next goes out. */
+  for (k = p->bits - 1; k >= 0; --k) {
+    wait_until(p->next);
+    memcpy(bb->out_state, p->plane[k], BUSYBOARD_N_PORTS);
+    busyboard_out(bb);
+
+    late = now() - p->next;
+    p->late_sum += late;
+    p->late_sq += late * late;
+    if (late > p->late_max) p->late_max = late;
+    if (late > p->slot) p->late++;
+    p->next += p->slot * (1 << k);
+  }
+  p->last = now();
+  p->periods++;
+}
+
+void pwm_report(const struct pwm *p) {
+  unsigned long n = p->periods * p->bits;
+  double t = p->last - p->start, mean = n ? p->late_sum / n : 0;
+  double var = n ? p->late_sq / n - mean * mean : 0;
+
+  printf("PWM: %lu periods in %.2f s: %.1f Hz (asked %.1f Hz), %d bits, "
+         "%d frames/period.\n", p->periods, t, t > 0 ? p->periods / t : 0,
+         1 / (p->slot * ((1 << p->bits) - 1)), p->bits, p->bits);
+  printf("Frame edges %.1f us late on average, %.1f us jitter (sd), "
+         "%.1f us worst; %lu edges over a slot late, %lu periods slipped.\n",
+         mean * 1e6, (var > 0 ? sqrt(var) : 0) * 1e6, p->late_max * 1e6,
+         p->late, p->slips);
+}
@@ -0,0 +1,72 @@
+#ifndef PWM_H
+#define PWM_H
+
+#include "busyboard.h"
+
+/* PWM/LED dimming on all 48 busyboard pins (channel 8 * port + bit) by
+   binary code modulation. Each duty cycle's bit k holds the pin for 2^k
+   slots, so a period with n bits of resolution is n frames, whatever the
+   number of channels: bit plane k carries bit k of all 48 duties and stays
+   out for 2^k slots. The planes go out on an absolute clock, so a late
+   frame shortens its own plane rather than shifting the ones after it.
+
+   Levels (0-255) go through a gamma table to duties. pwm_set() and
+   pwm_fade() stage levels and fades, which nothing shows until
+   pwm_commit() copies them over to the committed levels that the next
+   period puts out, so one never shows half updated; fades step the
+   committed levels, not the staged ones. A slot shorter than a
+   frame makes the edges after the short planes late, moving duty from one
+   plane to the next; pwm_report() counts edges late by more than a slot. */
+
+#define PWM_CHANNELS (8 * BUSYBOARD_N_PORTS)
+#define PWM_MAX_BITS 12
+
+struct pwm {
+  busyboard_t *bb;
+  int bits;
+  double slot;                   /* Time for duty 1, s */
+  unsigned short gamma[256];
+
+  /* Staged levels and fade lengths (0 to jump), on the channels staged
+   since the last commit. */
+  double level[PWM_CHANNELS];
+  unsigned span[PWM_CHANNELS];
+  unsigned char staged[PWM_CHANNELS];
+
+  /* Committed levels and fades in progress, and the planes in effect. */
+  double shown[PWM_CHANNELS], step[PWM_CHANNELS];
+  unsigned fade[PWM_CHANNELS];
+  int pending;
+  unsigned char plane[PWM_MAX_BITS][BUSYBOARD_N_PORTS];
+
+  /* Clock, and lateness of frames against it. */
+  double start, next, last;
+  unsigned long periods, late, slips;
+  double late_sum, late_sq, late_max;
+};
+
+/* Drive all ports, dark, with period_us per period (1e6 / refresh rate)
+   and bits of resolution, and a linear gamma table. */
+void pwm_init(struct pwm *p, busyboard_t *bb, int bits, unsigned period_us);
+
+/* Levels map to round((level / 255) ^ g * (2^bits - 1)). */
+void pwm_gamma(struct pwm *p, double g);
+
+/* Stage a level, or a fade to one over so many periods from the committed
+   level. Either cancels a fade in progress once committed. */
+void pwm_set(struct pwm *p, int ch, double level);
+void pwm_fade(struct pwm *p, int ch, double level, unsigned periods);
+
+/* Commit the staged levels and fades, for the next period to put out.
+   Fades then step every period until they're done. */
+void pwm_commit(struct pwm *p);
+
+/* Whether any fade is in progress. */
+int pwm_fading(const struct pwm *p);
+
+/* Put out one period of all planes. */
+void pwm_period(struct pwm *p);
+
+void pwm_report(const struct pwm *p);
+
+#endif
@@ -1,40 +1,47 @@
-/* ~100Hz Pulse-width modulation test. */
+/* Pulse-width modulation test: all 48 pins breathe, out of phase, then fade
+   out together. */
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "busyboard.h"
+#include "pwm.h"
 
-void pwm_cycle(struct busyboard *bb, double duty) {
-  int a = duty*10000, b = 10000 - a;
-  //printf("%d %d\n", a, b);
-  /* Turn the output on. */
-  if (a) {
-    bb->out_state[0] |= 1;
-    busyboard_out(bb);
-  }
-  
-  usleep(a);
-  
-  /* Turn the output off. */
-  if (b) {
-    bb->out_state[0] &= ~1;
-    busyboard_out(bb);
-  }
-  
-  usleep(b);
-}
+struct pwm pwm;
 
 int main(int argc, char **argv) {
+  const char *parport = (argc >= 2) ? argv[1] : "/dev/parport0";
+  int hz = (argc >= 3) ? atoi(argv[2]) : 100;
+  int bits = (argc >= 4) ? atoi(argv[3]) : 8;
   struct busyboard bb;
-  init_busyboard(&bb, (argc >= 2) ? argv[1] : "/dev/parport0");
-  bb.trimask = 0x3f;
-  busyboard_out(&bb);
-  
   int i, j;
-  for (i = 0; i < 100; ++i)
-    for (j = 0; j < 300; ++j)
-      pwm_cycle(&bb, pow((sin(2*M_PI*(j/300.0)) + 1)/2.0, 3));
 
+  if (hz <= 0) {
+    fprintf(stderr, "Usage: %s [parport [refresh Hz [bits]]]\n", argv[0]);
+    return 1;
+  }
+
+  init_busyboard(&bb, parport);
+  pwm_init(&pwm, &bb, bits, 1000000 / hz);
+  pwm_gamma(&pwm, 3); /* Was pow(..., 3) on the level. */
+
+  /* 300 periods per breath, each channel 1/48 of one behind the last. */
+  for (i = 0; i < 10; ++i)
+    for (j = 0; j < 300; ++j) {
+      int ch;
+      for (ch = 0; ch < PWM_CHANNELS; ++ch)
+        pwm_set(&pwm, ch, 255 * (sin(2 * M_PI * (j / 300.0 -
+                                     (double)ch / PWM_CHANNELS)) + 1) / 2);
+      pwm_commit(&pwm);
+      pwm_period(&pwm);
+    }
+
+  for (i = 0; i < PWM_CHANNELS; ++i) pwm_fade(&pwm, i, 0, hz);
+  pwm_commit(&pwm);
+  while (pwm_fading(&pwm)) pwm_period(&pwm);
+  pwm_period(&pwm);
+
+  pwm_report(&pwm);
   close_busyboard(&bb);
 
   return 0;
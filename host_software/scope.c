@@ -1,11 +1,162 @@
 /* Busyboard control program/library */
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <getopt.h>
 
 #include "busyboard.h"
+#include "capfile.h"
+#include "trigger.h"
+
+volatile sig_atomic_t stop;
+
+/* Trigger windows: samples kept before and after each trigger, and how
+   many windows to take (0 for no limit). */
+struct trigger trig;
+unsigned long pre = 1000, post = 1000, max_windows;
+
+/* Samples since the trigger was armed, as far back as pre. Only the sampler
+   touches it. */
+struct sample {
+  uint64_t t, word;
+} *ring;
+unsigned long ring_mask;
+
+void on_signal(int sig) {
+  (void)sig;
+  stop = 1;
+}
+
+uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Sample all 48 inputs as fast as the link goes, one frame per sample, and
+   keep the changes: all of them, or with a trigger, those in a window
+   around each time it fires.
+
+   A window's samples go to the capture from the ring, two per sample
+   taken until the window has caught up with the sampler, so a trigger
+   never stalls sampling while the pre-trigger samples are handed over. The
+   trigger is armed again once the window is complete. */
+int capture(struct busyboard *bb, const char *filename, double seconds,
+            unsigned long long max)
+{
+  struct capfile *cap = cap_create(filename);
+  unsigned long long n = 0, d = 0, fired = 0, kept = 0;
+  unsigned long windows = 0, size = 1024;
+  uint64_t start, t = 0, word;
+  int i, k, armed = 1;
+
+  if (!cap) return 1;
+  if (trig.n) {
+    while (size < pre + 2) size <<= 1;
+    ring = malloc(size * sizeof(*ring));
+    if (!ring) {
+      perror("malloc");
+      cap_close(cap);
+      return 1;
+    }
+    ring_mask = size - 1;
+    trig_arm(&trig, 0);
+  }
+
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+  t = start = now_ns();
+  while (!stop && (!max || n < max) &&
+         (!seconds || t - start < seconds * 1e9)) {
+    busyboard_xfer(bb);
+    t = now_ns();
+    word = 0;
+    for (i = 0; i < BUSYBOARD_N_PORTS; i++)
+      word |= (uint64_t)bb->in_state[i] << 8 * i;
+    if (!trig.n) {
+      cap_sample(cap, t, word);
+      n++;
+      continue;
+    }
+
+    ring[n & ring_mask].t = t;
+    ring[n & ring_mask].word = word;
+    if (armed && trig_sample(&trig, word)) {
+      armed = 0;
+      fired = n;
+      d = n > pre ? n - pre : 0;
+      if (windows && d <= kept) d = kept; /* Runs on from the last one */
+      else cap_mark(cap, d, CAP_WINDOW);
+    }
+    for (k = 0; !armed && k < 2 && d <= n; ++k, ++d) {
+      if (d == fired) cap_mark(cap, d, CAP_TRIGGER);
+      cap_sample(cap, ring[d & ring_mask].t, ring[d & ring_mask].word);
+      if (d == fired + post) {
+        armed = 1;
+        kept = d + 1;
+        trig_arm(&trig, word);
+        if (++windows == max_windows) stop = 1;
+      }
+    }
+    n++;
+  }
+
+  printf("Captured %llu samples in %.3f s: %.0f samples/s, ", n,
+         (t - start) * 1e-9, t > start ? n / ((t - start) * 1e-9) : 0);
+  if (trig.n) printf("%lu windows, ", windows);
+  printf("%llu changes.\n", (unsigned long long)cap_close(cap));
+  free(ring);
+
+  return 0;
+}
+
+void usage(const char *argv0) {
+  fprintf(stderr,
+    "Usage: %s [-c file [-s seconds] [-n samples]\n"
+    "       [-t stage]... [-b before] [-a after] [-w windows]] [parport]\n"
+    "  Prints the inputs about 100 times a second, or with -c captures them\n"
+    "  as fast as the board goes until the limit or ^C (see cap2vcd).\n"
+    "  With -t, only windows of samples around a trigger are kept: -b\n"
+    "  before it (default 1000) and -a after (default 1000), for up to -w\n"
+    "  windows. Each -t adds a stage, a comma separated list of a3=1 or\n"
+    "  a3=0 (pin level), b=0x55 (port value), a3+ or a3- (edge), and *10\n"
+    "  (count); e.g. -t a0+,b=0x55,*3 -t c7-.\n",
+    argv0);
+  exit(1);
+}
 
 int main(int argc, char **argv) {
+  const char *capfile = NULL;
+  unsigned long long max = 0;
+  double seconds = 0;
+  int c;
+
+  while ((c = getopt(argc, argv, "c:s:n:t:b:a:w:")) != -1) {
+    switch (c) {
+    case 'c': capfile = optarg; break;
+    case 't': if (trig_add(&trig, optarg)) return 1; break;
+    case 'b': pre = strtoul(optarg, NULL, 0); break;
+    case 'a': post = strtoul(optarg, NULL, 0); break;
+    case 'w': max_windows = strtoul(optarg, NULL, 0); break;
+    case 's': seconds = atof(optarg); break;
+    case 'n': max = strtoull(optarg, NULL, 0); break;
+    default: usage(argv[0]);
+    }
+  }
+  if (optind + 1 < argc || (trig.n && !capfile)) usage(argv[0]);
+
   struct busyboard bb;
-  init_busyboard(&bb, (argc >= 2) ? argv[1] : "/dev/parport0");  
+  init_busyboard(&bb, (optind < argc) ? argv[optind] : "/dev/parport0");
+
+  if (capfile) {
+    bb.trimask = 0;
+    busyboard_out(&bb);
+    c = capture(&bb, capfile, seconds, max);
+    close_busyboard(&bb);
+    return c;
+  }
 
   int i, j;
   for (;;) {
@@ -1,7 +1,9 @@
 /* Busyboard control program/library */
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "busyboard.h"
+#include "timing.h"
 
 /* SPI test: pinout
      A0 - CLK     A1 - MOSI (master->slave data)     A2 - CS0     A3 - CS1
@@ -11,8 +13,13 @@
      This allows support for up to 6 SPI devices on the same bus.
 */
 
+/* Wait after each clock edge; was a commented-out 10 ms. */
+enum { T_CLK };
+struct timing_param params[] = { { "clk", 0, 10000 } };
+struct timing timing = { "spi_adc", params, 1 };
+
 void do_delay() {
-  //usleep(10000);
+  timing_wait(params[T_CLK].us);
 }
 
 void spi_init(struct busyboard *bb) {
@@ -81,13 +88,29 @@ void plot(int x) {
   #endif
 }
 
+/* There is nothing to write and read back, so hold the input steady while
+   calibrating: the mean of a few conversions has to stay near the first
+   call's, taken at the slowest clock. */
+int verify(void *ctx) {
+  static int ref = -1;
+  struct busyboard *bb = ctx;
+  int i, sum = 0;
+
+  for (i = 0; i < 8; ++i) sum += spi_adc_read(bb);
+  if (ref < 0) ref = sum;
+
+  return abs(sum - ref) <= 8 * 8;
+}
+
 int main(int argc, char **argv) {
   int i;
+  const char *parport = (argc >= 2) ? argv[1] : "/dev/parport0";
   struct busyboard bb;
-  init_busyboard(&bb, (argc >= 2) ? argv[1] : "/dev/parport0");  
+  init_busyboard(&bb, parport);  
 
   spi_init(&bb);
   spi_clear_cs(&bb);
+  timing_setup(&timing, parport, verify, &bb);
 
   for (i = 0; i < 1000000; i++) plot(spi_adc_read(&bb));
   
@@ -0,0 +1,518 @@
+/* SPI NOR flash programmer for 25-series parts (W25Qxx, AT25xx, ...). */
+/* Pinout (as in spi_test):
+     A0 - CLK     A1 - MOSI (master->slave data)     A2 - CS0     A3 - CS1
+     A4 - CS2     A5 - CS3                           A6 - CS4     A7 - CS5
+     B0 - MISO (slave->master data)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "busyboard.h"
+#include "image.h"
+
+#define FLASH_WRSR      0x01
+#define FLASH_PP        0x02
+#define FLASH_READ      0x03
+#define FLASH_RDSR      0x05
+#define FLASH_WREN      0x06
+#define FLASH_FAST_READ 0x0b
+#define FLASH_SE        0x20
+#define FLASH_RDID      0x9f
+#define FLASH_CE        0xc7
+#define FLASH_BE        0xd8
+
+#define SR_WIP 0x01
+#define SR_BP  0x3c
+
+#define PAGE_SIZE   256
+#define SECTOR_SIZE 0x1000
+#define BLOCK_SIZE  0x10000
+
+/* Give up on a busy flash after this many seconds (chip erase is slowest). */
+#define WIP_TIMEOUT 400.0
+
+struct flash {
+  busyboard_t *bb;
+  int cs;
+  unsigned char id[3];
+  unsigned size;
+  const char *vendor;
+
+  /* Statistics */
+  unsigned long polls, erased, programmed, skipped;
+};
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void spi_init(struct busyboard *bb) {
+  bb->trimask = 1;
+  bb->out_state[0] = 0xfc;
+  busyboard_out(bb);
+}
+
+void spi_clear_cs(struct busyboard *bb) {
+  bb->out_state[0] |= ~3;
+  busyboard_out(bb);
+}
+
+void spi_set_cs(struct busyboard *bb, int id) {
+  unsigned char csbit = 1<<(id + 2);
+  bb->out_state[0] |= ~3;
+  bb->out_state[0] &= ~csbit;
+  busyboard_out(bb);
+}
+
+/* Clock one byte out on MOSI and, if in is non-null, one byte in from MISO.
+   Each bit is two frames: CLK falls with the new MOSI bit, then CLK rises. The
+   rising-edge frame is a transfer when reading, sampling MISO while CLK is
+   still low, i.e. after the slave shifted it out on the falling edge. */
+void spi_byte(struct busyboard *bb, unsigned char x, unsigned char *in) {
+  int i;
+  unsigned char y = 0;
+
+  for (i = 0; i < 8; i++, x <<= 1) {
+    bb->out_state[0] &= ~3;
+    if (x & 0x80) bb->out_state[0] |= 2;
+    busyboard_out(bb);
+
+    bb->out_state[0] |= 1;
+    if (in) {
+      busyboard_xfer(bb);
+      y = (y << 1) | (bb->in_state[1] & 1);
+    } else {
+      busyboard_out(bb);
+    }
+  }
+
+  if (in) *in = y;
+}
+
+void spi_send(struct busyboard *bb, const unsigned char *buf, int len) {
+  int i;
+  for (i = 0; i < len; i++) spi_byte(bb, buf[i], NULL);
+}
+
+void spi_rec(struct busyboard *bb, unsigned char *buf, int len) {
+  int i;
+  for (i = 0; i < len; i++) spi_byte(bb, 0xff, &buf[i]);
+}
+
+/* Issue a command with an optional 24-bit address. */
+void flash_cmd(struct flash *f, unsigned char cmd, int addr) {
+  unsigned char buf[4];
+  int len = 1;
+
+  buf[0] = cmd;
+  if (addr >= 0) {
+    buf[1] = (addr >> 16) & 0xff;
+    buf[2] = (addr >> 8) & 0xff;
+    buf[3] = addr & 0xff;
+    len = 4;
+  }
+
+  spi_set_cs(f->bb, f->cs);
+  spi_send(f->bb, buf, len);
+}
+
+unsigned char flash_rdsr(struct flash *f) {
+  unsigned char sr;
+  flash_cmd(f, FLASH_RDSR, -1);
+  spi_rec(f->bb, &sr, 1);
+  spi_clear_cs(f->bb);
+  return sr;
+}
+
+void flash_wren(struct flash *f) {
+  flash_cmd(f, FLASH_WREN, -1);
+  spi_clear_cs(f->bb);
+}
+
+/* Wait for the write in progress bit to clear. RDSR is issued once; the part
+   keeps shifting out fresh status bytes for as long as CS stays low. */
+int flash_wait(struct flash *f) {
+  unsigned char sr;
+  double start = now();
+
+  flash_cmd(f, FLASH_RDSR, -1);
+  do {
+    spi_rec(f->bb, &sr, 1);
+    f->polls++;
+    if (now() - start > WIP_TIMEOUT) {
+      spi_clear_cs(f->bb);
+      fprintf(stderr, "Timed out waiting for flash, status 0x%02x.\n", sr);
+      return -1;
+    }
+  } while (sr & SR_WIP);
+  spi_clear_cs(f->bb);
+
+  return 0;
+}
+
+static const struct { unsigned char mfr; const char *name; } vendors[] = {
+  { 0xef, "Winbond" }, { 0x1f, "Adesto/Atmel" }, { 0xc2, "Macronix" },
+  { 0x20, "Micron" }, { 0xbf, "SST" }, { 0x9d, "ISSI" },
+  { 0xc8, "GigaDevice" }, { 0x01, "Spansion" }
+};
+
+/* Read the JEDEC ID and work out the part's size. Returns -1 if nothing
+   sensible answered. */
+int flash_detect(struct flash *f) {
+  unsigned i;
+
+  flash_cmd(f, FLASH_RDID, -1);
+  spi_rec(f->bb, f->id, 3);
+  spi_clear_cs(f->bb);
+
+  if ((f->id[0] == 0xff || f->id[0] == 0x00) && f->id[1] == f->id[0])
+    return -1;
+
+  f->vendor = "unknown";
+  for (i = 0; i < sizeof(vendors)/sizeof(vendors[0]); ++i)
+    if (vendors[i].mfr == f->id[0]) f->vendor = vendors[i].name;
+
+  if (f->size) return 0; /* Given on the command line. */
+
+  if (f->id[0] == 0x1f) {
+    /* Atmel/Adesto: density code in the low bits of the first device byte. */
+    f->size = 1u << ((f->id[1] & 0x1f) + 15);
+  } else if (f->id[2] >= 0x10 && f->id[2] <= 0x19) {
+    f->size = 1u << f->id[2];
+  } else {
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Clear block protect bits left set by the factory or a previous owner. */
+void flash_unprotect(struct flash *f) {
+  unsigned char sr = flash_rdsr(f);
+  if (!(sr & SR_BP)) return;
+
+  flash_wren(f);
+  flash_cmd(f, FLASH_WRSR, -1);
+  spi_byte(f->bb, 0x00, NULL);
+  spi_clear_cs(f->bb);
+  flash_wait(f);
+}
+
+void flash_read(struct flash *f, unsigned addr, unsigned char *buf, int len) {
+  flash_cmd(f, FLASH_FAST_READ, addr);
+  spi_byte(f->bb, 0xff, NULL); /* Dummy byte. */
+  spi_rec(f->bb, buf, len);
+  spi_clear_cs(f->bb);
+}
+
+int flash_erase(struct flash *f, unsigned char cmd, int addr) {
+  flash_wren(f);
+  flash_cmd(f, cmd, addr);
+  spi_clear_cs(f->bb);
+  return flash_wait(f);
+}
+
+/* Program up to one page; the range must not cross a page boundary. */
+int flash_program(struct flash *f, unsigned addr,
+                  const unsigned char *buf, int len)
+{
+  flash_wren(f);
+  flash_cmd(f, FLASH_PP, addr);
+  spi_send(f->bb, buf, len);
+  spi_clear_cs(f->bb);
+  f->programmed += len;
+  return flash_wait(f);
+}
+
+void progress(struct flash *f, unsigned done, unsigned total, double start) {
+  double t = now() - start;
+  fprintf(stderr, "\r%3u%% %06x  %.0f B/s  erased %lu  programmed %lu  "
+          "skipped %lu ", total ? done * 100 / total : 100, done,
+          t > 0 ? done / t : 0, f->erased, f->programmed, f->skipped);
+}
+
+/* Program one sector whose current contents are in cur. Only sectors that
+   need a 0->1 transition are erased, and only the differing span of each page
+   is sent. Returns -1 on a flash timeout. */
+int program_sector(struct flash *f, unsigned addr, const unsigned char *img,
+                   unsigned char *cur, int erase)
+{
+  int p;
+
+  if (erase) {
+    if (flash_erase(f, FLASH_SE, addr)) return -1;
+    f->erased += SECTOR_SIZE;
+    memset(cur, 0xff, SECTOR_SIZE);
+  }
+
+  for (p = 0; p < SECTOR_SIZE; p += PAGE_SIZE) {
+    int lo = p, hi = p + PAGE_SIZE;
+    while (lo < hi && img[lo] == cur[lo]) lo++;
+    while (hi > lo && img[hi - 1] == cur[hi - 1]) hi--;
+    if (lo == hi) continue;
+
+    if (flash_program(f, addr + lo, img + lo, hi - lo)) return -1;
+  }
+
+  return 0;
+}
+
+int needs_erase(const unsigned char *img, const unsigned char *cur, int len) {
+  int i;
+  for (i = 0; i < len; i++) if (img[i] & ~cur[i]) return 1;
+  return 0;
+}
+
+/* Write an image, skipping sectors that already match. Erase-needed sectors
+   covering a whole 64 KB block inside the image are erased as one block. */
+int flash_write(struct flash *f, unsigned base, const unsigned char *img,
+                unsigned len)
+{
+  static unsigned char cur[BLOCK_SIZE];
+  unsigned char erase[BLOCK_SIZE/SECTOR_SIZE];
+  unsigned blk, s, n, n_erase;
+  double start = now();
+
+  for (blk = base & ~(BLOCK_SIZE - 1); blk < base + len; blk += BLOCK_SIZE) {
+    unsigned lo = blk < base ? base : blk,
+             hi = blk + BLOCK_SIZE > base + len ? base + len : blk + BLOCK_SIZE;
+
+    /* Sector granularity from here on: pad partial sectors with what the
+       flash already holds so they read back unchanged. */
+    unsigned s_lo = lo & ~(SECTOR_SIZE - 1),
+             s_hi = (hi + SECTOR_SIZE - 1) & ~(SECTOR_SIZE - 1);
+    static unsigned char want[BLOCK_SIZE];
+
+    flash_read(f, s_lo, cur + (s_lo - blk), s_hi - s_lo);
+    memcpy(want + (s_lo - blk), cur + (s_lo - blk), s_hi - s_lo);
+    memcpy(want + (lo - blk), img + (lo - base), hi - lo);
+
+    for (s = s_lo, n_erase = n = 0; s < s_hi; s += SECTOR_SIZE, n++) {
+      unsigned o = s - blk;
+      if (!memcmp(want + o, cur + o, SECTOR_SIZE)) {
+        erase[n] = 2; /* Already matches. */
+        f->skipped += SECTOR_SIZE;
+      } else {
+        erase[n] = needs_erase(want + o, cur + o, SECTOR_SIZE);
+        n_erase += erase[n];
+      }
+    }
+
+    if (n_erase == BLOCK_SIZE/SECTOR_SIZE) {
+      if (flash_erase(f, FLASH_BE, blk)) return -1;
+      f->erased += BLOCK_SIZE;
+      memset(cur, 0xff, BLOCK_SIZE);
+      memset(erase, 0, sizeof(erase));
+    }
+
+    for (s = s_lo, n = 0; s < s_hi; s += SECTOR_SIZE, n++) {
+      unsigned o = s - blk;
+      if (erase[n] != 2 &&
+          program_sector(f, s, want + o, cur + o, erase[n])) return -1;
+      progress(f, s + SECTOR_SIZE - base < len ? s + SECTOR_SIZE - base : len,
+               len, start);
+    }
+  }
+  fputc('\n', stderr);
+
+  return 0;
+}
+
+/* Compare the flash against an image with fast reads, a sector at a time. */
+unsigned flash_verify(struct flash *f, unsigned base, const unsigned char *img,
+                      unsigned len)
+{
+  static unsigned char buf[SECTOR_SIZE];
+  unsigned i, n, bad = 0;
+  double start = now();
+
+  for (i = 0; i < len; i += n) {
+    unsigned j;
+    n = (len - i > SECTOR_SIZE) ? SECTOR_SIZE : len - i;
+    flash_read(f, base + i, buf, n);
+    for (j = 0; j < n; ++j) {
+      if (buf[j] == img[i + j]) continue;
+      if (bad++ < 16)
+        fprintf(stderr, "\nMismatch at %06x: read %02x, expected %02x.",
+                base + i + j, buf[j], img[i + j]);
+    }
+    progress(f, i + n, len, start);
+  }
+  fputc('\n', stderr);
+
+  return bad;
+}
+
+/* Write or verify every segment of an image at offset. */
+int write_image(struct flash *f, unsigned offset, const struct image *img) {
+  unsigned i;
+
+  for (i = 0; i < img->n_seg; ++i)
+    if (flash_write(f, offset + img->seg[i].addr, img->seg[i].data,
+                    img->seg[i].len))
+      return -1;
+
+  return 0;
+}
+
+unsigned verify_image(struct flash *f, unsigned offset,
+                      const struct image *img)
+{
+  unsigned i, bad = 0;
+
+  for (i = 0; i < img->n_seg; ++i)
+    bad += flash_verify(f, offset + img->seg[i].addr, img->seg[i].data,
+                        img->seg[i].len);
+
+  return bad;
+}
+
+void usage(const char *argv0) {
+  fprintf(stderr,
+    "Usage: %s [-p parport] [-c cs] [-o offset] [-s size] [-n] [-b]\n"
+    "          [-F format] command\n"
+    "  id                 Print JEDEC ID and size.\n"
+    "  read file [len]    Dump flash contents to file.\n"
+    "  erase [addr len]   Erase a range, or the whole chip.\n"
+    "  write file         Program file at offset, skipping matching sectors.\n"
+    "  verify file        Compare flash at offset against file.\n"
+    "  Files are Intel HEX, S-records or raw binary; only the regions a file\n"
+    "  covers are touched. -b also leaves sectors that are blank (all 0xff)\n"
+    "  in the file alone. -n skips the verify pass after write. -F gives the\n"
+    "  format (ihex, srec, bytes or bin); without it .hex, .ihx, .s19, .srec\n"
+    "  and .mot are text and anything else is binary.\n", argv0);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  const char *parport = "/dev/parport0", *format = NULL;
+  struct flash f;
+  unsigned offset = 0, len, i;
+  unsigned char *buf;
+  struct image img;
+  int c, verify = 1, skip_blank = 0, ret = 0;
+  double start;
+
+  memset(&f, 0, sizeof(f));
+  while ((c = getopt(argc, argv, "p:c:o:s:nbF:")) != -1) {
+    switch (c) {
+    case 'p': parport = optarg; break;
+    case 'c': f.cs = atoi(optarg); break;
+    case 'o': offset = strtoul(optarg, NULL, 0); break;
+    case 's': f.size = strtoul(optarg, NULL, 0); break;
+    case 'n': verify = 0; break;
+    case 'b': skip_blank = 1; break;
+    case 'F': format = optarg; break;
+    default: usage(argv[0]);
+    }
+  }
+  if (optind >= argc || f.cs < 0 || f.cs > 5) usage(argv[0]);
+
+  busyboard_t bb;
+  init_busyboard(&bb, parport);
+  f.bb = &bb;
+  spi_init(&bb);
+
+  if (flash_detect(&f)) {
+    fprintf(stderr, "No flash detected on CS%d (ID %02x %02x %02x).\n",
+            f.cs, f.id[0], f.id[1], f.id[2]);
+    close_busyboard(&bb);
+    return 1;
+  }
+  printf("%s flash, ID %02x %02x %02x, %u bytes.\n",
+         f.vendor, f.id[0], f.id[1], f.id[2], f.size);
+
+  start = now();
+  if (!strcmp(argv[optind], "id")) {
+  } else if (!strcmp(argv[optind], "read") && optind + 1 < argc) {
+    if (offset >= f.size) {
+      fprintf(stderr, "Offset %u is past the end of the flash.\n", offset);
+      close_busyboard(&bb);
+      return 1;
+    }
+    len = (optind + 2 < argc) ? strtoul(argv[optind + 2], NULL, 0)
+                              : f.size - offset;
+    if (len > f.size - offset) len = f.size - offset;
+    if (!(buf = malloc(len))) {
+      perror("malloc");
+      close_busyboard(&bb);
+      return 1;
+    }
+    flash_read(&f, offset, buf, len);
+    FILE *fp = fopen(argv[optind + 1], "wb");
+    if (!fp || fwrite(buf, 1, len, fp) != len) {
+      perror(argv[optind + 1]);
+      ret = 1;
+    }
+    if (fp) fclose(fp);
+    free(buf);
+    printf("Read %u bytes in %.2f s (%.0f B/s).\n",
+           len, now() - start, len/(now() - start));
+  } else if (!strcmp(argv[optind], "erase")) {
+    flash_unprotect(&f);
+    if (optind + 2 < argc) {
+      unsigned a = strtoul(argv[optind + 1], NULL, 0),
+               end = a + strtoul(argv[optind + 2], NULL, 0);
+      a &= ~(SECTOR_SIZE - 1);
+      while (a < end && !ret) {
+        if (!(a & (BLOCK_SIZE - 1)) && end - a >= BLOCK_SIZE) {
+          ret = flash_erase(&f, FLASH_BE, a);
+          a += BLOCK_SIZE;
+        } else {
+          ret = flash_erase(&f, FLASH_SE, a);
+          a += SECTOR_SIZE;
+        }
+      }
+    } else {
+      ret = flash_erase(&f, FLASH_CE, -1);
+    }
+    printf("Erase took %.2f s, %lu status polls.\n", now() - start, f.polls);
+  } else if ((!strcmp(argv[optind], "write") ||
+              !strcmp(argv[optind], "verify")) && optind + 1 < argc) {
+    if (image_load(&img, argv[optind + 1], 0, format)) {
+      close_busyboard(&bb);
+      return 1;
+    }
+    if (skip_blank && image_strip_blank(&img, SECTOR_SIZE)) {
+      close_busyboard(&bb);
+      return 1;
+    }
+    for (i = len = 0; i < img.n_seg; ++i) len += img.seg[i].len;
+    printf("%s: %s, %u bytes in %u segments, hash %016llx.\n",
+           argv[optind + 1], img.format, len, img.n_seg, image_hash(&img));
+
+    if (img.hi > f.size || offset > f.size - img.hi) {
+      fprintf(stderr, "Image does not fit: %x-%x at %u.\n", img.lo, img.hi,
+              offset);
+      ret = 1;
+    } else if (!strcmp(argv[optind], "write")) {
+      flash_unprotect(&f);
+      ret = write_image(&f, offset, &img);
+      double t = now() - start;
+      printf("Wrote %u bytes in %.2f s (%.0f B/s): %lu erased, %lu "
+             "programmed, %lu skipped, %lu status polls, %lu frames/s.\n",
+             len, t, len/t, f.erased, f.programmed, f.skipped, f.polls,
+             (unsigned long)(bb.frames/t));
+    }
+
+    if (!ret && (verify || strcmp(argv[optind], "write"))) {
+      start = now();
+      unsigned bad = verify_image(&f, offset, &img);
+      printf("Verify: %u mismatches, %.0f B/s.\n", bad, len/(now() - start));
+      ret = bad ? 1 : 0;
+    }
+    image_free(&img);
+  } else {
+    usage(argv[0]);
+  }
+
+  close_busyboard(&bb);
+
+  return ret;
+}
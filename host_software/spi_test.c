@@ -1,7 +1,9 @@
 /* Busyboard control program/library */
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "busyboard.h"
+#include "timing.h"
 
 /* SPI test: pinout
      A0 - CLK     A1 - MOSI (master->slave data)     A2 - CS0     A3 - CS1
@@ -11,8 +13,13 @@
      This allows support for up to 6 SPI devices on the same bus.
 */
 
+/* Wait after each clock and chip select edge; was a commented-out 1 ms. */
+enum { T_CLK };
+struct timing_param params[] = { { "clk", 0, 1000 } };
+struct timing timing = { "spi_sram", params, 1 };
+
 void do_delay() {
-  // usleep(1000);
+  timing_wait(params[T_CLK].us);
 }
 
 void spi_init(struct busyboard *bb) {
@@ -91,14 +98,12 @@ void spi_rec(struct busyboard *bb, int id, unsigned char *buf, int len) {
     spi_rec_byte(bb, id, &buf[i]);
 }
 
-void spi_sram_write(struct busyboard *bb, int id, int addr, unsigned char data)
+void spi_sram_put(struct busyboard *bb, int id, int addr, unsigned char data)
 {
-  printf("Write %x: %x\n", addr, (unsigned int)data);
-  
   spi_clear_cs(bb);
   do_delay();
 
-  char buf[4];
+  char buf[5];
   buf[0] = 0x02; /* Write command */
   buf[1] = (addr >> 16) & 0xff; /* Address */
   buf[2] = (addr >> 8) & 0xff;
@@ -111,6 +116,12 @@ void spi_sram_write(struct busyboard *bb, int id, int addr, unsigned char data)
   do_delay();
 }
 
+void spi_sram_write(struct busyboard *bb, int id, int addr, unsigned char data)
+{
+  printf("Write %x: %x\n", addr, (unsigned int)data);
+  spi_sram_put(bb, id, addr, data);
+}
+
 unsigned char spi_sram_read(struct busyboard *bb, int id, int addr) {
   spi_clear_cs(bb);
   do_delay();
@@ -168,11 +179,30 @@ void spi_sram_reset(struct busyboard *bb, int id) {
 
 #define RSEED 100
 
+/* Write a few fresh bytes near the top of the SRAM and read them back. */
+int verify(void *ctx) {
+  static unsigned seq;
+  struct busyboard *bb = ctx;
+  int i, ok = 1;
+
+  seq++;
+  spi_sram_wrmr(bb, 0, 0x00);
+  for (i = 0; i < 4; ++i)
+    spi_sram_put(bb, 0, 0x1fff0 + i, (seq * 37 + i * 101) & 0xff);
+  for (i = 0; i < 4; ++i)
+    if (spi_sram_read(bb, 0, 0x1fff0 + i) != ((seq * 37 + i * 101) & 0xff))
+      ok = 0;
+
+  return ok;
+}
+
 int main(int argc, char **argv) {
+  const char *parport = (argc >= 2) ? argv[1] : "/dev/parport0";
   struct busyboard bb;
-  init_busyboard(&bb, (argc >= 2) ? argv[1] : "/dev/parport0");  
+  init_busyboard(&bb, parport);  
 
   spi_init(&bb);
+  timing_setup(&timing, parport, verify, &bb);
 
   //spi_sram_reset(&bb, 0);
 
@@ -0,0 +1,189 @@
+/* Pipelined block transfers to the parallel SRAM. */
+
+#include "sram.h"
+
+#include <stddef.h>
+
+#define CTL_IDLE  7 /* CE, OE, and WR de-asserted */
+#define CTL_SEL   6 /* CE asserted */
+#define CTL_WRITE 2 /* CE and WR asserted, OE de-asserted */
+#define CTL_READ  4 /* CE and OE asserted, WR clear. */
+
+enum { T_ACCESS, T_WR_PULSE };
+static struct timing_param params[] = {
+  { "access", 0, 100 },
+  { "wr_pulse", 0, 100 }
+};
+struct timing sram_timing = { "sram", params, 2 };
+
+static void set_addr(busyboard_t *bb, unsigned addr) {
+  bb->out_state[2] = addr & 0xff;
+  bb->out_state[3] = (addr >> 8) & 0xff;
+  bb->out_state[4] = (addr >> 16) & 0xff;
+}
+
+void sram_init(busyboard_t *bb) {
+  bb->out_state[0] = CTL_IDLE;
+  bb->trimask = 0x3d;
+  busyboard_out(bb);
+}
+
+void sram_write(busyboard_t *bb, unsigned addr, unsigned char data) {
+  sram_write_block(bb, addr, &data, 1);
+}
+
+unsigned char sram_read(busyboard_t *bb, unsigned addr) {
+  unsigned char data;
+  sram_read_block(bb, addr, &data, 1);
+  return data;
+}
+
+/* Put the first address out with CE and OE asserted; from then on every
+   frame samples one byte and puts out the address of the next. */
+void sram_read_block(busyboard_t *bb, unsigned addr, unsigned char *buf,
+                     unsigned len)
+{
+  unsigned i;
+
+  bb->trimask = 0x3d;
+  bb->out_state[0] = CTL_READ;
+  set_addr(bb, addr);
+  busyboard_out(bb);
+
+  for (i = 0; i < len; ++i) {
+    set_addr(bb, addr + i + 1);
+    timing_wait(params[T_ACCESS].us);
+    busyboard_xfer(bb);
+    buf[i] = bb->in_state[1];
+  }
+
+  sram_init(bb);
+}
+
+/* WR falls together with the data of access N, whose address went out the
+   frame before, and rises together with the address of access N+1. Address
+   and data thus never change while WR is low. */
+void sram_write_block(busyboard_t *bb, unsigned addr, const unsigned char *buf,
+                      unsigned len)
+{
+  unsigned i;
+
+  bb->trimask = 0x3f;
+  bb->out_state[0] = CTL_SEL;
+  set_addr(bb, addr);
+  busyboard_out(bb);
+
+  for (i = 0; i < len; ++i) {
+    bb->out_state[0] = CTL_WRITE;
+    bb->out_state[1] = buf[i];
+    busyboard_out(bb);
+    timing_wait(params[T_WR_PULSE].us);
+
+    bb->out_state[0] = CTL_SEL;
+    set_addr(bb, addr + i + 1);
+    busyboard_out(bb);
+  }
+
+  sram_init(bb);
+}
+
+unsigned sram_compare_block(busyboard_t *bb, unsigned addr,
+                            const unsigned char *buf, unsigned len,
+                            unsigned *first)
+{
+  unsigned i, bad = 0;
+
+  bb->trimask = 0x3d;
+  bb->out_state[0] = CTL_READ;
+  set_addr(bb, addr);
+  busyboard_out(bb);
+
+  for (i = 0; i < len; ++i) {
+    set_addr(bb, addr + i + 1);
+    timing_wait(params[T_ACCESS].us);
+    busyboard_xfer(bb);
+    if (bb->in_state[1] != buf[i] && !bad++ && first) *first = addr + i;
+  }
+
+  sram_init(bb);
+
+  return bad;
+}
+
+unsigned sram_element(busyboard_t *bb, const struct sram_element *e,
+                      unsigned n)
+{
+  unsigned i, a, bad = 0;
+
+  if (!n) return 0;
+
+  a = e->order(0);
+  bb->trimask = e->read ? 0x3d : 0x3f;
+  bb->out_state[0] = e->read ? CTL_READ : CTL_SEL;
+  set_addr(bb, a);
+  busyboard_out(bb);
+
+  for (i = 0; i < n; ++i) {
+    unsigned next = (i + 1 < n) ? e->order(i + 1) : a;
+    unsigned char bg = e->bg(a);
+
+    if (e->write) {
+      /* Turn the bus around and drop WR in the frame that samples the read,
+         if any; WR then rises with the next address. */
+      bb->trimask = 0x3f;
+      bb->out_state[0] = CTL_WRITE;
+      bb->out_state[1] = bg ^ e->wr_xor;
+      if (e->read) {
+        timing_wait(params[T_ACCESS].us);
+        busyboard_xfer(bb);
+      } else {
+        busyboard_out(bb);
+      }
+      timing_wait(params[T_WR_PULSE].us);
+
+      bb->trimask = e->read ? 0x3d : 0x3f;
+      bb->out_state[0] = e->read ? CTL_READ : CTL_SEL;
+      set_addr(bb, next);
+      busyboard_out(bb);
+    } else {
+      set_addr(bb, next);
+      timing_wait(params[T_ACCESS].us);
+      busyboard_xfer(bb);
+    }
+
+    if (e->read && bb->in_state[1] != (unsigned char)(bg ^ e->rd_xor)) {
+      bad++;
+      if (e->fail) e->fail(a, bb->in_state[1], bg ^ e->rd_xor);
+    }
+
+    a = next;
+  }
+
+  sram_init(bb);
+
+  return bad;
+}
+
+#define SCRATCH_SIZE 256
+#define SCRATCH_ADDR (SRAM_SIZE - SCRATCH_SIZE)
+
+int sram_verify(void *ctx) {
+  static unsigned char saved[SCRATCH_SIZE];
+  static unsigned seq;
+  busyboard_t *bb = ctx;
+  unsigned char buf[SCRATCH_SIZE];
+  unsigned i, bad, x;
+
+  /* The first call is at the maximum timings. */
+  if (!seq++) sram_read_block(bb, SCRATCH_ADDR, saved, SCRATCH_SIZE);
+
+  for (i = 0, x = seq * 2654435761u; i < SCRATCH_SIZE; ++i) {
+    x = x * 1103515245 + 12345;
+    buf[i] = x >> 16;
+  }
+  sram_write_block(bb, SCRATCH_ADDR, buf, SCRATCH_SIZE);
+  bad = sram_compare_block(bb, SCRATCH_ADDR, buf, SCRATCH_SIZE, NULL);
+  sram_write_block(bb, SCRATCH_ADDR, saved, SCRATCH_SIZE);
+
+  return !bad;
+}
@@ -0,0 +1,58 @@
+#ifndef SRAM_H
+#define SRAM_H
+
+#include "busyboard.h"
+#include "timing.h"
+
+/* Block transfers to the 512kB parallel SRAM. Ports (as in mem_test):
+    A0: #ce A1: #oe A2: #wr
+    B - Data
+    C - Address[7:0]
+    D - Address[15:8]
+    E - Address[23:16]
+*/
+
+#define SRAM_SIZE 0x80000
+
+void sram_init(busyboard_t *bb);
+
+/* Extra wait before each read sample and with WR held low; normally 0, as
+   a frame is already far longer than the chip's access time. verify writes
+   and checks a scratch area at the top of the chip, putting back what was
+   there. */
+extern struct timing sram_timing;
+int sram_verify(void *bb);
+
+/* Single-byte accesses. */
+void sram_write(busyboard_t *bb, unsigned addr, unsigned char data);
+unsigned char sram_read(busyboard_t *bb, unsigned addr);
+
+/* Reads cost one frame per byte, writes two. */
+void sram_read_block(busyboard_t *bb, unsigned addr, unsigned char *buf,
+                     unsigned len);
+void sram_write_block(busyboard_t *bb, unsigned addr, const unsigned char *buf,
+                      unsigned len);
+
+/* Read back and compare against buf without storing. Returns the number of
+   mismatching bytes; the address of the first is stored in *first. */
+unsigned sram_compare_block(busyboard_t *bb, unsigned addr,
+                            const unsigned char *buf, unsigned len,
+                            unsigned *first);
+
+/* One element of a march test: visit n addresses in the order given and at
+   each optionally read and check, then optionally write. Expected and written
+   values are the background at that address XORed with rd_xor and wr_xor. A
+   read or a write costs one frame per address, a read-then-write two. */
+struct sram_element {
+  int read, write;
+  unsigned char rd_xor, wr_xor;
+  unsigned (*order)(unsigned i);      /* i-th address visited */
+  unsigned char (*bg)(unsigned addr); /* Data background */
+  void (*fail)(unsigned addr, unsigned char got, unsigned char want);
+};
+
+/* Returns the number of mismatches, each also passed to fail(). */
+unsigned sram_element(busyboard_t *bb, const struct sram_element *e,
+                      unsigned n);
+
+#endif
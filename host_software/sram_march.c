@@ -0,0 +1,260 @@
+/* Whole-chip march/pattern test for the 512kB parallel SRAM. */
+/* Ports (as in mem_test):
+    A0: #ce A1: #oe A2: #wr
+    B - Data
+    C - Address[7:0]
+    D - Address[15:8]
+    E - Address[23:16]
+    F
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "busyboard.h"
+#include "sram.h"
+
+/* Addresses under test and the current data background. */
+static unsigned n_addr = SRAM_SIZE;
+static unsigned char bg_byte;
+
+/* Failing cells: one bit per address, plus which data bits failed. */
+static unsigned char fail_map[SRAM_SIZE/8];
+static unsigned long n_fails, bit_fails[8];
+static unsigned long accesses;
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Gray-code order: consecutive addresses differ in one bit, so only one
+   address line switches per frame. Its exact reverse serves as "down". */
+unsigned order_up(unsigned i) { return i ^ (i >> 1); }
+unsigned order_down(unsigned i) { return order_up(n_addr - 1 - i); }
+
+unsigned char bg_solid(unsigned addr) { return bg_byte; }
+
+/* Alternate with the parity of the address, so every address holds the
+   complement of all of its single-bit neighbours. */
+unsigned char bg_checker(unsigned addr) {
+  return __builtin_parity(addr) ? ~bg_byte : bg_byte;
+}
+
+void fail(unsigned addr, unsigned char got, unsigned char want) {
+  unsigned char x = got ^ want;
+  int i;
+
+  if (n_fails++ < 8)
+    printf("  fail at %05x: read %02x, expected %02x\n", addr, got, want);
+  fail_map[addr/8] |= 1 << addr%8;
+  for (i = 0; i < 8; ++i) if (x & (1 << i)) bit_fails[i]++;
+}
+
+/* An element is up to a read then a write of the background or its
+   complement, e.g. "r0w1". */
+unsigned element(busyboard_t *bb, int down, const char *ops,
+                 unsigned char (*bg)(unsigned))
+{
+  struct sram_element e;
+
+  memset(&e, 0, sizeof(e));
+  for (; *ops; ops += 2) {
+    if (ops[0] == 'r') {
+      e.read = 1;
+      e.rd_xor = (ops[1] == '1') ? 0xff : 0;
+    } else {
+      e.write = 1;
+      e.wr_xor = (ops[1] == '1') ? 0xff : 0;
+    }
+  }
+  e.order = down ? order_down : order_up;
+  e.bg = bg;
+  e.fail = fail;
+
+  accesses += (unsigned long)n_addr * (e.read + e.write);
+
+  return sram_element(bb, &e, n_addr);
+}
+
+/* March C-: {any(w0); up(r0,w1); up(r1,w0); down(r0,w1); down(r1,w0);
+   any(r0)} */
+unsigned march_c(busyboard_t *bb, unsigned char (*bg)(unsigned)) {
+  static const struct { int down; const char *ops; } m[] = {
+    { 0, "w0" }, { 0, "r0w1" }, { 0, "r1w0" }, { 1, "r0w1" }, { 1, "r1w0" },
+    { 0, "r0" }
+  };
+  unsigned i, bad = 0;
+
+  for (i = 0; i < sizeof(m)/sizeof(m[0]); ++i)
+    bad += element(bb, m[i].down, m[i].ops, bg);
+
+  return bad;
+}
+
+/* Checkerboard and its inverse. */
+unsigned checker(busyboard_t *bb) {
+  unsigned bad = 0;
+
+  bg_byte = 0x55;
+  bad += element(bb, 0, "w0", bg_checker);
+  bad += element(bb, 0, "r0w1", bg_checker);
+  bad += element(bb, 0, "r1", bg_checker);
+
+  return bad;
+}
+
+/* Walking ones on the address lines: put a marker at each power-of-two
+   address in turn and make sure it shows up nowhere else, catching shorted,
+   open and stuck address lines. */
+unsigned address_lines(busyboard_t *bb) {
+  unsigned k, j, bad = 0, bits = 0;
+
+  while ((1u << bits) < n_addr) bits++;
+
+  sram_write(bb, 0, 0x55);
+  for (k = 0; k < bits; ++k) sram_write(bb, 1 << k, 0x55);
+
+  for (k = 0; k < bits; ++k) {
+    sram_write(bb, 1 << k, 0xaa);
+    for (j = 0; j <= bits; ++j) {
+      unsigned a = (j == bits) ? 0 : 1 << j;
+      unsigned char want = (j == k) ? 0xaa : 0x55, got = sram_read(bb, a);
+      accesses++;
+      if (got == want) continue;
+      printf("  address line A%u: %05x reads %02x, expected %02x\n", k, a, got,
+             want);
+      fail(a, got, want);
+      bad++;
+    }
+    sram_write(bb, 1 << k, 0x55);
+  }
+
+  return bad;
+}
+
+/* Write a checkerboard, leave the chip deselected for a while, read back. */
+unsigned retention(busyboard_t *bb, unsigned seconds) {
+  unsigned bad = 0;
+
+  bg_byte = 0x33;
+  bad += element(bb, 0, "w0", bg_checker);
+  sleep(seconds);
+  bad += element(bb, 0, "r0w1", bg_checker);
+  sleep(seconds);
+  bad += element(bb, 0, "r1", bg_checker);
+
+  return bad;
+}
+
+void run(busyboard_t *bb, const char *name, unsigned (*test)(busyboard_t *)) {
+  double start = now(), t;
+  unsigned long acc = accesses;
+  unsigned bad;
+
+  printf("%s:\n", name);
+  bad = test(bb);
+  t = now() - start;
+  printf("  %s, %lu accesses in %.2f s (%.0f B/s)\n",
+         bad ? "FAILED" : "passed", accesses - acc, t, (accesses - acc)/t);
+}
+
+/* March C- over several data backgrounds, for intra-word coupling. */
+unsigned march_all(busyboard_t *bb) {
+  static const unsigned char bgs[] = { 0x00, 0x55, 0x33, 0x0f };
+  unsigned i, bad = 0;
+
+  for (i = 0; i < sizeof(bgs); ++i) {
+    bg_byte = bgs[i];
+    bad += march_c(bb, bg_solid);
+  }
+
+  return bad;
+}
+
+unsigned march_one(busyboard_t *bb) {
+  bg_byte = 0x00;
+  return march_c(bb, bg_solid);
+}
+
+static unsigned retention_secs = 10;
+unsigned retention_test(busyboard_t *bb) {
+  return retention(bb, retention_secs);
+}
+
+void usage(const char *argv0) {
+  fprintf(stderr,
+    "Usage: %s [-p parport] [-s size] [-t tests] [-r seconds] [-o failmap]\n"
+    "  tests: comma-separated from addr, march, march4, checker, retention\n"
+    "  (default addr,march,checker). -o writes a bitmap of failing\n"
+    "  addresses, one bit per byte of SRAM.\n", argv0);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  const char *parport = "/dev/parport0", *tests = "addr,march,checker",
+             *mapfile = NULL;
+  double start;
+  int c, i;
+
+  while ((c = getopt(argc, argv, "p:s:t:r:o:")) != -1) {
+    switch (c) {
+    case 'p': parport = optarg; break;
+    case 's': n_addr = strtoul(optarg, NULL, 0); break;
+    case 't': tests = optarg; break;
+    case 'r': retention_secs = atoi(optarg); break;
+    case 'o': mapfile = optarg; break;
+    default: usage(argv[0]);
+    }
+  }
+  if (optind != argc || !n_addr || n_addr > SRAM_SIZE ||
+      (n_addr & (n_addr - 1)))
+  {
+    usage(argv[0]);
+  }
+
+  busyboard_t bb;
+  init_busyboard(&bb, parport);
+  sram_init(&bb);
+  timing_setup(&sram_timing, parport, sram_verify, &bb);
+
+  start = now();
+  unsigned long frames = bb.frames;
+  char *list = strdup(tests), *name;
+  for (name = strtok(list, ","); name; name = strtok(NULL, ",")) {
+    if (!strcmp(name, "addr")) run(&bb, "Address lines", address_lines);
+    else if (!strcmp(name, "march")) run(&bb, "March C-", march_one);
+    else if (!strcmp(name, "march4"))
+      run(&bb, "March C-, 4 backgrounds", march_all);
+    else if (!strcmp(name, "checker")) run(&bb, "Checkerboard", checker);
+    else if (!strcmp(name, "retention")) run(&bb, "Retention", retention_test);
+    else usage(argv[0]);
+  }
+
+  double t = now() - start;
+  printf("%lu accesses in %.2f s (%.0f B/s, %.2f frames/access).\n",
+         accesses, t, accesses/t, (double)(bb.frames - frames)/accesses);
+  if (n_fails) {
+    unsigned cells = 0;
+    for (i = 0; i < (int)sizeof(fail_map); ++i)
+      cells += __builtin_popcount(fail_map[i]);
+    printf("%lu failures in %u cells. Failures by data bit:", n_fails, cells);
+    for (i = 7; i >= 0; --i) printf(" D%d:%lu", i, bit_fails[i]);
+    putc('\n', stdout);
+  }
+
+  if (mapfile) {
+    FILE *fp = fopen(mapfile, "wb");
+    if (!fp || fwrite(fail_map, 1, n_addr/8 ? n_addr/8 : 1, fp) == 0)
+      perror(mapfile);
+    if (fp) fclose(fp);
+  }
+
+  close_busyboard(&bb);
+
+  return n_fails ? 1 : 0;
+}
@@ -0,0 +1,491 @@
+/* NBD server exposing the 512kB parallel SRAM as a block device. */
+/* Ports (as in mem_test):
+    A0: #ce A1: #oe A2: #wr
+    B - Data
+    C - Address[7:0]
+    D - Address[15:8]
+    E - Address[23:16]
+    F
+
+   Usage, e.g.:
+     sram_nbd -u /tmp/sram.sock &
+     nbd-client -u /tmp/sram.sock /dev/nbd0 -N sram
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <getopt.h>
+#include <endian.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "busyboard.h"
+#include "sram.h"
+
+#define NBD_MAGIC            0x4e42444d41474943ull /* "NBDMAGIC" */
+#define NBD_OPTS_MAGIC       0x49484156454f5054ull /* "IHAVEOPT" */
+#define NBD_REP_MAGIC        0x0003e889045565a9ull
+#define NBD_REQUEST_MAGIC    0x25609513
+#define NBD_REPLY_MAGIC      0x67446698
+
+#define NBD_FLAG_FIXED_NEWSTYLE 1
+#define NBD_FLAG_NO_ZEROES      2
+
+#define NBD_OPT_EXPORT_NAME 1
+#define NBD_OPT_ABORT       2
+#define NBD_OPT_LIST        3
+#define NBD_OPT_INFO        6
+#define NBD_OPT_GO          7
+
+#define NBD_REP_ACK        1
+#define NBD_REP_SERVER     2
+#define NBD_REP_INFO       3
+#define NBD_REP_ERR_UNSUP  0x80000001
+#define NBD_REP_ERR_INVALID 0x80000003
+
+#define NBD_INFO_EXPORT 0
+
+#define NBD_FLAG_HAS_FLAGS   (1 << 0)
+#define NBD_FLAG_SEND_FLUSH  (1 << 2)
+#define NBD_FLAG_SEND_FUA    (1 << 3)
+
+#define NBD_CMD_READ  0
+#define NBD_CMD_WRITE 1
+#define NBD_CMD_DISC  2
+#define NBD_CMD_FLUSH 3
+
+#define NBD_CMD_FLAG_FUA 1
+
+#define TX_FLAGS (NBD_FLAG_HAS_FLAGS | NBD_FLAG_SEND_FLUSH | NBD_FLAG_SEND_FUA)
+
+/* Host-side cache. The whole SRAM fits, so pages are never evicted; they are
+   only filled on first use and written back when dirty. */
+#define PAGE_SIZE 4096
+#define N_PAGES   (SRAM_SIZE/PAGE_SIZE)
+
+/* Write back once this many pages are dirty, without waiting for a flush. */
+#define DIRTY_LIMIT 32
+
+/* Read-ahead window, in pages, grows while reads stay sequential. */
+#define RA_MAX 16
+
+struct cache {
+  busyboard_t *bb;
+  unsigned char data[SRAM_SIZE];
+  unsigned char valid[N_PAGES];
+  unsigned short dirty_lo[N_PAGES], dirty_hi[N_PAGES]; /* lo == hi: clean */
+  unsigned n_dirty;
+
+  unsigned ra_window, next_seq;
+
+  /* Statistics */
+  unsigned long hits, misses, fetched, written, bursts;
+};
+
+static volatile sig_atomic_t quit;
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Fill pages [first, last] that aren't valid yet, one burst per run. */
+void cache_fill(struct cache *c, unsigned first, unsigned last) {
+  unsigned p, q;
+
+  for (p = first; p <= last; p = q) {
+    if (c->valid[p]) {
+      q = p + 1;
+      continue;
+    }
+    for (q = p; q <= last && !c->valid[q]; ++q) c->valid[q] = 1;
+    sram_read_block(c->bb, p * PAGE_SIZE, c->data + p * PAGE_SIZE,
+                    (q - p) * PAGE_SIZE);
+    c->fetched += (q - p) * PAGE_SIZE;
+  }
+}
+
+/* Write dirty ranges back. Ranges that run into each other across page
+   boundaries go out as one sequential burst. */
+void cache_flush(struct cache *c) {
+  unsigned p = 0;
+
+  while (p < N_PAGES) {
+    unsigned start, end;
+
+    if (c->dirty_lo[p] == c->dirty_hi[p]) {
+      p++;
+      continue;
+    }
+
+    start = p * PAGE_SIZE + c->dirty_lo[p];
+    while (p + 1 < N_PAGES && c->dirty_hi[p] == PAGE_SIZE &&
+           c->dirty_lo[p + 1] == 0 && c->dirty_hi[p + 1] != 0)
+    {
+      c->dirty_lo[p] = c->dirty_hi[p] = 0;
+      p++;
+    }
+    end = p * PAGE_SIZE + c->dirty_hi[p];
+    c->dirty_lo[p] = c->dirty_hi[p] = 0;
+    p++;
+
+    sram_write_block(c->bb, start, c->data + start, end - start);
+    c->written += end - start;
+    c->bursts++;
+  }
+
+  c->n_dirty = 0;
+}
+
+void cache_read(struct cache *c, unsigned off, unsigned char *buf,
+                unsigned len)
+{
+  unsigned first = off / PAGE_SIZE, last = (off + len - 1) / PAGE_SIZE, p,
+           ra_last;
+  int miss = 0;
+
+  for (p = first; p <= last; ++p) miss |= !c->valid[p];
+
+  /* Sequential reads double the read-ahead window; anything else resets
+     it. */
+  if (off == c->next_seq) {
+    c->ra_window = c->ra_window ? c->ra_window * 2 : 1;
+    if (c->ra_window > RA_MAX) c->ra_window = RA_MAX;
+  } else {
+    c->ra_window = 0;
+  }
+  c->next_seq = off + len;
+
+  if (miss) {
+    c->misses++;
+    ra_last = last + c->ra_window;
+    if (ra_last >= N_PAGES) ra_last = N_PAGES - 1;
+    cache_fill(c, first, ra_last);
+  } else {
+    c->hits++;
+  }
+
+  memcpy(buf, c->data + off, len);
+}
+
+void cache_write(struct cache *c, unsigned off, const unsigned char *buf,
+                 unsigned len)
+{
+  unsigned end = off + len, p;
+
+  /* Only partially overwritten pages need their old contents. */
+  for (p = off / PAGE_SIZE; p * PAGE_SIZE < end; ++p) {
+    unsigned lo = p * PAGE_SIZE, hi = lo + PAGE_SIZE;
+    unsigned dlo = (off > lo ? off : lo) - lo, dhi = (end < hi ? end : hi) - lo;
+
+    if (!c->valid[p] && (dlo != 0 || dhi != PAGE_SIZE)) cache_fill(c, p, p);
+    c->valid[p] = 1;
+
+    if (c->dirty_lo[p] == c->dirty_hi[p]) {
+      c->dirty_lo[p] = dlo;
+      c->dirty_hi[p] = dhi;
+      c->n_dirty++;
+    } else {
+      if (dlo < c->dirty_lo[p]) c->dirty_lo[p] = dlo;
+      if (dhi > c->dirty_hi[p]) c->dirty_hi[p] = dhi;
+    }
+  }
+
+  memcpy(c->data + off, buf, len);
+  if (c->n_dirty >= DIRTY_LIMIT) cache_flush(c);
+}
+
+int read_all(int fd, void *buf, size_t len) {
+  unsigned char *p = buf;
+  while (len) {
+    ssize_t n = read(fd, p, len);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+int write_all(int fd, const void *buf, size_t len) {
+  const unsigned char *p = buf;
+  while (len) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+int send_rep(int fd, uint32_t opt, uint32_t type, const void *data,
+             uint32_t len)
+{
+  struct __attribute__((packed)) {
+    uint64_t magic;
+    uint32_t opt, type, len;
+  } h = { htobe64(NBD_REP_MAGIC), htobe32(opt), htobe32(type), htobe32(len) };
+
+  if (write_all(fd, &h, sizeof(h))) return -1;
+  return len ? write_all(fd, data, len) : 0;
+}
+
+/* Run the option haggling phase. Returns 0 once the client has picked the
+   export, -1 if it went away. */
+int negotiate(int fd) {
+  struct __attribute__((packed)) {
+    uint64_t magic, opts_magic;
+    uint16_t flags;
+  } hello = { htobe64(NBD_MAGIC), htobe64(NBD_OPTS_MAGIC),
+              htobe16(NBD_FLAG_FIXED_NEWSTYLE | NBD_FLAG_NO_ZEROES) };
+  uint32_t cflags;
+  int no_zeroes;
+
+  if (write_all(fd, &hello, sizeof(hello)) || read_all(fd, &cflags, 4))
+    return -1;
+  no_zeroes = be32toh(cflags) & NBD_FLAG_NO_ZEROES;
+
+  for (;;) {
+    struct __attribute__((packed)) {
+      uint64_t magic;
+      uint32_t opt, len;
+    } o;
+    unsigned char *data;
+    uint32_t opt, len;
+
+    if (read_all(fd, &o, sizeof(o)) || be64toh(o.magic) != NBD_OPTS_MAGIC)
+      return -1;
+    opt = be32toh(o.opt);
+    len = be32toh(o.len);
+    if (len > 4096) return -1;
+    data = malloc(len + 1);
+    if (read_all(fd, data, len)) {
+      free(data);
+      return -1;
+    }
+
+    if (opt == NBD_OPT_EXPORT_NAME) {
+      struct __attribute__((packed)) {
+        uint64_t size;
+        uint16_t flags;
+        unsigned char zeroes[124];
+      } r;
+      memset(&r, 0, sizeof(r));
+      r.size = htobe64(SRAM_SIZE);
+      r.flags = htobe16(TX_FLAGS);
+      free(data);
+      return write_all(fd, &r, no_zeroes ? 10 : sizeof(r));
+    } else if (opt == NBD_OPT_GO || opt == NBD_OPT_INFO) {
+      struct __attribute__((packed)) {
+        uint16_t type;
+        uint64_t size;
+        uint16_t flags;
+      } info = { htobe16(NBD_INFO_EXPORT), htobe64(SRAM_SIZE),
+                 htobe16(TX_FLAGS) };
+      free(data);
+      if (send_rep(fd, opt, NBD_REP_INFO, &info, sizeof(info)) ||
+          send_rep(fd, opt, NBD_REP_ACK, NULL, 0))
+        return -1;
+      if (opt == NBD_OPT_GO) return 0;
+    } else if (opt == NBD_OPT_LIST) {
+      static const char name[] = "sram";
+      unsigned char r[4 + sizeof(name) - 1];
+      uint32_t n = htobe32(sizeof(name) - 1);
+      memcpy(r, &n, 4);
+      memcpy(r + 4, name, sizeof(name) - 1);
+      free(data);
+      if (send_rep(fd, opt, NBD_REP_SERVER, r, sizeof(r)) ||
+          send_rep(fd, opt, NBD_REP_ACK, NULL, 0))
+        return -1;
+    } else if (opt == NBD_OPT_ABORT) {
+      free(data);
+      send_rep(fd, opt, NBD_REP_ACK, NULL, 0);
+      return -1;
+    } else {
+      free(data);
+      if (send_rep(fd, opt, NBD_REP_ERR_UNSUP, NULL, 0)) return -1;
+    }
+  }
+}
+
+/* Serve requests until the client disconnects. */
+void transmit(int fd, struct cache *c) {
+  static unsigned char buf[SRAM_SIZE];
+
+  while (!quit) {
+    struct __attribute__((packed)) {
+      uint32_t magic;
+      uint16_t flags, type;
+      uint64_t handle, offset;
+      uint32_t len;
+    } req;
+    struct __attribute__((packed)) {
+      uint32_t magic, error;
+      uint64_t handle;
+    } rep;
+    uint64_t off;
+    uint32_t len, err = 0;
+    uint16_t type, flags;
+
+    if (read_all(fd, &req, sizeof(req)) ||
+        be32toh(req.magic) != NBD_REQUEST_MAGIC)
+      break;
+
+    type = be16toh(req.type);
+    flags = be16toh(req.flags);
+    off = be64toh(req.offset);
+    len = be32toh(req.len);
+
+    rep.magic = htobe32(NBD_REPLY_MAGIC);
+    rep.handle = req.handle;
+
+    if (type == NBD_CMD_DISC) break;
+
+    if ((type == NBD_CMD_READ || type == NBD_CMD_WRITE) &&
+        (off > SRAM_SIZE || len > SRAM_SIZE - off))
+    {
+      /* Still have to swallow the payload of a bad write. */
+      if (type == NBD_CMD_WRITE && (len > sizeof(buf) ||
+                                    read_all(fd, buf, len)))
+        break;
+      err = EINVAL;
+      type = 0xffff;
+    }
+
+    switch (type) {
+    case NBD_CMD_READ:
+      if (len) cache_read(c, off, buf, len);
+      break;
+    case NBD_CMD_WRITE:
+      if (read_all(fd, buf, len)) return;
+      if (len) cache_write(c, off, buf, len);
+      if (flags & NBD_CMD_FLAG_FUA) cache_flush(c);
+      break;
+    case NBD_CMD_FLUSH:
+      cache_flush(c);
+      break;
+    case 0xffff:
+      break;
+    default:
+      err = EINVAL;
+    }
+
+    rep.error = htobe32(err);
+    if (write_all(fd, &rep, sizeof(rep))) break;
+    if (type == NBD_CMD_READ && !err && write_all(fd, buf, len)) break;
+  }
+}
+
+int listen_unix(const char *path) {
+  struct sockaddr_un sa;
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sun_family = AF_UNIX;
+  strncpy(sa.sun_path, path, sizeof(sa.sun_path) - 1);
+  unlink(path);
+  if (fd < 0 || bind(fd, (struct sockaddr *)&sa, sizeof(sa)) ||
+      listen(fd, 1))
+  {
+    perror(path);
+    exit(1);
+  }
+
+  return fd;
+}
+
+int listen_tcp(int port) {
+  struct sockaddr_in sa;
+  int fd = socket(AF_INET, SOCK_STREAM, 0), one = 1;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons(port);
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (fd < 0 || bind(fd, (struct sockaddr *)&sa, sizeof(sa)) ||
+      listen(fd, 1))
+  {
+    perror("listen");
+    exit(1);
+  }
+
+  return fd;
+}
+
+void on_signal(int sig) {
+  quit = 1;
+}
+
+void usage(const char *argv0) {
+  fprintf(stderr,
+    "Usage: %s [-p parport] (-u socket | -t port)\n"
+    "  Serves the SRAM as an NBD export over a Unix socket, or TCP on\n"
+    "  localhost. Writes are cached and written back on flush.\n", argv0);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  const char *parport = "/dev/parport0", *path = NULL;
+  static struct cache c;
+  struct sigaction sa;
+  int opt, port = 0, lfd;
+
+  while ((opt = getopt(argc, argv, "p:u:t:")) != -1) {
+    switch (opt) {
+    case 'p': parport = optarg; break;
+    case 'u': path = optarg; break;
+    case 't': port = atoi(optarg); break;
+    default: usage(argv[0]);
+    }
+  }
+  if (optind != argc || !path == !port) usage(argv[0]);
+
+  busyboard_t bb;
+  init_busyboard(&bb, parport);
+  sram_init(&bb);
+  timing_setup(&sram_timing, parport, sram_verify, &bb);
+  c.bb = &bb;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_signal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  lfd = path ? listen_unix(path) : listen_tcp(port);
+  printf("Serving %u bytes of SRAM on %s.\n", SRAM_SIZE, path ? path : "TCP");
+  fflush(stdout);
+
+  while (!quit) {
+    int fd = accept(lfd, NULL, NULL);
+    double start;
+
+    if (fd < 0) continue;
+    start = now();
+    if (!negotiate(fd)) transmit(fd, &c);
+    cache_flush(&c);
+    close(fd);
+
+    printf("Session: %.1f s, %lu hits, %lu misses, %lu bytes fetched, "
+           "%lu bytes written back in %lu bursts.\n", now() - start, c.hits,
+           c.misses, c.fetched, c.written, c.bursts);
+    fflush(stdout);
+  }
+
+  cache_flush(&c);
+  if (path) unlink(path);
+  close_busyboard(&bb);
+
+  return 0;
+}
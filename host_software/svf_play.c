@@ -0,0 +1,400 @@
+/* Plays SVF files to a JTAG chain: CPLD programming and boundary scan. */
+/* Pinout (as in spi_test; -c -m -i -o move them):
+     A0 - TCK     A1 - TMS     A2 - TDI (to the chain)
+     B0 - TDO (from the chain)
+*/
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/stat.h>
+
+#include "busyboard.h"
+#include "jtag.h"
+
+#define MAX_TOKENS 32
+
+/* Scan parameters from SIR, SDR and the header and trailer commands. TDI,
+   MASK and SMASK carry over to the next scan of the same length; TDO is
+   only checked by the command that gives it (or, for headers and
+   trailers, by every scan after one that did). */
+struct scan {
+  unsigned long len;
+  unsigned char *tdi, *tdo, *mask, *smask;
+  int check;
+};
+
+/* sir, sdr, hir, hdr, tir, tdr */
+struct scan scans[6];
+
+struct jtag jtag;
+enum tap_state end_ir = TAP_IDLE, end_dr = TAP_IDLE;
+enum tap_state run_state = TAP_IDLE, run_end = TAP_IDLE;
+double frequency;
+unsigned long line = 1, stmt_line, statements, checks;
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void wait_until(double t) {
+  struct timespec ts;
+  double d = t - now();
+
+  if (d <= 0) return;
+  ts.tv_sec = d;
+  ts.tv_nsec = (d - ts.tv_sec) * 1e9;
+  nanosleep(&ts, NULL);
+}
+
+/* "b3" is pin 11. */
+int parse_pin(const char *s) {
+  int port = tolower((unsigned char)s[0]) - 'a';
+
+  if (port < 0 || port >= BUSYBOARD_N_PORTS || s[1] < '0' || s[1] > '7' ||
+      s[2])
+    return -1;
+  return port * 8 + s[1] - '0';
+}
+
+/* Report running out of memory at the current statement. Returns -2 for
+   the callers to pass up; playing stops there. */
+int no_memory(void) {
+  printf("Line %lu: out of memory.\n", stmt_line);
+  return -2;
+}
+
+/* Read the next statement, up to its ';', into *buf: upper case, comments
+   (! and //) dropped, and tokens one space apart, with the hex in
+   parentheses one token without spaces. Only one statement is held at a
+   time, so files of any size stream. Returns 0 at the end of the file, or
+   -2 if out of memory. */
+int read_statement(FILE *f, char **buf, size_t *cap) {
+  size_t n = 0;
+  int c, paren = 0, space = 0;
+  char *grown;
+
+  stmt_line = 0;
+  while ((c = getc(f)) != EOF) {
+    if (c == '\n') line++;
+    if (c == '!' || (c == '/' && (c = getc(f)) == '/')) {
+      while ((c = getc(f)) != EOF && c != '\n')
+        ;
+      line++;
+      space = 1;
+      continue;
+    }
+    if (isspace(c)) {
+      space = 1;
+      continue;
+    }
+    if (c == ';' && !paren) break;
+    if (!stmt_line) stmt_line = line;
+    if (n + 3 > *cap) {
+      if (!(grown = realloc(*buf, *cap ? *cap * 2 : 4096)))
+        return no_memory();
+      *buf = grown;
+      *cap = *cap ? *cap * 2 : 4096;
+    }
+    if (c == '(') {
+      paren = 1;
+      space = 1;
+    }
+    if (space && n && !paren) (*buf)[n++] = ' ';
+    if (c == '(') (*buf)[n++] = ' ';
+    if (c == ')') paren = 0;
+    space = 0;
+    (*buf)[n++] = toupper(c);
+  }
+  if (*buf) (*buf)[n] = 0;
+  return n != 0;
+}
+
+/* "(1F0)" into len bits, bit 0 the last digit. */
+int parse_hex(const char *s, unsigned long len, unsigned char *out) {
+  const char *end = s + strlen(s) - 1;
+  unsigned long bit;
+  int d, b;
+
+  if (*s != '(' || *end != ')') return -1;
+  memset(out, 0, (len + 7) / 8);
+  for (bit = 0, --end; end > s; --end, bit += 4) {
+    if (!isxdigit((unsigned char)*end)) return -1;
+    d = isdigit((unsigned char)*end) ? *end - '0' : *end - 'A' + 10;
+    for (b = 0; b < 4; ++b)
+      if ((d >> b & 1) && bit + b < len)
+        out[(bit + b) / 8] |= 1 << (bit + b) % 8;
+  }
+  return 0;
+}
+
+/* Returns 0, or -2 if out of memory. */
+int set_len(struct scan *s, unsigned long len) {
+  unsigned char **buf[4] = { &s->tdi, &s->tdo, &s->mask, &s->smask }, *b;
+  size_t n = (len + 7) / 8;
+  int i;
+
+  if (s->len == len && s->tdi) return 0;
+  for (i = 0; i < 4; ++i) {
+    if (!(b = realloc(*buf[i], n + 1))) return no_memory();
+    *buf[i] = b;
+    memset(b, i < 2 ? 0 : 0xff, n + 1);
+  }
+  s->len = len;
+  return 0;
+}
+
+/* SIR/SDR/HIR/HDR/TIR/TDR len [TDI (hex)] [TDO (hex)] [MASK (hex)]
+   [SMASK (hex)]. Returns 0, -1 if it doesn't parse, or -2 if out of
+   memory. */
+int parse_scan(struct scan *s, char **tok, int n) {
+  unsigned char **dst;
+  unsigned long len;
+  char *end;
+  int i;
+
+  if (n < 2) return -1;
+  len = strtoul(tok[1], &end, 10);
+  if (*end) return -1;
+  if (set_len(s, len)) return -2;
+  s->check = 0;
+  for (i = 2; i + 1 < n; i += 2) {
+    if (!strcmp(tok[i], "TDI")) dst = &s->tdi;
+    else if (!strcmp(tok[i], "TDO")) dst = &s->tdo;
+    else if (!strcmp(tok[i], "MASK")) dst = &s->mask;
+    else if (!strcmp(tok[i], "SMASK")) dst = &s->smask;
+    else return -1;
+    if (parse_hex(tok[i + 1], s->len, *dst)) return -1;
+    if (dst == &s->tdo) s->check = 1;
+  }
+  return (i == n) ? 0 : -1;
+}
+
+void copy_bits(unsigned char *dst, unsigned long at, const unsigned char *src,
+               unsigned long n)
+{
+  unsigned long i;
+
+  for (i = 0; i < n; ++i, ++at)
+    if (src[i / 8] >> i % 8 & 1) dst[at / 8] |= 1 << at % 8;
+}
+
+/* Header, then the scan, then the trailer, as one shift; header first.
+   Returns 1 on a TDO mismatch, or -2 if out of memory. */
+int do_scan(int ir) {
+  struct scan *h = &scans[ir ? 2 : 3], *s = &scans[ir ? 0 : 1],
+              *t = &scans[ir ? 4 : 5], *part[3] = { h, s, t };
+  unsigned long len = h->len + s->len + t->len, at, i;
+  size_t n = (len + 7) / 8 + 1;
+  static unsigned char *tdi, *exp, *mask, *got;
+  static size_t cap;
+  unsigned char **buf[4] = { &tdi, &exp, &mask, &got }, *b;
+  int p, check = 0;
+
+  if (n > cap) {
+    for (p = 0; p < 4; ++p) {
+      if (!(b = realloc(*buf[p], n))) return no_memory();
+      *buf[p] = b;
+    }
+    cap = n;
+  }
+  memset(tdi, 0, n);
+  memset(exp, 0, n);
+  memset(mask, 0, n);
+  for (p = 0, at = 0; p < 3; at += part[p++]->len) {
+    copy_bits(tdi, at, part[p]->tdi, part[p]->len);
+    if (!part[p]->check) continue;
+    check = 1;
+    copy_bits(exp, at, part[p]->tdo, part[p]->len);
+    copy_bits(mask, at, part[p]->mask, part[p]->len);
+  }
+
+  jtag_scan(&jtag, ir, len, tdi, check ? got : NULL, ir ? end_ir : end_dr);
+  if (!check) return 0;
+  checks++;
+  for (i = 0; i < n - 1; ++i)
+    if ((got[i] ^ exp[i]) & mask[i]) break;
+  if (i == n - 1) return 0;
+
+  at = i * 8 + __builtin_ctz((got[i] ^ exp[i]) & mask[i]);
+  printf("Line %lu: TDO mismatch at bit %lu of %lu: bits %lu-%lu are %02x, "
+         "not %02x (mask %02x).\n", stmt_line, at, len, i * 8, i * 8 + 7,
+         got[i], exp[i], mask[i]);
+  return 1;
+}
+
+/* RUNTEST [run_state] [count TCK|SCK] [min SEC [MAXIMUM max SEC]]
+   [ENDSTATE end_state]. The clocks are given at least count / FREQUENCY
+   seconds, as the file assumes that's how long they take. */
+int do_runtest(char **tok, int n) {
+  unsigned long count = 0;
+  double min = 0, v, start;
+  int i = 1, s;
+
+  if (i < n && (s = tap_by_name(tok[i])) >= 0) {
+    run_state = run_end = s;
+    i++;
+  }
+  for (; i < n; ++i) {
+    if (!strcmp(tok[i], "ENDSTATE") && i + 1 < n &&
+        (s = tap_by_name(tok[i + 1])) >= 0) {
+      run_end = s;
+      i++;
+      continue;
+    }
+    if (!strcmp(tok[i], "MAXIMUM")) {
+      i += 2;
+      continue;
+    }
+    v = strtod(tok[i], NULL);
+    if (i + 1 >= n) return -1;
+    if (!strcmp(tok[i + 1], "TCK") || !strcmp(tok[i + 1], "SCK")) count = v;
+    else if (!strcmp(tok[i + 1], "SEC")) min = v;
+    else return -1;
+    i++;
+  }
+  if (frequency > 0 && count / frequency > min) min = count / frequency;
+
+  jtag_goto(&jtag, run_state);
+  start = now();
+  jtag_idle(&jtag, count);
+  wait_until(start + min);
+  jtag_goto(&jtag, run_end);
+  return 0;
+}
+
+/* Returns 0, 1 if the chain didn't answer as expected, -1 if the
+   statement doesn't parse, or -2 if out of memory. */
+int statement(char *buf) {
+  char *tok[MAX_TOKENS], *cmd;
+  int n = 0, i, s, r;
+
+  for (cmd = strtok(buf, " "); cmd && n < MAX_TOKENS;
+       cmd = strtok(NULL, " "))
+    tok[n++] = cmd;
+  if (!n) return 0;
+  cmd = tok[0];
+  statements++;
+
+  if (!strcmp(cmd, "SIR")) {
+    return (r = parse_scan(&scans[0], tok, n)) ? r : do_scan(1);
+  } else if (!strcmp(cmd, "SDR")) {
+    return (r = parse_scan(&scans[1], tok, n)) ? r : do_scan(0);
+  } else if (!strcmp(cmd, "HIR")) {
+    return parse_scan(&scans[2], tok, n);
+  } else if (!strcmp(cmd, "HDR")) {
+    return parse_scan(&scans[3], tok, n);
+  } else if (!strcmp(cmd, "TIR")) {
+    return parse_scan(&scans[4], tok, n);
+  } else if (!strcmp(cmd, "TDR")) {
+    return parse_scan(&scans[5], tok, n);
+  } else if (!strcmp(cmd, "ENDIR") || !strcmp(cmd, "ENDDR")) {
+    if (n != 2 || (s = tap_by_name(tok[1])) < 0) return -1;
+    if (cmd[3] == 'I') end_ir = s;
+    else end_dr = s;
+  } else if (!strcmp(cmd, "STATE")) {
+    for (i = 1; i < n; ++i) {
+      if ((s = tap_by_name(tok[i])) < 0) return -1;
+      if (s == TAP_RESET) jtag_reset(&jtag);
+      else jtag_goto(&jtag, s);
+    }
+  } else if (!strcmp(cmd, "RUNTEST")) {
+    return do_runtest(tok, n);
+  } else if (!strcmp(cmd, "FREQUENCY")) {
+    frequency = (n > 1) ? strtod(tok[1], NULL) : 0;
+  } else if (!strcmp(cmd, "TRST")) {
+    /* There's no TRST pin; TMS resets do instead. */
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+void progress(FILE *f, long size, double start, int done) {
+  double t = now() - start, frac = size > 0 ? (double)ftell(f) / size : 0;
+
+  fprintf(stderr, "\r%5.1f%%  %llu TCK  %.0f TCK/s", 100 * frac, jtag.tcks,
+          t > 0 ? jtag.tcks / t : 0);
+  if (!done && frac > 0) fprintf(stderr, "  %.0f s left ", t / frac - t);
+  if (done) fprintf(stderr, "%*s\n", 16, "");
+}
+
+void usage(const char *argv0) {
+  fprintf(stderr,
+    "Usage: %s [-p parport] [-c tck] [-m tms] [-i tdi] [-o tdo] [-q] "
+    "file.svf\n"
+    "  Pins are a0-f7 (default a0, a1, a2 and b0); TDO can't share a port\n"
+    "  with the others. Progress and TCK/s go to stderr unless -q; playing\n"
+    "  stops at the first TDO mismatch.\n", argv0);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  const char *parport = "/dev/parport0";
+  int c, quiet = 0, ret = 0, pins[4] = { 0, 1, 2, 8 };
+  char *buf = NULL;
+  size_t cap = 0;
+  double start, last;
+  struct stat st;
+  FILE *f;
+
+  while ((c = getopt(argc, argv, "p:c:m:i:o:q")) != -1) {
+    switch (c) {
+    case 'p': parport = optarg; break;
+    case 'c': pins[0] = parse_pin(optarg); break;
+    case 'm': pins[1] = parse_pin(optarg); break;
+    case 'i': pins[2] = parse_pin(optarg); break;
+    case 'o': pins[3] = parse_pin(optarg); break;
+    case 'q': quiet = 1; break;
+    default: usage(argv[0]);
+    }
+  }
+  if (optind + 1 != argc || pins[0] < 0 || pins[1] < 0 || pins[2] < 0 ||
+      pins[3] < 0)
+    usage(argv[0]);
+  if (!(f = fopen(argv[optind], "r"))) {
+    perror(argv[optind]);
+    return 1;
+  }
+  fstat(fileno(f), &st);
+
+  busyboard_t bb;
+  init_busyboard(&bb, parport);
+  bb.trimask = 0;
+  if (jtag_init(&jtag, &bb, pins[0], pins[1], pins[2], pins[3])) {
+    fprintf(stderr, "TDO needs a port of its own.\n");
+    close_busyboard(&bb);
+    return 1;
+  }
+
+  start = last = now();
+  while ((c = read_statement(f, &buf, &cap)) > 0) {
+    if ((ret = statement(buf))) {
+      if (ret == -1)
+        printf("Line %lu: can't parse or don't support this.\n", stmt_line);
+      break;
+    }
+    if (!quiet && now() - last >= 1) {
+      progress(f, st.st_size, start, 0);
+      last = now();
+    }
+  }
+  if (c < 0) ret = c;
+  if (!quiet) progress(f, st.st_size, start, 1);
+
+  printf("%lu statements, %lu TDO checks, %llu TCK in %lu frames in "
+         "%.3f s: %.0f TCK/s.\n", statements, checks, jtag.tcks, bb.frames,
+         now() - start, jtag.tcks / (now() - start));
+  if (ret) printf("Failed.\n");
+
+  free(buf);
+  fclose(f);
+  close_busyboard(&bb);
+
+  return ret ? 1 : 0;
+}
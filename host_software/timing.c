@@ -0,0 +1,204 @@
+/* Timing profiles: calibration and storage of per-device delays. */
+
+#include "timing.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* A setting has to verify this many times in a row to be accepted. */
+#define TIMING_PASSES 3
+
+/* Below this, waits spin; usleep overshoots by tens of us. */
+#define SPIN_US 100
+
+#define DEFAULT_MARGIN 25
+
+void timing_wait(unsigned us) {
+  struct timespec ts, end;
+
+  if (!us) return;
+  if (us >= SPIN_US) {
+    usleep(us);
+    return;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  end.tv_nsec += us * 1000;
+  if (end.tv_nsec >= 1000000000) {
+    end.tv_sec++;
+    end.tv_nsec -= 1000000000;
+  }
+  do {
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+  } while (ts.tv_sec < end.tv_sec ||
+           (ts.tv_sec == end.tv_sec && ts.tv_nsec < end.tv_nsec));
+}
+
+static const char *profile_path(void) {
+  static char path[512];
+  const char *env = getenv("BUSYBOARD_TIMING"), *home = getenv("HOME");
+
+  if (env) return env;
+  snprintf(path, sizeof(path), "%s/.busyboard_timing", home ? home : ".");
+  return path;
+}
+
+const char *timing_board(const char *parport) {
+  const char *name = getenv("BUSYBOARD_NAME"), *slash;
+
+  if (name) return name;
+  slash = strrchr(parport, '/');
+  return slash ? slash + 1 : parport;
+}
+
+int timing_load(struct timing *t, const char *board) {
+  FILE *fp = fopen(profile_path(), "r");
+  char line[256], b[64], d[64], name[64];
+  unsigned us, found = 0;
+  int i;
+
+  if (!fp) return -1;
+  while (fgets(line, sizeof(line), fp)) {
+    if (sscanf(line, "%63s %63s %63s %u", b, d, name, &us) != 4 ||
+        strcmp(b, board) || strcmp(d, t->device))
+      continue;
+    for (i = 0; i < t->n; ++i) {
+      if (strcmp(name, t->p[i].name)) continue;
+      t->p[i].cal = us;
+      found |= 1u << i;
+    }
+  }
+  fclose(fp);
+
+  return (found == (1u << t->n) - 1) ? 0 : -1;
+}
+
+/* Rewrite the profile with this device's lines for this board replaced. */
+int timing_save(const struct timing *t, const char *board) {
+  const char *path = profile_path();
+  char tmp[520], line[256], b[64], d[64];
+  FILE *in = fopen(path, "r"), *out;
+  int i;
+
+  snprintf(tmp, sizeof(tmp), "%s.new", path);
+  out = fopen(tmp, "w");
+  if (!out) {
+    perror(tmp);
+    if (in) fclose(in);
+    return -1;
+  }
+
+  if (in) {
+    while (fgets(line, sizeof(line), in)) {
+      if (sscanf(line, "%63s %63s", b, d) == 2 && !strcmp(b, board) &&
+          !strcmp(d, t->device))
+        continue;
+      fputs(line, out);
+    }
+    fclose(in);
+  }
+  for (i = 0; i < t->n; ++i)
+    fprintf(out, "%s %s %s %u\n", board, t->device, t->p[i].name,
+            t->p[i].cal);
+
+  if (fclose(out) || rename(tmp, path)) {
+    perror(path);
+    return -1;
+  }
+
+  return 0;
+}
+
+void timing_margin(struct timing *t, unsigned percent) {
+  int i;
+
+  for (i = 0; i < t->n; ++i) {
+    struct timing_param *p = &t->p[i];
+    p->us = p->cal + (p->cal * percent + 99) / 100;
+    if (p->us > p->max) p->us = p->max;
+  }
+}
+
+static int passes(int (*verify)(void *), void *ctx) {
+  int i;
+
+  for (i = 0; i < TIMING_PASSES; ++i)
+    if (!verify(ctx)) return 0;
+
+  return 1;
+}
+
+static void set_max(struct timing *t) {
+  int i;
+
+  for (i = 0; i < t->n; ++i) t->p[i].cal = t->p[i].us = t->p[i].max;
+}
+
+/* Search the parameters one at a time, the others held where they are: at
+   the maximum for those still to come, at the value found for those done. */
+int timing_calibrate(struct timing *t, int (*verify)(void *ctx), void *ctx) {
+  int i;
+
+  set_max(t);
+  if (!passes(verify, ctx)) {
+    fprintf(stderr, "%s: fails even at the maximum timings.\n", t->device);
+    return -1;
+  }
+
+  for (i = 0; i < t->n; ++i) {
+    struct timing_param *p = &t->p[i];
+    unsigned lo = p->min, hi = p->max;
+
+    while (lo < hi) {
+      p->us = lo + (hi - lo) / 2;
+      if (passes(verify, ctx)) hi = p->us;
+      else lo = p->us + 1;
+    }
+    p->cal = p->us = hi;
+    fprintf(stderr, "%s: %s verified at %u us.\n", t->device, p->name, hi);
+  }
+
+  return 0;
+}
+
+int timing_setup(struct timing *t, const char *parport,
+                 int (*verify)(void *ctx), void *ctx)
+{
+  const char *board = timing_board(parport), *env = getenv("BUSYBOARD_MARGIN"),
+             *how = "profile";
+  unsigned margin = env ? atoi(env) : DEFAULT_MARGIN;
+  int i, ret = 0;
+
+  if (getenv("BUSYBOARD_CALIBRATE") || timing_load(t, board)) {
+    if (!verify) {
+      how = "defaults";
+      set_max(t);
+    } else if (timing_calibrate(t, verify, ctx)) {
+      how = "defaults, calibration failed";
+      set_max(t);
+      ret = -1;
+    } else {
+      how = "calibrated";
+      timing_save(t, board);
+    }
+  }
+  timing_margin(t, margin);
+
+  /* The margin is there to cover drift; the result must still work now. */
+  if (!strcmp(how, "calibrated") && !passes(verify, ctx)) {
+    fprintf(stderr, "%s: fails with %u%% margin; using the maximum timings.\n",
+            t->device, margin);
+    how = "defaults, calibration failed";
+    set_max(t);
+    ret = -1;
+  }
+
+  printf("Timing for %s on %s (%s):", t->device, board, how);
+  for (i = 0; i < t->n; ++i) printf(" %s %u us", t->p[i].name, t->p[i].us);
+  putc('\n', stdout);
+
+  return ret;
+}
@@ -0,0 +1,43 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+/* Per-device timing profiles. A driver declares its delays as parameters
+   with a known-safe maximum; calibration binary-searches each one down
+   against a verify callback, and the fastest values that verified are kept
+   per board and device in a profile file (BUSYBOARD_TIMING, default
+   ~/.busyboard_timing, lines of "board device param us"). Drivers run at
+   the calibrated values plus BUSYBOARD_MARGIN percent (default 25).
+   Setting BUSYBOARD_CALIBRATE forces a new calibration; BUSYBOARD_NAME
+   names the board if it isn't identified by its parport alone. */
+
+struct timing_param {
+  const char *name;
+  unsigned min, max; /* Search range, us; max must be safe. */
+  unsigned cal;      /* Fastest value that verified. */
+  unsigned us;       /* In effect: cal plus the margin. */
+};
+
+struct timing {
+  const char *device;
+  struct timing_param *p;
+  int n;
+};
+
+/* Wait us microseconds; short waits spin rather than sleep. */
+void timing_wait(unsigned us);
+
+/* Load the profile for this board, or calibrate it if there isn't one (or
+   BUSYBOARD_CALIBRATE is set) and verify is given. verify returns nonzero if
+   the device works at the timing currently in effect. Returns 0, or -1 if
+   the device failed even at the maximum timings, which are then used. */
+int timing_setup(struct timing *t, const char *parport,
+                 int (*verify)(void *ctx), void *ctx);
+
+/* The pieces of timing_setup. */
+const char *timing_board(const char *parport);
+int timing_load(struct timing *t, const char *board);
+int timing_save(const struct timing *t, const char *board);
+int timing_calibrate(struct timing *t, int (*verify)(void *ctx), void *ctx);
+void timing_margin(struct timing *t, unsigned percent);
+
+#endif
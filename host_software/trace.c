@@ -0,0 +1,172 @@
+/* Binary bus trace recorder and reader. */
+
+#include "trace.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Records between the CPU loop and the writer; a power of two. */
+#define QUEUE_LEN 65536
+
+struct trace {
+  int fd;
+  struct trace_hdr *hdr;
+  struct trace_rec *ring;
+  size_t map_len;
+
+  /* Single producer, single consumer: head is only written by trace_put(),
+     tail only by the writer. */
+  struct trace_rec queue[QUEUE_LEN];
+  unsigned long head, tail;
+  int done;
+  pthread_t thread;
+};
+
+static unsigned long min_ul(unsigned long a, unsigned long b) {
+  return a < b ? a : b;
+}
+
+static void *writer(void *arg) {
+  struct trace *t = arg;
+  unsigned long cap = t->hdr->capacity;
+
+  for (;;) {
+    /* done first: once it is seen, head is final. */
+    int done = __atomic_load_n(&t->done, __ATOMIC_ACQUIRE);
+    unsigned long head = __atomic_load_n(&t->head, __ATOMIC_ACQUIRE);
+
+    if (head == t->tail) {
+      if (done) break;
+      usleep(1000);
+      continue;
+    }
+
+    while (t->tail != head) {
+      unsigned long q = t->tail % QUEUE_LEN, r = t->hdr->count % cap,
+                    n = min_ul(min_ul(head - t->tail, QUEUE_LEN - q), cap - r);
+
+      memcpy(&t->ring[r], &t->queue[q], n * sizeof(struct trace_rec));
+      t->hdr->count += n;
+      __atomic_store_n(&t->tail, t->tail + n, __ATOMIC_RELEASE);
+    }
+  }
+
+  return NULL;
+}
+
+struct trace *trace_open(const char *filename, const char *cpu,
+                         unsigned long capacity)
+{
+  struct trace *t = calloc(1, sizeof(*t));
+
+  if (!t) {
+    perror("calloc");
+    return NULL;
+  }
+  t->map_len = sizeof(struct trace_hdr) + capacity * sizeof(struct trace_rec);
+  t->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (t->fd < 0 || ftruncate(t->fd, t->map_len)) goto fail;
+  t->hdr = mmap(NULL, t->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, t->fd,
+                0);
+  if (t->hdr == MAP_FAILED) goto fail;
+
+  memcpy(t->hdr->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+  strncpy(t->hdr->cpu, cpu, sizeof(t->hdr->cpu) - 1);
+  t->hdr->version = TRACE_VERSION;
+  t->hdr->rec_size = sizeof(struct trace_rec);
+  t->hdr->capacity = capacity;
+  t->ring = (struct trace_rec *)(t->hdr + 1);
+
+  if (pthread_create(&t->thread, NULL, writer, t)) {
+    fprintf(stderr, "%s: could not start the writer thread.\n", filename);
+    munmap(t->hdr, t->map_len);
+    close(t->fd);
+    free(t);
+    return NULL;
+  }
+
+  return t;
+
+ fail:
+  perror(filename);
+  if (t->fd >= 0) close(t->fd);
+  free(t);
+  return NULL;
+}
+
+void trace_put(struct trace *t, const struct trace_rec *r) {
+  unsigned long head = t->head;
+
+  /* The writer only copies memory, so this only waits if it was starved. */
+  while (head - __atomic_load_n(&t->tail, __ATOMIC_ACQUIRE) >= QUEUE_LEN)
+    sched_yield();
+  t->queue[head % QUEUE_LEN] = *r;
+  __atomic_store_n(&t->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void trace_hook(struct buscyc *bc, const struct bus_rec *r) {
+  struct trace_rec tr = { bc->cycles, r->addr, r->data, r->status };
+  trace_put(bc->ctx, &tr);
+}
+
+unsigned long long trace_close(struct trace *t) {
+  unsigned long long count;
+
+  __atomic_store_n(&t->done, 1, __ATOMIC_RELEASE);
+  pthread_join(t->thread, NULL);
+  count = t->hdr->count;
+  munmap(t->hdr, t->map_len);
+  close(t->fd);
+  free(t);
+
+  return count;
+}
+
+const struct trace_hdr *trace_map(const char *filename, size_t *len) {
+  const struct trace_hdr *hdr;
+  struct stat st;
+  int fd = open(filename, O_RDONLY);
+
+  if (fd < 0 || fstat(fd, &st)) {
+    perror(filename);
+    if (fd >= 0) close(fd);
+    return NULL;
+  }
+  if ((size_t)st.st_size < sizeof(*hdr)) {
+    fprintf(stderr, "%s: not a bus trace.\n", filename);
+    close(fd);
+    return NULL;
+  }
+  hdr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (hdr == MAP_FAILED) {
+    perror(filename);
+    return NULL;
+  }
+
+  if (memcmp(hdr->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) ||
+      hdr->version != TRACE_VERSION ||
+      hdr->rec_size != sizeof(struct trace_rec) || !hdr->capacity ||
+      sizeof(*hdr) + hdr->capacity * sizeof(struct trace_rec) >
+      (size_t)st.st_size)
+  {
+    fprintf(stderr, "%s: not a version %d bus trace.\n", filename,
+            TRACE_VERSION);
+    munmap((void *)hdr, st.st_size);
+    return NULL;
+  }
+
+  *len = st.st_size;
+  return hdr;
+}
+
+void trace_unmap(const struct trace_hdr *hdr, size_t len) {
+  munmap((void *)hdr, len);
+}
@@ -0,0 +1,68 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "buscyc.h"
+
+/* Binary bus traces. The CPU loop hands each cycle to trace_put(), which
+   only queues it; a writer thread copies the queue into a ring of records
+   in a memory-mapped file. Once the ring is full the oldest records are
+   overwritten, so a trace holds the last capacity cycles of the run.
+
+   File layout: struct trace_hdr, then capacity struct trace_recs. Record i
+   (counting from the start of the run) is at index i % capacity. */
+
+#define TRACE_MAGIC "BBTRACE"
+#define TRACE_VERSION 1
+#define TRACE_DEFAULT_RECORDS (1ul << 20)
+
+struct trace_rec {
+  uint32_t cycle;  /* Low 32 bits of the cycle number. */
+  uint16_t addr;
+  uint8_t data;
+  uint8_t status;  /* CPU status port, active high. */
+};
+
+struct trace_hdr {
+  char magic[8];
+  char cpu[8];       /* bus_cpu name, e.g. "Z80" */
+  uint32_t version, rec_size;
+  uint64_t capacity; /* Records in the ring. */
+  uint64_t count;    /* Records written. */
+  uint64_t reserved[3];
+};
+
+struct trace;
+
+/* Create filename with room for capacity records and start the writer.
+   Returns NULL (after printing why) on error. */
+struct trace *trace_open(const char *filename, const char *cpu,
+                         unsigned long capacity);
+
+void trace_put(struct trace *t, const struct trace_rec *r);
+
+/* buscyc trace hook; bc->ctx is the struct trace. */
+void trace_hook(struct buscyc *bc, const struct bus_rec *r);
+
+/* Drain the queue, stop the writer and close the file. Returns the number of
+   records written. */
+unsigned long long trace_close(struct trace *t);
+
+/* Map a trace for reading. Returns NULL (after printing why) on error. */
+const struct trace_hdr *trace_map(const char *filename, size_t *len);
+void trace_unmap(const struct trace_hdr *hdr, size_t len);
+
+/* Oldest record still in the ring, and record i. */
+static inline uint64_t trace_first(const struct trace_hdr *hdr) {
+  return hdr->count > hdr->capacity ? hdr->count - hdr->capacity : 0;
+}
+
+static inline const struct trace_rec *trace_at(const struct trace_hdr *hdr,
+                                               uint64_t i)
+{
+  return (const struct trace_rec *)(hdr + 1) + i % hdr->capacity;
+}
+
+#endif
@@ -0,0 +1,264 @@
+/* Decoder for the bus traces written by z80_test and 65c02_test. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "buscyc.h"
+#include "disasm.h"
+#include "image.h"
+#include "trace.h"
+
+/* Memory as the bus has shown it so far, and as it was before the first
+   write to each byte. */
+unsigned char mem[0x10000], orig[0x10000];
+unsigned char known[0x10000], orig_known[0x10000], written[0x10000];
+
+const struct bus_cpu *cpu;
+unsigned (*disasm)(const unsigned char *mem, unsigned pc, char *buf,
+                   size_t n);
+unsigned lo = 0, hi = 0xffff;
+int show_raw, show_insn, show_writes, show_mem;
+
+/* Instruction being collected: its opcode fetches, so far. */
+int insn_active;
+unsigned long long insn_cycle;
+unsigned insn_pc, insn_fetches;
+unsigned char insn_last;
+
+unsigned prev_flags, prev_addr;
+unsigned long long n_insn, n_writes;
+
+int in_range(unsigned addr) {
+  return addr >= lo && addr <= hi;
+}
+
+void print_raw(unsigned long long cycle, const struct trace_rec *r,
+               unsigned flags)
+{
+  int i;
+
+  printf("%10llu  %04x %02x(%c)", cycle, r->addr, r->data,
+         (flags & BUS_RD) ? 'O' : 'I');
+  for (i = 0; i < 8; i++)
+    if (((r->status >> i) & 1) && cpu->status_name[i])
+      printf(" %s", cpu->status_name[i]);
+  putc('\n', stdout);
+}
+
+/* The instruction is only disassembled once the next one starts, so that
+   its operands have been read into mem. */
+void end_insn(void) {
+  char text[64], bytes[16];
+  unsigned i, len;
+
+  if (!insn_active) return;
+  insn_active = 0;
+  n_insn++;
+  if (!show_insn || !in_range(insn_pc)) return;
+
+  len = disasm(mem, insn_pc, text, sizeof(text));
+  bytes[0] = 0;
+  for (i = 0; i < len && i < 4; ++i)
+    sprintf(bytes + 3 * i, "%02x ", mem[(insn_pc + i) & 0xffff]);
+  printf("%10llu  %04x  %-12s %s\n", insn_cycle, insn_pc, bytes, text);
+}
+
+/* Z80 prefixes are fetched with M1 like opcodes. */
+int continues_insn(unsigned addr) {
+  if (cpu != &bus_z80 || addr != ((insn_pc + insn_fetches) & 0xffff))
+    return 0;
+  if (insn_last == 0xdd || insn_last == 0xfd) return 1;
+  return (insn_last == 0xcb || insn_last == 0xed) && insn_fetches == 1;
+}
+
+void fetch(unsigned long long cycle, unsigned addr, unsigned char op) {
+  if (insn_active && continues_insn(addr)) {
+    insn_fetches++;
+    insn_last = op;
+    return;
+  }
+  end_insn();
+  insn_active = 1;
+  insn_cycle = cycle;
+  insn_pc = addr;
+  insn_fetches = 1;
+  insn_last = op;
+}
+
+void bus_write(unsigned long long cycle, unsigned addr, unsigned char data,
+               unsigned flags)
+{
+  n_writes++;
+
+  if (flags & BUS_IO) {
+    if (show_writes && in_range(addr))
+      printf("%10llu  out  %02x: %02x\n", cycle, addr & 0xff, data);
+    return;
+  }
+
+  if (show_writes && in_range(addr)) {
+    if (known[addr])
+      printf("%10llu  %04x: %02x -> %02x\n", cycle, addr, mem[addr], data);
+    else printf("%10llu  %04x: -- -> %02x\n", cycle, addr, data);
+  }
+  if (!written[addr]) {
+    written[addr] = 1;
+    orig[addr] = mem[addr];
+    orig_known[addr] = known[addr];
+  }
+  mem[addr] = data;
+  known[addr] = 1;
+}
+
+void record(unsigned long long cycle, const struct trace_rec *r) {
+  unsigned flags = cpu->flags(r->status), rw = flags & (BUS_RD | BUS_WR);
+  int fresh = 1;
+
+  /* Z80 accesses span several records, the 65C02's exactly one. */
+  if (cpu == &bus_z80) {
+    fresh = rw && (r->addr != prev_addr ||
+                   rw != (prev_flags & (BUS_RD | BUS_WR)));
+  }
+  prev_flags = flags;
+  prev_addr = r->addr;
+
+  if (show_raw && in_range(r->addr)) print_raw(cycle, r, flags);
+  if (!fresh) return;
+
+  if ((flags & (BUS_RD | BUS_MEM)) == (BUS_RD | BUS_MEM)) {
+    mem[r->addr] = r->data;
+    known[r->addr] = 1;
+    if (flags & BUS_FETCH) fetch(cycle, r->addr, r->data);
+  } else if (flags & BUS_WR) {
+    bus_write(cycle, r->addr, r->data, flags);
+  }
+}
+
+/* Rows that changed over the run, in the harnesses' dump_hex() format. */
+void print_changes(void) {
+  unsigned i, j, bytes = 0, rows = 0;
+
+  for (i = 0; i < 0x10000; i += 16) {
+    int changed = 0;
+    for (j = 0; j < 16; ++j) {
+      unsigned a = i + j;
+      if (written[a] && in_range(a) && (!orig_known[a] || orig[a] != mem[a])) {
+        changed = 1;
+        bytes++;
+      }
+    }
+    if (!changed) continue;
+
+    rows++;
+    printf("%04x: ", i);
+    for (j = 0; j < 16; j++) {
+      if (known[i + j]) printf("%02x", mem[i + j]);
+      else printf("--");
+      if (j != 15) {
+        putc(' ', stdout);
+        if (j % 4 == 3) putc(' ', stdout);
+      }
+    }
+    putc('\n', stdout);
+  }
+  printf("%u bytes changed in %u rows.\n", bytes, rows);
+}
+
+void load_image(const char *filename, unsigned base, const char *format) {
+  struct image img;
+  unsigned i;
+
+  if (image_load(&img, filename, base, format)) exit(1);
+  for (i = 0; i < img.n_seg; ++i) {
+    const struct image_seg *s = &img.seg[i];
+    unsigned len = s->addr < 0x10000 ? s->len : 0;
+    if (s->addr + len > 0x10000) len = 0x10000 - s->addr;
+    memcpy(mem + s->addr, s->data, len);
+    memset(known + s->addr, 1, len);
+  }
+  image_free(&img);
+}
+
+void usage(const char *argv0) {
+  fprintf(stderr, "Usage: %s [-r] [-d] [-w] [-m] [-a lo[-hi]] "
+          "[-i image [-b base] [-F format]] trace\n"
+          "  -r  every record\n"
+          "  -d  instructions, disassembled (the default)\n"
+          "  -w  memory and I/O writes, with the value they replaced\n"
+          "  -m  memory rows changed over the run\n"
+          "  -a  only addresses from lo to hi\n"
+          "  -i  memory image the run started from\n"
+          "  -b  load address for binary images\n"
+          "  -F  image format: ihex, srec, bytes or bin (default by "
+          "extension)\n", argv0);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  const char *image = NULL, *format = NULL;
+  const struct trace_hdr *hdr;
+  unsigned long long cycle, high = 0;
+  unsigned base = 0;
+  uint32_t last = 0;
+  uint64_t i, first;
+  size_t len;
+  char *end;
+  int c;
+
+  while ((c = getopt(argc, argv, "rdwma:i:b:F:")) != -1) {
+    switch (c) {
+    case 'r': show_raw = 1; break;
+    case 'd': show_insn = 1; break;
+    case 'w': show_writes = 1; break;
+    case 'm': show_mem = 1; break;
+    case 'a':
+      lo = hi = strtoul(optarg, &end, 0);
+      if (*end == '-') hi = strtoul(end + 1, &end, 0);
+      if (*end || hi < lo || hi > 0xffff) usage(argv[0]);
+      break;
+    case 'i': image = optarg; break;
+    case 'b': base = strtoul(optarg, NULL, 0); break;
+    case 'F': format = optarg; break;
+    default: usage(argv[0]);
+    }
+  }
+  if (optind + 1 != argc) usage(argv[0]);
+  if (!show_raw && !show_writes && !show_mem) show_insn = 1;
+
+  hdr = trace_map(argv[optind], &len);
+  if (!hdr) return 1;
+  if (!strncmp(hdr->cpu, bus_z80.name, sizeof(hdr->cpu))) {
+    cpu = &bus_z80;
+    disasm = disasm_z80;
+  } else if (!strncmp(hdr->cpu, bus_65c02.name, sizeof(hdr->cpu))) {
+    cpu = &bus_65c02;
+    disasm = disasm_65c02;
+  } else {
+    fprintf(stderr, "%s: unknown CPU %.8s.\n", argv[optind], hdr->cpu);
+    return 1;
+  }
+  if (image) load_image(image, base, format);
+
+  first = trace_first(hdr);
+  printf("%s trace, %llu of %llu cycles.\n", cpu->name,
+         (unsigned long long)(hdr->count - first),
+         (unsigned long long)hdr->count);
+
+  for (i = first; i < hdr->count; ++i) {
+    const struct trace_rec *r = trace_at(hdr, i);
+    if (i > first && r->cycle < last) high += 1ull << 32;
+    last = r->cycle;
+    cycle = high | r->cycle;
+    record(cycle, r);
+  }
+  end_insn();
+
+  if (show_mem) print_changes();
+  printf("%llu instructions, %llu writes.\n", n_insn, n_writes);
+
+  trace_unmap(hdr, len);
+
+  return 0;
+}
@@ -0,0 +1,59 @@
+/* Pattern, edge and sequence triggers on the busyboard inputs. */
+
+#include "trigger.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int trig_add(struct trigger *t, const char *spec) {
+  struct trig_stage s = { 0, 0, 0, 0, 1 };
+  const char *p = spec;
+  char *end;
+  unsigned long v;
+  int port, bit;
+
+  if (t->n == TRIG_STAGES) {
+    fprintf(stderr, "Trigger: at most %d stages.\n", TRIG_STAGES);
+    return -1;
+  }
+
+  while (*p) {
+    port = tolower((unsigned char)*p) - 'a';
+    if (*p == '*') {
+      s.count = strtoul(p + 1, &end, 0);
+      if (!s.count || end == p + 1) goto bad;
+      p = end;
+    } else if (port >= 0 && port < 6 && p[1] == '=') {
+      v = strtoul(p + 2, &end, 0);
+      if (v > 0xff || end == p + 2) goto bad;
+      s.mask |= 0xffull << 8 * port;
+      s.value = (s.value & ~(0xffull << 8 * port)) | (uint64_t)v << 8 * port;
+      p = end;
+    } else if (port >= 0 && port < 6 && p[1] >= '0' && p[1] <= '7') {
+      bit = 8 * port + p[1] - '0';
+      if (p[2] == '+') s.rise |= 1ull << bit;
+      else if (p[2] == '-') s.fall |= 1ull << bit;
+      else if (p[2] == '=' && (p[3] == '0' || p[3] == '1')) {
+        s.mask |= 1ull << bit;
+        s.value = (s.value & ~(1ull << bit)) | (uint64_t)(p[3] - '0') << bit;
+        p++;
+      } else {
+        goto bad;
+      }
+      p += 3;
+    } else {
+      goto bad;
+    }
+    if (*p == ',') p++;
+    else if (*p) goto bad;
+  }
+
+  t->stage[t->n++] = s;
+  return 0;
+
+ bad:
+  fprintf(stderr, "Trigger: can't parse \"%s\" at \"%s\".\n", spec, p);
+  return -1;
+}
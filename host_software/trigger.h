@@ -0,0 +1,62 @@
+#ifndef TRIGGER_H
+#define TRIGGER_H
+
+#include <stdint.h>
+
+/* Triggers on the 48 busyboard inputs, as words laid out like capture
+   samples (pin A0 is bit 0, F7 bit 47). A trigger is a sequence of stages,
+   each a condition on one sample:
+     pattern  (word & mask) == value
+     edges    any of the rise pins rose, or fall pins fell, since the last
+              sample (no edge pins: no edge needed)
+     count    the stage is done after this many matching samples, not
+              necessarily in a row
+   Each stage's match is a few 64-bit operations, whatever the number of
+   pins involved; the trigger fires when the last stage is done. */
+
+#define TRIG_STAGES 8
+
+struct trig_stage {
+  uint64_t mask, value, rise, fall;
+  unsigned long count;
+};
+
+struct trigger {
+  struct trig_stage stage[TRIG_STAGES];
+  int n, at;          /* Stages, and the one being looked for */
+  unsigned long hits; /* Matches of that one so far */
+  uint64_t prev;
+};
+
+/* Add a stage from a spec: comma separated terms of
+     a3=1, a3=0   pin high or low      a3+, a3-   pin rises or falls
+     b=0x55       whole port value     *10        count
+   e.g. "b=0x55,a0+,*3" for the third rising edge of A0 with B at 0x55.
+   Returns 0, or -1 after printing why. */
+int trig_add(struct trigger *t, const char *spec);
+
+/* Start over at the first stage, with word as the last sample seen. */
+static inline void trig_arm(struct trigger *t, uint64_t word) {
+  t->at = 0;
+  t->hits = 0;
+  t->prev = word;
+}
+
+/* Take a sample; returns 1 if it fires the trigger (which then starts
+   over). */
+static inline int trig_sample(struct trigger *t, uint64_t word) {
+  const struct trig_stage *s = &t->stage[t->at];
+  uint64_t rise = ~t->prev & word, fall = t->prev & ~word;
+
+  t->prev = word;
+  if ((word & s->mask) != s->value) return 0;
+  if ((s->rise | s->fall) && !((rise & s->rise) | (fall & s->fall)))
+    return 0;
+  if (++t->hits < s->count) return 0;
+  t->hits = 0;
+  if (++t->at < t->n) return 0;
+  t->at = 0;
+  return 1;
+}
+
+#endif